@@ -0,0 +1,344 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/* Copyright (C) 2013-2025 Intel Corporation */
+
+/* ITR trace replay tool
+ *
+ * Replays recorded per-poll packet and byte counts through the adaptive
+ * interrupt moderation algorithm used by the driver (src/i40e_itr.h) and
+ * reports the interrupt rate and the ITR induced Rx latency it would have
+ * produced. This allows ITR changes to be compared against the same input
+ * without a lab setup.
+ *
+ * Build:
+ *	cc -O2 -Wall -I../src -o itr_replay itr_replay.c
+ *
+ * Usage:
+ *	itr_replay [-s <link speed Gbps>] [-z <HZ>] <rpc|bulk|mixed|file|->
+ *
+ * rpc, bulk and mixed select one of the built-in canned traces, the bulk
+ * phases are paced by the -s link speed (default 40). Any other
+ * argument is read as a trace file with one poll per line:
+ *
+ *	<usecs since previous poll> <rx pkts> <rx bytes> <tx pkts> <tx bytes>
+ *
+ * Lines starting with '#' are ignored.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+#include "i40e_itr.h"
+
+/* NAPI poll budget, a single poll never cleans more Rx packets than this */
+#define NAPI_BUDGET	64
+
+/* full size frame on the wire: 1514 + FCS, preamble and inter frame gap */
+#define BULK_FRAME_BYTES	1514
+#define BULK_WIRE_BYTES		(BULK_FRAME_BYTES + 4 + 8 + 12)
+
+struct poll_rec {
+	unsigned int gap_usecs;
+	unsigned int rx_pkts;
+	unsigned int rx_bytes;
+	unsigned int tx_pkts;
+	unsigned int tx_bytes;
+};
+
+struct container {
+	unsigned int target_itr;
+	unsigned int current_itr;
+	unsigned long next_update;
+	unsigned int total_packets;
+	unsigned int total_bytes;
+};
+
+struct vector {
+	struct container rx;
+	struct container tx;
+	unsigned int itr_countdown;
+};
+
+struct result {
+	unsigned long polls;
+	unsigned long itr_writes;
+	double sim_usecs;
+	double rx_pkts;
+	double rx_lat_sum;
+	unsigned int rx_lat_max;
+};
+
+static unsigned int hz = 250;
+static unsigned int link_gbps = 40;
+static unsigned int divisor = I40E_ITR_DIVISOR_40G;
+
+/* mirrors i40e_update_itr */
+static void update_itr(struct vector *v, struct container *c, bool is_rx,
+		       unsigned long now)
+{
+	struct container *peer = is_rx ? &v->tx : &v->rx;
+	unsigned int itr;
+
+	if ((long)(c->next_update - now) < 0)
+		itr = i40e_itr_default(is_rx);
+	else if (v->itr_countdown)
+		itr = c->target_itr;
+	else
+		itr = i40e_itr_compute(is_rx, c->target_itr, peer->target_itr,
+				       v->tx.current_itr < v->rx.current_itr ?
+				       v->tx.current_itr : v->rx.current_itr,
+				       c->total_packets, c->total_bytes,
+				       divisor);
+
+	c->target_itr = itr;
+	c->next_update = now + 1;
+	c->total_packets = 0;
+	c->total_bytes = 0;
+}
+
+/* mirrors i40e_update_enable_itr */
+static bool update_enable_itr(struct vector *v, unsigned long now)
+{
+	update_itr(v, &v->tx, false, now);
+	update_itr(v, &v->rx, true, now);
+
+	switch (i40e_itr_select(v->rx.target_itr, v->rx.current_itr,
+				v->tx.target_itr, v->tx.current_itr)) {
+	case I40E_ITR_UPDATE_RX:
+		v->rx.current_itr = v->rx.target_itr;
+		v->itr_countdown = ITR_COUNTDOWN_START;
+		return true;
+	case I40E_ITR_UPDATE_TX:
+		v->tx.current_itr = v->tx.target_itr;
+		v->itr_countdown = ITR_COUNTDOWN_START;
+		return true;
+	default:
+		if (v->itr_countdown)
+			v->itr_countdown--;
+		return false;
+	}
+}
+
+static void replay(const struct poll_rec *recs, size_t n, struct result *res)
+{
+	struct vector v;
+	double now = 0;
+	size_t i;
+
+	memset(&v, 0, sizeof(v));
+	memset(res, 0, sizeof(*res));
+	v.rx.target_itr = v.rx.current_itr = I40E_ITR_20K;
+	v.tx.target_itr = v.tx.current_itr = I40E_ITR_20K;
+
+	for (i = 0; i < n; i++) {
+		unsigned int rx_itr = v.rx.current_itr & I40E_ITR_MASK;
+		unsigned int tx_itr = v.tx.current_itr & I40E_ITR_MASK;
+		unsigned int itr = rx_itr < tx_itr ? rx_itr : tx_itr;
+		double gap = recs[i].gap_usecs;
+
+		/* the interrupt cannot fire sooner than the programmed ITR */
+		if (gap < itr)
+			gap = itr;
+		now += gap;
+
+		v.rx.total_packets += recs[i].rx_pkts;
+		v.rx.total_bytes += recs[i].rx_bytes;
+		v.tx.total_packets += recs[i].tx_pkts;
+		v.tx.total_bytes += recs[i].tx_bytes;
+
+		/* each Rx packet waits for at most the vector ITR to expire */
+		res->rx_pkts += recs[i].rx_pkts;
+		res->rx_lat_sum += (double)recs[i].rx_pkts * itr / 2;
+		if (recs[i].rx_pkts && itr > res->rx_lat_max)
+			res->rx_lat_max = itr;
+
+		if (update_enable_itr(&v, (unsigned long)(now * hz / 1000000)))
+			res->itr_writes++;
+		res->polls++;
+	}
+
+	res->sim_usecs = now;
+}
+
+/* request/response: a handful of small frames per poll with idle gaps */
+static size_t gen_rpc(struct poll_rec *recs, size_t max)
+{
+	size_t i;
+
+	for (i = 0; i < max; i++) {
+		recs[i].gap_usecs = 20 + (i * 7919) % 60;
+		recs[i].rx_pkts = 1 + i % 2;
+		recs[i].rx_bytes = recs[i].rx_pkts * 128;
+		recs[i].tx_pkts = 1;
+		recs[i].tx_bytes = 256;
+	}
+
+	return max;
+}
+
+/* bulk TCP receive: full size frames arriving back to back at line rate,
+ * at most a NAPI budget per poll, ACKs on Tx. The gap is the time the
+ * polled frames take on the wire at the -s link speed.
+ */
+static size_t gen_bulk(struct poll_rec *recs, size_t max)
+{
+	double frame_usecs = BULK_WIRE_BYTES * 8.0 / (link_gbps * 1000.0);
+	size_t i;
+
+	for (i = 0; i < max; i++) {
+		recs[i].rx_pkts = NAPI_BUDGET / 2 +
+				  (i * 31) % (NAPI_BUDGET / 2 + 1);
+		recs[i].gap_usecs = recs[i].rx_pkts * frame_usecs + 0.5;
+		recs[i].rx_bytes = recs[i].rx_pkts * BULK_FRAME_BYTES;
+		recs[i].tx_pkts = recs[i].rx_pkts / 2;
+		recs[i].tx_bytes = recs[i].tx_pkts * 66;
+	}
+
+	return max;
+}
+
+/* alternating phases of bulk transfer and request/response traffic */
+static size_t gen_mixed(struct poll_rec *recs, size_t max)
+{
+	size_t i, phase = max / 8;
+
+	for (i = 0; i + phase <= max; i += 2 * phase) {
+		gen_bulk(recs + i, phase);
+		if (i + 2 * phase <= max)
+			gen_rpc(recs + i + phase, phase);
+	}
+
+	return i < max ? i : max;
+}
+
+static size_t read_trace(FILE *f, struct poll_rec **recs)
+{
+	size_t n = 0, max = 1024;
+	char line[256];
+
+	*recs = malloc(max * sizeof(**recs));
+	if (!*recs)
+		return 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		struct poll_rec *r;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (n == max) {
+			max *= 2;
+			r = realloc(*recs, max * sizeof(**recs));
+			if (!r)
+				break;
+			*recs = r;
+		}
+		r = &(*recs)[n];
+		if (sscanf(line, "%u %u %u %u %u", &r->gap_usecs, &r->rx_pkts,
+			   &r->rx_bytes, &r->tx_pkts, &r->tx_bytes) == 5)
+			n++;
+	}
+
+	return n;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-s <link speed Gbps>] [-z <HZ>] <rpc|bulk|mixed|file|->\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct poll_rec *recs = NULL;
+	struct result res;
+	const char *name;
+	size_t n;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:z:")) != -1) {
+		switch (opt) {
+		case 's':
+			link_gbps = atoi(optarg);
+			if (!link_gbps)
+				usage(argv[0]);
+			switch (link_gbps) {
+			case 40:
+				divisor = I40E_ITR_DIVISOR_40G;
+				break;
+			case 25:
+			case 20:
+				divisor = I40E_ITR_DIVISOR_25G;
+				break;
+			case 10:
+				divisor = I40E_ITR_DIVISOR_10G;
+				break;
+			default:
+				divisor = I40E_ITR_DIVISOR_1G;
+				break;
+			}
+			break;
+		case 'z':
+			hz = atoi(optarg);
+			if (!hz)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	name = argv[optind];
+
+	if (!strcmp(name, "rpc") || !strcmp(name, "bulk") ||
+	    !strcmp(name, "mixed")) {
+		n = 100000;
+		recs = calloc(n, sizeof(*recs));
+		if (!recs)
+			return 1;
+		if (!strcmp(name, "rpc"))
+			n = gen_rpc(recs, n);
+		else if (!strcmp(name, "bulk"))
+			n = gen_bulk(recs, n);
+		else
+			n = gen_mixed(recs, n);
+	} else {
+		FILE *f = strcmp(name, "-") ? fopen(name, "r") : stdin;
+
+		if (!f) {
+			perror(name);
+			return 1;
+		}
+		n = read_trace(f, &recs);
+		if (f != stdin)
+			fclose(f);
+	}
+
+	if (!n) {
+		fprintf(stderr, "%s: empty trace\n", name);
+		free(recs);
+		return 1;
+	}
+
+	replay(recs, n, &res);
+
+	printf("trace:            %s (%zu polls)\n", name, n);
+	printf("interrupt rate:   %.0f ints/sec\n",
+	       res.polls * 1000000.0 / res.sim_usecs);
+	printf("ITR writes:       %lu (%.1f%% of interrupts)\n",
+	       res.itr_writes, res.itr_writes * 100.0 / res.polls);
+	printf("Rx ITR latency:   avg %.1f usecs, max %u usecs\n",
+	       res.rx_pkts ? res.rx_lat_sum / res.rx_pkts : 0.0,
+	       res.rx_lat_max);
+
+	free(recs);
+	return 0;
+}
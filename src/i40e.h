@@ -44,6 +44,13 @@
 #endif
 #include <linux/if_vlan.h>
 #include <linux/if_bridge.h>
+#ifdef HAVE_RHASHTABLE_TYPES
+#include <linux/rhashtable-types.h>
+#endif /* HAVE_RHASHTABLE_TYPES */
+#include <linux/jhash.h>
+#ifdef HAVE_XARRAY_API
+#include <linux/xarray.h>
+#endif /* HAVE_XARRAY_API */
 
 /* AF_XDP is currently only supported in kernel versions 4.20 to 5.1,
  * and only on redhat */
@@ -128,6 +135,14 @@ bool i40e_is_l4mode_enabled(void);
 #define I40E_MIN_ARQ_LEN		1
 #define I40E_MIN_ASQ_LEN		2
 #define I40E_AQ_WORK_LIMIT		66 /* max number of VFs + a little */
+
+/* HW stats are read when someone asks for them and cached for
+ * stats_fresh_usecs. Every I40E_STATS_WRAP_GUARD they are read anyway, well
+ * before a 32-bit packet counter can wrap at 40G line rate (~70 secs).
+ */
+#define I40E_STATS_FRESH_USECS_DEFAULT	200000
+#define I40E_STATS_FRESH_USECS_MAX	1000000
+#define I40E_STATS_WRAP_GUARD		(10 * HZ)
 #define I40E_READ_REG_INVALID		0xaabbccdd /* not supported or fail read */
 /*
  * If I40E_MAX_USER_PRIORITY is updated please also update
@@ -187,6 +202,7 @@ enum i40e_state_t {
 	__I40E_DOWN,
 	__I40E_SERVICE_SCHED,
 	__I40E_ADMINQ_EVENT_PENDING,
+	__I40E_ADMINQ_SCHED,
 	__I40E_MDD_EVENT_PENDING,
 	__I40E_MDD_VF_PRINT_PENDING,
 	__I40E_VFLR_EVENT_PENDING,
@@ -242,10 +258,45 @@ enum i40e_vsi_state_t {
 	__I40E_VSI_REINIT_REQUESTED,
 	__I40E_VSI_DOWN_REQUESTED,
 	__I40E_VSI_RELEASING,
+	__I40E_VSI_STATS_REQUESTED,
 	/* This must be last as it determines the size of the BITMAP */
 	__I40E_VSI_STATE_SIZE__,
 };
 
+/* Service subtasks, each one runs as its own work item. The order is the
+ * order in which the service task queues them.
+ */
+enum i40e_subtask_id {
+	I40E_SUBTASK_RESET,
+	I40E_SUBTASK_MDD,
+	I40E_SUBTASK_VFLR,
+	I40E_SUBTASK_SYNC_FILTERS,
+	I40E_SUBTASK_HUNG_DETECT,
+	I40E_SUBTASK_WATCHDOG,
+	I40E_SUBTASK_FDIR_REINIT,
+	I40E_SUBTASK_CLIENT,
+	I40E_SUBTASK_UDP_SYNC,
+	I40E_SUBTASK_STATS,
+	I40E_SUBTASK_MAX,
+};
+
+struct i40e_pf;
+
+struct i40e_subtask {
+	struct work_struct work;
+	struct i40e_pf *pf;
+	void (*fn)(struct i40e_pf *pf);
+	const char *name;
+	unsigned long interval;	/* min jiffies between runs, 0 for none */
+	bool high_prio;		/* runs on the high priority workqueue */
+	unsigned long last_run;	/* jiffies */
+	/* run-time accounting, see "dump service" in debugfs */
+	u64 runs;
+	u64 throttled;		/* not queued because of the interval */
+	u64 total_ns;
+	u64 max_ns;
+};
+
 enum i40e_interrupt_policy {
 	I40E_INTERRUPT_BEST_CASE,
 	I40E_INTERRUPT_MEDIUM,
@@ -272,6 +323,14 @@ struct i40e_lump_tracking {
 #define I40E_FDIR_BUFFER_FULL_MARGIN	10
 #define I40E_FDIR_BUFFER_HEAD_ROOM	32
 #define I40E_FDIR_BUFFER_HEAD_ROOM_FOR_ATR (I40E_FDIR_BUFFER_HEAD_ROOM * 4)
+/* size of the HW filter table, bounds the fd_id of sideband filters */
+#define I40E_FDIR_MAX_FD_ID		8192
+
+enum i40e_fd_flush_state {
+	I40E_FD_FLUSH_IDLE = 0,
+	I40E_FD_FLUSH_CLEARING,		/* waiting for the HW to clear the table */
+	I40E_FD_FLUSH_REPLAY,		/* replaying sideband filters */
+};
 
 #define I40E_HKEY_ARRAY_SIZE	((I40E_PFQF_HKEY_MAX_INDEX + 1) * 4)
 #define I40E_HLUT_ARRAY_SIZE	((I40E_PFQF_HLUT_MAX_INDEX + 1) * 4)
@@ -290,6 +349,13 @@ enum i40e_fd_stat_idx {
 			(I40E_FD_STAT_PF_IDX(pf_id) + I40E_FD_STAT_SB)
 #define I40E_FD_ATR_TUNNEL_STAT_IDX(pf_id) \
 			(I40E_FD_STAT_PF_IDX(pf_id) + I40E_FD_STAT_ATR_TUNNEL)
+/* The FD statistics pool left over after the per-PF counters above is split
+ * evenly between the PFs of the device and handed out to individual sideband
+ * rules, see i40e_fdir_cnt_layout(). Rules added once a PF's share is used up
+ * count on I40E_FD_SB_STAT_IDX. The largest share is the one of a single PF.
+ */
+#define I40E_FD_STAT_RULE_MAX \
+			(I40E_GLQF_PCNT_MAX_INDEX + 1 - I40E_FD_STAT_PF_COUNT)
 
 /* get PTP pins for ioctl */
 #define SIOCGPINS	(SIOCDEVPRIVATE + 0)
@@ -313,6 +379,7 @@ struct i40e_rx_flow_userdef {
 
 struct i40e_fdir_filter {
 	struct hlist_node fdir_node;
+	struct hlist_node tuple_hlist;	/* pf->fdir_tuple_hash */
 	/* filter input set */
 	u8 flow_type;
 	u8 ipl4_proto;
@@ -341,8 +408,36 @@ struct i40e_fdir_filter {
 	u8  fd_status;
 	u16 cnt_index;
 	u32 fd_id;
+
+	/* set when the rule was installed by a tc flower drop action */
+	bool tc_owned;
+	struct hlist_node cookie_hlist;	/* pf->fdir_tc_cookie_hash */
+	unsigned long tc_cookie;
+	u64 tc_hits_reported;
+	unsigned long tc_lastused;
+
+	/* set when the rule was added by a VF through virtchnl */
+	bool vf_owned;
+	u16 vf_id;
 };
 
+/**
+ * i40e_fdir_tuple_to_hkey - Hash the match criteria of a sideband filter
+ * @f: the filter
+ *
+ * Covers exactly the fields compared by i40e_match_fdir_filter so that two
+ * filters matching the same flow always land in the same bucket.
+ **/
+static inline u32 i40e_fdir_tuple_to_hkey(const struct i40e_fdir_filter *f)
+{
+	return jhash_3words((__force u32)f->dst_ip ^ (__force u32)f->src_ip,
+			    ((__force u32)f->dst_port << 16) |
+			    (__force u16)f->src_port,
+			    ((__force u32)f->vlan_tag << 16) |
+			    (__force u16)f->vlan_etype,
+			    (f->flow_type << 8) | f->ipl4_proto);
+}
+
 #define I40E_CLOUD_FIELD_OMAC		BIT(0)
 #define I40E_CLOUD_FIELD_IMAC		BIT(1)
 #define I40E_CLOUD_FIELD_IVLAN		BIT(2)
@@ -375,6 +470,8 @@ struct i40e_fdir_filter {
 
 struct i40e_cloud_filter {
 	struct hlist_node cloud_node;
+	struct hlist_node cookie_hlist;	/* pf->cloud_cookie_hash */
+	struct hlist_node ip_hlist;	/* pf->cloud_ip_hash */
 	unsigned long cookie;
 	/* cloud filter input set follows */
 	u8 outer_mac[ETH_ALEN];
@@ -598,10 +695,32 @@ struct i40e_pf {
 	u8 atr_sample_rate;
 	bool wol_en;
 
+	/* Sideband filters are kept on fdir_filter_list for full walks and
+	 * indexed by fd_id (ethtool location) and by match tuple so that
+	 * lookup, insert and duplicate detection do not scan the list.
+	 * VFs add and remove rules without rtnl, so the filter indexes and
+	 * the FD programming ring are protected by fdir_mutex.
+	 */
+	struct mutex fdir_mutex;
 	struct hlist_head fdir_filter_list;
+#ifdef HAVE_XARRAY_API
+	struct xarray fdir_filter_xa;
+#endif /* HAVE_XARRAY_API */
+	DECLARE_HASHTABLE(fdir_tuple_hash, 10);
+	DECLARE_HASHTABLE(fdir_tc_cookie_hash, 8);
+	u32 fdir_tc_loc_hint;	/* next location tried for a tc drop rule */
 	u16 fdir_pf_active_filters;
+	u16 fdir_vf_active_filters;	/* of the above, owned by VFs */
 	unsigned long fd_flush_timestamp;
 	u32 fd_flush_cnt;
+	/* FD table flush and replay, driven by the service task */
+	enum i40e_fd_flush_state fd_flush_state;
+	bool fd_flush_disable_atr;
+	struct i40e_fdir_filter *fd_replay_pos;	/* next filter to replay */
+	u64 fd_flush_start_ns;
+	u64 fd_flush_blackout_us;	/* flush to end of SB replay, last */
+	u64 fd_flush_blackout_max_us;
+	u32 fd_flush_timeout_cnt;
 	u32 fd_add_err;
 	u32 fd_atr_cnt;
 
@@ -636,6 +755,11 @@ struct i40e_pf {
 #endif /* HAVE_UDP_TUNNEL_NIC_INFO */
 
 	struct hlist_head cloud_filter_list;
+#ifdef HAVE_XARRAY_API
+	struct xarray cloud_filter_xa;	/* ethtool cloud filters by location */
+#endif /* HAVE_XARRAY_API */
+	DECLARE_HASHTABLE(cloud_cookie_hash, 8);	/* tc filters by cookie */
+	DECLARE_HASHTABLE(cloud_ip_hash, 8);	/* all filters by dst_ipv4 */
 	u16 num_cloud_filters;
 
 	/* Array of count of outerip cloud filters */
@@ -646,11 +770,15 @@ struct i40e_pf {
 	u16 tx_itr_default;
 	u32 msg_enable;
 	char int_name[I40E_INT_NAME_STR_LEN];
-	u16 adminq_work_limit; /* num of admin receive queue desc to process */
+	u16 adminq_work_limit; /* ARQ descs drained per run of adminq_task */
 	unsigned long service_timer_period;
 	unsigned long service_timer_previous;
 	struct timer_list service_timer;
 	struct work_struct service_task;
+	struct work_struct adminq_task;	/* ARQ events and ASQ completions */
+	struct i40e_subtask subtask[I40E_SUBTASK_MAX];
+	/* held for reading by the subtasks, for writing by a reset */
+	struct rw_semaphore service_rwsem;
 
 	u32 hw_features;
 #define I40E_HW_RSS_AQ_CAPABLE			BIT(0)
@@ -710,6 +838,8 @@ struct i40e_pf {
 #define I40E_FLAG_VF_VLAN_PRUNING		BIT(30)
 #define I40E_FLAG_VF_SOURCE_PRUNING		BIT(31)
 #define I40E_FLAG_MDD_AUTO_RESET_VF		BIT(32)
+#define I40E_FLAG_ADAPTIVE_INTRL		BIT_ULL(33)
+#define I40E_FLAG_NAPI_THREAD_AFFINITY		BIT_ULL(34)
 
 #define I40E_FLAG_MAC_SOURCE_PRUNING		BIT_ULL(60)
 	u32 mac_src_prun_mask[2];
@@ -720,6 +850,14 @@ struct i40e_pf {
 	bool stat_offsets_loaded;
 	struct i40e_hw_port_stats stats;
 	struct i40e_hw_port_stats stats_offsets;
+	unsigned long stats_updated;	/* jiffies of the last register read */
+	struct mutex stats_mutex;	/* serializes HW stats register reads */
+	u32 stats_fresh_usecs;		/* ethtool stats-block-usecs */
+	u32 stats_hw_reads;		/* PF/VSI/VEB stats register sweeps */
+	u32 stats_cached;		/* reads served from cached stats */
+	/* all VF stats are read in one sweep into vf->stats_snap */
+	unsigned long vf_stats_updated;	/* jiffies of the last VF sweep */
+	seqlock_t vf_stats_lock;	/* consistent reads of vf->stats_snap */
 	u32 tx_timeout_count;
 	u32 tx_timeout_recovery_level;
 	unsigned long tx_timeout_last_recovery;
@@ -735,6 +873,7 @@ struct i40e_pf {
 
 	struct mutex switch_mutex;
 	struct mutex tc_mutex; /* Used to protect the dcb config */
+	struct mutex link_mutex; /* serializes link state updates */
 	u16 lan_vsi;       /* our default LAN VSI */
 	u16 lan_veb;       /* initial relay, if exists */
 #define I40E_NO_VEB	0xffff
@@ -762,7 +901,19 @@ struct i40e_pf {
 	struct i40e_vf *vf;
 	int num_alloc_vfs;	/* actual number of VFs allocated */
 	u32 vf_aq_requests;
+	struct workqueue_struct *vc_wq;	/* per-VF virtchnl message workers */
+	/* held for reading by VF messages that only touch the VF's own VSI,
+	 * for writing by the others and by VFLR handling
+	 */
+	struct rw_semaphore vc_rwsem;
+	/* VF VSI teardown and setup, they share the queue pile and the VEB */
+	struct mutex vf_res_mutex;
+	struct i40e_vfr_stats vfr_all_stats;	/* i40e_reset_all_vfs */
+	struct i40e_vfr_stats vfr_one_stats;	/* i40e_reset_vf */
 	u32 arq_overflows;	/* Not fatal, possibly indicative of problems */
+	u32 arq_events;		/* ARQ events processed by adminq_task */
+	u32 arq_budget_exhausted; /* adminq_task runs that hit the work limit */
+	u16 arq_pending_max;	/* deepest ARQ backlog seen by adminq_task */
 	unsigned long last_printed_mdd_jiffies; /* MDD message rate limit */
 	/* DCBx/DCBNL capability for PF that indicates
 	 * whether DCBx is managed by firmware or host
@@ -894,6 +1045,16 @@ struct i40e_pf {
 
 	u32 ioremap_len;
 	u32 fd_inv;
+	/* fd_ids the HW failed to program, handled by the service task */
+	DECLARE_BITMAP(fd_inv_map, I40E_FDIR_MAX_FD_ID);
+	/* per-rule sideband hit counters, see i40e_fdir_cnt_layout(); the
+	 * lock also covers stats.fd_sb_match
+	 */
+	spinlock_t fd_rule_cnt_lock;
+	u16 fd_rule_cnt_base;	/* GLQF_PCNT index of counter slot 0 */
+	u16 fd_rule_cnt_num;	/* counter slots of this PF */
+	DECLARE_BITMAP(fd_rule_cnt_map, I40E_FD_STAT_RULE_MAX);
+	u64 fd_rule_hits[I40E_FD_STAT_RULE_MAX];
 	u16 phy_led_val;
 	u16 last_sw_conf_flags;
 	u16 last_sw_conf_valid_flags;
@@ -934,6 +1095,17 @@ static inline u64 i40e_addr_to_hkey(const u8 *macaddr)
 	return key;
 }
 
+/**
+ * i40e_vlan_to_hkey - Convert a filter VLAN to a hash key
+ * @vlan: the VLAN, including I40E_VLAN_ANY
+ *
+ * Returns the key used for the per-VLAN filter index
+ **/
+static inline u32 i40e_vlan_to_hkey(s16 vlan)
+{
+	return (u16)vlan;
+}
+
 enum i40e_filter_state {
 	I40E_FILTER_INVALID = 0,	/* Invalid state */
 	I40E_FILTER_NEW,		/* New, not sent to FW yet */
@@ -946,12 +1118,30 @@ enum i40e_filter_state {
 };
 struct i40e_mac_filter {
 	struct hlist_node hlist;
+	/* macaddr and vlan must stay adjacent, together they form the key
+	 * of the (mac, vlan) filter index, see struct i40e_mac_filter_key
+	 */
 	u8 macaddr[ETH_ALEN];
 #define I40E_VLAN_ANY -1
 	s16 vlan;
 	enum i40e_filter_state state;
+	struct hlist_node vlan_hlist;
+	/* on the VSI filter_dirty_list while NEW or REMOVE */
+	struct list_head dirty;
+#ifdef HAVE_RHASHTABLE_TYPES
+	struct rhash_head ht_node;
+#endif /* HAVE_RHASHTABLE_TYPES */
+};
+
+/* Lookup key for the (mac, vlan) filter index */
+struct i40e_mac_filter_key {
+	u8 macaddr[ETH_ALEN];
+	s16 vlan;
 };
 
+/* remove macvlan requests i40e_sync_vsi_filters keeps posted on the ASQ */
+#define I40E_DEL_FILTERS_INFLIGHT	4
+
 /* Wrapper structure to keep track of filters while we are preparing to send
  * firmware commands. We cannot send firmware commands while holding a
  * spinlock, since it might sleep. To avoid this, we wrap the added filters in
@@ -985,6 +1175,7 @@ struct i40e_veb {
 	u8  bw_tc_max_quanta[I40E_MAX_TRAFFIC_CLASS];
 	struct kobject *kobj;
 	bool stat_offsets_loaded;
+	unsigned long stats_updated;	/* jiffies of the last register read */
 	struct i40e_eth_stats stats;
 	struct i40e_eth_stats stats_offsets;
 	struct i40e_veb_tc_stats tc_stats;
@@ -1001,6 +1192,7 @@ struct i40e_vsi {
 #endif
 	bool netdev_registered;
 	bool stat_offsets_loaded;
+	unsigned long stats_updated;	/* jiffies of the last register read */
 
 	u32 current_netdev_flags;
 	DECLARE_BITMAP(state, __I40E_VSI_STATE_SIZE__);
@@ -1010,8 +1202,21 @@ struct i40e_vsi {
 
 	/* Per VSI lock to protect elements/hash (MAC filter) */
 	spinlock_t mac_filter_hash_lock;
-	/* Fixed size hash table with 2^8 buckets for MAC filters */
+	/* Fixed size hash table with 2^8 buckets for MAC filters, keyed on
+	 * the MAC address and used for full sweeps and MAC lookups
+	 */
 	DECLARE_HASHTABLE(mac_filter_hash, 8);
+	/* Secondary index of the same filters keyed on VLAN */
+	DECLARE_HASHTABLE(vlan_filter_hash, 8);
+#ifdef HAVE_RHASHTABLE_TYPES
+	/* Resizable index of the same filters keyed on (mac, vlan) */
+	struct rhashtable mac_filter_ht;
+	/* hashed filters that could not be added to mac_filter_ht */
+	u32 mac_filter_ht_unlinked;
+#endif /* HAVE_RHASHTABLE_TYPES */
+	/* Filters waiting for i40e_sync_vsi_filters() */
+	struct list_head filter_dirty_list;
+	u32 vlan_filter_count;	/* hashed filters with vlan > 0 */
 	bool has_vlan_filter;
 
 	/* VSI stats */
@@ -1039,7 +1244,11 @@ struct i40e_vsi {
 	struct i40e_ring **xdp_rings; /* XDP Tx rings */
 
 	u32  active_filters;
+	u32  failed_filters;
 	u32  promisc_threshold;
+	/* last i40e_sync_vsi_filters() run, for debugfs */
+	u32  filter_sync_dirty;
+	u64  filter_sync_ns;
 
 	u16 work_limit;
 	u16 int_rate_limit;	/* value in usecs */
@@ -1065,6 +1274,12 @@ struct i40e_vsi {
 	u16 uplink_seid;
 
 	u16 base_queue;		/* vsi's first queue in hw array */
+	/* SR-IOV VSIs may be built from scattered qp_pile entries when no
+	 * contiguous lump is left, qp_map then holds the PF queue of each
+	 * VF queue
+	 */
+	bool qp_scattered;
+	u16 qp_map[I40E_MAX_VF_QUEUES];
 	u16 alloc_queue_pairs;	/* Allocated Tx/Rx queues */
 	u16 req_queue_pairs;	/* User requested queue pairs */
 	u16 num_queue_pairs;	/* Used tx and rx pairs */
@@ -1081,6 +1296,7 @@ struct i40e_vsi {
 	/* VSI BW limit (absolute across all TCs) */
 	u16 bw_limit;		/* VSI BW Limit (0 = disabled) */
 	u8  bw_max_quanta;	/* Max Quanta when BW limit is enabled */
+	u8  bw_burst;		/* log2 of the credits a BW limit may burst */
 
 	/* Relative TC credits across VSIs */
 	u8  bw_ets_share_credits[I40E_MAX_TRAFFIC_CLASS];
@@ -1146,9 +1362,20 @@ struct i40e_q_vector {
 	u8 itr_countdown;	/* when 0 should adjust adaptive ITR */
 	u8 num_ringpairs;	/* total number of ring pairs in vector */
 
+	/* adaptive interrupt rate limiting state and telemetry */
+	u16 intrl;		/* INTRL currently programmed, in usecs */
+	u16 intrl_busy_polls;	/* consecutive polls that used the budget */
+	u16 intrl_idle_irqs;	/* consecutive single poll interrupts */
+	u64 intrl_budget_exhausted;
+	u64 intrl_raised;
+	u64 intrl_lowered;
+
 #ifdef HAVE_IRQ_AFFINITY_NOTIFY
 	cpumask_t affinity_mask;
 	struct irq_affinity_notify affinity_notify;
+#ifdef HAVE_NAPI_THREADED
+	struct delayed_work affinity_work;	/* re-pins the NAPI kthread */
+#endif /* HAVE_NAPI_THREADED */
 #endif
 
 	struct rcu_head rcu;	/* to avoid race with update stats on free */
@@ -1281,6 +1508,19 @@ static inline void i40e_write_fd_input_set(struct i40e_pf *pf,
 			  (u32)(val & 0xFFFFFFFFULL));
 }
 
+/**
+ * i40e_vsi_pf_q - PF queue backing a VSI queue
+ * @vsi: the VSI owning the queue
+ * @q: VSI relative queue index
+ *
+ * Returns the absolute PF queue index, which is only base_queue + @q when
+ * the VSI got a contiguous lump from the qp_pile.
+ **/
+static inline u16 i40e_vsi_pf_q(struct i40e_vsi *vsi, u16 q)
+{
+	return vsi->qp_scattered ? vsi->qp_map[q] : vsi->base_queue + q;
+}
+
 /* needed by i40e_ethtool.c */
 int i40e_up(struct i40e_vsi *vsi);
 void i40e_down(struct i40e_vsi *vsi);
@@ -1315,6 +1555,7 @@ i40e_find_vsi_by_type(struct i40e_pf *pf, u16 type)
 }
 void i40e_update_stats(struct i40e_vsi *vsi);
 void i40e_update_veb_stats(struct i40e_veb *veb);
+void i40e_update_vf_stats(struct i40e_pf *pf);
 void i40e_update_eth_stats(struct i40e_vsi *vsi);
 #ifdef HAVE_NDO_GET_STATS64
 struct rtnl_link_stats64 *i40e_get_vsi_stats_struct(struct i40e_vsi *vsi);
@@ -1324,8 +1565,11 @@ struct net_device_stats *i40e_get_vsi_stats_struct(struct i40e_vsi *vsi);
 int i40e_fetch_switch_configuration(struct i40e_pf *pf,
 				    bool printconfig);
 
+int __i40e_add_del_fdir(struct i40e_vsi *vsi,
+			struct i40e_fdir_filter *input, bool add);
 int i40e_add_del_fdir(struct i40e_vsi *vsi,
 		      struct i40e_fdir_filter *input, bool add);
+void i40e_fdir_kick(struct i40e_pf *pf);
 void i40e_fdir_check_and_reenable(struct i40e_pf *pf);
 u32 i40e_get_current_fd_count(struct i40e_pf *pf);
 u32 i40e_get_cur_guaranteed_fd_count(struct i40e_pf *pf);
@@ -1343,20 +1587,69 @@ struct i40e_mac_filter *i40e_find_filter(struct i40e_vsi *vsi,
 struct i40e_mac_filter *i40e_add_filter(struct i40e_vsi *vsi,
 					const u8 *macaddr, s16 vlan);
 void __i40e_del_filter(struct i40e_vsi *vsi, struct i40e_mac_filter *f);
+int i40e_filter_hash_init(struct i40e_vsi *vsi);
+void i40e_filter_hash_destroy(struct i40e_vsi *vsi);
+void i40e_filter_hash_add(struct i40e_vsi *vsi, struct i40e_mac_filter *f);
+void i40e_filter_hash_del(struct i40e_vsi *vsi, struct i40e_mac_filter *f);
+void i40e_filter_set_vlan(struct i40e_vsi *vsi, struct i40e_mac_filter *f,
+			  s16 vlan);
+void i40e_filter_set_state(struct i40e_vsi *vsi, struct i40e_mac_filter *f,
+			   enum i40e_filter_state state);
+void i40e_filter_mark_dirty(struct i40e_vsi *vsi, struct i40e_mac_filter *f);
+struct i40e_mac_filter *i40e_filter_hash_find(struct i40e_vsi *vsi,
+					      const u8 *macaddr, s16 vlan);
+void i40e_sb_filter_index_init(struct i40e_pf *pf);
+void i40e_fdir_cnt_layout(struct i40e_pf *pf);
+struct i40e_fdir_filter *i40e_fdir_index_find(struct i40e_pf *pf, u32 fd_id);
+int i40e_fdir_index_add(struct i40e_pf *pf, struct i40e_fdir_filter *input);
+void i40e_fdir_index_del(struct i40e_pf *pf, struct i40e_fdir_filter *filter);
+struct i40e_fdir_filter *i40e_fdir_index_next(struct i40e_pf *pf, u32 fd_id);
+struct i40e_fdir_filter *i40e_fdir_index_after(struct i40e_pf *pf,
+					      struct i40e_fdir_filter *filter);
+bool i40e_fdir_rule_hits(struct i40e_pf *pf, struct i40e_fdir_filter *filter,
+			 u64 *hits);
+bool i40e_fdir_rule_has_cnt(struct i40e_pf *pf, struct i40e_fdir_filter *filter);
+bool i40e_fdir_has_tc_rules(struct i40e_pf *pf);
+void i40e_fdir_update_sb_stats(struct i40e_pf *pf);
+void i40e_fdir_reset_rule_stats(struct i40e_pf *pf);
+struct i40e_fdir_filter *
+i40e_fdir_index_find_tc_cookie(struct i40e_pf *pf, unsigned long cookie);
+void i40e_fdir_index_set_vf(struct i40e_pf *pf,
+			    struct i40e_fdir_filter *filter, u16 vf_id);
+void i40e_fdir_index_set_tc_cookie(struct i40e_pf *pf,
+				   struct i40e_fdir_filter *filter,
+				   unsigned long cookie);
+struct i40e_cloud_filter *i40e_cloud_index_find(struct i40e_pf *pf, u32 id);
+struct i40e_cloud_filter *
+i40e_cloud_index_find_cookie(struct i40e_pf *pf, unsigned long cookie);
+int i40e_cloud_index_add(struct i40e_pf *pf, struct i40e_cloud_filter *filter,
+			 bool by_id);
+void i40e_cloud_index_del(struct i40e_pf *pf, struct i40e_cloud_filter *filter);
 void i40e_del_filter(struct i40e_vsi *vsi, const u8 *macaddr, s16 vlan);
 int i40e_sync_vsi_filters(struct i40e_vsi *vsi);
 struct i40e_vsi *i40e_vsi_setup(struct i40e_pf *pf, u8 type,
 				u16 uplink, u32 param1);
+struct i40e_vsi *i40e_vsi_reserve(struct i40e_pf *pf, u8 type,
+				  u16 uplink_seid, u32 param1);
+int i40e_vsi_activate(struct i40e_vsi *vsi);
+int i40e_vsi_clear(struct i40e_vsi *vsi);
 int i40e_vsi_release(struct i40e_vsi *vsi);
 int i40e_vsi_mem_alloc(struct i40e_pf *pf, enum i40e_vsi_type type);
 int i40e_vsi_setup_rx_resources(struct i40e_vsi *vsi);
 int i40e_vsi_setup_tx_resources(struct i40e_vsi *vsi);
 i40e_status i40e_vsi_config_tc(struct i40e_vsi *vsi, u8 enabled_tc);
 int i40e_vsi_request_irq_msix(struct i40e_vsi *vsi, char *basename);
+void i40e_vsi_napi_thread_affinity(struct i40e_vsi *vsi);
 void i40e_service_event_schedule(struct i40e_pf *pf);
+void i40e_adminq_event_schedule(struct i40e_pf *pf);
+void i40e_subtask_stats_clear(struct i40e_pf *pf);
 void i40e_notify_client_of_vf_msg(struct i40e_vsi *vsi, u32 vf_id,
 				  u8 *msg, u16 len);
 
+void i40e_control_tx_q(struct i40e_pf *pf, int pf_q, bool enable);
+void i40e_control_rx_q(struct i40e_pf *pf, int pf_q, bool enable);
+int i40e_pf_txq_wait(struct i40e_pf *pf, int pf_q, bool enable);
+int i40e_pf_rxq_wait(struct i40e_pf *pf, int pf_q, bool enable);
 int i40e_control_wait_tx_q(int seid, struct i40e_pf *pf, int pf_q, bool is_xdp,
 			   bool enable);
 int i40e_control_wait_rx_q(struct i40e_pf *pf, int pf_q, bool enable);
@@ -1373,6 +1666,7 @@ struct i40e_veb *i40e_veb_setup(struct i40e_pf *pf, u16 uplink_seid,
 				u16 downlink_seid, u8 enabled_tc);
 void i40e_veb_release(struct i40e_veb *veb);
 int i40e_max_lump_qp(struct i40e_pf *pf);
+int i40e_free_lump_qp(struct i40e_pf *pf);
 
 int i40e_veb_config_tc(struct i40e_veb *veb, u8 enabled_tc);
 int i40e_vsi_add_pvid(struct i40e_vsi *vsi, u16 vid);
@@ -1384,6 +1678,13 @@ int i40e_get_custom_cloud_filter_type(u8 flags, u16 *type);
 int i40e_add_del_custom_cloud_filter(struct i40e_vsi *vsi,
 				     struct i40e_cloud_filter *filter,
 				     bool add);
+int i40e_add_fdir_tc(struct i40e_vsi *vsi, struct ethtool_rx_flow_spec *fsp,
+		     unsigned long cookie);
+int i40e_add_fdir_vf(struct i40e_vsi *vsi, struct ethtool_rx_flow_spec *fsp,
+		     u16 vf_id);
+int i40e_del_fdir_owned(struct i40e_vsi *vsi, struct i40e_fdir_filter *filter);
+void i40e_del_fdir_vf_all(struct i40e_vsi *vsi, u16 vf_id);
+int i40e_fdir_free_loc(struct i40e_pf *pf, u32 *loc);
 int i40e_get_cloud_filter_type(u8 flags, u16 *type);
 void i40e_vsi_reset_stats(struct i40e_vsi *vsi);
 void i40e_pf_reset_stats(struct i40e_pf *pf);
@@ -442,6 +442,41 @@ init_adminq_exit:
 	return ret_code;
 }
 
+/**
+ *  i40e_asq_flush_pending - complete commands firmware will never write back
+ *  @hw: pointer to the hardware structure
+ *
+ *  Called before the ASQ ring is reset or freed so that submitters waiting
+ *  on an i40e_asq_cmd_done are not left behind. Must be called with
+ *  asq_spinlock held.
+ **/
+static void i40e_asq_flush_pending(struct i40e_hw *hw)
+{
+	struct i40e_adminq_ring *asq = &hw->aq.asq;
+	struct i40e_asq_cmd_details *details;
+	struct i40e_asq_cmd_done *done;
+	u16 ntc = asq->next_to_clean;
+
+	if (!asq->count || !asq->cmd_buf.va)
+		return;
+
+	while (ntc != asq->next_to_use) {
+		details = I40E_ADMINQ_DETAILS(*asq, ntc);
+		done = details->done;
+		details->done = NULL;
+		if (done && !done->completed) {
+			done->status = I40E_ERR_ADMIN_QUEUE_ERROR;
+			done->aq_rc = I40E_AQ_RC_EFLUSHED;
+			done->completed = true;
+			if (done->fn)
+				done->fn(hw, done);
+		}
+		ntc++;
+		if (ntc == asq->count)
+			ntc = 0;
+	}
+}
+
 /**
  *  i40e_shutdown_asq - shutdown the ASQ
  *  @hw: pointer to the hardware structure
@@ -459,6 +494,8 @@ static i40e_status i40e_shutdown_asq(struct i40e_hw *hw)
 		goto shutdown_asq_out;
 	}
 
+	i40e_asq_flush_pending(hw);
+
 	/* Stop firmware AdminQ processing */
 	wr32(hw, hw->aq.asq.head, 0);
 	wr32(hw, hw->aq.asq.tail, 0);
@@ -516,11 +553,15 @@ shutdown_arq_out:
  **/
 static void i40e_resume_aq(struct i40e_hw *hw)
 {
+	i40e_acquire_spinlock(&hw->aq.asq_spinlock);
+	i40e_asq_flush_pending(hw);
+
 	/* Registers are reset after PF reset */
 	hw->aq.asq.next_to_use = 0;
 	hw->aq.asq.next_to_clean = 0;
 
 	i40e_config_asq_regs(hw);
+	i40e_release_spinlock(&hw->aq.asq_spinlock);
 
 	hw->aq.arq.next_to_use = 0;
 	hw->aq.arq.next_to_clean = 0;
@@ -727,6 +768,170 @@ i40e_status i40e_shutdown_adminq(struct i40e_hw *hw)
 	return ret_code;
 }
 
+/**
+ *  i40e_aq_op_stats_get - find or claim the accounting entry of an opcode
+ *  @hw: pointer to the hardware structure
+ *  @opcode: AQ opcode
+ *
+ *  Returns NULL if accounting is off or all entries are taken
+ **/
+static struct i40e_aq_op_stats *i40e_aq_op_stats_get(struct i40e_hw *hw,
+						     u16 opcode)
+{
+	struct i40e_aq_op_stats *tbl = hw->aq.op_stats;
+	u16 i, n;
+
+	if (!tbl || !opcode)
+		return NULL;
+
+	n = (opcode * 31) % I40E_AQ_STATS_OPCODES;
+	for (i = 0; i < I40E_AQ_STATS_OPCODES; i++) {
+		if (tbl[n].opcode == opcode)
+			return &tbl[n];
+		if (!tbl[n].opcode) {
+			tbl[n].opcode = opcode;
+			tbl[n].lat_min_ns = U64_MAX;
+			return &tbl[n];
+		}
+		n = (n + 1) % I40E_AQ_STATS_OPCODES;
+	}
+
+	hw->aq.op_stats_dropped++;
+	return NULL;
+}
+
+/**
+ *  i40e_aq_stats_complete - account a command written back by firmware
+ *  @hw: pointer to the hardware structure
+ *  @desc: written back descriptor
+ *  @submit_ns: time the command was posted
+ **/
+static void i40e_aq_stats_complete(struct i40e_hw *hw,
+				   struct i40e_aq_desc *desc, u64 submit_ns)
+{
+	u64 lat_ns = submit_ns ? i40e_time_ns() - submit_ns : 0;
+	u16 retval = LE16_TO_CPU(desc->retval) & 0xff;
+	struct i40e_aq_op_stats *st;
+	u32 b;
+
+	i40e_aq_trace_done(hw, desc, lat_ns);
+
+	st = i40e_aq_op_stats_get(hw, LE16_TO_CPU(desc->opcode));
+	if (!st)
+		return;
+
+	st->count++;
+	if (retval != I40E_AQ_RC_OK)
+		st->errors++;
+	if (retval == I40E_AQ_RC_EBUSY)
+		st->ebusy++;
+
+	st->lat_sum_ns += lat_ns;
+	if (lat_ns < st->lat_min_ns)
+		st->lat_min_ns = lat_ns;
+	if (lat_ns > st->lat_max_ns)
+		st->lat_max_ns = lat_ns;
+
+	b = fls64(div_u64(lat_ns, 1000));
+	if (b >= I40E_AQ_STATS_BUCKETS)
+		b = I40E_AQ_STATS_BUCKETS - 1;
+	st->lat_hist[b]++;
+}
+
+/**
+ *  i40e_aq_stats_timeout - account a command that was not written back
+ *  @hw: pointer to the hardware structure
+ *  @opcode: AQ opcode, in CPU order
+ **/
+static void i40e_aq_stats_timeout(struct i40e_hw *hw, u16 opcode)
+{
+	struct i40e_aq_op_stats *st = i40e_aq_op_stats_get(hw, opcode);
+
+	if (st)
+		st->timeouts++;
+}
+
+/**
+ *  i40e_aq_stats_snapshot - copy the per-opcode AdminQ accounting
+ *  @hw: pointer to the hardware structure
+ *  @stats: I40E_AQ_STATS_OPCODES entries to copy to
+ *  @clear: also reset the accounting
+ *
+ *  Returns the number of commands whose opcode could not be tracked
+ **/
+u32 i40e_aq_stats_snapshot(struct i40e_hw *hw, struct i40e_aq_op_stats *stats,
+			   bool clear)
+{
+	u32 dropped;
+
+	i40e_acquire_spinlock(&hw->aq.asq_spinlock);
+	dropped = hw->aq.op_stats_dropped;
+	if (hw->aq.op_stats) {
+		if (stats)
+			i40e_memcpy(stats, hw->aq.op_stats,
+				    sizeof(*stats) * I40E_AQ_STATS_OPCODES,
+				    I40E_NONDMA_TO_NONDMA);
+		if (clear)
+			i40e_memset(hw->aq.op_stats, 0,
+				    sizeof(*stats) * I40E_AQ_STATS_OPCODES,
+				    I40E_NONDMA_MEM);
+	} else if (stats) {
+		i40e_memset(stats, 0, sizeof(*stats) * I40E_AQ_STATS_OPCODES,
+			    I40E_NONDMA_MEM);
+	}
+	if (clear)
+		hw->aq.op_stats_dropped = 0;
+	i40e_release_spinlock(&hw->aq.asq_spinlock);
+
+	return dropped;
+}
+
+/**
+ *  i40e_asq_complete - record the write back of an ASQ command
+ *  @hw: pointer to the hardware structure
+ *  @desc: descriptor on the ring, already written back by firmware
+ *  @dma_buff: DMA buffer of the descriptor slot
+ *  @done: completion requested by the submitter
+ *
+ *  The response buffer is copied only if the submitter asked for it, which
+ *  it does for indirect commands only.
+ **/
+static void i40e_asq_complete(struct i40e_hw *hw, struct i40e_aq_desc *desc,
+			      struct i40e_dma_mem *dma_buff,
+			      struct i40e_asq_cmd_done *done)
+{
+	u16 retval;
+
+	i40e_memcpy(&done->desc, desc, sizeof(struct i40e_aq_desc),
+		    I40E_DMA_TO_NONDMA);
+	if (done->buff)
+		i40e_memcpy(done->buff, dma_buff->va, done->buff_size,
+			    I40E_DMA_TO_NONDMA);
+
+	retval = LE16_TO_CPU(desc->retval);
+	if (retval != 0) {
+		i40e_debug(hw,
+			   I40E_DEBUG_AQ_MESSAGE,
+			   "AQTX: Command completed with error 0x%X.\n",
+			   retval);
+
+		/* strip off FW internal code */
+		retval &= 0xff;
+	}
+
+	if ((enum i40e_admin_queue_err)retval == I40E_AQ_RC_OK)
+		done->status = I40E_SUCCESS;
+	else if ((enum i40e_admin_queue_err)retval == I40E_AQ_RC_EBUSY)
+		done->status = I40E_ERR_NOT_READY;
+	else
+		done->status = I40E_ERR_ADMIN_QUEUE_ERROR;
+	done->aq_rc = (enum i40e_admin_queue_err)retval;
+	done->completed = true;
+
+	if (done->fn)
+		done->fn(hw, done);
+}
+
 /**
  *  i40e_clean_asq - cleans Admin send queue
  *  @hw: pointer to the hardware structure
@@ -768,6 +973,10 @@ static u16 i40e_clean_asq(struct i40e_hw *hw)
 				    I40E_DMA_TO_DMA);
 			cb_func(hw, &desc_cb);
 		}
+		i40e_aq_stats_complete(hw, desc, details->submit_ns);
+		if (details->done)
+			i40e_asq_complete(hw, desc, &asq->r.asq_bi[ntc],
+					  details->done);
 		i40e_memset(desc, 0, sizeof(*desc), I40E_DMA_MEM);
 		i40e_memset(details, 0, sizeof(*details), I40E_NONDMA_MEM);
 		ntc++;
@@ -783,22 +992,6 @@ clean_asq_exit:
 	return I40E_DESC_UNUSED(asq);
 }
 
-/**
- *  i40e_asq_done - check if FW has processed the Admin Send Queue
- *  @hw: pointer to the hw struct
- *
- *  Returns true if the firmware has processed all descriptors on the
- *  admin send queue. Returns false if there are still requests pending.
- **/
-static bool i40e_asq_done(struct i40e_hw *hw)
-{
-	/* AQ designers suggest use of head for better
-	 * timing reliability than DD bit
-	 */
-	return rd32(hw, hw->aq.asq.head) == hw->aq.asq.next_to_use;
-
-}
-
 /**
  *  i40e_asq_send_command_atomic_exec - send command to Admin Queue
  *  @hw: pointer to the hw struct
@@ -810,6 +1003,10 @@ static bool i40e_asq_done(struct i40e_hw *hw)
  *
  *  This is the main send command driver routine for the Admin Queue send
  *  queue.  It runs the queue, cleans the queue, etc
+ *
+ *  Asynchronous commands return as soon as the descriptor is posted, and
+ *  complete through cmd_details->done from i40e_clean_asq. Synchronous ones
+ *  are posted the same way and then wait for their own completion.
  **/
 static enum i40e_status_code
 i40e_asq_send_command_atomic_exec(struct i40e_hw *hw,
@@ -822,9 +1019,12 @@ i40e_asq_send_command_atomic_exec(struct i40e_hw *hw,
 	i40e_status status = I40E_SUCCESS;
 	struct i40e_dma_mem *dma_buff = NULL;
 	struct i40e_asq_cmd_details *details;
+	struct i40e_asq_cmd_done sync_done;
 	struct i40e_aq_desc *desc_on_ring;
+	struct i40e_aq_desc *wb_desc;
 	bool cmd_completed = false;
-	u16  retval = 0;
+	u32 total_delay = 0;
+	bool sync;
 	u32  val = 0;
 
 	hw->aq.asq_last_status = I40E_AQ_RC_OK;
@@ -888,6 +1088,10 @@ i40e_asq_send_command_atomic_exec(struct i40e_hw *hw,
 		goto asq_send_command_error;
 	}
 
+	/* the slot is cleared by i40e_clean_asq once the command completes */
+	sync = !details->async && !details->postpone;
+	wb_desc = details->wb_desc;
+
 	/* call clean and check queue available function to reclaim the
 	 * descriptors that were processed by FW, the function returns the
 	 * number of desc available
@@ -903,6 +1107,17 @@ i40e_asq_send_command_atomic_exec(struct i40e_hw *hw,
 		goto asq_send_command_error;
 	}
 
+	/* synchronous commands collect their write back like any other */
+	if (sync) {
+		i40e_memset(&sync_done, 0, sizeof(sync_done),
+			    I40E_NONDMA_MEM);
+		sync_done.buff = buff;
+		sync_done.buff_size = buff ? buff_size : 0;
+		details->done = &sync_done;
+	} else if (details->done) {
+		details->done->completed = false;
+	}
+
 	/* initialize the temp desc pointer with the right desc */
 	desc_on_ring = I40E_ADMINQ_DESC(hw->aq.asq, hw->aq.asq.next_to_use);
 
@@ -927,6 +1142,9 @@ i40e_asq_send_command_atomic_exec(struct i40e_hw *hw,
 				CPU_TO_LE32(lower_32_bits(dma_buff->pa));
 	}
 
+	details->submit_ns = i40e_time_ns();
+	i40e_aq_trace_submit(hw, desc_on_ring);
+
 	/* bump the tail */
 	i40e_debug(hw, I40E_DEBUG_AQ_COMMAND, "AQTX: desc and buffer:\n");
 	i40e_debug_aq(hw, I40E_DEBUG_AQ_COMMAND, (void *)desc_on_ring,
@@ -937,65 +1155,47 @@ i40e_asq_send_command_atomic_exec(struct i40e_hw *hw,
 	if (!details->postpone)
 		wr32(hw, hw->aq.asq.tail, hw->aq.asq.next_to_use);
 
-	/* if cmd_details are not defined or async flag is not set,
-	 * we need to wait for desc write back
-	 */
-	if (!details->async && !details->postpone) {
-		u32 total_delay = 0;
-
-		do {
-			/* AQ designers suggest use of head for better
-			 * timing reliability than DD bit
-			 */
-			if (i40e_asq_done(hw))
-				break;
-			if (is_atomic_context)
-				udelay(50);
-			else
-				usleep_range(40, 60);
-			total_delay += 50;
-		} while (total_delay < hw->aq.asq_cmd_timeout);
-	}
+	/* asynchronous commands are done once posted */
+	if (!sync)
+		goto asq_send_command_wb;
 
-	/* if ready, copy the desc back to temp */
-	if (i40e_asq_done(hw)) {
-		i40e_memcpy(desc, desc_on_ring, sizeof(struct i40e_aq_desc),
-			    I40E_DMA_TO_NONDMA);
-		if (buff != NULL)
-			i40e_memcpy(buff, dma_buff->va, buff_size,
-				    I40E_DMA_TO_NONDMA);
-		retval = LE16_TO_CPU(desc->retval);
-		if (retval != 0) {
-			i40e_debug(hw,
-				   I40E_DEBUG_AQ_MESSAGE,
-				   "AQTX: Command completed with error 0x%X.\n",
-				   retval);
-
-			/* strip off FW internal code */
-			retval &= 0xff;
-		}
-		cmd_completed = true;
-		if ((enum i40e_admin_queue_err)retval == I40E_AQ_RC_OK)
-			status = I40E_SUCCESS;
-		else if ((enum i40e_admin_queue_err)retval == I40E_AQ_RC_EBUSY)
-			status = I40E_ERR_NOT_READY;
+	do {
+		i40e_clean_asq(hw);
+		if (sync_done.completed)
+			break;
+		if (is_atomic_context)
+			udelay(50);
 		else
-			status = I40E_ERR_ADMIN_QUEUE_ERROR;
-		hw->aq.asq_last_status = (enum i40e_admin_queue_err)retval;
+			usleep_range(40, 60);
+		total_delay += 50;
+	} while (total_delay < hw->aq.asq_cmd_timeout);
+
+	if (sync_done.completed) {
+		i40e_memcpy(desc, &sync_done.desc, sizeof(struct i40e_aq_desc),
+			    I40E_NONDMA_TO_NONDMA);
+		cmd_completed = true;
+		status = sync_done.status;
+		hw->aq.asq_last_status = sync_done.aq_rc;
+	} else {
+		/* firmware may still write the slot back later, do not let
+		 * i40e_clean_asq complete into this stack frame
+		 */
+		details->done = NULL;
+		i40e_aq_stats_timeout(hw, LE16_TO_CPU(desc->opcode));
 	}
 
 	i40e_debug(hw, I40E_DEBUG_AQ_COMMAND,
 		   "AQTX: desc and buffer writeback:\n");
 	i40e_debug_aq(hw, I40E_DEBUG_AQ_COMMAND, (void *)desc, buff, buff_size);
 
+asq_send_command_wb:
 	/* save writeback aq if requested */
-	if (details->wb_desc)
-		i40e_memcpy(details->wb_desc, desc_on_ring,
+	if (wb_desc)
+		i40e_memcpy(wb_desc, cmd_completed ? desc : desc_on_ring,
 			    sizeof(struct i40e_aq_desc), I40E_DMA_TO_NONDMA);
 
 	/* update the error if time out occurred */
-	if ((!cmd_completed) &&
-	    (!details->async && !details->postpone)) {
+	if (!cmd_completed && sync) {
 		if (rd32(hw, hw->aq.asq.len) & I40E_GL_ATQLEN_ATQCRIT_MASK) {
 			i40e_debug(hw, I40E_DEBUG_AQ_MESSAGE,
 				   "AQTX: AQ Critical error.\n");
@@ -1102,6 +1302,80 @@ inline i40e_status i40e_asq_send_command_v2(struct i40e_hw *hw,
 					       cmd_details, true, aq_status);
 }
 
+/**
+ *  i40e_asq_reap - collect completed Admin Send Queue commands
+ *  @hw: pointer to the hw struct
+ *
+ *  Runs the completions of every command firmware has written back since the
+ *  last call. Meant to be called when the AdminQ interrupt fires for
+ *  commands posted with I40E_AQ_FLAG_SI, and by waiters.
+ *
+ *  Returns the number of free descriptors
+ **/
+u16 i40e_asq_reap(struct i40e_hw *hw)
+{
+	u16 unused = 0;
+
+	i40e_acquire_spinlock(&hw->aq.asq_spinlock);
+	if (hw->aq.asq.count)
+		unused = i40e_clean_asq(hw);
+	i40e_release_spinlock(&hw->aq.asq_spinlock);
+
+	return unused;
+}
+
+/**
+ *  i40e_asq_wait_done - wait for an asynchronous command to complete
+ *  @hw: pointer to the hw struct
+ *  @done: completion passed in the command details on submission
+ *  @is_atomic_context: is the function called in an atomic context?
+ *
+ *  Does not hold the ASQ lock while waiting, so other commands can be
+ *  posted meanwhile. On timeout the completion is detached from its slot and
+ *  may be reused by the caller.
+ **/
+enum i40e_status_code
+i40e_asq_wait_done(struct i40e_hw *hw, struct i40e_asq_cmd_done *done,
+		   bool is_atomic_context)
+{
+	struct i40e_asq_cmd_details *details;
+	u32 total_delay = 0;
+	u16 ntc;
+
+	do {
+		i40e_asq_reap(hw);
+		if (done->completed)
+			return done->status;
+		if (is_atomic_context)
+			udelay(50);
+		else
+			usleep_range(40, 60);
+		total_delay += 50;
+	} while (total_delay < hw->aq.asq_cmd_timeout);
+
+	i40e_acquire_spinlock(&hw->aq.asq_spinlock);
+	if (!done->completed && hw->aq.asq.count) {
+		for (ntc = hw->aq.asq.next_to_clean;
+		     ntc != hw->aq.asq.next_to_use;
+		     ntc = (ntc + 1 == hw->aq.asq.count) ? 0 : ntc + 1) {
+			details = I40E_ADMINQ_DETAILS(hw->aq.asq, ntc);
+			if (details->done != done)
+				continue;
+			details->done = NULL;
+			i40e_aq_stats_timeout(hw, LE16_TO_CPU(
+					I40E_ADMINQ_DESC(hw->aq.asq,
+							 ntc)->opcode));
+		}
+		done->status = I40E_ERR_ADMIN_QUEUE_TIMEOUT;
+		done->completed = true;
+		if (done->fn)
+			done->fn(hw, done);
+	}
+	i40e_release_spinlock(&hw->aq.asq_spinlock);
+
+	return done->status;
+}
+
 /**
  *  i40e_fill_default_direct_cmd_desc - AQ descriptor helper function
  *  @desc:     pointer to the temp descriptor (non DMA mem)
@@ -38,6 +38,23 @@ struct i40e_adminq_ring {
 	u32 bal;
 };
 
+struct i40e_hw;
+
+/* ASQ command completion, filled in by i40e_clean_asq once firmware has
+ * written the descriptor back. Must stay valid until completed is set.
+ */
+struct i40e_asq_cmd_done {
+	/* called with the ASQ lock held, must not send AQ commands */
+	void (*fn)(struct i40e_hw *hw, struct i40e_asq_cmd_done *done);
+	void *priv;			/* owned by the submitter */
+	void *buff;			/* indirect response is copied here */
+	u16 buff_size;
+	bool completed;
+	enum i40e_status_code status;
+	enum i40e_admin_queue_err aq_rc;
+	struct i40e_aq_desc desc;	/* descriptor written back by FW */
+};
+
 /* ASQ transaction details */
 struct i40e_asq_cmd_details {
 	void *callback; /* cast from type I40E_ADMINQ_CALLBACK */
@@ -47,6 +64,8 @@ struct i40e_asq_cmd_details {
 	bool async;
 	bool postpone;
 	struct i40e_aq_desc *wb_desc;
+	struct i40e_asq_cmd_done *done;
+	u64 submit_ns;			/* set when the command is posted */
 };
 
 #define I40E_ADMINQ_DETAILS(R, i)   \
@@ -60,6 +79,25 @@ struct i40e_arq_event_info {
 	u8 *msg_buf;
 };
 
+#define I40E_AQ_STATS_OPCODES	64	/* distinct opcodes accounted */
+#define I40E_AQ_STATS_BUCKETS	24	/* log2(usecs) latency buckets */
+
+/* Per-opcode ASQ accounting, updated under the ASQ lock. Bucket 0 counts
+ * commands completed in less than 1 usec, bucket n those which took
+ * [2^(n-1), 2^n) usecs, and the last bucket everything above.
+ */
+struct i40e_aq_op_stats {
+	u16 opcode;			/* 0 for an unused entry */
+	u32 count;
+	u32 errors;
+	u32 ebusy;
+	u32 timeouts;
+	u64 lat_min_ns;
+	u64 lat_max_ns;
+	u64 lat_sum_ns;
+	u32 lat_hist[I40E_AQ_STATS_BUCKETS];
+};
+
 /* Admin Queue information */
 struct i40e_adminq_info {
 	struct i40e_adminq_ring arq;    /* receive queue */
@@ -81,6 +119,10 @@ struct i40e_adminq_info {
 	/* last status values on send and receive queues */
 	enum i40e_admin_queue_err asq_last_status;
 	enum i40e_admin_queue_err arq_last_status;
+
+	/* optional, I40E_AQ_STATS_OPCODES entries owned by the driver */
+	struct i40e_aq_op_stats *op_stats;
+	u32 op_stats_dropped;		/* commands of untracked opcodes */
 };
 
 /**
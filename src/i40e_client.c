@@ -777,18 +777,19 @@ static void i40e_client_device_unregister(struct i40e_info *ldev)
 	struct i40e_pf *pf = ldev->pf;
 	struct i40e_client_instance *cdev = pf->cinst;
 
-	while (test_and_set_bit(__I40E_SERVICE_SCHED, pf->state))
-		usleep_range(500, 1000);
+	/* keep the service subtasks, the client one included, out */
+	down_write(&pf->service_rwsem);
 
 	if (!cdev || !cdev->client || !cdev->client->ops ||
 	    !cdev->client->ops->close) {
 		dev_err(&pf->pdev->dev, "Cannot close client device\n");
+		up_write(&pf->service_rwsem);
 		return;
 	}
 	cdev->client->ops->close(&cdev->lan_info, cdev->client, false);
 	clear_bit(__I40E_CLIENT_INSTANCE_OPENED, &cdev->state);
 	i40e_client_release_qvlist(&cdev->lan_info);
 	pf->cinst->client = NULL;
-	clear_bit(__I40E_SERVICE_SCHED, pf->state);
+	up_write(&pf->service_rwsem);
 }
 
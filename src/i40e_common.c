@@ -1979,9 +1979,6 @@ i40e_status i40e_aq_add_vsi(struct i40e_hw *hw,
 	struct i40e_aq_desc desc;
 	struct i40e_aqc_add_get_update_vsi *cmd =
 		(struct i40e_aqc_add_get_update_vsi *)&desc.params.raw;
-	struct i40e_aqc_add_get_update_vsi_completion *resp =
-		(struct i40e_aqc_add_get_update_vsi_completion *)
-		&desc.params.raw;
 	i40e_status status;
 
 	i40e_fill_default_direct_cmd_desc(&desc,
@@ -2001,13 +1998,34 @@ i40e_status i40e_aq_add_vsi(struct i40e_hw *hw,
 	if (status != I40E_SUCCESS)
 		goto aq_add_vsi_exit;
 
+	/* only posted, the submitter passes the write back to
+	 * i40e_aq_add_vsi_resp once it completes
+	 */
+	if (cmd_details && cmd_details->async)
+		goto aq_add_vsi_exit;
+
+	i40e_aq_add_vsi_resp(vsi_ctx, &desc);
+
+aq_add_vsi_exit:
+	return status;
+}
+
+/**
+ * i40e_aq_add_vsi_resp - Fill in the VSI context from an add VSI completion
+ * @vsi_ctx: the VSI context the command was sent with
+ * @desc: descriptor written back by firmware
+ **/
+void i40e_aq_add_vsi_resp(struct i40e_vsi_context *vsi_ctx,
+			  struct i40e_aq_desc *desc)
+{
+	struct i40e_aqc_add_get_update_vsi_completion *resp =
+		(struct i40e_aqc_add_get_update_vsi_completion *)
+		&desc->params.raw;
+
 	vsi_ctx->seid = LE16_TO_CPU(resp->seid);
 	vsi_ctx->vsi_number = LE16_TO_CPU(resp->vsi_number);
 	vsi_ctx->vsis_allocated = LE16_TO_CPU(resp->vsi_used);
 	vsi_ctx->vsis_unallocated = LE16_TO_CPU(resp->vsi_free);
-
-aq_add_vsi_exit:
-	return status;
 }
 
 /**
@@ -6427,6 +6445,19 @@ i40e_status i40e_aq_rx_ctl_write_register(struct i40e_hw *hw,
 	return status;
 }
 
+/**
+ * i40e_rx_ctl_use_register - check how Rx control registers are written
+ * @hw: pointer to the hw struct
+ *
+ * Returns true if the firmware has no rx_ctl_reg_write command and the
+ * registers are written directly.
+ **/
+bool i40e_rx_ctl_use_register(struct i40e_hw *hw)
+{
+	return ((hw->aq.api_maj_ver == 1) && (hw->aq.api_min_ver < 5)) ||
+	       (hw->mac.type == I40E_MAC_X722);
+}
+
 /**
  * i40e_write_rx_ctl - write to an Rx control register
  * @hw: pointer to the hw struct
@@ -6439,9 +6470,7 @@ void i40e_write_rx_ctl(struct i40e_hw *hw, u32 reg_addr, u32 reg_val)
 	bool use_register;
 	int retry = 5;
 
-	use_register = (((hw->aq.api_maj_ver == 1) &&
-			(hw->aq.api_min_ver < 5)) ||
-			(hw->mac.type == I40E_MAC_X722));
+	use_register = i40e_rx_ctl_use_register(hw);
 	if (!use_register) {
 do_retry:
 		status = i40e_aq_rx_ctl_write_register(hw, reg_addr,
@@ -124,6 +124,9 @@ static void i40e_dbg_dump_vsi_filters(struct i40e_pf *pf, struct i40e_vsi *vsi)
 		 vsi->active_filters, vsi->promisc_threshold,
 		 (test_bit(__I40E_VSI_OVERFLOW_PROMISC, vsi->state) ?
 		  "ON" : "OFF"));
+	dev_info(&pf->pdev->dev, "    failed_filters %u, vlan_filters %u, last sync %u dirty filters in %llu ns\n",
+		 vsi->failed_filters, vsi->vlan_filter_count,
+		 vsi->filter_sync_dirty, vsi->filter_sync_ns);
 }
 
 /**
@@ -386,6 +389,18 @@ static void i40e_dbg_dump_vsi_seid(struct i40e_pf *pf, int seid)
 	dev_info(&pf->pdev->dev,
 		 "    num_q_vectors = %i, base_vector = %i\n",
 		 vsi->num_q_vectors, vsi->base_vector);
+	for (i = 0; i < vsi->num_q_vectors && vsi->q_vectors; i++) {
+		struct i40e_q_vector *q_vector = vsi->q_vectors[i];
+
+		if (!q_vector)
+			continue;
+
+		dev_info(&pf->pdev->dev,
+			 "    q_vectors[%i]: reg_idx = %d, intrl = %d, budget_exhausted = %llu, intrl_raised = %llu, intrl_lowered = %llu\n",
+			 i, q_vector->reg_idx, q_vector->intrl,
+			 q_vector->intrl_budget_exhausted,
+			 q_vector->intrl_raised, q_vector->intrl_lowered);
+	}
 	dev_info(&pf->pdev->dev,
 		 "    seid = %d, id = %d, uplink_seid = %d\n",
 		 vsi->seid, vsi->id, vsi->uplink_seid);
@@ -393,6 +408,11 @@ static void i40e_dbg_dump_vsi_seid(struct i40e_pf *pf, int seid)
 		 "    base_queue = %d, num_queue_pairs = %d, num_tx_desc = %d, num_rx_desc = %d\n",
 		 vsi->base_queue, vsi->num_queue_pairs, vsi->num_tx_desc,
 		 vsi->num_rx_desc);
+	if (vsi->qp_scattered) {
+		for (i = 0; i < vsi->alloc_queue_pairs; i++)
+			dev_info(&pf->pdev->dev,
+				 "    qp_map[%i] = %d\n", i, vsi->qp_map[i]);
+	}
 	dev_info(&pf->pdev->dev, "    type = %i\n", vsi->type);
 	if (vsi->type == I40E_VSI_SRIOV)
 		dev_info(&pf->pdev->dev, "    VF ID = %i\n", vsi->vf_id);
@@ -484,8 +504,8 @@ static void i40e_dbg_dump_vsi_seid(struct i40e_pf *pf, int seid)
 			 vsi->tc_config.tc_info[i].netdev_tc);
 	}
 	dev_info(&pf->pdev->dev,
-		 "    bw: bw_limit = %d, bw_max_quanta = %d\n",
-		 vsi->bw_limit, vsi->bw_max_quanta);
+		 "    bw: bw_limit = %d, bw_max_quanta = %d, bw_burst = %d\n",
+		 vsi->bw_limit, vsi->bw_max_quanta, vsi->bw_burst);
 	for (i = 0; i < I40E_MAX_TRAFFIC_CLASS; i++) {
 		dev_info(&pf->pdev->dev,
 			 "    bw[%d]: ets_share_credits = %d, ets_limit_credits = %d, max_quanta = %d\n",
@@ -538,6 +558,123 @@ static void i40e_dbg_dump_aq_desc(struct i40e_pf *pf)
 	}
 }
 
+/**
+ * i40e_dbg_dump_aq_stats - handles dump aq stats write into command datum
+ * @pf: the i40e_pf created in command write
+ *
+ * Latencies are reported in usecs. The p99 value is the upper bound of the
+ * log2 histogram bucket holding the 99th percentile, capped by the maximum.
+ **/
+static void i40e_dbg_dump_aq_stats(struct i40e_pf *pf)
+{
+	struct i40e_aq_op_stats *stats;
+	u32 dropped;
+	int i, b;
+
+	if (!pf->hw.aq.op_stats) {
+		dev_info(&pf->pdev->dev, "AdminQ accounting is not available\n");
+		return;
+	}
+
+	stats = kcalloc(I40E_AQ_STATS_OPCODES, sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return;
+	dropped = i40e_aq_stats_snapshot(&pf->hw, stats, false);
+
+	dev_info(&pf->pdev->dev,
+		 "AdminQ opcode    count   errors    ebusy timeouts  min_us  avg_us  max_us  p99_us\n");
+	for (i = 0; i < I40E_AQ_STATS_OPCODES; i++) {
+		struct i40e_aq_op_stats *st = &stats[i];
+		u64 max_us, p99_us;
+		u32 target, seen;
+
+		if (!st->opcode || !st->count)
+			continue;
+
+		max_us = div_u64(st->lat_max_ns, 1000);
+		target = st->count - st->count / 100;
+		p99_us = max_us;
+		for (b = 0, seen = 0; b < I40E_AQ_STATS_BUCKETS - 1; b++) {
+			seen += st->lat_hist[b];
+			if (seen >= target) {
+				p99_us = min_t(u64, BIT_ULL(b), max_us);
+				break;
+			}
+		}
+
+		dev_info(&pf->pdev->dev,
+			 "       0x%04x %8u %8u %8u %8u %7llu %7llu %7llu %7llu\n",
+			 st->opcode, st->count, st->errors, st->ebusy,
+			 st->timeouts, div_u64(st->lat_min_ns, 1000),
+			 div_u64(div_u64(st->lat_sum_ns, st->count), 1000),
+			 max_us, p99_us);
+	}
+	if (dropped)
+		dev_info(&pf->pdev->dev,
+			 "%u commands of untracked opcodes\n", dropped);
+
+	kfree(stats);
+}
+
+/**
+ * i40e_dbg_dump_service - handles dump service write into command datum
+ * @pf: the i40e_pf created in command write
+ **/
+static void i40e_dbg_dump_service(struct i40e_pf *pf)
+{
+	int i;
+
+	dev_info(&pf->pdev->dev,
+		 "subtask       prio  interval_ms         runs    throttled   avg_us   max_us  last_ms_ago\n");
+	for (i = 0; i < I40E_SUBTASK_MAX; i++) {
+		struct i40e_subtask *st = &pf->subtask[i];
+
+		if (!st->fn)
+			continue;
+
+		dev_info(&pf->pdev->dev,
+			 "%-12s  %-4s  %11u %12llu %12llu %8llu %8llu %12u\n",
+			 st->name, st->high_prio ? "high" : "norm",
+			 jiffies_to_msecs(st->interval), st->runs,
+			 st->throttled,
+			 st->runs ? div64_u64(st->total_ns, st->runs * 1000) : 0,
+			 div_u64(st->max_ns, 1000),
+			 st->runs ? jiffies_to_msecs(jiffies - st->last_run) : 0);
+	}
+}
+
+/**
+ * i40e_dbg_dump_vfr_stats - print the phase times of one kind of VF reset
+ * @pf: the i40e_pf created in command write
+ * @name: which reset the statistics are for
+ * @stats: the statistics to print
+ **/
+static void i40e_dbg_dump_vfr_stats(struct i40e_pf *pf, const char *name,
+				    struct i40e_vfr_stats *stats)
+{
+	static const char * const phase[I40E_VFR_PHASE_MAX] = {
+		[I40E_VFR_PHASE_TRIGGER] = "trigger",
+		[I40E_VFR_PHASE_HW_WAIT] = "hw_wait",
+		[I40E_VFR_PHASE_SETTLE] = "settle",
+		[I40E_VFR_PHASE_RINGS] = "rings",
+		[I40E_VFR_PHASE_REBUILD] = "rebuild",
+	};
+	int i;
+
+	spin_lock(&stats->lock);
+	dev_info(&pf->pdev->dev, "%s: %llu resets, %llu VFs rebuilt\n",
+		 name, stats->count, stats->vfs);
+	dev_info(&pf->pdev->dev,
+		 "  phase       last_us    avg_us    max_us\n");
+	for (i = 0; i < I40E_VFR_PHASE_MAX; i++)
+		dev_info(&pf->pdev->dev, "  %-8s  %9llu %9llu %9llu\n",
+			 phase[i], div_u64(stats->last_ns[i], 1000),
+			 stats->count ?
+			 div64_u64(stats->total_ns[i], stats->count * 1000) : 0,
+			 div_u64(stats->max_ns[i], 1000));
+	spin_unlock(&stats->lock);
+}
+
 /* Helper macros for printing upper half of the 32byte descriptor. */
 #ifdef I40E_32BYTE_RX
 #define RXD_RSVD1(_rxd) ((_rxd)->read.rsvd1)
@@ -912,6 +1049,17 @@ static void i40e_dbg_dump_vf(struct i40e_pf *pf, int vf_id)
 			 vf_id, vf->lan_vsi_id, vsi->seid, vf->num_queue_pairs);
 		dev_info(&pf->pdev->dev, "       num MDD=%lld",
 			 vf->mdd_tx_events.count + vf->mdd_rx_events.count);
+		dev_info(&pf->pdev->dev, "       fdir rules=%u rss hash=%s\n",
+			 vf->num_fdir_filters,
+			 vf->rss_hfunc == VIRTCHNL_RSS_ALG_TOEPLITZ_SYMMETRIC ?
+			 "toeplitz symmetric" : "toeplitz");
+		dev_info(&pf->pdev->dev,
+			 "       virtchnl msgs=%llu depth=%u depth_max=%u dropped=%llu lat avg=%llu max=%llu ns\n",
+			 vf->vc_msg_count, vf->vc_msg_depth,
+			 vf->vc_msg_depth_max, vf->vc_msg_dropped,
+			 vf->vc_msg_count ?
+			 div64_u64(vf->vc_msg_lat_sum_ns, vf->vc_msg_count) : 0,
+			 vf->vc_msg_lat_max_ns);
 	} else {
 		dev_info(&pf->pdev->dev, "invalid VF id %d\n", vf_id);
 	}
@@ -989,6 +1137,8 @@ static void i40e_dbg_dump_dcb_cfg(struct i40e_pf *pf,
 static inline void i40e_dbg_dump_fdir_filter(struct i40e_pf *pf,
 					     struct i40e_fdir_filter *f)
 {
+	u64 hits;
+
 	dev_info(&pf->pdev->dev, "fdir filter %d:\n", f->fd_id);
 	dev_info(&pf->pdev->dev, "    flow_type=%d ipl4_proto=%d\n",
 		 f->flow_type, f->ipl4_proto);
@@ -1005,6 +1155,12 @@ static inline void i40e_dbg_dump_fdir_filter(struct i40e_pf *pf,
 		 f->pctype, f->dest_vsi, f->dest_ctl);
 	dev_info(&pf->pdev->dev, "    fd_status=%d cnt_index=%d\n",
 		 f->fd_status, f->cnt_index);
+	if (f->vf_owned)
+		dev_info(&pf->pdev->dev, "    owner=vf %d\n", f->vf_id);
+	if (i40e_fdir_rule_hits(pf, f, &hits))
+		dev_info(&pf->pdev->dev, "    hits=%llu\n", hits);
+	else
+		dev_info(&pf->pdev->dev, "    hits=shared (port.fdir_sb_match)\n");
 }
 
 /**
@@ -1297,6 +1453,11 @@ static ssize_t i40e_dbg_command_write(struct file *filp,
 				i40e_dbg_dump_veb_seid(pf, vsi_seid);
 			else
 				i40e_dbg_dump_veb_all(pf);
+		} else if (strncmp(&cmd_buf[5], "vf_reset", 8) == 0) {
+			i40e_dbg_dump_vfr_stats(pf, "all VFs reset",
+						&pf->vfr_all_stats);
+			i40e_dbg_dump_vfr_stats(pf, "single VF reset",
+						&pf->vfr_one_stats);
 		} else if (strncmp(&cmd_buf[5], "vf", 2) == 0) {
 			cnt = sscanf(&cmd_buf[7], "%i", &vf_id);
 			if (cnt > 0)
@@ -1326,6 +1487,10 @@ static ssize_t i40e_dbg_command_write(struct file *filp,
 					 "dump desc rx <vsi_seid> <ring_id> [<desc_n>]\n");
 				dev_info(&pf->pdev->dev, "dump desc aq\n");
 			}
+		} else if (strncmp(&cmd_buf[5], "service", 7) == 0) {
+			i40e_dbg_dump_service(pf);
+		} else if (strncmp(&cmd_buf[5], "aq stats", 8) == 0) {
+			i40e_dbg_dump_aq_stats(pf);
 		} else if (strncmp(&cmd_buf[5], "reset stats", 11) == 0) {
 			dev_info(&pf->pdev->dev,
 				 "core reset count: %d\n", pf->corer_count);
@@ -1447,13 +1612,25 @@ static ssize_t i40e_dbg_command_write(struct file *filp,
 		} else if (strncmp(&cmd_buf[5], "filters", 7) == 0) {
 			struct i40e_fdir_filter *f_rule;
 			struct i40e_cloud_filter *c_rule;
+			u32 counted = 0, unhit = 0;
 			struct hlist_node *node2;
+			u64 hits;
 
+			mutex_lock(&pf->fdir_mutex);
 			hlist_for_each_entry_safe(f_rule, node2,
 						  &pf->fdir_filter_list,
 						  fdir_node) {
 				i40e_dbg_dump_fdir_filter(pf, f_rule);
+				if (!i40e_fdir_rule_hits(pf, f_rule, &hits))
+					continue;
+				counted++;
+				if (!hits)
+					unhit++;
 			}
+			mutex_unlock(&pf->fdir_mutex);
+			dev_info(&pf->pdev->dev,
+				 "fdir: %u rules, %u with own counter, %u of those never hit\n",
+				 pf->fdir_pf_active_filters, counted, unhit);
 
 			/* find the cloud filter rule ids */
 			hlist_for_each_entry_safe(c_rule, node2,
@@ -1470,8 +1647,11 @@ static ssize_t i40e_dbg_command_write(struct file *filp,
 			dev_info(&pf->pdev->dev, "dump capabilities\n");
 			dev_info(&pf->pdev->dev, "dump resources\n");
 			dev_info(&pf->pdev->dev, "dump reset stats\n");
+			dev_info(&pf->pdev->dev, "dump aq stats\n");
+			dev_info(&pf->pdev->dev, "dump service\n");
 			dev_info(&pf->pdev->dev, "dump port\n");
 			dev_info(&pf->pdev->dev, "dump VF [vf_id]\n");
+			dev_info(&pf->pdev->dev, "dump vf_reset\n");
 			dev_info(&pf->pdev->dev,
 				 "dump debug fwdata <cluster_id> <table_id> <index>\n");
 			dev_info(&pf->pdev->dev, "dump filters\n");
@@ -1495,6 +1675,25 @@ static ssize_t i40e_dbg_command_write(struct file *filp,
 			dev_info(&pf->pdev->dev, "msg_enable = 0x%08x\n",
 				 pf->msg_enable);
 		}
+	} else if (strncmp(cmd_buf, "arq_budget", 10) == 0) {
+		u32 budget;
+
+		cnt = sscanf(&cmd_buf[10], "%i", &budget);
+		if (cnt == 1 && budget >= 1 &&
+		    budget <= pf->hw.aq.num_arq_entries) {
+			pf->adminq_work_limit = budget;
+			dev_info(&pf->pdev->dev, "set arq_budget = %u\n",
+				 pf->adminq_work_limit);
+		} else if (cnt == 1) {
+			dev_info(&pf->pdev->dev,
+				 "arq_budget must be between 1 and %u\n",
+				 pf->hw.aq.num_arq_entries);
+		} else {
+			dev_info(&pf->pdev->dev,
+				 "arq_budget = %u, events %u, budget exhausted %u, max pending %u\n",
+				 pf->adminq_work_limit, pf->arq_events,
+				 pf->arq_budget_exhausted, pf->arq_pending_max);
+		}
 	} else if (strncmp(cmd_buf, "defport on", 10) == 0) {
 		dev_info(&pf->pdev->dev, "debugfs: forcing PFR with defport enabled\n");
 		pf->cur_promisc = true;
@@ -1534,8 +1733,17 @@ static ssize_t i40e_dbg_command_write(struct file *filp,
 			} else {
 				dev_info(&pf->pdev->dev, "clear port stats not allowed on this port partition\n");
 			}
+		} else if (strncmp(&cmd_buf[12], "service", 7) == 0) {
+			i40e_subtask_stats_clear(pf);
+			dev_info(&pf->pdev->dev, "service subtask stats cleared\n");
+		} else if (strncmp(&cmd_buf[12], "vf_reset", 8) == 0) {
+			i40e_vfr_stats_clear(pf);
+			dev_info(&pf->pdev->dev, "VF reset stats cleared\n");
+		} else if (strncmp(&cmd_buf[12], "aq", 2) == 0) {
+			i40e_aq_stats_snapshot(&pf->hw, NULL, true);
+			dev_info(&pf->pdev->dev, "AdminQ stats cleared\n");
 		} else {
-			dev_info(&pf->pdev->dev, "clear_stats vsi [seid] or clear_stats port\n");
+			dev_info(&pf->pdev->dev, "clear_stats vsi [seid], port, aq, service or vf_reset\n");
 		}
 	} else if (strncmp(cmd_buf, "send aq_cmd", 11) == 0) {
 		struct i40e_aq_desc *desc;
@@ -2189,12 +2397,19 @@ static ssize_t i40e_dbg_command_write(struct file *filp,
 		dev_info(&pf->pdev->dev, "  dump desc rx <vsi_seid> <ring_id> [<desc_n>]\n");
 		dev_info(&pf->pdev->dev, "  dump desc aq\n");
 		dev_info(&pf->pdev->dev, "  dump reset stats\n");
+		dev_info(&pf->pdev->dev, "  dump aq stats\n");
+		dev_info(&pf->pdev->dev, "  dump service\n");
+		dev_info(&pf->pdev->dev, "  dump vf_reset\n");
 		dev_info(&pf->pdev->dev, "  dump debug fwdata <cluster_id> <table_id> <index>\n");
 		dev_info(&pf->pdev->dev, "  msg_enable [level]\n");
+		dev_info(&pf->pdev->dev, "  arq_budget [events]\n");
 		dev_info(&pf->pdev->dev, "  read <reg>\n");
 		dev_info(&pf->pdev->dev, "  write <reg> <value>\n");
 		dev_info(&pf->pdev->dev, "  clear_stats vsi [seid]\n");
 		dev_info(&pf->pdev->dev, "  clear_stats port\n");
+		dev_info(&pf->pdev->dev, "  clear_stats aq\n");
+		dev_info(&pf->pdev->dev, "  clear_stats service\n");
+		dev_info(&pf->pdev->dev, "  clear_stats vf_reset\n");
 		dev_info(&pf->pdev->dev, "  defport on\n");
 		dev_info(&pf->pdev->dev, "  defport off\n");
 		dev_info(&pf->pdev->dev, "  send aq_cmd <flags> <opcode> <datalen> <retval> <cookie_h> <cookie_l> <param0> <param1> <param2> <param3>\n");
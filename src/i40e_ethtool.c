@@ -143,12 +143,21 @@ static const struct i40e_stats i40e_gstrings_stats[] = {
 	I40E_PF_STAT("port.rx_jabber", stats.rx_jabber),
 	I40E_PF_STAT("port.VF_admin_queue_requests", vf_aq_requests),
 	I40E_PF_STAT("port.arq_overflows", arq_overflows),
+	I40E_PF_STAT("port.arq_events", arq_events),
+	I40E_PF_STAT("port.arq_budget_exhausted", arq_budget_exhausted),
+	I40E_PF_STAT("port.arq_pending_max", arq_pending_max),
+	I40E_PF_STAT("port.hw_stats_reads", stats_hw_reads),
+	I40E_PF_STAT("port.hw_stats_cached", stats_cached),
 #ifdef HAVE_PTP_1588_CLOCK
 	I40E_PF_STAT("port.tx_hwtstamp_timeouts", tx_hwtstamp_timeouts),
 	I40E_PF_STAT("port.rx_hwtstamp_cleared", rx_hwtstamp_cleared),
 	I40E_PF_STAT("port.tx_hwtstamp_skipped", tx_hwtstamp_skipped),
 #endif /* HAVE_PTP_1588_CLOCK */
 	I40E_PF_STAT("port.fdir_flush_cnt", fd_flush_cnt),
+	I40E_PF_STAT("port.fdir_flush_timeout_cnt", fd_flush_timeout_cnt),
+	I40E_PF_STAT("port.fdir_flush_blackout_us", fd_flush_blackout_us),
+	I40E_PF_STAT("port.fdir_flush_blackout_max_us",
+		     fd_flush_blackout_max_us),
 	I40E_PF_STAT("port.fdir_atr_match", stats.fd_atr_match),
 	I40E_PF_STAT("port.fdir_atr_tunnel_match", stats.fd_atr_tunnel_match),
 	I40E_PF_STAT("port.fdir_atr_status", stats.fd_atr_status),
@@ -338,6 +347,10 @@ static const struct i40e_priv_flags i40e_gstrings_priv_flags[] = {
 		       I40E_FLAG_VF_SOURCE_PRUNING, 0),
 	I40E_PRIV_FLAG("mdd-auto-reset-vf",
 		       I40E_FLAG_MDD_AUTO_RESET_VF, 0),
+	I40E_PRIV_FLAG("adaptive-intrl",
+		       I40E_FLAG_ADAPTIVE_INTRL, 0),
+	I40E_PRIV_FLAG("napi-thread-affinity",
+		       I40E_FLAG_NAPI_THREAD_AFFINITY, 0),
 };
 
 #define I40E_PRIV_FLAGS_STR_LEN ARRAY_SIZE(i40e_gstrings_priv_flags)
@@ -2133,8 +2146,11 @@ static int i40e_set_flags(struct net_device *netdev, u32 data)
 #ifdef ETHTOOL_GRXRINGS
 	need_reset = i40e_set_ntuple(pf, netdev->features);
 #endif /* ETHTOOL_GRXRINGS */
-	if (need_reset)
+	if (need_reset) {
+		down_write(&pf->service_rwsem);
 		i40e_do_reset(pf, BIT(__I40E_PF_RESET_REQUESTED), true);
+		up_write(&pf->service_rwsem);
+	}
 
 	return 0;
 }
@@ -3247,16 +3263,19 @@ static void i40e_diag_test(struct net_device *netdev,
 		}
 
 		/* If the device is online then take it offline */
-		if (if_running)
+		if (if_running) {
 			/* indicate we're in test mode */
 			i40e_close(netdev);
-		else
+		} else {
 			/* This reset does not affect link - if it is
 			 * changed to a type of reset that does affect
 			 * link then the following link test would have
 			 * to be moved to before the reset
 			 */
+			down_write(&pf->service_rwsem);
 			i40e_do_reset(pf, BIT(__I40E_PF_RESET_REQUESTED), true);
+			up_write(&pf->service_rwsem);
+		}
 
 		if (i40e_link_test(netdev, &data[I40E_ETH_TEST_LINK]))
 			eth_test->flags |= ETH_TEST_FL_FAILED;
@@ -3272,7 +3291,9 @@ static void i40e_diag_test(struct net_device *netdev,
 			eth_test->flags |= ETH_TEST_FL_FAILED;
 
 		clear_bit(__I40E_TESTING, pf->state);
+		down_write(&pf->service_rwsem);
 		i40e_do_reset(pf, BIT(__I40E_PF_RESET_REQUESTED), true);
+		up_write(&pf->service_rwsem);
 
 		if (if_running)
 			i40e_open(netdev);
@@ -3521,6 +3542,9 @@ static int __i40e_get_coalesce(struct net_device *netdev,
 	ec->rx_coalesce_usecs_high = vsi->int_rate_limit;
 	ec->tx_coalesce_usecs_high = vsi->int_rate_limit;
 
+	/* how long HW stats read from the registers are served from cache */
+	ec->stats_block_coalesce_usecs = vsi->back->stats_fresh_usecs;
+
 	return 0;
 }
 
@@ -3608,6 +3632,7 @@ static void i40e_set_itr_per_queue(struct i40e_vsi *vsi,
 	 * into the q_vector, no need to write the values now.
 	 */
 
+	q_vector->intrl = vsi->int_rate_limit;
 	wr32(hw, I40E_PFINT_RATEN(q_vector->reg_idx), intrl);
 	i40e_flush(hw);
 }
@@ -3629,7 +3654,6 @@ int i40e_is_coalesce_param_invalid(struct net_device *netdev,
 		u32 value;
 		const char *name;
 	} param[] = {
-		{ec->stats_block_coalesce_usecs, "stats-block-usecs"},
 		{ec->rate_sample_interval, "sample-interval"},
 		{ec->pkt_rate_low, "pkt-rate-low"},
 		{ec->pkt_rate_high, "pkt-rate-high"},
@@ -3679,6 +3703,14 @@ static int __i40e_set_coalesce(struct net_device *netdev,
 	if (i40e_is_coalesce_param_invalid(netdev, ec))
 		return -EOPNOTSUPP;
 
+	if (ec->stats_block_coalesce_usecs > I40E_STATS_FRESH_USECS_MAX) {
+		netif_info(pf, drv, netdev,
+			   "Invalid value, stats-block-usecs range is 0-%d\n",
+			   I40E_STATS_FRESH_USECS_MAX);
+		return -EINVAL;
+	}
+	pf->stats_fresh_usecs = ec->stats_block_coalesce_usecs;
+
 	if (ec->tx_max_coalesced_frames_irq || ec->rx_max_coalesced_frames_irq)
 		vsi->work_limit = ec->tx_max_coalesced_frames_irq;
 
@@ -4133,12 +4165,20 @@ static int i40e_get_rx_filter_ids(struct i40e_pf *pf,
 	struct i40e_cloud_filter *c_rule;
 	struct hlist_node *node2;
 	unsigned int cnt = 0;
+#ifdef HAVE_XARRAY_API
+	unsigned long fd_id;
+#endif
 
 	/* report total rule count */
 	cmd->data = i40e_get_fd_cnt_all(pf);
 
+#ifdef HAVE_XARRAY_API
+	/* the fdir list is unordered, report locations in ascending order */
+	xa_for_each(&pf->fdir_filter_xa, fd_id, f_rule) {
+#else
 	hlist_for_each_entry_safe(f_rule, node2,
 				  &pf->fdir_filter_list, fdir_node) {
+#endif /* HAVE_XARRAY_API */
 		if (cnt == cmd->rule_cnt)
 			return -EMSGSIZE;
 
@@ -4177,19 +4217,13 @@ static int i40e_get_ethtool_fdir_entry(struct i40e_pf *pf,
 	struct ethtool_rx_flow_spec *fsp =
 			(struct ethtool_rx_flow_spec *)&cmd->fs;
 	struct i40e_rx_flow_userdef userdef = {0};
-	struct i40e_fdir_filter *rule = NULL;
-	struct hlist_node *node2;
+	struct i40e_fdir_filter *rule;
 	struct i40e_vsi *vsi;
 	u64 input_set;
 	u16 index;
 
-	hlist_for_each_entry_safe(rule, node2,
-				  &pf->fdir_filter_list, fdir_node) {
-		if (fsp->location <= rule->fd_id)
-			break;
-	}
-
-	if (!rule || fsp->location != rule->fd_id)
+	rule = i40e_fdir_index_find(pf, fsp->location);
+	if (!rule)
 		return -EINVAL;
 
 	fsp->flow_type = rule->flow_type;
@@ -4358,21 +4392,10 @@ static int i40e_get_cloud_filter_entry(struct i40e_pf *pf,
 	struct ethtool_rx_flow_spec *fsp =
 			(struct ethtool_rx_flow_spec *)&cmd->fs;
 	static const u8 mac_broadcast[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-	struct i40e_cloud_filter *rule, *filter = NULL;
 	struct i40e_rx_flow_userdef userdef = {0};
-	struct hlist_node *node2;
+	struct i40e_cloud_filter *filter;
 
-	hlist_for_each_entry_safe(rule, node2,
-				  &pf->cloud_filter_list, cloud_node) {
-		/* filter found */
-		if (rule->id == fsp->location)
-			filter = rule;
-
-		/* bail out if we've passed the likely location in the list */
-		if (rule->id >= fsp->location)
-			break;
-
-	}
+	filter = i40e_cloud_index_find(pf, fsp->location);
 	if (!filter) {
 		dev_info(&pf->pdev->dev, "No cloud filter with loc %d\n",
 			fsp->location);
@@ -4480,17 +4503,21 @@ static int i40e_get_rxnfc(struct net_device *netdev, struct ethtool_rxnfc *cmd,
 		ret = 0;
 		break;
 	case ETHTOOL_GRXCLSRULE:
+		mutex_lock(&pf->fdir_mutex);
 		ret = i40e_get_ethtool_fdir_entry(pf, cmd);
+		mutex_unlock(&pf->fdir_mutex);
 		/* if no such fdir filter then try the cloud list */
 		if (ret)
 			ret = i40e_get_cloud_filter_entry(pf, cmd);
 		break;
 	case ETHTOOL_GRXCLSRLALL:
+		mutex_lock(&pf->fdir_mutex);
 #ifdef HAVE_ETHTOOL_GET_RXNFC_VOID_RULE_LOCS
 		ret = i40e_get_rx_filter_ids(pf, cmd, (u32 *)rule_locs);
 #else
 		ret = i40e_get_rx_filter_ids(pf, cmd, rule_locs);
 #endif
+		mutex_unlock(&pf->fdir_mutex);
 		break;
 	default:
 		break;
@@ -4917,11 +4944,10 @@ static int i40e_add_cloud_filter_ethtool(struct i40e_vsi *vsi,
 					 struct ethtool_rxnfc *cmd,
 					 struct i40e_rx_flow_userdef *userdef)
 {
-	struct i40e_cloud_filter *rule, *parent, *filter = NULL;
+	struct i40e_cloud_filter *rule, *filter;
 	struct ethtool_rx_flow_spec *fsp;
 	u16 dest_seid = 0, q_index = 0;
 	struct i40e_pf *pf = vsi->back;
-	struct hlist_node *node2;
 	u32 ring, vf;
 	u8 flags = 0;
 	int ret;
@@ -4980,40 +5006,20 @@ static int i40e_add_cloud_filter_ethtool(struct i40e_vsi *vsi,
 	if (ret)
 		return -EINVAL;
 
-	/* if filter exists with same id, delete the old one */
-	parent = NULL;
-	hlist_for_each_entry_safe(rule, node2,
-				  &pf->cloud_filter_list, cloud_node) {
-		/* filter exists with the id */
-		if (rule->id == fsp->location)
-			filter = rule;
-
-		/* Abort now if we're trying to add an outer IP filter and it
-		 * already exists in the device. We must detect this condition
-		 * here since we can't rely on the firmware return code to tell
-		 * us this later.
-		 */
-		if (userdef->outer_ip && fsp->h_u.usr_ip4_spec.ip4dst ==
-		    rule->dst_ipv4)
-			return -EEXIST;
-
-		/* bail out if we've passed the likely location in the list */
-		if (rule->id >= fsp->location)
-			break;
-
-		/* track where we left off */
-		parent = rule;
-	}
-
-	/* Continue searching for duplicates if we're dealing with outer IP
-	 * filters and haven't reached the end of the list yet.
+	/* Abort now if we're trying to add an outer IP filter and it
+	 * already exists in the device. We must detect this condition
+	 * here since we can't rely on the firmware return code to tell
+	 * us this later.
 	 */
-	if (rule && userdef->outer_ip)
-		hlist_for_each_entry_continue(rule, cloud_node)
+	if (userdef->outer_ip)
+		hash_for_each_possible(pf->cloud_ip_hash, rule, ip_hlist,
+				       (__force u32)fsp->h_u.usr_ip4_spec.ip4dst)
 			if (fsp->h_u.usr_ip4_spec.ip4dst == rule->dst_ipv4)
 				return -EEXIST;
 
-	if (filter && (filter->id == fsp->location)) {
+	/* if filter exists with same id, delete the old one */
+	filter = i40e_cloud_index_find(pf, fsp->location);
+	if (filter) {
 		/* found it in the cloud list, so remove it */
 		if (filter->flags & I40E_CLOUD_FIELD_OIP1 ||
 		    filter->flags & I40E_CLOUD_FIELD_OIP2)
@@ -5023,9 +5029,8 @@ static int i40e_add_cloud_filter_ethtool(struct i40e_vsi *vsi,
 			ret = i40e_add_del_cloud_filter_ex(pf, filter, false);
 		if (ret && pf->hw.aq.asq_last_status != I40E_AQ_RC_ENOENT)
 			return ret;
-		hlist_del(&filter->cloud_node);
+		i40e_cloud_index_del(pf, filter);
 		kfree(filter);
-		pf->num_cloud_filters--;
 	} else {
 		/* not in the cloud list, so check the PF's fdir list */
 		(void)i40e_del_fdir_entry(pf->vsi[pf->lan_vsi], cmd);
@@ -5101,13 +5106,16 @@ static int i40e_add_cloud_filter_ethtool(struct i40e_vsi *vsi,
 		return ret;
 	}
 
-	/* add filter to the ordered list */
-	INIT_HLIST_NODE(&filter->cloud_node);
-	if (parent)
-		hlist_add_behind(&filter->cloud_node, &parent->cloud_node);
-	else
-		hlist_add_head(&filter->cloud_node, &pf->cloud_filter_list);
-	pf->num_cloud_filters++;
+	ret = i40e_cloud_index_add(pf, filter, true);
+	if (ret) {
+		if (userdef->outer_ip)
+			(void)i40e_add_del_custom_cloud_filter(vsi, filter,
+							       false);
+		else
+			(void)i40e_add_del_cloud_filter_ex(pf, filter, false);
+		kfree(filter);
+		return ret;
+	}
 
 	return 0;
 }
@@ -5123,22 +5131,12 @@ static int i40e_add_cloud_filter_ethtool(struct i40e_vsi *vsi,
 static int i40e_del_cloud_filter_ethtool(struct i40e_pf *pf,
 					 struct ethtool_rxnfc *cmd)
 {
-	struct i40e_cloud_filter *rule, *filter = NULL;
-	struct ethtool_rx_flow_spec *fsp;
-	struct hlist_node *node2;
 	struct i40e_vsi *vsi = pf->vsi[pf->lan_vsi];
+	struct ethtool_rx_flow_spec *fsp;
+	struct i40e_cloud_filter *filter;
 
 	fsp = (struct ethtool_rx_flow_spec *)&cmd->fs;
-	hlist_for_each_entry_safe(rule, node2,
-				  &pf->cloud_filter_list, cloud_node) {
-		/* filter found */
-		if (rule->id == fsp->location)
-			filter = rule;
-
-		/* bail out if we've passed the likely location in the list */
-		if (rule->id >= fsp->location)
-			break;
-	}
+	filter = i40e_cloud_index_find(pf, fsp->location);
 	if (!filter)
 		return -ENOENT;
 
@@ -5148,9 +5146,8 @@ static int i40e_del_cloud_filter_ethtool(struct i40e_pf *pf,
 		(void)i40e_add_del_custom_cloud_filter(vsi, filter, false);
 	else
 		(void)i40e_add_del_cloud_filter_ex(pf, filter, false);
-	hlist_del(&filter->cloud_node);
+	i40e_cloud_index_del(pf, filter);
 	kfree(filter);
-	pf->num_cloud_filters--;
 
 	return 0;
 }
@@ -5160,8 +5157,8 @@ static int i40e_del_cloud_filter_ethtool(struct i40e_pf *pf,
  * @input: The filter to update or NULL to indicate deletion
  * @sw_idx: Software index to the filter
  *
- * This function updates (or deletes) a Flow Director entry from
- * the hlist of the corresponding PF
+ * This function updates (or deletes) a Flow Director entry in
+ * the filter indexes of the corresponding PF
  *
  * Returns 0 on success
  **/
@@ -5169,30 +5166,18 @@ static int i40e_update_ethtool_fdir_entry(struct i40e_vsi *vsi,
 					  struct i40e_fdir_filter *input,
 					  u16 sw_idx)
 {
-	struct i40e_fdir_filter *rule, *parent;
 	struct i40e_pf *pf = vsi->back;
-	struct hlist_node *node2;
+	struct i40e_fdir_filter *rule;
 	int err = -ENOENT;
 
-	parent = NULL;
-	rule = NULL;
-
-	hlist_for_each_entry_safe(rule, node2,
-				  &pf->fdir_filter_list, fdir_node) {
-		/* rule id found, or passed its spot in the list */
-		if (rule->fd_id >= sw_idx)
-			break;
-		parent = rule;
-	}
-
 	/* is there is an old rule occupying our target filter slot? */
-	if (rule && (rule->fd_id == sw_idx)) {
+	rule = i40e_fdir_index_find(pf, sw_idx);
+	if (rule) {
 		/* Remove this rule, since we're either deleting it, or
 		 * replacing it.
 		 */
 		err = i40e_add_del_fdir(vsi, rule, false);
-		hlist_del(&rule->fdir_node);
-		pf->fdir_pf_active_filters--;
+		i40e_fdir_index_del(pf, rule);
 
 		kfree(rule);
 	}
@@ -5204,18 +5189,7 @@ static int i40e_update_ethtool_fdir_entry(struct i40e_vsi *vsi,
 		return err;
 
 	/* Otherwise, install the new rule as requested */
-	INIT_HLIST_NODE(&input->fdir_node);
-
-	/* add filter to the ordered list */
-	if (parent)
-		hlist_add_behind(&input->fdir_node, &parent->fdir_node);
-	else
-		hlist_add_head(&input->fdir_node, &pf->fdir_filter_list);
-
-	/* update counts */
-	pf->fdir_pf_active_filters++;
-
-	return 0;
+	return i40e_fdir_index_add(pf, input);
 }
 
 /**
@@ -6187,17 +6161,18 @@ static bool i40e_match_fdir_filter(struct i40e_fdir_filter *a,
  * This avoids needing to track location for programming the filter to
  * hardware, and ensures that we avoid some strange scenarios involving
  * deleting filters which match the same criteria.
+ *
+ * Returns -EEXIST if another filter already matches the same flow.
  **/
 static int i40e_disallow_matching_filters(struct i40e_vsi *vsi,
 					  struct i40e_fdir_filter *input)
 {
 	struct i40e_pf *pf = vsi->back;
 	struct i40e_fdir_filter *rule;
-	struct hlist_node *node2;
 
-	/* Loop through every filter, and check that it doesn't match */
-	hlist_for_each_entry_safe(rule, node2,
-				  &pf->fdir_filter_list, fdir_node) {
+	/* Only filters hashing to the same tuple bucket can match */
+	hash_for_each_possible(pf->fdir_tuple_hash, rule, tuple_hlist,
+			       i40e_fdir_tuple_to_hkey(input)) {
 		/* Don't check the filters match if they share the same fd_id,
 		 * since the new filter is actually just updating the target
 		 * of the old filter.
@@ -6212,7 +6187,7 @@ static int i40e_disallow_matching_filters(struct i40e_vsi *vsi,
 			dev_warn(&pf->pdev->dev,
 				 "Existing user defined filter %d already matches this flow.\n",
 				 rule->fd_id);
-			return -EINVAL;
+			return -EEXIST;
 		}
 	}
 
@@ -6371,7 +6346,9 @@ static int i40e_add_fdir_ethtool(struct i40e_vsi *vsi,
 	 * a previous filter. Do not free the input structure after adding it
 	 * to the list as this would cause a use after free bug.
 	 */
-	i40e_update_ethtool_fdir_entry(vsi, input, fsp->location);
+	ret = i40e_update_ethtool_fdir_entry(vsi, input, fsp->location);
+	if (ret)
+		goto free_filter_memory;
 
 	(void)i40e_del_cloud_filter_ethtool(pf, cmd);
 	ret = i40e_add_del_fdir(vsi, input, true);
@@ -6382,13 +6359,143 @@ static int i40e_add_fdir_ethtool(struct i40e_vsi *vsi,
 	return 0;
 
 remove_sw_rule:
-	hlist_del(&input->fdir_node);
-	pf->fdir_pf_active_filters--;
+	i40e_fdir_index_del(pf, input);
 free_filter_memory:
 	kfree(input);
 	return ret;
 }
 
+/**
+ * i40e_add_fdir_tc - Add a Flow Director filter on behalf of tc flower
+ * @vsi: pointer to the targeted VSI
+ * @fsp: flow spec translated from the flower match and action
+ * @cookie: tc flower cookie of the rule
+ *
+ * Programs the rule exactly like ETHTOOL_SRXCLSRLINS would, then marks it as
+ * owned by tc so that it is looked up by cookie from now on.
+ **/
+int i40e_add_fdir_tc(struct i40e_vsi *vsi, struct ethtool_rx_flow_spec *fsp,
+		     unsigned long cookie)
+{
+	struct ethtool_rxnfc cmd = {};
+	struct i40e_pf *pf = vsi->back;
+	struct i40e_fdir_filter *rule;
+	int ret;
+
+	cmd.cmd = ETHTOOL_SRXCLSRLINS;
+	cmd.fs = *fsp;
+
+	ret = i40e_add_fdir_ethtool(vsi, &cmd);
+	if (ret)
+		return ret;
+
+	rule = i40e_fdir_index_find(pf, fsp->location);
+	if (!rule)
+		return -ENOENT;
+
+	i40e_fdir_index_set_tc_cookie(pf, rule, cookie);
+	if (!i40e_fdir_rule_has_cnt(pf, rule))
+		dev_warn_once(&pf->pdev->dev,
+			      "All %u Flow Director rule counters are in use, tc flower drop rules added from now on report no statistics\n",
+			      pf->fd_rule_cnt_num);
+	return 0;
+}
+
+/**
+ * i40e_add_fdir_vf - Add a Flow Director filter on behalf of a VF
+ * @vsi: pointer to the PF's main VSI
+ * @fsp: flow spec translated from the virtchnl rule, its ring_cookie
+ *	 selects the VF and one of its queues, or drop
+ * @vf_id: the VF asking for the rule
+ *
+ * Programs the rule exactly like ETHTOOL_SRXCLSRLINS would, then marks it as
+ * owned by the VF so that only the VF can remove it.
+ **/
+int i40e_add_fdir_vf(struct i40e_vsi *vsi, struct ethtool_rx_flow_spec *fsp,
+		     u16 vf_id)
+{
+	struct ethtool_rxnfc cmd = {};
+	struct i40e_pf *pf = vsi->back;
+	struct i40e_fdir_filter *rule;
+	int ret;
+
+	cmd.cmd = ETHTOOL_SRXCLSRLINS;
+	cmd.fs = *fsp;
+
+	ret = i40e_add_fdir_ethtool(vsi, &cmd);
+	if (ret)
+		return ret;
+
+	rule = i40e_fdir_index_find(pf, fsp->location);
+	if (!rule)
+		return -ENOENT;
+
+	i40e_fdir_index_set_vf(pf, rule, vf_id);
+	return 0;
+}
+
+/**
+ * i40e_del_fdir_owned - Remove a Flow Director filter owned by tc or a VF
+ * @vsi: pointer to the targeted VSI
+ * @filter: the filter, as found by its owner
+ **/
+int i40e_del_fdir_owned(struct i40e_vsi *vsi, struct i40e_fdir_filter *filter)
+{
+	struct i40e_pf *pf = vsi->back;
+	int ret;
+
+	if (test_bit(__I40E_RESET_RECOVERY_PENDING, pf->state) ||
+	    test_bit(__I40E_RESET_INTR_RECEIVED, pf->state))
+		return -EBUSY;
+
+	if (test_bit(__I40E_FD_FLUSH_REQUESTED, pf->state))
+		return -EBUSY;
+
+	ret = i40e_update_ethtool_fdir_entry(vsi, NULL, filter->fd_id);
+
+	i40e_prune_flex_pit_list(pf);
+
+	i40e_fdir_check_and_reenable(pf);
+	return ret;
+}
+
+/**
+ * i40e_del_fdir_vf_all - Remove all Flow Director filters owned by a VF
+ * @vsi: pointer to the PF's main VSI
+ * @vf_id: the VF being reset or removed
+ *
+ * Unlike a delete requested by the VF this does not wait for a pending
+ * reset or table flush, the rules must be gone before the VF's VSI is.
+ **/
+void i40e_del_fdir_vf_all(struct i40e_vsi *vsi, u16 vf_id)
+{
+	struct i40e_pf *pf = vsi->back;
+	struct i40e_fdir_filter *rule;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_safe(rule, node, &pf->fdir_filter_list,
+				  fdir_node) {
+		if (rule->vf_owned && rule->vf_id == vf_id)
+			i40e_update_ethtool_fdir_entry(vsi, NULL, rule->fd_id);
+	}
+
+	i40e_prune_flex_pit_list(pf);
+}
+
+/**
+ * i40e_fdir_loc_owned - Check if an ethtool location belongs to tc or a VF
+ * @pf: the PF data structure
+ * @cmd: ethtool rxnfc command
+ **/
+static bool i40e_fdir_loc_owned(struct i40e_pf *pf, struct ethtool_rxnfc *cmd)
+{
+	struct i40e_fdir_filter *rule;
+
+	rule = i40e_fdir_index_find(pf, cmd->fs.location);
+
+	return rule && (rule->tc_owned || rule->vf_owned);
+}
+
 /**
  * i40e_set_rxnfc - command to set RX flow classification rules
  * @netdev: network interface device structure
@@ -6409,11 +6516,24 @@ static int i40e_set_rxnfc(struct net_device *netdev, struct ethtool_rxnfc *cmd)
 		break;
 
 	case ETHTOOL_SRXCLSRLINS:
-		ret = i40e_add_fdir_ethtool(vsi, cmd);
+		mutex_lock(&pf->fdir_mutex);
+		if (i40e_fdir_loc_owned(pf, cmd))
+			ret = -EBUSY;
+		else
+			ret = i40e_add_fdir_ethtool(vsi, cmd);
+		mutex_unlock(&pf->fdir_mutex);
+		/* ethtool has always reported a duplicate flow as invalid */
+		if (ret == -EEXIST)
+			ret = -EINVAL;
 		break;
 
 	case ETHTOOL_SRXCLSRLDEL:
-		ret = i40e_del_fdir_entry(vsi, cmd);
+		mutex_lock(&pf->fdir_mutex);
+		if (i40e_fdir_loc_owned(pf, cmd))
+			ret = -EBUSY;
+		else
+			ret = i40e_del_fdir_entry(vsi, cmd);
+		mutex_unlock(&pf->fdir_mutex);
 		if (ret == -ENOENT)
 			ret = i40e_del_cloud_filter_ethtool(pf, cmd);
 		break;
@@ -6511,8 +6631,12 @@ static int i40e_set_channels(struct net_device *dev,
 	/* verify that the number of channels does not invalidate any current
 	 * flow director rules
 	 */
+	mutex_lock(&pf->fdir_mutex);
 	hlist_for_each_entry_safe(rule, node2,
 				  &pf->fdir_filter_list, fdir_node) {
+		/* VF rules steer to queues of the VF's own VSI */
+		if (rule->vf_owned)
+			continue;
 		if (rule->dest_ctl != drop && count <= rule->q_index) {
 			dev_warn(&pf->pdev->dev,
 				 "Existing user defined filter %d assigns flow to queue %d\n",
@@ -6520,6 +6644,7 @@ static int i40e_set_channels(struct net_device *dev,
 			err = -EINVAL;
 		}
 	}
+	mutex_unlock(&pf->fdir_mutex);
 
 	if (err) {
 		dev_err(&pf->pdev->dev,
@@ -7036,11 +7161,36 @@ flags_complete:
 	 */
 	pf->flags = new_flags;
 
+	/* Drop any rate limit picked by adaptive INTRL back to the value
+	 * configured through rx-usecs-high.
+	 */
+	if ((changed_flags & I40E_FLAG_ADAPTIVE_INTRL) &&
+	    !(new_flags & I40E_FLAG_ADAPTIVE_INTRL) &&
+	    (new_flags & I40E_FLAG_MSIX_ENABLED)) {
+		u16 intrl = i40e_intrl_usec_to_reg(vsi->int_rate_limit);
+		int v;
+
+		for (v = 0; v < vsi->num_q_vectors; v++) {
+			struct i40e_q_vector *q_vector = vsi->q_vectors[v];
+
+			q_vector->intrl = vsi->int_rate_limit;
+			wr32(&pf->hw, I40E_PFINT_RATEN(q_vector->reg_idx),
+			     intrl);
+		}
+		i40e_flush(&pf->hw);
+	}
+
+	if (changed_flags & I40E_FLAG_NAPI_THREAD_AFFINITY)
+		i40e_vsi_napi_thread_affinity(vsi);
+
 	/* Issue reset to cause things to take effect, as additional bits
 	 * are added we will need to create a mask of bits requiring reset
 	 */
-	if (reset_needed)
+	if (reset_needed) {
+		down_write(&pf->service_rwsem);
 		i40e_do_reset(pf, reset_needed, true);
+		up_write(&pf->service_rwsem);
+	}
 
 	return 0;
 }
@@ -7254,6 +7404,8 @@ static int i40e_get_keee(struct net_device *netdev, struct ethtool_keee *kedata)
 	if (phy_cfg.eee_capability)
 		linkmode_copy(kedata->advertised, kedata->supported);
 	kedata->eee_enabled = !!phy_cfg.eee_capability;
+	/* LPI status is collected with the PF stats */
+	i40e_update_stats(i40e_pf_get_main_vsi(pf));
 	kedata->tx_lpi_enabled = pf->stats.tx_lpi_status;
 
 	kedata->eee_active = pf->stats.tx_lpi_status && pf->stats.rx_lpi_status;
@@ -7503,7 +7655,8 @@ static const struct ethtool_ops i40e_ethtool_ops = {
 				     ETHTOOL_COALESCE_MAX_FRAMES_IRQ |
 				     ETHTOOL_COALESCE_USE_ADAPTIVE |
 				     ETHTOOL_COALESCE_RX_USECS_HIGH |
-				     ETHTOOL_COALESCE_TX_USECS_HIGH,
+				     ETHTOOL_COALESCE_TX_USECS_HIGH |
+				     ETHTOOL_COALESCE_STATS_BLOCK_USECS,
 #endif
 	.get_coalesce		= i40e_get_coalesce,
 	.set_coalesce		= i40e_set_coalesce,
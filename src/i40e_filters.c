@@ -2,6 +2,227 @@
 /* Copyright (C) 2013-2025 Intel Corporation */
 
 #include "i40e_filters.h"
+#ifdef HAVE_RHASHTABLE_TYPES
+#include <linux/rhashtable.h>
+
+static const struct rhashtable_params i40e_mac_filter_ht_params = {
+	.key_len = sizeof(struct i40e_mac_filter_key),
+	.key_offset = offsetof(struct i40e_mac_filter, macaddr),
+	.head_offset = offsetof(struct i40e_mac_filter, ht_node),
+	.automatic_shrinking = true,
+};
+#endif /* HAVE_RHASHTABLE_TYPES */
+
+/**
+ * i40e_filter_hash_init - Initialize the MAC filter indexes of a VSI
+ * @vsi: the VSI being set up
+ *
+ * Returns 0 on success, negative on failure
+ **/
+int i40e_filter_hash_init(struct i40e_vsi *vsi)
+{
+	hash_init(vsi->mac_filter_hash);
+	hash_init(vsi->vlan_filter_hash);
+	INIT_LIST_HEAD(&vsi->filter_dirty_list);
+	vsi->vlan_filter_count = 0;
+#ifdef HAVE_RHASHTABLE_TYPES
+	BUILD_BUG_ON(offsetof(struct i40e_mac_filter, vlan) !=
+		     offsetof(struct i40e_mac_filter, macaddr) + ETH_ALEN);
+	BUILD_BUG_ON(sizeof(struct i40e_mac_filter_key) != ETH_ALEN + 2);
+
+	vsi->mac_filter_ht_unlinked = 0;
+	return rhashtable_init(&vsi->mac_filter_ht, &i40e_mac_filter_ht_params);
+#else
+	return 0;
+#endif /* HAVE_RHASHTABLE_TYPES */
+}
+
+/**
+ * i40e_filter_hash_destroy - Release the MAC filter indexes of a VSI
+ * @vsi: the VSI being freed
+ *
+ * The filters themselves are not freed, this only releases the memory used
+ * by the resizable index. May sleep.
+ **/
+void i40e_filter_hash_destroy(struct i40e_vsi *vsi)
+{
+#ifdef HAVE_RHASHTABLE_TYPES
+	rhashtable_destroy(&vsi->mac_filter_ht);
+#endif /* HAVE_RHASHTABLE_TYPES */
+}
+
+/**
+ * i40e_filter_hash_add - Link a filter into all MAC filter indexes of a VSI
+ * @vsi: the VSI to add to
+ * @f: the filter, not currently linked into any index
+ *
+ * If the (mac, vlan) index cannot take the filter, it is counted as unlinked
+ * so that lookups fall back to walking the per-VLAN index instead of missing
+ * it, until it is linked by a later lookup or deleted.
+ *
+ * NOTE: This function is expected to be called with mac_filter_hash_lock
+ * being held.
+ **/
+void i40e_filter_hash_add(struct i40e_vsi *vsi, struct i40e_mac_filter *f)
+{
+#ifdef HAVE_RHASHTABLE_TYPES
+	if (rhashtable_insert_fast(&vsi->mac_filter_ht, &f->ht_node,
+				   i40e_mac_filter_ht_params))
+		vsi->mac_filter_ht_unlinked++;
+#endif /* HAVE_RHASHTABLE_TYPES */
+	hash_add(vsi->mac_filter_hash, &f->hlist,
+		 i40e_addr_to_hkey(f->macaddr));
+	hash_add(vsi->vlan_filter_hash, &f->vlan_hlist,
+		 i40e_vlan_to_hkey(f->vlan));
+	if (f->vlan > 0)
+		vsi->vlan_filter_count++;
+}
+
+/**
+ * i40e_filter_hash_del - Unlink a filter from all MAC filter indexes of a VSI
+ * @vsi: the VSI to remove from
+ * @f: the filter
+ *
+ * The filter is not freed and f->hlist may be reused to put it on a
+ * temporary list afterwards. It is also taken off the dirty list, the
+ * caller is now responsible for getting it synced.
+ *
+ * NOTE: This function is expected to be called with mac_filter_hash_lock
+ * being held.
+ **/
+void i40e_filter_hash_del(struct i40e_vsi *vsi, struct i40e_mac_filter *f)
+{
+#ifdef HAVE_RHASHTABLE_TYPES
+	if (rhashtable_remove_fast(&vsi->mac_filter_ht, &f->ht_node,
+				   i40e_mac_filter_ht_params) &&
+	    vsi->mac_filter_ht_unlinked)
+		vsi->mac_filter_ht_unlinked--;
+#endif /* HAVE_RHASHTABLE_TYPES */
+	hash_del(&f->hlist);
+	hash_del(&f->vlan_hlist);
+	list_del_init(&f->dirty);
+	if (f->vlan > 0)
+		vsi->vlan_filter_count--;
+}
+
+/**
+ * i40e_filter_set_vlan - Change the VLAN of a filter that is in the indexes
+ * @vsi: the VSI the filter belongs to
+ * @f: the filter
+ * @vlan: the new VLAN
+ *
+ * The VLAN is part of the key of the (mac, vlan) and per-VLAN indexes so it
+ * must never be written directly while the filter is linked into them.
+ *
+ * NOTE: This function is expected to be called with mac_filter_hash_lock
+ * being held.
+ **/
+void i40e_filter_set_vlan(struct i40e_vsi *vsi, struct i40e_mac_filter *f,
+			  s16 vlan)
+{
+	if (f->vlan == vlan)
+		return;
+
+	i40e_filter_hash_del(vsi, f);
+	f->vlan = vlan;
+	i40e_filter_hash_add(vsi, f);
+}
+
+/**
+ * i40e_filter_mark_dirty - Queue a filter for the next filter sync
+ * @vsi: the VSI the filter belongs to
+ * @f: the filter
+ *
+ * i40e_sync_vsi_filters() only looks at filters on the dirty list, so this
+ * must be called for every filter moved to the NEW or REMOVE state.
+ *
+ * NOTE: This function is expected to be called with mac_filter_hash_lock
+ * being held.
+ **/
+void i40e_filter_mark_dirty(struct i40e_vsi *vsi, struct i40e_mac_filter *f)
+{
+	if (list_empty(&f->dirty))
+		list_add_tail(&f->dirty, &vsi->filter_dirty_list);
+}
+
+/**
+ * i40e_filter_set_state - Change the state of a filter
+ * @vsi: the VSI the filter belongs to
+ * @f: the filter
+ * @state: the new state
+ *
+ * Keeps the VSI active and failed filter counts and the dirty list in step
+ * with the filter states, so that syncing does not need to sweep the whole
+ * table. The transient I40E_FILTER_NEW_SYNC state may still be written
+ * directly by the sync task.
+ *
+ * NOTE: This function is expected to be called with mac_filter_hash_lock
+ * being held.
+ **/
+void i40e_filter_set_state(struct i40e_vsi *vsi, struct i40e_mac_filter *f,
+			   enum i40e_filter_state state)
+{
+	if (f->state == state)
+		return;
+
+	if (f->state == I40E_FILTER_ACTIVE)
+		vsi->active_filters--;
+	else if (f->state == I40E_FILTER_FAILED)
+		vsi->failed_filters--;
+
+	if (state == I40E_FILTER_ACTIVE)
+		vsi->active_filters++;
+	else if (state == I40E_FILTER_FAILED)
+		vsi->failed_filters++;
+
+	f->state = state;
+
+	if (state == I40E_FILTER_NEW || state == I40E_FILTER_REMOVE)
+		i40e_filter_mark_dirty(vsi, f);
+}
+
+/**
+ * i40e_filter_hash_find - Look up a mac/vlan filter in the VSI indexes
+ * @vsi: the VSI to be searched
+ * @macaddr: the MAC address
+ * @vlan: the vlan
+ *
+ * Returns ptr to the filter object or NULL
+ *
+ * NOTE: This function is expected to be called with mac_filter_hash_lock
+ * being held.
+ **/
+struct i40e_mac_filter *i40e_filter_hash_find(struct i40e_vsi *vsi,
+					      const u8 *macaddr, s16 vlan)
+{
+	struct i40e_mac_filter *f;
+#ifdef HAVE_RHASHTABLE_TYPES
+	struct i40e_mac_filter_key key = {};
+
+	ether_addr_copy(key.macaddr, macaddr);
+	key.vlan = vlan;
+	f = rhashtable_lookup_fast(&vsi->mac_filter_ht, &key,
+				   i40e_mac_filter_ht_params);
+	if (f || !vsi->mac_filter_ht_unlinked)
+		return f;
+#endif /* HAVE_RHASHTABLE_TYPES */
+
+	hash_for_each_possible(vsi->vlan_filter_hash, f, vlan_hlist,
+			       i40e_vlan_to_hkey(vlan)) {
+		if (vlan == f->vlan && ether_addr_equal(macaddr, f->macaddr)) {
+#ifdef HAVE_RHASHTABLE_TYPES
+			/* only unlinked filters get here, retry linking it */
+			if (!rhashtable_insert_fast(&vsi->mac_filter_ht,
+						    &f->ht_node,
+						    i40e_mac_filter_ht_params))
+				vsi->mac_filter_ht_unlinked--;
+#endif /* HAVE_RHASHTABLE_TYPES */
+			return f;
+		}
+	}
+
+	return NULL;
+}
 
 /**
  * __i40e_del_filter - Remove a specific filter from the VSI
@@ -28,13 +249,519 @@ void __i40e_del_filter(struct i40e_vsi *vsi, struct i40e_mac_filter *f)
 	 * admin queue command will unnecessarily fire.
 	 */
 	if (f->state == I40E_FILTER_FAILED || f->state == I40E_FILTER_NEW) {
-		hash_del(&f->hlist);
+		/* drop it from the failed filter count */
+		i40e_filter_set_state(vsi, f, I40E_FILTER_INVALID);
+		i40e_filter_hash_del(vsi, f);
 		kfree(f);
 	} else {
-		f->state = I40E_FILTER_REMOVE;
+		i40e_filter_set_state(vsi, f, I40E_FILTER_REMOVE);
 	}
 
 	vsi->flags |= I40E_VSI_FLAG_FILTER_CHANGED;
 	set_bit(__I40E_MACVLAN_SYNC_PENDING, vsi->back->state);
 }
 
+/**
+ * i40e_sb_filter_index_init - Initialize the sideband and cloud filter indexes
+ * @pf: board private structure
+ **/
+void i40e_sb_filter_index_init(struct i40e_pf *pf)
+{
+	spin_lock_init(&pf->fd_rule_cnt_lock);
+	mutex_init(&pf->fdir_mutex);
+	INIT_HLIST_HEAD(&pf->fdir_filter_list);
+	INIT_HLIST_HEAD(&pf->cloud_filter_list);
+#ifdef HAVE_XARRAY_API
+	xa_init(&pf->fdir_filter_xa);
+	xa_init(&pf->cloud_filter_xa);
+#endif /* HAVE_XARRAY_API */
+	hash_init(pf->fdir_tuple_hash);
+	hash_init(pf->fdir_tc_cookie_hash);
+	hash_init(pf->cloud_cookie_hash);
+	hash_init(pf->cloud_ip_hash);
+}
+
+/**
+ * i40e_fdir_cnt_layout - Find the per-rule FD counters owned by this PF
+ * @pf: board private structure
+ *
+ * GLQF_PCNT starts with the ATR/SB/ATR tunnel counters of every PF of the
+ * device, indexed by pf_id (see I40E_FD_STAT_PF_IDX). The rest is split
+ * evenly between the same PFs. Must run after the capabilities were read,
+ * a PF which cannot tell its share gets no per-rule counters.
+ **/
+void i40e_fdir_cnt_layout(struct i40e_pf *pf)
+{
+	struct i40e_hw *hw = &pf->hw;
+	u16 num_pf = hw->num_ports * hw->num_partitions;
+	u16 base, per_pf;
+
+	pf->fd_rule_cnt_base = 0;
+	pf->fd_rule_cnt_num = 0;
+	if (!num_pf || hw->pf_id >= num_pf)
+		return;
+
+	base = num_pf * I40E_FD_STAT_PF_COUNT;
+	per_pf = (I40E_GLQF_PCNT_MAX_INDEX + 1 - base) / num_pf;
+
+	pf->fd_rule_cnt_base = base + hw->pf_id * per_pf;
+	pf->fd_rule_cnt_num = min_t(u16, per_pf, I40E_FD_STAT_RULE_MAX);
+}
+
+/**
+ * i40e_fdir_cnt_read - Fold a per-rule FD counter into the rule and PF stats
+ * @pf: board private structure
+ * @n: counter slot of this PF
+ *
+ * The counters are cleared on read, so the delta is added both to the
+ * rule's hits and to fd_sb_match, which keeps counting all sideband hits.
+ * Called with fd_rule_cnt_lock held.
+ **/
+static void i40e_fdir_cnt_read(struct i40e_pf *pf, unsigned int n)
+{
+	struct i40e_hw *hw = &pf->hw;
+	u32 reg = I40E_GLQF_PCNT(pf->fd_rule_cnt_base + n);
+	u32 new_data = rd32(hw, reg);
+
+	wr32(hw, reg, 1); /* must write a nonzero value to clear register */
+	pf->fd_rule_hits[n] += new_data;
+	pf->stats.fd_sb_match += new_data;
+}
+
+/**
+ * i40e_fdir_cnt_alloc - Give a sideband rule its own hit counter
+ * @pf: board private structure
+ * @input: the rule, left on the shared counter if the pool is used up
+ **/
+static void i40e_fdir_cnt_alloc(struct i40e_pf *pf,
+				struct i40e_fdir_filter *input)
+{
+	struct i40e_hw *hw = &pf->hw;
+	unsigned int n;
+
+	if (!pf->fd_rule_cnt_num)
+		return;
+
+	spin_lock_bh(&pf->fd_rule_cnt_lock);
+	n = find_first_zero_bit(pf->fd_rule_cnt_map, pf->fd_rule_cnt_num);
+	if (n < pf->fd_rule_cnt_num) {
+		set_bit(n, pf->fd_rule_cnt_map);
+		wr32(hw, I40E_GLQF_PCNT(pf->fd_rule_cnt_base + n), 1);
+		pf->fd_rule_hits[n] = 0;
+		input->cnt_index = pf->fd_rule_cnt_base + n;
+	}
+	spin_unlock_bh(&pf->fd_rule_cnt_lock);
+}
+
+/**
+ * i40e_fdir_cnt_slot - Get the counter slot of a sideband rule
+ * @pf: board private structure
+ * @filter: the rule
+ *
+ * Returns the slot or -ENOENT if the rule counts on the shared counter
+ **/
+static int i40e_fdir_cnt_slot(struct i40e_pf *pf,
+			      struct i40e_fdir_filter *filter)
+{
+	int n = filter->cnt_index - pf->fd_rule_cnt_base;
+
+	if (n < 0 || n >= pf->fd_rule_cnt_num)
+		return -ENOENT;
+
+	return n;
+}
+
+/**
+ * i40e_fdir_cnt_free - Return the hit counter of a removed sideband rule
+ * @pf: board private structure
+ * @filter: the rule, already removed from the HW
+ **/
+static void i40e_fdir_cnt_free(struct i40e_pf *pf,
+			       struct i40e_fdir_filter *filter)
+{
+	int n = i40e_fdir_cnt_slot(pf, filter);
+
+	if (n < 0)
+		return;
+
+	spin_lock_bh(&pf->fd_rule_cnt_lock);
+	i40e_fdir_cnt_read(pf, n);
+	clear_bit(n, pf->fd_rule_cnt_map);
+	spin_unlock_bh(&pf->fd_rule_cnt_lock);
+	filter->cnt_index = I40E_FD_SB_STAT_IDX(pf->hw.pf_id);
+}
+
+/**
+ * i40e_fdir_rule_hits - Read the hit count of a sideband rule
+ * @pf: board private structure
+ * @filter: the rule
+ * @hits: filled with the packets matched by the rule since it was added
+ *
+ * Returns false if the rule shares its counter with other rules
+ **/
+bool i40e_fdir_rule_hits(struct i40e_pf *pf, struct i40e_fdir_filter *filter,
+			 u64 *hits)
+{
+	int n = i40e_fdir_cnt_slot(pf, filter);
+
+	if (n < 0)
+		return false;
+
+	spin_lock_bh(&pf->fd_rule_cnt_lock);
+	i40e_fdir_cnt_read(pf, n);
+	*hits = pf->fd_rule_hits[n];
+	spin_unlock_bh(&pf->fd_rule_cnt_lock);
+
+	return true;
+}
+
+/**
+ * i40e_fdir_rule_has_cnt - Check if a sideband rule owns a hit counter
+ * @pf: board private structure
+ * @filter: the rule
+ **/
+bool i40e_fdir_rule_has_cnt(struct i40e_pf *pf, struct i40e_fdir_filter *filter)
+{
+	return i40e_fdir_cnt_slot(pf, filter) >= 0;
+}
+
+/**
+ * i40e_fdir_has_tc_rules - Check if tc flower owns any sideband rule
+ * @pf: board private structure
+ **/
+bool i40e_fdir_has_tc_rules(struct i40e_pf *pf)
+{
+	return !hash_empty(pf->fdir_tc_cookie_hash);
+}
+
+/**
+ * i40e_fdir_update_sb_stats - Collect the sideband FD counters
+ * @pf: board private structure
+ *
+ * Called from the PF stats update. Folds the shared sideband counter and the
+ * per-rule counters into fd_sb_match under fd_rule_cnt_lock, which is also
+ * taken when a single rule's counter is read.
+ **/
+void i40e_fdir_update_sb_stats(struct i40e_pf *pf)
+{
+	struct i40e_hw *hw = &pf->hw;
+	u32 reg = I40E_GLQF_PCNT(I40E_FD_SB_STAT_IDX(hw->pf_id));
+	unsigned int n;
+
+	spin_lock_bh(&pf->fd_rule_cnt_lock);
+	pf->stats.fd_sb_match += rd32(hw, reg);
+	wr32(hw, reg, 1); /* must write a nonzero value to clear register */
+	for_each_set_bit(n, pf->fd_rule_cnt_map, pf->fd_rule_cnt_num)
+		i40e_fdir_cnt_read(pf, n);
+	spin_unlock_bh(&pf->fd_rule_cnt_lock);
+}
+
+/**
+ * i40e_fdir_reset_rule_stats - Clear the per-rule sideband hit counts
+ * @pf: board private structure
+ **/
+void i40e_fdir_reset_rule_stats(struct i40e_pf *pf)
+{
+	spin_lock_bh(&pf->fd_rule_cnt_lock);
+	memset(pf->fd_rule_hits, 0, sizeof(pf->fd_rule_hits));
+	spin_unlock_bh(&pf->fd_rule_cnt_lock);
+}
+
+/**
+ * i40e_fdir_index_find - Look up a sideband filter by its fd_id
+ * @pf: board private structure
+ * @fd_id: ethtool location of the filter
+ *
+ * Returns the filter or NULL if the location is unused
+ **/
+struct i40e_fdir_filter *i40e_fdir_index_find(struct i40e_pf *pf, u32 fd_id)
+{
+#ifdef HAVE_XARRAY_API
+	return xa_load(&pf->fdir_filter_xa, fd_id);
+#else
+	struct i40e_fdir_filter *rule;
+
+	/* without the xarray the list is kept ordered by fd_id */
+	hlist_for_each_entry(rule, &pf->fdir_filter_list, fdir_node) {
+		if (rule->fd_id == fd_id)
+			return rule;
+		if (rule->fd_id > fd_id)
+			break;
+	}
+
+	return NULL;
+#endif /* HAVE_XARRAY_API */
+}
+
+/**
+ * i40e_fdir_index_next - Find the sideband filter following a location
+ * @pf: board private structure
+ * @fd_id: lowest location to consider
+ *
+ * Returns the filter with the lowest fd_id not below @fd_id, or NULL
+ **/
+struct i40e_fdir_filter *i40e_fdir_index_next(struct i40e_pf *pf, u32 fd_id)
+{
+#ifdef HAVE_XARRAY_API
+	unsigned long index = fd_id;
+
+	return xa_find(&pf->fdir_filter_xa, &index, ULONG_MAX, XA_PRESENT);
+#else
+	struct i40e_fdir_filter *rule;
+
+	hlist_for_each_entry(rule, &pf->fdir_filter_list, fdir_node)
+		if (rule->fd_id >= fd_id)
+			return rule;
+
+	return NULL;
+#endif /* HAVE_XARRAY_API */
+}
+
+/**
+ * i40e_fdir_index_after - Find the sideband filter following another one
+ * @pf: board private structure
+ * @filter: a tracked filter
+ *
+ * Returns the filter with the next higher fd_id, or NULL. Without xarray
+ * the list is kept sorted by fd_id, so this does not walk it.
+ **/
+struct i40e_fdir_filter *i40e_fdir_index_after(struct i40e_pf *pf,
+					      struct i40e_fdir_filter *filter)
+{
+#ifdef HAVE_XARRAY_API
+	return i40e_fdir_index_next(pf, filter->fd_id + 1);
+#else
+	return hlist_entry_safe(filter->fdir_node.next,
+				struct i40e_fdir_filter, fdir_node);
+#endif /* HAVE_XARRAY_API */
+}
+
+/**
+ * i40e_fdir_index_add - Track a new sideband filter
+ * @pf: board private structure
+ * @input: the filter, its fd_id must not be in use
+ *
+ * Returns 0 on success, negative on failure
+ **/
+int i40e_fdir_index_add(struct i40e_pf *pf, struct i40e_fdir_filter *input)
+{
+#ifdef HAVE_XARRAY_API
+	int err;
+
+	err = xa_insert(&pf->fdir_filter_xa, input->fd_id, input, GFP_KERNEL);
+	if (err)
+		return err;
+
+	hlist_add_head(&input->fdir_node, &pf->fdir_filter_list);
+#else
+	struct i40e_fdir_filter *rule, *parent = NULL;
+
+	hlist_for_each_entry(rule, &pf->fdir_filter_list, fdir_node) {
+		if (rule->fd_id == input->fd_id)
+			return -EBUSY;
+		if (rule->fd_id > input->fd_id)
+			break;
+		parent = rule;
+	}
+
+	if (parent)
+		hlist_add_behind(&input->fdir_node, &parent->fdir_node);
+	else
+		hlist_add_head(&input->fdir_node, &pf->fdir_filter_list);
+#endif /* HAVE_XARRAY_API */
+	hash_add(pf->fdir_tuple_hash, &input->tuple_hlist,
+		 i40e_fdir_tuple_to_hkey(input));
+	pf->fdir_pf_active_filters++;
+
+	if (input->cnt_index == I40E_FD_SB_STAT_IDX(pf->hw.pf_id))
+		i40e_fdir_cnt_alloc(pf, input);
+
+	return 0;
+}
+
+/**
+ * i40e_fdir_index_del - Stop tracking a sideband filter
+ * @pf: board private structure
+ * @filter: the filter, which the caller frees
+ **/
+void i40e_fdir_index_del(struct i40e_pf *pf, struct i40e_fdir_filter *filter)
+{
+	/* keep a replay in progress pointing at a live filter */
+	if (pf->fd_replay_pos == filter)
+		pf->fd_replay_pos = i40e_fdir_index_after(pf, filter);
+#ifdef HAVE_XARRAY_API
+	xa_erase(&pf->fdir_filter_xa, filter->fd_id);
+#endif /* HAVE_XARRAY_API */
+	hlist_del(&filter->fdir_node);
+	hash_del(&filter->tuple_hlist);
+	if (filter->tc_owned)
+		hash_del(&filter->cookie_hlist);
+	if (filter->vf_owned) {
+		pf->fdir_vf_active_filters--;
+		if (filter->vf_id < pf->num_alloc_vfs)
+			pf->vf[filter->vf_id].num_fdir_filters--;
+	}
+	pf->fdir_pf_active_filters--;
+	i40e_fdir_cnt_free(pf, filter);
+}
+
+/**
+ * i40e_fdir_index_find_tc_cookie - Look up a tc flower owned sideband filter
+ * @pf: board private structure
+ * @cookie: tc flower cookie of the rule
+ *
+ * Returns the filter or NULL if no sideband filter carries the cookie
+ **/
+struct i40e_fdir_filter *
+i40e_fdir_index_find_tc_cookie(struct i40e_pf *pf, unsigned long cookie)
+{
+	struct i40e_fdir_filter *rule;
+
+	hash_for_each_possible(pf->fdir_tc_cookie_hash, rule, cookie_hlist,
+			       cookie)
+		if (rule->tc_cookie == cookie)
+			return rule;
+
+	return NULL;
+}
+
+/**
+ * i40e_fdir_index_set_vf - Hand an indexed sideband filter over to a VF
+ * @pf: board private structure
+ * @filter: filter already added with i40e_fdir_index_add
+ * @vf_id: the VF that asked for the filter
+ *
+ * Once owned by a VF the filter can no longer be replaced or removed through
+ * ethtool, and it counts against the VF's share of the table.
+ **/
+void i40e_fdir_index_set_vf(struct i40e_pf *pf,
+			    struct i40e_fdir_filter *filter, u16 vf_id)
+{
+	filter->vf_owned = true;
+	filter->vf_id = vf_id;
+	pf->vf[vf_id].num_fdir_filters++;
+	pf->fdir_vf_active_filters++;
+}
+
+/**
+ * i40e_fdir_index_set_tc_cookie - Hand an indexed sideband filter over to tc
+ * @pf: board private structure
+ * @filter: filter already added with i40e_fdir_index_add
+ * @cookie: tc flower cookie of the rule
+ *
+ * Once owned by tc the filter can no longer be replaced or removed through
+ * ethtool, and its hit counter is reported through FLOW_CLS_STATS.
+ **/
+void i40e_fdir_index_set_tc_cookie(struct i40e_pf *pf,
+				   struct i40e_fdir_filter *filter,
+				   unsigned long cookie)
+{
+	filter->tc_owned = true;
+	filter->tc_cookie = cookie;
+	filter->tc_hits_reported = 0;
+	filter->tc_lastused = jiffies;
+	hash_add(pf->fdir_tc_cookie_hash, &filter->cookie_hlist, cookie);
+}
+
+/**
+ * i40e_cloud_index_find - Look up an ethtool cloud filter by location
+ * @pf: board private structure
+ * @id: ethtool location of the filter
+ *
+ * Returns the filter or NULL if the location is unused
+ **/
+struct i40e_cloud_filter *i40e_cloud_index_find(struct i40e_pf *pf, u32 id)
+{
+#ifdef HAVE_XARRAY_API
+	return xa_load(&pf->cloud_filter_xa, id);
+#else
+	struct i40e_cloud_filter *rule;
+
+	hlist_for_each_entry(rule, &pf->cloud_filter_list, cloud_node)
+		if (rule->id == id)
+			return rule;
+
+	return NULL;
+#endif /* HAVE_XARRAY_API */
+}
+
+/**
+ * i40e_cloud_index_find_cookie - Look up a tc cloud filter by cookie
+ * @pf: board private structure
+ * @cookie: filter specific cookie
+ *
+ * Returns the filter or NULL if there is none with this cookie
+ **/
+struct i40e_cloud_filter *
+i40e_cloud_index_find_cookie(struct i40e_pf *pf, unsigned long cookie)
+{
+	struct i40e_cloud_filter *rule;
+
+	hash_for_each_possible(pf->cloud_cookie_hash, rule, cookie_hlist, cookie)
+		if (rule->cookie == cookie)
+			return rule;
+
+	return NULL;
+}
+
+/**
+ * i40e_cloud_index_add - Track a new PF cloud filter
+ * @pf: board private structure
+ * @filter: the filter
+ * @by_id: filter was added by ethtool and is indexed by its location
+ *
+ * Returns 0 on success, negative on failure
+ **/
+int i40e_cloud_index_add(struct i40e_pf *pf, struct i40e_cloud_filter *filter,
+			 bool by_id)
+{
+	struct i40e_cloud_filter *parent = NULL;
+
+#ifdef HAVE_XARRAY_API
+	if (by_id) {
+		int err = xa_insert(&pf->cloud_filter_xa, filter->id, filter,
+				    GFP_KERNEL);
+
+		if (err)
+			return err;
+	}
+#else
+	struct i40e_cloud_filter *rule;
+
+	/* without the xarray ethtool filters are kept ordered by location */
+	hlist_for_each_entry(rule, &pf->cloud_filter_list, cloud_node) {
+		if (!by_id || rule->id >= filter->id)
+			break;
+		parent = rule;
+	}
+#endif /* HAVE_XARRAY_API */
+
+	if (parent)
+		hlist_add_behind(&filter->cloud_node, &parent->cloud_node);
+	else
+		hlist_add_head(&filter->cloud_node, &pf->cloud_filter_list);
+	hash_add(pf->cloud_cookie_hash, &filter->cookie_hlist, filter->cookie);
+	hash_add(pf->cloud_ip_hash, &filter->ip_hlist,
+		 (__force u32)filter->dst_ipv4);
+	pf->num_cloud_filters++;
+
+	return 0;
+}
+
+/**
+ * i40e_cloud_index_del - Stop tracking a PF cloud filter
+ * @pf: board private structure
+ * @filter: the filter, which the caller frees
+ **/
+void i40e_cloud_index_del(struct i40e_pf *pf, struct i40e_cloud_filter *filter)
+{
+#ifdef HAVE_XARRAY_API
+	/* tc filters share the location space but are not indexed by it */
+	if (xa_load(&pf->cloud_filter_xa, filter->id) == filter)
+		xa_erase(&pf->cloud_filter_xa, filter->id);
+#endif /* HAVE_XARRAY_API */
+	hlist_del(&filter->cloud_node);
+	hash_del(&filter->cookie_hlist);
+	hash_del(&filter->ip_hlist);
+	pf->num_cloud_filters--;
+}
@@ -0,0 +1,281 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/* Copyright (C) 2013-2025 Intel Corporation */
+
+#ifndef _I40E_ITR_H_
+#define _I40E_ITR_H_
+
+/* Adaptive interrupt moderation algorithm.
+ *
+ * Everything in this file is a pure function of the values passed in and
+ * only depends on the u16/u32/bool types, so that it can be built both into
+ * the driver and into the userspace trace replay tool (scripts/itr_replay.c).
+ * Keep it free of kernel headers, jiffies, register access and driver
+ * structures; the callers in i40e_txrx.c take care of those.
+ */
+
+#define I40E_ITR_MASK		0x1FFE	/* mask for ITR register value */
+
+#define I40E_ITR_100K		    10  /* all values below must be even */
+#define I40E_ITR_50K		    20
+#define I40E_ITR_20K		    50
+#define I40E_ITR_18K		    60
+#define I40E_ITR_8K		   122
+
+#define I40E_ITR_ADAPTIVE_MIN_INC       0x0002
+#define I40E_ITR_ADAPTIVE_MIN_USECS     0x0002
+#define I40E_ITR_ADAPTIVE_MAX_USECS     0x007e
+#define I40E_ITR_ADAPTIVE_LATENCY       0x8000
+#define I40E_ITR_ADAPTIVE_BULK          0x0000
+#define ITR_IS_BULK(x) (!((x) & I40E_ITR_ADAPTIVE_LATENCY))
+
+/* The act of updating the ITR will cause it to immediately trigger. In order
+ * to prevent this from throwing off adaptive update statistics we defer the
+ * update so that it can only happen so often. So after either Tx or Rx are
+ * updated we make the adaptive scheme wait until either the ITR completely
+ * expires via the next_update expiration or we have been through at least
+ * 3 interrupts.
+ */
+#define ITR_COUNTDOWN_START 3
+
+/* divisors used to scale the bulk ITR to the current link speed */
+#define I40E_ITR_DIVISOR_40G	(I40E_ITR_ADAPTIVE_MIN_INC * 1024)
+#define I40E_ITR_DIVISOR_25G	(I40E_ITR_ADAPTIVE_MIN_INC * 512)
+#define I40E_ITR_DIVISOR_10G	(I40E_ITR_ADAPTIVE_MIN_INC * 256)
+#define I40E_ITR_DIVISOR_1G	(I40E_ITR_ADAPTIVE_MIN_INC * 32)
+
+/* which ITR index, if any, should be written on interrupt re-enable */
+enum i40e_itr_update {
+	I40E_ITR_UPDATE_NONE = 0,
+	I40E_ITR_UPDATE_RX,
+	I40E_ITR_UPDATE_TX,
+};
+
+/**
+ * i40e_itr_default - starting ITR for an adaptive update
+ * @is_rx: true when computing for the Rx container
+ *
+ * For Rx we want to push the delay up and default to low latency.
+ * for Tx we want to pull the delay down and default to high latency.
+ **/
+static inline unsigned int i40e_itr_default(bool is_rx)
+{
+	return is_rx ?
+	       I40E_ITR_ADAPTIVE_MIN_USECS | I40E_ITR_ADAPTIVE_LATENCY :
+	       I40E_ITR_ADAPTIVE_MAX_USECS | I40E_ITR_ADAPTIVE_LATENCY;
+}
+
+/**
+ * i40e_itr_clamp - limit an adaptive ITR to the maximum while keeping mode
+ * @itr: adaptive ITR value, possibly with I40E_ITR_ADAPTIVE_LATENCY set
+ **/
+static inline unsigned int i40e_itr_clamp(unsigned int itr)
+{
+	if ((itr & I40E_ITR_MASK) > I40E_ITR_ADAPTIVE_MAX_USECS) {
+		itr &= I40E_ITR_ADAPTIVE_LATENCY;
+		itr += I40E_ITR_ADAPTIVE_MAX_USECS;
+	}
+
+	return itr;
+}
+
+/**
+ * i40e_itr_compute - compute the next adaptive ITR for a ring container
+ * @is_rx: true when computing for the Rx container of the vector
+ * @target_itr: current target ITR of the container being updated
+ * @peer_target_itr: current target ITR of the other container on the vector
+ * @min_current_itr: smaller of the Tx and Rx ITR currently programmed
+ * @packets: packets processed by the container since the last update
+ * @bytes: bytes processed by the container since the last update
+ * @divisor: link speed dependent scaling, one of I40E_ITR_DIVISOR_*
+ *
+ * Returns the new target ITR based on packets and byte counts during the
+ * last interrupt.  The advantage of per interrupt computation is faster
+ * updates and more accurate ITR for the current traffic pattern.  Constants
+ * in this function were computed based on theoretical maximum wire speed and
+ * thresholds were set based on testing data as well as attempting to
+ * minimize response time while increasing bulk throughput.
+ **/
+static inline unsigned int i40e_itr_compute(bool is_rx,
+					    unsigned int target_itr,
+					    unsigned int peer_target_itr,
+					    unsigned int min_current_itr,
+					    unsigned int packets,
+					    unsigned int bytes,
+					    unsigned int divisor)
+{
+	unsigned int avg_wire_size, itr;
+
+	itr = i40e_itr_default(is_rx);
+
+	if (is_rx) {
+		/* If Rx there are 1 to 4 packets and bytes are less than
+		 * 9000 assume insufficient data to use bulk rate limiting
+		 * approach unless Tx is already in bulk rate limiting. We
+		 * are likely latency driven.
+		 */
+		if (packets && packets < 4 && bytes < 9000 &&
+		    (peer_target_itr & I40E_ITR_ADAPTIVE_LATENCY)) {
+			itr = I40E_ITR_ADAPTIVE_LATENCY;
+			goto adjust_by_size;
+		}
+	} else if (packets < 4) {
+		/* If we have Tx and Rx ITR maxed and Tx ITR is running in
+		 * bulk mode and we are receiving 4 or fewer packets just
+		 * reset the ITR_ADAPTIVE_LATENCY bit for latency mode so
+		 * that the Rx can relax.
+		 */
+		if (target_itr == I40E_ITR_ADAPTIVE_MAX_USECS &&
+		    (peer_target_itr & I40E_ITR_MASK) ==
+		     I40E_ITR_ADAPTIVE_MAX_USECS)
+			return itr;
+	} else if (packets > 32) {
+		/* If we have processed over 32 packets in a single interrupt
+		 * for Tx assume we need to switch over to "bulk" mode.
+		 */
+		target_itr &= ~I40E_ITR_ADAPTIVE_LATENCY;
+	}
+
+	/* We have no packets to actually measure against. This means
+	 * either one of the other queues on this vector is active or
+	 * we are a Tx queue doing TSO with too high of an interrupt rate.
+	 *
+	 * Between 4 and 56 we can assume that our current interrupt delay
+	 * is only slightly too low. As such we should increase it by a small
+	 * fixed amount.
+	 */
+	if (packets < 56)
+		return i40e_itr_clamp(target_itr + I40E_ITR_ADAPTIVE_MIN_INC);
+
+	if (packets <= 256) {
+		itr = min_current_itr & I40E_ITR_MASK;
+
+		/* Between 56 and 112 is our "goldilocks" zone where we are
+		 * working out "just right". Just report that our current
+		 * ITR is good for us.
+		 */
+		if (packets <= 112)
+			return itr;
+
+		/* If packet count is 128 or greater we are likely looking
+		 * at a slight overrun of the delay we want. Try halving
+		 * our delay to see if that will cut the number of packets
+		 * in half per interrupt.
+		 */
+		itr /= 2;
+		itr &= I40E_ITR_MASK;
+		if (itr < I40E_ITR_ADAPTIVE_MIN_USECS)
+			itr = I40E_ITR_ADAPTIVE_MIN_USECS;
+
+		return itr;
+	}
+
+	/* The paths below assume we are dealing with a bulk ITR since
+	 * number of packets is greater than 256. We are just going to have
+	 * to compute a value and try to bring the count under control,
+	 * though for smaller packet sizes there isn't much we can do as
+	 * NAPI polling will likely be kicking in sooner rather than later.
+	 */
+	itr = I40E_ITR_ADAPTIVE_BULK;
+
+adjust_by_size:
+	/* If packet counts are 256 or greater we can assume we have a gross
+	 * overestimation of what the rate should be. Instead of trying to fine
+	 * tune it just use the formula below to try and dial in an exact value
+	 * give the current packet size of the frame.
+	 */
+	avg_wire_size = bytes / packets;
+
+	/* The following is a crude approximation of:
+	 *  wmem_default / (size + overhead) = desired_pkts_per_int
+	 *  rate / bits_per_byte / (size + ethernet overhead) = pkt_rate
+	 *  (desired_pkt_rate / pkt_rate) * usecs_per_sec = ITR value
+	 *
+	 * Assuming wmem_default is 212992 and overhead is 640 bytes per
+	 * packet, (256 skb, 64 headroom, 320 shared info), we can reduce the
+	 * formula down to
+	 *
+	 *  (170 * (size + 24)) / (size + 640) = ITR
+	 *
+	 * We first do some math on the packet size and then finally bitshift
+	 * by 8 after rounding up. We also have to account for PCIe link speed
+	 * difference as ITR scales based on this.
+	 */
+	if (avg_wire_size <= 60) {
+		/* Start at 250k ints/sec */
+		avg_wire_size = 4096;
+	} else if (avg_wire_size <= 380) {
+		/* 250K ints/sec to 60K ints/sec */
+		avg_wire_size *= 40;
+		avg_wire_size += 1696;
+	} else if (avg_wire_size <= 1084) {
+		/* 60K ints/sec to 36K ints/sec */
+		avg_wire_size *= 15;
+		avg_wire_size += 11452;
+	} else if (avg_wire_size <= 1980) {
+		/* 36K ints/sec to 30K ints/sec */
+		avg_wire_size *= 5;
+		avg_wire_size += 22420;
+	} else {
+		/* plateau at a limit of 30K ints/sec */
+		avg_wire_size = 32256;
+	}
+
+	/* If we are in low latency mode halve our delay which doubles the
+	 * rate to somewhere between 100K to 16K ints/sec
+	 */
+	if (itr & I40E_ITR_ADAPTIVE_LATENCY)
+		avg_wire_size /= 2;
+
+	/* Resultant value is 256 times larger than it needs to be. This
+	 * gives us room to adjust the value as needed to either increase
+	 * or decrease the value based on link speeds of 10G, 2.5G, 1G, etc.
+	 *
+	 * Use addition as we have already recorded the new latency flag
+	 * for the ITR value.
+	 */
+	itr += ((avg_wire_size + divisor - 1) / divisor) *
+	       I40E_ITR_ADAPTIVE_MIN_INC;
+
+	return i40e_itr_clamp(itr);
+}
+
+/**
+ * i40e_itr_select - pick which ITR to write when re-enabling the interrupt
+ * @rx_target: target Rx ITR
+ * @rx_current: Rx ITR currently programmed
+ * @tx_target: target Tx ITR
+ * @tx_current: Tx ITR currently programmed
+ *
+ * This block of logic allows us to get away with only updating
+ * one ITR value with each interrupt. The idea is to perform a
+ * pseudo-lazy update with the following criteria.
+ *
+ * 1. Rx is given higher priority than Tx if both are in same state
+ * 2. If we must reduce an ITR that is given highest priority.
+ * 3. We then give priority to increasing ITR based on amount.
+ **/
+static inline enum i40e_itr_update i40e_itr_select(u16 rx_target,
+						   u16 rx_current,
+						   u16 tx_target,
+						   u16 tx_current)
+{
+	/* Rx ITR needs to be reduced, this is highest priority */
+	if (rx_target < rx_current)
+		return I40E_ITR_UPDATE_RX;
+
+	/* Tx ITR needs to be reduced, this is second priority
+	 * Tx ITR needs to be increased more than Rx, fourth priority
+	 */
+	if (tx_target < tx_current ||
+	    (rx_target - rx_current) < (tx_target - tx_current))
+		return I40E_ITR_UPDATE_TX;
+
+	/* Rx ITR needs to be increased, third priority */
+	if (rx_current != rx_target)
+		return I40E_ITR_UPDATE_RX;
+
+	/* No ITR update, lowest priority */
+	return I40E_ITR_UPDATE_NONE;
+}
+
+#endif /* _I40E_ITR_H_ */
@@ -65,6 +65,7 @@ static void i40e_determine_queue_usage(struct i40e_pf *pf);
 static int i40e_setup_pf_filter_control(struct i40e_pf *pf);
 static void i40e_clear_rss_config_user(struct i40e_vsi *vsi);
 static void i40e_prep_for_reset(struct i40e_pf *pf);
+static void i40e_subtask_schedule(struct i40e_pf *pf, enum i40e_subtask_id id);
 static void i40e_reset_and_rebuild(struct i40e_pf *pf, bool reinit,
 				   bool lock_acquired);
 static int i40e_reset(struct i40e_pf *pf);
@@ -157,6 +158,8 @@ MODULE_LICENSE("GPL");
 MODULE_VERSION(DRV_VERSION);
 
 static struct workqueue_struct *i40e_wq;
+static struct workqueue_struct *i40e_aq_wq;
+static struct workqueue_struct *i40e_svc_wq;
 
 bool i40e_is_l4mode_enabled(void)
 {
@@ -243,6 +246,28 @@ i40e_status i40e_free_virt_mem(struct i40e_hw *hw, struct i40e_virt_mem *mem)
 	return I40E_SUCCESS;
 }
 
+/**
+ * i40e_aq_trace_submit_d - AdminQ command submit tracepoint for shared code
+ * @hw:   pointer to the HW structure
+ * @desc: descriptor as posted on the ring
+ **/
+void i40e_aq_trace_submit_d(struct i40e_hw *hw, struct i40e_aq_desc *desc)
+{
+	i40e_trace(aq_submit, hw, desc, 0);
+}
+
+/**
+ * i40e_aq_trace_done_d - AdminQ command completion tracepoint for shared code
+ * @hw:     pointer to the HW structure
+ * @desc:   descriptor as written back by firmware
+ * @lat_ns: time between submit and write back
+ **/
+void i40e_aq_trace_done_d(struct i40e_hw *hw, struct i40e_aq_desc *desc,
+			  u64 lat_ns)
+{
+	i40e_trace(aq_complete, hw, desc, lat_ns);
+}
+
 /**
  * i40e_get_lump - find a lump of free generic resource
  * @pf: board private structure
@@ -368,6 +393,110 @@ int i40e_max_lump_qp(struct i40e_pf *pf)
 	return max_size;
 }
 
+/**
+ * i40e_free_lump_qp - count the free entries in qp_pile
+ * @pf: pointer to private device data structure
+ *
+ * The last entry is left out as it is kept for the FDIR VSI.
+ *
+ * Returns the number of unassigned queues, or negative for error
+ **/
+int i40e_free_lump_qp(struct i40e_pf *pf)
+{
+	struct i40e_lump_tracking *pile = pf->qp_pile;
+	int count = 0;
+	u16 i;
+
+	if (!pile)
+		return -EINVAL;
+
+	for (i = 0; i + 1 < pile->num_entries; i++)
+		if (!(pile->list[i] & I40E_PILE_VALID_BIT))
+			count++;
+
+	return count;
+}
+
+/**
+ * i40e_get_scattered_lump - assign scattered qp_pile entries to a VSI
+ * @pf: board private structure
+ * @vsi: the SR-IOV VSI to assign the queues to
+ * @needed: the number of queues needed
+ *
+ * Used when the pile is too fragmented to hold a contiguous lump for a VF.
+ * The VSI queue map is non-contiguous anyway, so any free queues will do.
+ *
+ * Returns the first assigned queue, or negative for error
+ **/
+static int i40e_get_scattered_lump(struct i40e_pf *pf, struct i40e_vsi *vsi,
+				   u16 needed)
+{
+	struct i40e_lump_tracking *pile = pf->qp_pile;
+	u16 i, n = 0;
+
+	if (needed > I40E_MAX_VF_QUEUES || i40e_free_lump_qp(pf) < needed)
+		return -ENOMEM;
+
+	/* leave the last entry alone, it is kept for the FDIR VSI */
+	for (i = 0; i + 1 < pile->num_entries && n < needed; i++) {
+		if (pile->list[i] & I40E_PILE_VALID_BIT)
+			continue;
+		pile->list[i] = vsi->idx | I40E_PILE_VALID_BIT;
+		vsi->qp_map[n++] = i;
+	}
+	vsi->qp_scattered = true;
+
+	return vsi->qp_map[0];
+}
+
+/**
+ * i40e_vsi_get_qp_lump - assign qp_pile entries to a VSI
+ * @vsi: the VSI to assign the queues to
+ * @needed: the number of queues needed
+ *
+ * SR-IOV VSIs fall back to scattered queues when no contiguous lump is left.
+ *
+ * Returns the base queue of the VSI, or negative for error
+ **/
+static int i40e_vsi_get_qp_lump(struct i40e_vsi *vsi, u16 needed)
+{
+	struct i40e_pf *pf = vsi->back;
+	int ret;
+
+	vsi->qp_scattered = false;
+	ret = i40e_get_lump(pf, pf->qp_pile, needed, vsi->idx);
+	if (ret >= 0 || vsi->type != I40E_VSI_SRIOV)
+		return ret;
+
+	ret = i40e_get_scattered_lump(pf, vsi, needed);
+	if (ret >= 0)
+		dev_dbg(&pf->pdev->dev,
+			"VF %d got %d scattered queues\n", vsi->vf_id, needed);
+	return ret;
+}
+
+/**
+ * i40e_vsi_put_qp_lump - return the qp_pile entries of a VSI
+ * @vsi: the VSI giving back its queues
+ **/
+static void i40e_vsi_put_qp_lump(struct i40e_vsi *vsi)
+{
+	struct i40e_pf *pf = vsi->back;
+	u16 i;
+
+	if (!vsi->qp_scattered) {
+		i40e_put_lump(pf->qp_pile, vsi->base_queue, vsi->idx);
+		return;
+	}
+
+	/* adjacent entries go back together with the first of them, the
+	 * later calls then find nothing left and are harmless
+	 */
+	for (i = 0; i < vsi->alloc_queue_pairs; i++)
+		i40e_put_lump(pf->qp_pile, vsi->qp_map[i], vsi->idx);
+	vsi->qp_scattered = false;
+}
+
 /**
  * i40e_find_vsi_from_id - searches for the vsi with the given id
  * @pf: the pf structure to search for the vsi
@@ -414,6 +543,21 @@ void i40e_service_event_schedule(struct i40e_pf *pf)
 		queue_work(i40e_wq, &pf->service_task);
 }
 
+/**
+ * i40e_adminq_event_schedule - Schedule the AdminQ task to wake up
+ * @pf: board private structure
+ *
+ * The AdminQ task runs on its own high priority workqueue so that link,
+ * LLDP and VF mailbox events are not held up behind the service task.
+ **/
+void i40e_adminq_event_schedule(struct i40e_pf *pf)
+{
+	if ((!test_bit(__I40E_DOWN, pf->state) &&
+	     !test_bit(__I40E_RESET_RECOVERY_PENDING, pf->state)) ||
+	      test_bit(__I40E_RECOVERY_MODE, pf->state))
+		queue_work(i40e_aq_wq, &pf->adminq_task);
+}
+
 /**
  * i40e_tx_timeout - Respond to a Tx Hang
  * @netdev: network interface device structure
@@ -532,7 +676,7 @@ static void i40e_tx_timeout(struct net_device *netdev)
  * @vsi: the VSI we care about
  *
  * Returns the address of the device statistics structure.
- * The statistics are actually updated from the service task.
+ * The HW statistics are actually updated from the stats subtask.
  **/
 #ifdef HAVE_NDO_GET_STATS64
 struct rtnl_link_stats64 *i40e_get_vsi_stats_struct(struct i40e_vsi *vsi)
@@ -572,6 +716,25 @@ static void i40e_get_netdev_stats_struct_tx(struct i40e_ring *ring,
 	stats->tx_bytes   += bytes;
 }
 
+/**
+ * i40e_stats_max_age - How old cached HW stats may be when they are read
+ * @pf: board private structure
+ **/
+static unsigned long i40e_stats_max_age(struct i40e_pf *pf)
+{
+	return usecs_to_jiffies(pf->stats_fresh_usecs);
+}
+
+/**
+ * i40e_stats_stale - Check whether cached HW stats need a register read
+ * @updated: jiffies of the last read, 0 if they were never read
+ * @max_age: how old the cached values may be
+ **/
+static bool i40e_stats_stale(unsigned long updated, unsigned long max_age)
+{
+	return !updated || !time_before(jiffies, updated + max_age);
+}
+
 /**
  * i40e_get_netdev_stats_struct - Get statistics for netdev interface
  * @netdev: network interface device structure
@@ -635,7 +798,16 @@ static struct rtnl_link_stats64 *i40e_get_netdev_stats_struct(
 	}
 	rcu_read_unlock();
 
-	/* following stats updated by i40e_watchdog_subtask() */
+	/* The stats below come from HW registers, which cannot be read from
+	 * here. Ask the stats subtask for a refresh when they are older than
+	 * the freshness window, so that the next reader gets current values.
+	 */
+	if (i40e_stats_stale(vsi->stats_updated,
+			     i40e_stats_max_age(vsi->back)) &&
+	    !test_and_set_bit(__I40E_VSI_STATS_REQUESTED, vsi->state))
+		i40e_subtask_schedule(vsi->back, I40E_SUBTASK_STATS);
+
+	/* following stats are cached by i40e_update_stats() */
 	stats->multicast	= vsi_stats->multicast;
 	stats->tx_errors	= vsi_stats->tx_errors;
 	stats->tx_dropped	= vsi_stats->tx_dropped;
@@ -696,6 +868,7 @@ void i40e_vsi_reset_stats(struct i40e_vsi *vsi)
 		}
 	}
 	vsi->stat_offsets_loaded = false;
+	vsi->stats_updated = 0;
 }
 
 /**
@@ -709,6 +882,9 @@ void i40e_pf_reset_stats(struct i40e_pf *pf)
 	memset(&pf->stats, 0, sizeof(pf->stats));
 	memset(&pf->stats_offsets, 0, sizeof(pf->stats_offsets));
 	pf->stat_offsets_loaded = false;
+	pf->stats_updated = 0;
+	pf->vf_stats_updated = 0;
+	i40e_fdir_reset_rule_stats(pf);
 
 	for (i = 0; i < I40E_MAX_VEB; i++) {
 		if (pf->veb[i]) {
@@ -721,6 +897,7 @@ void i40e_pf_reset_stats(struct i40e_pf *pf)
 			memset(&pf->veb[i]->tc_stats_offsets, 0,
 			       sizeof(pf->veb[i]->tc_stats_offsets));
 			pf->veb[i]->stat_offsets_loaded = false;
+			pf->veb[i]->stats_updated = 0;
 		}
 	}
 	pf->hw_csum_rx_error = 0;
@@ -953,10 +1130,10 @@ void i40e_update_eth_stats(struct i40e_vsi *vsi)
 }
 
 /**
- * i40e_update_veb_stats - Update Switch component statistics
+ * i40e_read_veb_stats - Read Switch component statistics from HW
  * @veb: the VEB being updated
  **/
-void i40e_update_veb_stats(struct i40e_veb *veb)
+static void i40e_read_veb_stats(struct i40e_veb *veb)
 {
 	struct i40e_pf *pf = veb->pf;
 	struct i40e_hw *hw = &pf->hw;
@@ -1028,6 +1205,8 @@ void i40e_update_veb_stats(struct i40e_veb *veb)
 				   &veb_es->tc_tx_bytes[i]);
 	}
 	veb->stat_offsets_loaded = true;
+	veb->stats_updated = jiffies;
+	pf->stats_hw_reads++;
 }
 
 /**
@@ -1161,6 +1340,9 @@ static void i40e_update_vsi_stats(struct i40e_vsi *vsi)
 				pf->stats.rx_oversize;
 		ns->rx_length_errors = pf->stats.rx_length_errors;
 	}
+
+	vsi->stats_updated = jiffies;
+	pf->stats_hw_reads++;
 }
 
 /**
@@ -1357,9 +1539,7 @@ static void i40e_update_pf_stats(struct i40e_pf *pf)
 	i40e_stat_update_and_clear32(hw,
 			I40E_GLQF_PCNT(I40E_FD_ATR_STAT_IDX(hw->pf_id)),
 			&nsd->fd_atr_match);
-	i40e_stat_update_and_clear32(hw,
-			I40E_GLQF_PCNT(I40E_FD_SB_STAT_IDX(hw->pf_id)),
-			&nsd->fd_sb_match);
+	i40e_fdir_update_sb_stats(pf);
 	i40e_stat_update_and_clear32(hw,
 			I40E_GLQF_PCNT(I40E_FD_ATR_TUNNEL_STAT_IDX(hw->pf_id)),
 			&nsd->fd_atr_tunnel_match);
@@ -1384,22 +1564,189 @@ static void i40e_update_pf_stats(struct i40e_pf *pf)
 		nsd->fd_atr_status = false;
 
 	pf->stat_offsets_loaded = true;
+	pf->stats_updated = jiffies;
+	pf->stats_hw_reads++;
 }
 
 /**
- * i40e_update_stats - Update the various statistics counters.
+ * __i40e_update_stats - Read the stats of a VSI unless they are recent
  * @vsi: the VSI to be updated
+ * @max_age: how old the cached values may be, in jiffies
  *
- * Update the various stats for this VSI and its related entities.
+ * The PF stats go with the main VSI. Readers coming in while another one
+ * reads the registers wait for it and then find the values fresh.
  **/
-void i40e_update_stats(struct i40e_vsi *vsi)
+static void __i40e_update_stats(struct i40e_vsi *vsi, unsigned long max_age)
 {
 	struct i40e_pf *pf = vsi->back;
+	bool main_vsi = vsi->type == I40E_VSI_MAIN;
 
-	if (vsi->type == I40E_VSI_MAIN)
+	if (!(main_vsi && i40e_stats_stale(pf->stats_updated, max_age)) &&
+	    !i40e_stats_stale(vsi->stats_updated, max_age)) {
+		pf->stats_cached++;
+		return;
+	}
+
+	mutex_lock(&pf->stats_mutex);
+	if (main_vsi && i40e_stats_stale(pf->stats_updated, max_age))
 		i40e_update_pf_stats(pf);
+	if (i40e_stats_stale(vsi->stats_updated, max_age))
+		i40e_update_vsi_stats(vsi);
+	mutex_unlock(&pf->stats_mutex);
+}
+
+/**
+ * i40e_update_stats - Update the various statistics counters.
+ * @vsi: the VSI to be updated
+ *
+ * Update the various stats for this VSI and its related entities, unless
+ * they were read within the stats freshness window (stats-block-usecs).
+ **/
+void i40e_update_stats(struct i40e_vsi *vsi)
+{
+	__i40e_update_stats(vsi, i40e_stats_max_age(vsi->back));
+}
+
+/**
+ * __i40e_update_veb_stats - Read VEB stats unless they are recent
+ * @veb: the VEB being updated
+ * @max_age: how old the cached values may be, in jiffies
+ **/
+static void __i40e_update_veb_stats(struct i40e_veb *veb,
+				    unsigned long max_age)
+{
+	struct i40e_pf *pf = veb->pf;
+
+	if (!i40e_stats_stale(veb->stats_updated, max_age)) {
+		pf->stats_cached++;
+		return;
+	}
+
+	mutex_lock(&pf->stats_mutex);
+	if (i40e_stats_stale(veb->stats_updated, max_age))
+		i40e_read_veb_stats(veb);
+	mutex_unlock(&pf->stats_mutex);
+}
+
+/**
+ * i40e_update_veb_stats - Update Switch component statistics
+ * @veb: the VEB being updated
+ *
+ * Registers are only read if the cached values are older than the stats
+ * freshness window.
+ **/
+void i40e_update_veb_stats(struct i40e_veb *veb)
+{
+	__i40e_update_veb_stats(veb, i40e_stats_max_age(veb->pf));
+}
+
+/**
+ * __i40e_update_vf_stats - Read the stats of all VFs unless they are recent
+ * @pf: board private structure
+ * @max_age: how old the snapshot may be, in jiffies
+ *
+ * All VF VSIs are read in one sweep and published together in their
+ * vf->stats_snap, so readers of any VF are served from the same snapshot.
+ * The caller holds pf->vc_rwsem, which keeps VF resets and i40e_free_vfs()
+ * from releasing the VSIs under the sweep.
+ **/
+static void __i40e_update_vf_stats(struct i40e_pf *pf, unsigned long max_age)
+{
+	struct i40e_vsi *vsi;
+	struct i40e_vf *vf;
+	int i;
+
+	if (!pf->num_alloc_vfs)
+		return;
+
+	if (!i40e_stats_stale(pf->vf_stats_updated, max_age)) {
+		pf->stats_cached++;
+		return;
+	}
+
+	mutex_lock(&pf->stats_mutex);
+	if (!i40e_stats_stale(pf->vf_stats_updated, max_age))
+		goto unlock;
+
+	/* read the registers first, readers only wait for the copy */
+	for (i = 0; i < pf->num_alloc_vfs; i++) {
+		vf = &pf->vf[i];
+		if (!test_bit(I40E_VF_STATE_INIT, &vf->vf_states) ||
+		    !vf->lan_vsi_idx)
+			continue;
+		vsi = pf->vsi[vf->lan_vsi_idx];
+		if (vsi)
+			i40e_update_eth_stats(vsi);
+	}
 
-	i40e_update_vsi_stats(vsi);
+	write_seqlock_bh(&pf->vf_stats_lock);
+	for (i = 0; i < pf->num_alloc_vfs; i++) {
+		vf = &pf->vf[i];
+		if (!test_bit(I40E_VF_STATE_INIT, &vf->vf_states) ||
+		    !vf->lan_vsi_idx)
+			continue;
+		vsi = pf->vsi[vf->lan_vsi_idx];
+		if (vsi)
+			vf->stats_snap = vsi->eth_stats;
+	}
+	write_sequnlock_bh(&pf->vf_stats_lock);
+
+	pf->vf_stats_updated = jiffies;
+	pf->stats_hw_reads++;
+unlock:
+	mutex_unlock(&pf->stats_mutex);
+}
+
+/**
+ * i40e_update_vf_stats - Refresh the VF stats snapshot
+ * @pf: board private structure
+ *
+ * Registers are only read if the snapshot is older than the stats
+ * freshness window. The caller holds pf->vc_rwsem.
+ **/
+void i40e_update_vf_stats(struct i40e_pf *pf)
+{
+	__i40e_update_vf_stats(pf, i40e_stats_max_age(pf));
+}
+
+/**
+ * i40e_stats_subtask - Refresh requested and about to wrap HW stats
+ * @pf: board private structure
+ *
+ * Serves the refreshes asked for by ndo_get_stats64, which cannot sleep,
+ * and reads everything not read for I40E_STATS_WRAP_GUARD so that no
+ * counter wraps twice between two reads.
+ **/
+static void i40e_stats_subtask(struct i40e_pf *pf)
+{
+	struct i40e_vsi *vsi;
+	int i;
+
+	if (test_bit(__I40E_DOWN, pf->state) ||
+	    test_bit(__I40E_CONFIG_BUSY, pf->state))
+		return;
+
+	for (i = 0; i < pf->num_alloc_vsi; i++) {
+		vsi = pf->vsi[i];
+		if (!vsi || !vsi->netdev)
+			continue;
+
+		if (test_and_clear_bit(__I40E_VSI_STATS_REQUESTED, vsi->state))
+			i40e_update_stats(vsi);
+		else
+			__i40e_update_stats(vsi, I40E_STATS_WRAP_GUARD);
+	}
+
+	if (pf->flags & I40E_FLAG_VEB_STATS_ENABLED) {
+		for (i = 0; i < I40E_MAX_VEB; i++)
+			if (pf->veb[i])
+				__i40e_update_veb_stats(pf->veb[i],
+							I40E_STATS_WRAP_GUARD);
+	}
+
+	down_read(&pf->vc_rwsem);
+	__i40e_update_vf_stats(pf, I40E_STATS_WRAP_GUARD);
+	up_read(&pf->vc_rwsem);
 }
 
 /**
@@ -1454,19 +1801,10 @@ int i40e_count_all_filters(struct i40e_vsi *vsi)
 struct i40e_mac_filter *i40e_find_filter(struct i40e_vsi *vsi,
 					 const u8 *macaddr, s16 vlan)
 {
-	struct i40e_mac_filter *f;
-	u64 key;
-
 	if (!vsi || !macaddr)
 		return NULL;
 
-	key = i40e_addr_to_hkey(macaddr);
-	hash_for_each_possible(vsi->mac_filter_hash, f, hlist, key) {
-		if ((ether_addr_equal(macaddr, f->macaddr)) &&
-		    (vlan == f->vlan))
-			return f;
-	}
-	return NULL;
+	return i40e_filter_hash_find(vsi, macaddr, vlan);
 }
 
 /**
@@ -1585,7 +1923,7 @@ static int i40e_correct_mac_vlan_filters(struct i40e_vsi *vsi,
 	struct i40e_mac_filter *f, *add_head;
 	struct i40e_new_mac_filter *new_mac;
 	struct hlist_node *h;
-	int bkt, new_vlan;
+	int old_vlan, new_vlan;
 
 	/* To determine if a particular filter needs to be replaced we
 	 * have the three following conditions:
@@ -1604,25 +1942,26 @@ static int i40e_correct_mac_vlan_filters(struct i40e_vsi *vsi,
 	/* Update the filters about to be added in place */
 	hlist_for_each_entry(new_mac, tmp_add_list, hlist) {
 		if (vlan_filters && new_mac->f->vlan == I40E_VLAN_ANY)
-			new_mac->f->vlan = 0;
+			i40e_filter_set_vlan(vsi, new_mac->f, 0);
 		else if (!vlan_filters && new_mac->f->vlan == 0)
-			new_mac->f->vlan = I40E_VLAN_ANY;
+			i40e_filter_set_vlan(vsi, new_mac->f, I40E_VLAN_ANY);
+	}
+
+	/* Only filters on the VLAN being replaced need to be changed, so
+	 * walk just that VLAN in the per-VLAN index.
+	 */
+	if (vlan_filters) {
+		old_vlan = I40E_VLAN_ANY;
+		new_vlan = 0;
+	} else {
+		old_vlan = 0;
+		new_vlan = I40E_VLAN_ANY;
 	}
 
 	/* Update the remaining active filters */
-	hash_for_each_safe(vsi->mac_filter_hash, bkt, h, f, hlist) {
-		/* Combine the checks for whether a filter needs to be changed
-		 * and then determine the new vlan inside the if block, in
-		 * order to avoid duplicating code for adding the new filter
-		 * then deleting the old filter.
-		 */
-		if ((vlan_filters && f->vlan == I40E_VLAN_ANY) ||
-		    (!vlan_filters && f->vlan == 0)) {
-			/* Determine the new vlan */
-			if (vlan_filters)
-				new_vlan = 0;
-			else
-				new_vlan = I40E_VLAN_ANY;
+	hash_for_each_possible_safe(vsi->vlan_filter_hash, f, h, vlan_hlist,
+				    i40e_vlan_to_hkey(old_vlan)) {
+		if (f->vlan == old_vlan) {
 			/* Create the new filter */
 			add_head = i40e_add_filter(vsi, f->macaddr, new_vlan);
 			if (!add_head)
@@ -1643,8 +1982,8 @@ static int i40e_correct_mac_vlan_filters(struct i40e_vsi *vsi,
 			hlist_add_head(&new_mac->hlist, tmp_add_list);
 
 			/* Put the original filter into the delete list */
-			f->state = I40E_FILTER_REMOVE;
-			hash_del(&f->hlist);
+			i40e_filter_set_state(vsi, f, I40E_FILTER_REMOVE);
+			i40e_filter_hash_del(vsi, f);
 			hlist_add_head(&f->hlist, tmp_del_list);
 		}
 	}
@@ -1728,21 +2067,33 @@ static int i40e_correct_vf_mac_vlan_filters(struct i40e_vsi *vsi,
 					    bool allow_untagged,
 					    bool trusted)
 {
+	static const s16 untagged_vlans[] = { I40E_VLAN_ANY, 0 };
 	enum i40e_filter_state new_state = I40E_FILTER_INVALID;
 	struct i40e_mac_filter *f, *add_head;
 	struct i40e_new_mac_filter *new_mac;
 	struct hlist_node *h;
-	int bkt, new_vlan;
+	int i, new_vlan;
 
 	hlist_for_each_entry(new_mac, tmp_add_list, hlist) {
-		new_mac->f->vlan = i40e_get_vf_new_vlan(vsi, new_mac, NULL,
-							vlan_filters, trusted);
+		new_vlan = i40e_get_vf_new_vlan(vsi, new_mac, NULL,
+						vlan_filters, trusted);
+		i40e_filter_set_vlan(vsi, new_mac->f, new_vlan);
 	}
 
-	hash_for_each_safe(vsi->mac_filter_hash, bkt, h, f, hlist) {
-		new_vlan = i40e_get_vf_new_vlan(vsi, NULL, f, vlan_filters,
-						trusted);
-		if (new_vlan != f->vlan) {
+	/* Only untagged (VLAN=0) and VLAN=-1 filters are ever replaced, so
+	 * walk just those two VLANs in the per-VLAN index.
+	 */
+	for (i = 0; i < ARRAY_SIZE(untagged_vlans); i++) {
+		hash_for_each_possible_safe(vsi->vlan_filter_hash, f, h,
+					    vlan_hlist,
+					    i40e_vlan_to_hkey(untagged_vlans[i])) {
+			if (f->vlan != untagged_vlans[i])
+				continue;
+			new_vlan = i40e_get_vf_new_vlan(vsi, NULL, f,
+							vlan_filters, trusted);
+			if (new_vlan == f->vlan)
+				continue;
+
 			add_head = i40e_add_filter(vsi, f->macaddr, new_vlan);
 			if (!add_head)
 				return -ENOMEM;
@@ -1761,13 +2112,14 @@ static int i40e_correct_vf_mac_vlan_filters(struct i40e_vsi *vsi,
 			hlist_add_head(&new_mac->hlist, tmp_add_list);
 
 			/* Put the original filter into the delete list */
-			f->state = I40E_FILTER_REMOVE;
-			hash_del(&f->hlist);
+			i40e_filter_set_state(vsi, f, I40E_FILTER_REMOVE);
+			i40e_filter_hash_del(vsi, f);
 			hlist_add_head(&f->hlist, tmp_del_list);
 		}
 	}
 
-	hash_for_each_safe(vsi->mac_filter_hash, bkt, h, f, hlist) {
+	hash_for_each_possible_safe(vsi->vlan_filter_hash, f, h, vlan_hlist,
+				    i40e_vlan_to_hkey(0)) {
 		new_state = f->state;
 		if (!allow_untagged &&
 		    (f->state == I40E_FILTER_ACTIVE ||
@@ -1779,7 +2131,7 @@ static int i40e_correct_vf_mac_vlan_filters(struct i40e_vsi *vsi,
 		    f->vlan == 0)
 			new_state = I40E_FILTER_ACTIVE;
 		if (new_state != f->state) {
-			f->state = new_state;
+			i40e_filter_set_state(vsi, f, new_state);
 			if (new_state == I40E_FILTER_INACTIVE) {
 				add_head = (struct i40e_mac_filter *)
 					kzalloc(sizeof(*f), GFP_ATOMIC);
@@ -1869,7 +2221,6 @@ struct i40e_mac_filter *i40e_add_filter(struct i40e_vsi *vsi,
 					const u8 *macaddr, s16 vlan)
 {
 	struct i40e_mac_filter *f;
-	u64 key;
 
 	if (!vsi || !macaddr)
 		return NULL;
@@ -1888,12 +2239,13 @@ struct i40e_mac_filter *i40e_add_filter(struct i40e_vsi *vsi,
 
 		ether_addr_copy(f->macaddr, macaddr);
 		f->vlan = vlan;
-		f->state = I40E_FILTER_NEW;
 
 		INIT_HLIST_NODE(&f->hlist);
+		INIT_HLIST_NODE(&f->vlan_hlist);
+		INIT_LIST_HEAD(&f->dirty);
 
-		key = i40e_addr_to_hkey(macaddr);
-		hash_add(vsi->mac_filter_hash, &f->hlist, key);
+		i40e_filter_hash_add(vsi, f);
+		i40e_filter_set_state(vsi, f, I40E_FILTER_NEW);
 
 		vsi->flags |= I40E_VSI_FLAG_FILTER_CHANGED;
 		set_bit(__I40E_MACVLAN_SYNC_PENDING, vsi->back->state);
@@ -1908,7 +2260,7 @@ struct i40e_mac_filter *i40e_add_filter(struct i40e_vsi *vsi,
 	 * sync task leaves it in place
 	 */
 	if (f->state == I40E_FILTER_REMOVE)
-		f->state = I40E_FILTER_ACTIVE;
+		i40e_filter_set_state(vsi, f, I40E_FILTER_ACTIVE);
 
 	return f;
 }
@@ -2400,7 +2752,7 @@ static void i40e_vsi_setup_queue_map(struct i40e_vsi *vsi,
 				     cpu_to_le16(I40E_AQ_VSI_QUE_MAP_NONCONTIG);
 		for (i = 0; i < vsi->num_queue_pairs; i++)
 			ctxt->info.queue_mapping[i] =
-					       cpu_to_le16(vsi->base_queue + i);
+					cpu_to_le16(i40e_vsi_pf_q(vsi, i));
 	} else {
 		ctxt->info.mapping_flags |=
 					cpu_to_le16(I40E_AQ_VSI_QUE_MAP_CONTIG);
@@ -2497,11 +2849,10 @@ static void i40e_undo_del_filter_entries(struct i40e_vsi *vsi,
 	struct hlist_node *h;
 
 	hlist_for_each_entry_safe(f, h, from, hlist) {
-		u64 key = i40e_addr_to_hkey(f->macaddr);
-
 		/* Move the element back into MAC filter list*/
 		hlist_del(&f->hlist);
-		hash_add(vsi->mac_filter_hash, &f->hlist, key);
+		i40e_filter_hash_add(vsi, f);
+		i40e_filter_mark_dirty(vsi, f);
 	}
 }
 
@@ -2520,7 +2871,13 @@ static void i40e_undo_add_filter_entries(struct i40e_vsi *vsi,
 	struct hlist_node *h;
 
 	hlist_for_each_entry_safe(new_mac, h, from, hlist) {
-		/* We can simply free the wrapper structure */
+		/* Requeue the filter for the next sync, then we can simply
+		 * free the wrapper structure
+		 */
+		if (new_mac->f->state == I40E_FILTER_NEW_SYNC)
+			new_mac->f->state = I40E_FILTER_NEW;
+		if (new_mac->f->state == I40E_FILTER_NEW)
+			i40e_filter_mark_dirty(vsi, new_mac->f);
 		hlist_del(&new_mac->hlist);
 		kfree(new_mac);
 	}
@@ -2587,28 +2944,85 @@ i40e_update_filter_state(int count,
 	return retval;
 }
 
+/**
+ * i40e_aqc_del_filters_reap - Collect a posted delete filters request
+ * @vsi: ptr to the VSI
+ * @vsi_name: name to display in messages
+ * @done: completion the request was posted with
+ * @retval: Set to -EIO on failure to delete
+ *
+ * Waits for the request if firmware has not written it back yet. Does
+ * nothing if nothing was posted with @done.
+ */
+static void i40e_aqc_del_filters_reap(struct i40e_vsi *vsi,
+				      const char *vsi_name,
+				      struct i40e_asq_cmd_done *done,
+				      int *retval)
+{
+	struct i40e_hw *hw = &vsi->back->hw;
+
+	if (!done->priv)
+		return;
+	done->priv = NULL;
+
+	/* filter sync runs in process context, sleep while waiting */
+	i40e_asq_wait_done(hw, done, false);
+
+	/* Explicitly ignore and do not report when firmware returns ENOENT */
+	if (done->status && !(done->aq_rc == I40E_AQ_RC_ENOENT)) {
+		*retval = -EIO;
+		dev_info(&vsi->back->pdev->dev,
+			 "ignoring delete macvlan error on %s, err %s, aq_err %s\n",
+			 vsi_name, i40e_stat_str(hw, done->status),
+			 i40e_aq_str(hw, done->aq_rc));
+	}
+}
+
 /**
  * i40e_aqc_del_filters - Request firmware to delete a set of filters
  * @vsi: ptr to the VSI
  * @vsi_name: name to display in messages
  * @list: the list of filters to send to firmware
  * @num_del: the number of filters to delete
+ * @done: completion to post the request with, or NULL to wait for it
  * @retval: Set to -EIO on failure to delete
  *
  * Send a request to firmware via AdminQ to delete a set of filters. Uses
  * *retval instead of a return value so that success does not force ret_val to
  * be set to 0. This ensures that a sequence of calls to this function
  * preserve the previous value of *retval on successful delete.
+ *
+ * With @done the request is only posted, @list can be reused right away and
+ * the result is collected by i40e_aqc_del_filters_reap, at the latest when
+ * @done is used for the next request.
  */
 static
 void i40e_aqc_del_filters(struct i40e_vsi *vsi, const char *vsi_name,
 			  struct i40e_aqc_remove_macvlan_element_data *list,
-			  int num_del, int *retval)
+			  int num_del, struct i40e_asq_cmd_done *done,
+			  int *retval)
 {
 	struct i40e_hw *hw = &vsi->back->hw;
 	enum i40e_admin_queue_err aq_status;
 	i40e_status aq_ret;
 
+	if (done) {
+		struct i40e_asq_cmd_details cmd_details = {};
+
+		i40e_aqc_del_filters_reap(vsi, vsi_name, done, retval);
+
+		cmd_details.async = true;
+		cmd_details.done = done;
+		aq_ret = i40e_aq_remove_macvlan_v2(hw, vsi->seid, list,
+						   num_del, &cmd_details,
+						   &aq_status);
+		if (!aq_ret) {
+			done->priv = vsi;
+			return;
+		}
+		/* not posted, e.g. the ASQ is full; fall back to waiting */
+	}
+
 	aq_ret = i40e_aq_remove_macvlan_v2(hw, vsi->seid, list, num_del, NULL,
 					   &aq_status);
 
@@ -2854,7 +3268,9 @@ int i40e_sync_vsi_filters(struct i40e_vsi *vsi)
 	bool old_overflow, new_overflow;
 	unsigned int failed_filters = 0;
 	unsigned int vlan_filters = 0;
+	u32 filter_sync_dirty = 0;
 	struct i40e_mac_filter *f;
+	struct i40e_mac_filter *ftmp;
 	char vsi_name[16] = "PF";
 	int filter_list_len = 0;
 	u32 changed_flags = 0;
@@ -2863,17 +3279,20 @@ int i40e_sync_vsi_filters(struct i40e_vsi *vsi)
 	int num_add = 0;
 	int num_del = 0;
 	int retval = 0;
+	u64 sync_start;
 	u16 cmd_flags;
 	int list_size;
-	int bkt;
 
 	/* empty array typed pointers, kcalloc later */
 	struct i40e_aqc_add_macvlan_element_data *add_list;
 	struct i40e_aqc_remove_macvlan_element_data *del_list;
+	struct i40e_asq_cmd_done *del_done;
+	int del_slot = 0;
 
 	while (test_and_set_bit(__I40E_VSI_SYNCING_FILTERS, vsi->state))
 		usleep_range(1000, 2000);
 	pf = vsi->back;
+	sync_start = ktime_get_ns();
 
 	old_overflow = test_bit(__I40E_VSI_OVERFLOW_PROMISC, vsi->state);
 
@@ -2894,14 +3313,17 @@ int i40e_sync_vsi_filters(struct i40e_vsi *vsi)
 		vsi->flags &= ~I40E_VSI_FLAG_FILTER_CHANGED;
 
 		spin_lock_bh(&vsi->mac_filter_hash_lock);
-		/* Create a list of filters to delete. */
-		hash_for_each_safe(vsi->mac_filter_hash, bkt, h, f, hlist) {
+		/* Only filters which changed since the last sync are on the
+		 * dirty list, so the work here is proportional to the change
+		 * rather than to the size of the table.
+		 */
+		list_for_each_entry_safe(f, ftmp, &vsi->filter_dirty_list,
+					 dirty) {
+			filter_sync_dirty++;
 			if (f->state == I40E_FILTER_REMOVE) {
 				/* Move the element into temporary del_list */
-				hash_del(&f->hlist);
+				i40e_filter_hash_del(vsi, f);
 				hlist_add_head(&f->hlist, &tmp_del_list);
-
-				/* Avoid counting removed filters */
 				continue;
 			}
 			if (f->state == I40E_FILTER_NEW) {
@@ -2919,15 +3341,15 @@ int i40e_sync_vsi_filters(struct i40e_vsi *vsi)
 				hlist_add_head(&new_mac->hlist, &tmp_add_list);
 				f->state = I40E_FILTER_NEW_SYNC;
 			}
-
-			/* Count the number of active (current and new) VLAN
-			 * filters we have now. Does not count filters which
-			 * are marked for deletion.
-			 */
-			if (f->vlan > 0)
-				vlan_filters++;
+			list_del_init(&f->dirty);
 		}
 
+		/* Count the number of active (current and new) VLAN filters
+		 * we have now. Filters marked for deletion have all been
+		 * moved out of the hash above so are not counted.
+		 */
+		vlan_filters = vsi->vlan_filter_count;
+
 		if (vsi->type != I40E_VSI_SRIOV)
 			retval = i40e_correct_mac_vlan_filters
 				(vsi, &tmp_add_list, &tmp_del_list,
@@ -2954,6 +3376,11 @@ int i40e_sync_vsi_filters(struct i40e_vsi *vsi)
 			kzalloc(list_size, GFP_ATOMIC);
 		if (!del_list)
 			goto err_no_memory;
+		/* keep a few remove requests in flight instead of waiting
+		 * for each one, or wait for each if this allocation fails
+		 */
+		del_done = kcalloc(I40E_DEL_FILTERS_INFLIGHT, sizeof(*del_done),
+				   GFP_ATOMIC);
 
 		hlist_for_each_entry_safe(f, h, &tmp_del_list, hlist) {
 			cmd_flags = 0;
@@ -2985,7 +3412,12 @@ int i40e_sync_vsi_filters(struct i40e_vsi *vsi)
 			/* flush a full buffer */
 			if (num_del == filter_list_len) {
 				i40e_aqc_del_filters(vsi, vsi_name, del_list,
-						     num_del, &retval);
+						     num_del,
+						     del_done ?
+						     &del_done[del_slot] : NULL,
+						     &retval);
+				del_slot = (del_slot + 1) %
+					   I40E_DEL_FILTERS_INFLIGHT;
 				memset(del_list, 0, list_size);
 				num_del = 0;
 			}
@@ -2998,7 +3430,17 @@ int i40e_sync_vsi_filters(struct i40e_vsi *vsi)
 
 		if (num_del) {
 			i40e_aqc_del_filters(vsi, vsi_name, del_list,
-					     num_del, &retval);
+					     num_del, NULL, &retval);
+		}
+
+		/* collect the remove requests still in flight */
+		if (del_done) {
+			for (del_slot = 0; del_slot < I40E_DEL_FILTERS_INFLIGHT;
+			     del_slot++)
+				i40e_aqc_del_filters_reap(vsi, vsi_name,
+							  &del_done[del_slot],
+							  &retval);
+			kfree(del_done);
 		}
 
 		kfree(del_list);
@@ -3074,7 +3516,8 @@ int i40e_sync_vsi_filters(struct i40e_vsi *vsi)
 			/* .. or INACTIVE                           */
 			    new_mac->state == I40E_FILTER_INACTIVE ||
 			    new_mac->f->state == I40E_FILTER_NEW_SYNC)
-				new_mac->f->state = new_mac->state;
+				i40e_filter_set_state(vsi, new_mac->f,
+						      new_mac->state);
 			hlist_del(&new_mac->hlist);
 			kfree(new_mac);
 		}
@@ -3083,17 +3526,16 @@ int i40e_sync_vsi_filters(struct i40e_vsi *vsi)
 		add_list = NULL;
 	}
 
-	/* Determine the number of active and failed filters. */
+	/* The number of active and failed filters is kept up to date by
+	 * i40e_filter_set_state().
+	 */
 	spin_lock_bh(&vsi->mac_filter_hash_lock);
-	vsi->active_filters = 0;
-	hash_for_each(vsi->mac_filter_hash, bkt, f, hlist) {
-		if (f->state == I40E_FILTER_ACTIVE)
-			vsi->active_filters++;
-		else if (f->state == I40E_FILTER_FAILED)
-			failed_filters++;
-	}
+	failed_filters = vsi->failed_filters;
 	spin_unlock_bh(&vsi->mac_filter_hash_lock);
 
+	vsi->filter_sync_dirty = filter_sync_dirty;
+	vsi->filter_sync_ns = ktime_get_ns() - sync_start;
+
 	/* Check if we are able to exit overflow promiscuous mode. We can
 	 * safely exit if we didn't just enter, we no longer have any failed
 	 * filters, and we have reduced filters below the threshold value.
@@ -3538,7 +3980,7 @@ int i40e_add_vlan_all_mac(struct i40e_vsi *vsi, s16 vid)
 		 * in place.
 		 */
 		if (f->state == I40E_FILTER_REMOVE && f->vlan == vid) {
-			f->state = I40E_FILTER_ACTIVE;
+			i40e_filter_set_state(vsi, f, I40E_FILTER_ACTIVE);
 			continue;
 		} else if (f->state == I40E_FILTER_REMOVE) {
 			continue;
@@ -3606,9 +4048,9 @@ void i40e_rm_vlan_all_mac(struct i40e_vsi *vsi, s16 vid)
 {
 	struct i40e_mac_filter *f;
 	struct hlist_node *h;
-	int bkt;
 
-	hash_for_each_safe(vsi->mac_filter_hash, bkt, h, f, hlist) {
+	hash_for_each_possible_safe(vsi->vlan_filter_hash, f, h, vlan_hlist,
+				    i40e_vlan_to_hkey(vid)) {
 		if (f->vlan == vid)
 			__i40e_del_filter(vsi, f);
 	}
@@ -4618,16 +5060,26 @@ static void i40e_fdir_filter_restore(struct i40e_vsi *vsi)
 	struct i40e_pf *pf = vsi->back;
 	struct hlist_node *node;
 
+	/* a full replay supersedes any flush still in flight */
+	pf->fd_flush_state = I40E_FD_FLUSH_IDLE;
+	pf->fd_replay_pos = NULL;
+
 	if (!(pf->flags & I40E_FLAG_FD_SB_ENABLED))
 		return;
 
 	/* reset FDIR counters as we're replaying all existing filters */
 	i40e_reset_fdir_filter_cnt(pf);
 
+	/* post all of the filters back to back and only then hand them to
+	 * the HW, failures are reported per filter by i40e_fd_handle_status
+	 */
+	mutex_lock(&pf->fdir_mutex);
 	hlist_for_each_entry_safe(filter, node,
 				  &pf->fdir_filter_list, fdir_node) {
-		i40e_add_del_fdir(vsi, filter, true);
+		__i40e_add_del_fdir(vsi, filter, true);
 	}
+	i40e_fdir_kick(pf);
+	mutex_unlock(&pf->fdir_mutex);
 }
 
 /**
@@ -4905,6 +5357,9 @@ static void i40e_vsi_configure_msix(struct i40e_vsi *vsi)
 		     q_vector->tx.target_itr >> 1);
 		q_vector->tx.current_itr = q_vector->tx.target_itr;
 
+		q_vector->intrl = vsi->int_rate_limit;
+		q_vector->intrl_busy_polls = 0;
+		q_vector->intrl_idle_irqs = 0;
 		wr32(hw, I40E_PFINT_RATEN(vector - 1),
 		     i40e_intrl_usec_to_reg(vsi->int_rate_limit));
 
@@ -5053,20 +5508,102 @@ void i40e_irq_dynamic_enable_icr0(struct i40e_pf *pf)
 }
 
 /**
- * i40e_msix_clean_rings - MSIX mode Interrupt Handler
- * @irq: interrupt number
- * @data: pointer to a q_vector
+ * i40e_msix_clean_rings - MSIX mode Interrupt Handler
+ * @irq: interrupt number
+ * @data: pointer to a q_vector
+ **/
+static irqreturn_t i40e_msix_clean_rings(int irq, void *data)
+{
+	struct i40e_q_vector *q_vector = data;
+
+	if (!q_vector->tx.ring && !q_vector->rx.ring)
+		return IRQ_HANDLED;
+
+	napi_schedule_irqoff(&q_vector->napi);
+
+	return IRQ_HANDLED;
+}
+
+#ifdef HAVE_NAPI_THREADED
+/**
+ * i40e_napi_thread_set_affinity - pin a threaded NAPI kthread to its vector
+ * @q_vector: the q_vector whose NAPI kthread is updated
+ *
+ * When NAPI runs in threaded mode and the napi-thread-affinity private flag
+ * is set, restrict the kthread to the CPUs the vector's interrupt is affine
+ * to; otherwise let the scheduler place it anywhere. Does nothing while NAPI
+ * is serviced from softirq context.
+ *
+ * With the flag clear this undoes any pinning, including one set by the
+ * user with taskset, so only call it then when the flag was just cleared.
+ *
+ * Note: expects to be called while under rtnl_lock()
+ **/
+static void i40e_napi_thread_set_affinity(struct i40e_q_vector *q_vector)
+{
+	struct task_struct *thread = q_vector->napi.thread;
+
+	if (!thread)
+		return;
+
+#ifdef HAVE_IRQ_AFFINITY_NOTIFY
+	if (q_vector->vsi->back->flags & I40E_FLAG_NAPI_THREAD_AFFINITY) {
+		set_cpus_allowed_ptr(thread, &q_vector->affinity_mask);
+		return;
+	}
+#endif /* HAVE_IRQ_AFFINITY_NOTIFY */
+	set_cpus_allowed_ptr(thread, cpu_possible_mask);
+}
+
+#ifdef HAVE_IRQ_AFFINITY_NOTIFY
+/**
+ * i40e_napi_thread_affinity_task - apply a new IRQ affinity to the kthread
+ * @work: the affinity_work of the q_vector
+ *
+ * The NAPI kthread can only be looked up safely under RTNL, but the vector
+ * is freed with RTNL held and this work is cancelled synchronously there,
+ * so RTNL is only tried here and the work retries while it is contended.
+ **/
+static void i40e_napi_thread_affinity_task(struct work_struct *work)
+{
+	struct i40e_q_vector *q_vector =
+		container_of(to_delayed_work(work), struct i40e_q_vector,
+			     affinity_work);
+
+	if (!rtnl_trylock()) {
+		schedule_delayed_work(&q_vector->affinity_work,
+				      msecs_to_jiffies(10));
+		return;
+	}
+
+	if (q_vector->vsi->back->flags & I40E_FLAG_NAPI_THREAD_AFFINITY)
+		i40e_napi_thread_set_affinity(q_vector);
+	rtnl_unlock();
+}
+
+#endif /* HAVE_IRQ_AFFINITY_NOTIFY */
+#endif /* HAVE_NAPI_THREADED */
+/**
+ * i40e_vsi_napi_thread_affinity - apply NAPI kthread pinning to a VSI
+ * @vsi: the VSI whose q_vectors are updated
+ *
+ * Re-evaluates the CPU placement of every threaded NAPI kthread of the VSI,
+ * e.g. after the napi-thread-affinity private flag changed.
+ *
+ * Note: expects to be called while under rtnl_lock()
  **/
-static irqreturn_t i40e_msix_clean_rings(int irq, void *data)
+void i40e_vsi_napi_thread_affinity(struct i40e_vsi *vsi)
 {
-	struct i40e_q_vector *q_vector = data;
-
-	if (!q_vector->tx.ring && !q_vector->rx.ring)
-		return IRQ_HANDLED;
+#ifdef HAVE_NAPI_THREADED
+	int q_idx;
 
-	napi_schedule_irqoff(&q_vector->napi);
+	if (!vsi->netdev || !vsi->q_vectors)
+		return;
 
-	return IRQ_HANDLED;
+	for (q_idx = 0; q_idx < vsi->num_q_vectors; q_idx++)
+		if (vsi->q_vectors[q_idx])
+			i40e_napi_thread_set_affinity(vsi->q_vectors[q_idx]);
+#endif /* HAVE_NAPI_THREADED */
 }
 
 #ifdef HAVE_IRQ_AFFINITY_NOTIFY
@@ -5085,6 +5622,11 @@ static void i40e_irq_affinity_notify(struct irq_affinity_notify *notify,
 		container_of(notify, struct i40e_q_vector, affinity_notify);
 
 	cpumask_copy(&q_vector->affinity_mask, mask);
+
+#ifdef HAVE_NAPI_THREADED
+	if (q_vector->vsi->back->flags & I40E_FLAG_NAPI_THREAD_AFFINITY)
+		schedule_delayed_work(&q_vector->affinity_work, 0);
+#endif /* HAVE_NAPI_THREADED */
 }
 
 /**
@@ -5145,6 +5687,10 @@ int i40e_vsi_request_irq_msix(struct i40e_vsi *vsi, char *basename)
 			goto free_queue_irqs;
 		}
 
+#ifdef HAVE_NETIF_NAPI_SET_IRQ
+		if (vsi->netdev)
+			netif_napi_set_irq(&q_vector->napi, irq_num);
+#endif /* HAVE_NETIF_NAPI_SET_IRQ */
 #ifdef HAVE_IRQ_AFFINITY_NOTIFY
 		/* register for affinity change notifications */
 		q_vector->affinity_notify.notify = i40e_irq_affinity_notify;
@@ -5396,6 +5942,11 @@ enable_intr:
 	wr32(hw, I40E_PFINT_ICR0_ENA, ena_mask);
 	if (!test_bit(__I40E_DOWN, pf->state) ||
 	    test_bit(__I40E_RECOVERY_MODE, pf->state)) {
+		/* only after ena_mask is written, the AdminQ task re-enables
+		 * the AdminQ cause when it is done
+		 */
+		if (test_bit(__I40E_ADMINQ_EVENT_PENDING, pf->state))
+			i40e_adminq_event_schedule(pf);
 		i40e_service_event_schedule(pf);
 		i40e_irq_dynamic_enable_icr0(pf);
 	}
@@ -5651,7 +6202,7 @@ static void i40e_netpoll(struct net_device *netdev)
  * Returns -ETIMEDOUT in case of failing to reach the requested state after
  * multiple retries; else will return 0 in case of success.
  **/
-static int i40e_pf_txq_wait(struct i40e_pf *pf, int pf_q, bool enable)
+int i40e_pf_txq_wait(struct i40e_pf *pf, int pf_q, bool enable)
 {
 	int i;
 	u32 tx_reg;
@@ -5678,7 +6229,7 @@ static int i40e_pf_txq_wait(struct i40e_pf *pf, int pf_q, bool enable)
  * required after the operation is expected to be handled by the caller of
  * this function.
  **/
-static void i40e_control_tx_q(struct i40e_pf *pf, int pf_q, bool enable)
+void i40e_control_tx_q(struct i40e_pf *pf, int pf_q, bool enable)
 {
 	struct i40e_hw *hw = &pf->hw;
 	u32 tx_reg;
@@ -5749,8 +6300,8 @@ static int i40e_vsi_control_tx(struct i40e_vsi *vsi, bool enable)
 	struct i40e_pf *pf = vsi->back;
 	int i, pf_q, ret = 0;
 
-	pf_q = vsi->base_queue;
-	for (i = 0; i < vsi->num_queue_pairs; i++, pf_q++) {
+	for (i = 0; i < vsi->num_queue_pairs; i++) {
+		pf_q = i40e_vsi_pf_q(vsi, i);
 		ret = i40e_control_wait_tx_q(vsi->seid, pf,
 					     pf_q,
 					     false /*is xdp*/, enable);
@@ -5781,7 +6332,7 @@ static int i40e_vsi_control_tx(struct i40e_vsi *vsi, bool enable)
  * Returns -ETIMEDOUT in case of failing to reach the requested state after
  * multiple retries; else will return 0 in case of success.
  **/
-static int i40e_pf_rxq_wait(struct i40e_pf *pf, int pf_q, bool enable)
+int i40e_pf_rxq_wait(struct i40e_pf *pf, int pf_q, bool enable)
 {
 	int i;
 	u32 rx_reg;
@@ -5809,7 +6360,7 @@ static int i40e_pf_rxq_wait(struct i40e_pf *pf, int pf_q, bool enable)
  * any delay required after the operation is expected to be
  * handled by the caller of this function.
  **/
-static void i40e_control_rx_q(struct i40e_pf *pf, int pf_q, bool enable)
+void i40e_control_rx_q(struct i40e_pf *pf, int pf_q, bool enable)
 {
 	struct i40e_hw *hw = &pf->hw;
 	u32 rx_reg;
@@ -5870,8 +6421,8 @@ static int i40e_vsi_control_rx(struct i40e_vsi *vsi, bool enable)
 	struct i40e_pf *pf = vsi->back;
 	int i, pf_q, ret = 0;
 
-	pf_q = vsi->base_queue;
-	for (i = 0; i < vsi->num_queue_pairs; i++, pf_q++) {
+	for (i = 0; i < vsi->num_queue_pairs; i++) {
+		pf_q = i40e_vsi_pf_q(vsi, i);
 		ret = i40e_control_wait_rx_q(pf, pf_q, enable);
 		if (ret) {
 			dev_info(&pf->pdev->dev,
@@ -5938,8 +6489,8 @@ void i40e_vsi_stop_rings_no_wait(struct i40e_vsi *vsi)
 	struct i40e_pf *pf = vsi->back;
 	int i, pf_q;
 
-	pf_q = vsi->base_queue;
-	for (i = 0; i < vsi->num_queue_pairs; i++, pf_q++) {
+	for (i = 0; i < vsi->num_queue_pairs; i++) {
+		pf_q = i40e_vsi_pf_q(vsi, i);
 		i40e_control_tx_q(pf, pf_q, false);
 		i40e_control_rx_q(pf, pf_q, false);
 	}
@@ -5981,6 +6532,11 @@ static void i40e_vsi_free_irq(struct i40e_vsi *vsi)
 			/* clear the affinity notifier in the IRQ descriptor */
 			irq_set_affinity_notifier(irq_num, NULL);
 #endif
+#ifdef HAVE_NETIF_NAPI_SET_IRQ
+			if (vsi->netdev)
+				netif_napi_set_irq(&vsi->q_vectors[i]->napi,
+						   -1);
+#endif /* HAVE_NETIF_NAPI_SET_IRQ */
 			synchronize_irq(irq_num);
 			free_irq(irq_num, vsi->q_vectors[i]);
 
@@ -6089,6 +6645,9 @@ static void i40e_free_q_vector(struct i40e_vsi *vsi, int v_idx)
 	i40e_for_each_ring(ring, q_vector->rx)
 		ring->q_vector = NULL;
 
+#if defined(HAVE_IRQ_AFFINITY_NOTIFY) && defined(HAVE_NAPI_THREADED)
+	cancel_delayed_work_sync(&q_vector->affinity_work);
+#endif
 	/* only VSI w/ an associated netdev is set up w/ NAPI */
 	if (vsi->netdev)
 		netif_napi_del(&q_vector->napi);
@@ -6155,6 +6714,34 @@ static void i40e_clear_interrupt_scheme(struct i40e_pf *pf)
 	i40e_reset_interrupt_capability(pf);
 }
 
+/**
+ * i40e_q_vector_set_napi - link the rings of a q_vector to its NAPI instance
+ * @q_vector: the q_vector whose rings are updated
+ * @link: true to associate the rings with the NAPI instance, false to clear
+ *
+ * Lets the stack report the NAPI id serving every Rx and Tx queue, so that
+ * busy polling and threaded NAPI users can map queues to polling contexts.
+ **/
+static void i40e_q_vector_set_napi(struct i40e_q_vector *q_vector, bool link)
+{
+#ifdef HAVE_NETIF_QUEUE_SET_NAPI
+	struct napi_struct *napi = link ? &q_vector->napi : NULL;
+	struct net_device *netdev = q_vector->vsi->netdev;
+	struct i40e_ring *ring;
+
+	i40e_for_each_ring(ring, q_vector->rx)
+		netif_queue_set_napi(netdev, ring->queue_index,
+				     NETDEV_QUEUE_TYPE_RX, napi);
+
+	i40e_for_each_ring(ring, q_vector->tx) {
+		if (ring_is_xdp(ring))
+			continue;
+		netif_queue_set_napi(netdev, ring->queue_index,
+				     NETDEV_QUEUE_TYPE_TX, napi);
+	}
+#endif /* HAVE_NETIF_QUEUE_SET_NAPI */
+}
+
 /**
  * i40e_napi_enable_all - Enable NAPI for all q_vectors in the VSI
  * @vsi: the VSI being configured
@@ -6169,8 +6756,16 @@ static void i40e_napi_enable_all(struct i40e_vsi *vsi)
 	for (q_idx = 0; q_idx < vsi->num_q_vectors; q_idx++) {
 		struct i40e_q_vector *q_vector = vsi->q_vectors[q_idx];
 
-		if (q_vector->tx.ring || q_vector->rx.ring)
-			napi_enable(&q_vector->napi);
+		if (!q_vector->tx.ring && !q_vector->rx.ring)
+			continue;
+
+		napi_enable(&q_vector->napi);
+		i40e_q_vector_set_napi(q_vector, true);
+#ifdef HAVE_NAPI_THREADED
+		/* leave placement made by the user alone unless pinning */
+		if (vsi->back->flags & I40E_FLAG_NAPI_THREAD_AFFINITY)
+			i40e_napi_thread_set_affinity(q_vector);
+#endif /* HAVE_NAPI_THREADED */
 	}
 }
 
@@ -6188,8 +6783,11 @@ static void i40e_napi_disable_all(struct i40e_vsi *vsi)
 	for (q_idx = 0; q_idx < vsi->num_q_vectors; q_idx++) {
 		struct i40e_q_vector *q_vector = vsi->q_vectors[q_idx];
 
-		if (q_vector->tx.ring || q_vector->rx.ring)
-			napi_disable(&q_vector->napi);
+		if (!q_vector->tx.ring && !q_vector->rx.ring)
+			continue;
+
+		i40e_q_vector_set_napi(q_vector, false);
+		napi_disable(&q_vector->napi);
 	}
 }
 
@@ -6289,8 +6887,8 @@ int i40e_vsi_wait_queues_disabled(struct i40e_vsi *vsi)
 	struct i40e_pf *pf = vsi->back;
 	int i, pf_q, ret;
 
-	pf_q = vsi->base_queue;
-	for (i = 0; i < vsi->num_queue_pairs; i++, pf_q++) {
+	for (i = 0; i < vsi->num_queue_pairs; i++) {
+		pf_q = i40e_vsi_pf_q(vsi, i);
 		/* Check and wait for the Tx queue */
 		ret = i40e_pf_txq_wait(pf, pf_q, false);
 		if (ret) {
@@ -8167,7 +8765,7 @@ i40e_status i40e_set_bw_limit(struct i40e_vsi *vsi, u16 seid, u64 max_tx_rate)
 	/* Tx rate credits are in values of 50Mbps, 0 is disabled */
 	ret = i40e_aq_config_vsi_bw_limit(&pf->hw, seid,
 					  max_tx_rate / I40E_BW_CREDIT_DIVISOR,
-					  I40E_MAX_BW_INACTIVE_ACCUM, NULL);
+					  vsi->bw_burst, NULL);
 	if (ret)
 		dev_err(&pf->pdev->dev,
 			"Failed set tx rate (%llu Mbps) for vsi->seid %u, err %s aq_err %s\n",
@@ -8410,7 +9008,7 @@ static void i40e_remove_queue_channels(struct i40e_vsi *vsi)
 			if (cfilter->seid != ch->seid)
 				continue;
 
-			hash_del(&cfilter->cloud_node);
+			i40e_cloud_index_del(pf, cfilter);
 			if (cfilter->dst_port)
 				ret = i40e_add_del_cloud_filter_big_buf(vsi,
 									cfilter,
@@ -8433,7 +9031,7 @@ static void i40e_remove_queue_channels(struct i40e_vsi *vsi)
 			if (cfilter->seid != ch->seid)
 				continue;
 
-			hash_del(&cfilter->cloud_node);
+			i40e_cloud_index_del(pf, cfilter);
 			if (cfilter->dst_port)
 				ret = i40e_add_del_cloud_filter_big_buf(vsi,
 									cfilter,
@@ -9645,6 +10243,179 @@ static int i40e_handle_tclass(struct i40e_vsi *vsi, u32 tc,
 	return -EINVAL;
 }
 
+#ifdef HAVE_TC_FLOW_RULE_INFRASTRUCTURE
+/**
+ * i40e_clsflower_is_drop - Check if the only action of a flower rule is drop
+ * @cls_flower: Pointer to struct flow_cls_offload
+ **/
+static bool i40e_clsflower_is_drop(struct flow_cls_offload *cls_flower)
+{
+	struct flow_rule *rule = flow_cls_offload_flow_rule(cls_flower);
+	struct flow_action_entry *act;
+	int i;
+
+	if (!rule->action.num_entries)
+		return false;
+
+	flow_action_for_each(i, act, &rule->action)
+		if (act->id != FLOW_ACTION_DROP)
+			return false;
+
+	return true;
+}
+
+/**
+ * i40e_clsflower_to_fdir - Translate a parsed flower match into a flow spec
+ * @pf: Pointer to PF
+ * @filter: flower match as parsed by i40e_parse_cls_flower
+ * @fsp: flow spec to fill, in the Rx view like ethtool
+ *
+ * Cloud filters have no drop action, so drop rules are programmed as
+ * sideband Flow Director filters instead. Only the L3/L4 tuples that
+ * ethtool ntuple filters can express are accepted.
+ **/
+static int i40e_clsflower_to_fdir(struct i40e_pf *pf,
+				  struct i40e_cloud_filter *filter,
+				  struct ethtool_rx_flow_spec *fsp)
+{
+	if (filter->flags & (I40E_CLOUD_FIELD_OMAC | I40E_CLOUD_FIELD_IMAC |
+			     I40E_CLOUD_FIELD_IVLAN | I40E_CLOUD_FIELD_TEN_ID)) {
+		dev_err(&pf->pdev->dev,
+			"Drop action supports IP address and port matches only\n");
+		return -EOPNOTSUPP;
+	}
+
+	switch (filter->n_proto) {
+	case ETH_P_IP:
+		switch (filter->ip_proto) {
+		case IPPROTO_TCP:
+			fsp->flow_type = TCP_V4_FLOW;
+			break;
+		case IPPROTO_UDP:
+			fsp->flow_type = UDP_V4_FLOW;
+			break;
+		case IPPROTO_SCTP:
+			fsp->flow_type = SCTP_V4_FLOW;
+			break;
+		default:
+			goto err_proto;
+		}
+		fsp->h_u.tcp_ip4_spec.ip4src = filter->src_ipv4;
+		fsp->h_u.tcp_ip4_spec.ip4dst = filter->dst_ipv4;
+		fsp->h_u.tcp_ip4_spec.psrc = filter->src_port;
+		fsp->h_u.tcp_ip4_spec.pdst = filter->dst_port;
+		if (filter->src_ipv4)
+			fsp->m_u.tcp_ip4_spec.ip4src = htonl(0xFFFFFFFF);
+		if (filter->dst_ipv4)
+			fsp->m_u.tcp_ip4_spec.ip4dst = htonl(0xFFFFFFFF);
+		if (filter->src_port)
+			fsp->m_u.tcp_ip4_spec.psrc = htons(0xFFFF);
+		if (filter->dst_port)
+			fsp->m_u.tcp_ip4_spec.pdst = htons(0xFFFF);
+		break;
+#ifdef HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC
+	case ETH_P_IPV6:
+		switch (filter->ip_proto) {
+		case IPPROTO_TCP:
+			fsp->flow_type = TCP_V6_FLOW;
+			break;
+		case IPPROTO_UDP:
+			fsp->flow_type = UDP_V6_FLOW;
+			break;
+		case IPPROTO_SCTP:
+			fsp->flow_type = SCTP_V6_FLOW;
+			break;
+		default:
+			goto err_proto;
+		}
+		memcpy(fsp->h_u.tcp_ip6_spec.ip6src, filter->src_ipv6,
+		       sizeof(fsp->h_u.tcp_ip6_spec.ip6src));
+		memcpy(fsp->h_u.tcp_ip6_spec.ip6dst, filter->dst_ipv6,
+		       sizeof(fsp->h_u.tcp_ip6_spec.ip6dst));
+		fsp->h_u.tcp_ip6_spec.psrc = filter->src_port;
+		fsp->h_u.tcp_ip6_spec.pdst = filter->dst_port;
+		if (!ipv6_addr_any(&filter->ip.v6.src_ip6))
+			memset(fsp->m_u.tcp_ip6_spec.ip6src, 0xFF,
+			       sizeof(fsp->m_u.tcp_ip6_spec.ip6src));
+		if (!ipv6_addr_any(&filter->ip.v6.dst_ip6))
+			memset(fsp->m_u.tcp_ip6_spec.ip6dst, 0xFF,
+			       sizeof(fsp->m_u.tcp_ip6_spec.ip6dst));
+		if (filter->src_port)
+			fsp->m_u.tcp_ip6_spec.psrc = htons(0xFFFF);
+		if (filter->dst_port)
+			fsp->m_u.tcp_ip6_spec.pdst = htons(0xFFFF);
+		break;
+#endif /* HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC */
+	default:
+		dev_err(&pf->pdev->dev,
+			"Drop action requires an IPv4 or IPv6 match\n");
+		return -EOPNOTSUPP;
+	}
+
+	fsp->ring_cookie = RX_CLS_FLOW_DISC;
+	return 0;
+
+err_proto:
+	dev_err(&pf->pdev->dev,
+		"Drop action supports TCP, UDP and SCTP only\n");
+	return -EOPNOTSUPP;
+}
+
+/**
+ * i40e_configure_clsflower_drop - Offload a tc flower drop rule
+ * @vsi: Pointer to VSI
+ * @cls_flower: Pointer to struct flow_cls_offload
+ **/
+static int i40e_configure_clsflower_drop(struct i40e_vsi *vsi,
+					 struct flow_cls_offload *cls_flower)
+{
+	struct ethtool_rx_flow_spec fsp = {};
+	struct i40e_cloud_filter filter = {};
+	struct i40e_pf *pf = vsi->back;
+	int err;
+
+	if (test_bit(__I40E_RESET_RECOVERY_PENDING, pf->state) ||
+	    test_bit(__I40E_RESET_INTR_RECEIVED, pf->state))
+		return -EBUSY;
+
+#ifdef NETIF_F_HW_TC
+	if (!(vsi->netdev->features & NETIF_F_HW_TC) &&
+	    !(pf->flags & I40E_FLAG_CLS_FLOWER)) {
+		dev_err(&pf->pdev->dev,
+			"Can't apply TC flower filters, turn ON hw-tc-offload and try again\n");
+		return -EOPNOTSUPP;
+	}
+#endif /* NETIF_F_HW_TC */
+
+	if (!(pf->flags & I40E_FLAG_FD_SB_ENABLED)) {
+		dev_err(&pf->pdev->dev,
+			"Drop action needs Flow Director Sideband, turn ntuple on and remove hw_tc filters\n");
+		return -EOPNOTSUPP;
+	}
+
+	err = i40e_parse_cls_flower(vsi, cls_flower, &filter);
+	if (err < 0)
+		return err;
+
+	err = i40e_clsflower_to_fdir(pf, &filter, &fsp);
+	if (err)
+		return err;
+
+	mutex_lock(&pf->fdir_mutex);
+	if (i40e_fdir_index_find_tc_cookie(pf, cls_flower->cookie)) {
+		err = -EEXIST;
+		goto unlock;
+	}
+
+	err = i40e_fdir_free_loc(pf, &fsp.location);
+	if (!err)
+		err = i40e_add_fdir_tc(vsi, &fsp, cls_flower->cookie);
+unlock:
+	mutex_unlock(&pf->fdir_mutex);
+	return err;
+}
+
+#endif /* HAVE_TC_FLOW_RULE_INFRASTRUCTURE */
 /**
  * i40e_configure_clsflower - Configure tc flower filters
  * @vsi: Pointer to VSI
@@ -9659,6 +10430,11 @@ static int i40e_configure_clsflower(struct i40e_vsi *vsi,
 	struct i40e_pf *pf = vsi->back;
 	int err = 0;
 
+#ifdef HAVE_TC_FLOW_RULE_INFRASTRUCTURE
+	if (i40e_clsflower_is_drop(cls_flower))
+		return i40e_configure_clsflower_drop(vsi, cls_flower);
+
+#endif /* HAVE_TC_FLOW_RULE_INFRASTRUCTURE */
 	if (tc < 0) {
 		dev_err(&vsi->back->pdev->dev, "Invalid traffic class\n");
 		return -EINVAL;
@@ -9722,12 +10498,14 @@ static int i40e_configure_clsflower(struct i40e_vsi *vsi,
 		goto err;
 	}
 
-	/* add filter to the ordered list */
-	INIT_HLIST_NODE(&filter->cloud_node);
-
-	hlist_add_head(&filter->cloud_node, &pf->cloud_filter_list);
-
-	pf->num_cloud_filters++;
+	err = i40e_cloud_index_add(pf, filter, false);
+	if (err) {
+		if (filter->dst_port)
+			i40e_add_del_cloud_filter_big_buf(vsi, filter, false);
+		else
+			i40e_add_del_cloud_filter(vsi, filter, false);
+		goto err;
+	}
 
 	return err;
 err:
@@ -9744,14 +10522,7 @@ err:
 static struct i40e_cloud_filter *i40e_find_cloud_filter(struct i40e_vsi *vsi,
 							unsigned long *cookie)
 {
-	struct i40e_cloud_filter *filter = NULL;
-	struct hlist_node *node2;
-
-	hlist_for_each_entry_safe(filter, node2,
-				  &vsi->back->cloud_filter_list, cloud_node)
-		if (!memcmp(cookie, &filter->cookie, sizeof(filter->cookie)))
-			return filter;
-	return NULL;
+	return i40e_cloud_index_find_cookie(vsi->back, *cookie);
 }
 
 /**
@@ -9769,10 +10540,23 @@ static int i40e_delete_clsflower(struct i40e_vsi *vsi,
 
 	filter = i40e_find_cloud_filter(vsi, &cls_flower->cookie);
 
-	if (!filter)
+	if (!filter) {
+#ifdef HAVE_TC_FLOW_RULE_INFRASTRUCTURE
+		struct i40e_fdir_filter *rule;
+
+		err = -EINVAL;
+		mutex_lock(&pf->fdir_mutex);
+		rule = i40e_fdir_index_find_tc_cookie(pf, cls_flower->cookie);
+		if (rule)
+			err = i40e_del_fdir_owned(vsi, rule);
+		mutex_unlock(&pf->fdir_mutex);
+		return err;
+#else
 		return -EINVAL;
+#endif /* HAVE_TC_FLOW_RULE_INFRASTRUCTURE */
+	}
 
-	hash_del(&filter->cloud_node);
+	i40e_cloud_index_del(pf, filter);
 
 	if (filter->dst_port)
 		err = i40e_add_del_cloud_filter_big_buf(vsi, filter, false);
@@ -9787,7 +10571,6 @@ static int i40e_delete_clsflower(struct i40e_vsi *vsi,
 		return i40e_aq_rc_to_posix(err, pf->hw.aq.asq_last_status);
 	}
 
-	pf->num_cloud_filters--;
 	if (!pf->num_cloud_filters)
 		if ((pf->flags & I40E_FLAG_FD_SB_TO_CLOUD_FILTER) &&
 		    !(pf->flags & I40E_FLAG_FD_SB_INACTIVE)) {
@@ -9798,6 +10581,75 @@ static int i40e_delete_clsflower(struct i40e_vsi *vsi,
 	return 0;
 }
 
+#ifdef HAVE_TC_FLOW_RULE_INFRASTRUCTURE
+/**
+ * i40e_flow_stats_update - Report packets matched by an offloaded rule
+ * @stats: flower stats to update
+ * @pkts: packets matched since the previous report
+ * @drops: packets dropped since the previous report
+ * @lastused: jiffies of the last match
+ **/
+static void i40e_flow_stats_update(struct flow_stats *stats, u64 pkts,
+				   u64 drops, u64 lastused)
+{
+#if defined(HAVE_FLOW_STATS_UPDATE_DROPS)
+	flow_stats_update(stats, 0, pkts, drops, lastused,
+			  FLOW_ACTION_HW_STATS_IMMEDIATE);
+#elif defined(HAVE_FLOW_STATS_UPDATE_HW_STATS)
+	flow_stats_update(stats, 0, pkts, lastused,
+			  FLOW_ACTION_HW_STATS_IMMEDIATE);
+#else
+	flow_stats_update(stats, 0, pkts, lastused);
+#endif /* HAVE_FLOW_STATS_UPDATE_DROPS */
+}
+
+/**
+ * i40e_stats_clsflower - Report hardware counters of a tc flower rule
+ * @vsi: Pointer to VSI
+ * @cls_flower: Pointer to struct flow_cls_offload
+ *
+ * Only drop rules, which are Flow Director filters with a counter of their
+ * own, have hardware statistics. Byte counts are not available.
+ **/
+static int i40e_stats_clsflower(struct i40e_vsi *vsi,
+				struct flow_cls_offload *cls_flower)
+{
+	struct i40e_pf *pf = vsi->back;
+	struct i40e_fdir_filter *rule;
+	u64 hits, pkts;
+
+	mutex_lock(&pf->fdir_mutex);
+	rule = i40e_fdir_index_find_tc_cookie(pf, cls_flower->cookie);
+	if (!rule) {
+		mutex_unlock(&pf->fdir_mutex);
+		/* cloud filters steering to a hw_tc have no counters */
+		if (i40e_find_cloud_filter(vsi, &cls_flower->cookie))
+			return 0;
+		return -EINVAL;
+	}
+
+	if (!i40e_fdir_rule_hits(pf, rule, &hits)) {
+		mutex_unlock(&pf->fdir_mutex);
+		return 0;
+	}
+
+	/* per-rule hits restart from zero when the PF stats are reset */
+	if (hits < rule->tc_hits_reported)
+		rule->tc_hits_reported = 0;
+
+	pkts = hits - rule->tc_hits_reported;
+	if (pkts) {
+		rule->tc_hits_reported = hits;
+		rule->tc_lastused = jiffies;
+	}
+
+	i40e_flow_stats_update(&cls_flower->stats, pkts, pkts,
+			       rule->tc_lastused);
+	mutex_unlock(&pf->fdir_mutex);
+	return 0;
+}
+
+#endif /* HAVE_TC_FLOW_RULE_INFRASTRUCTURE */
 /**
  * i40e_setup_tc_cls_flower - flower classifier offloads
  * @np: net device to configure
@@ -9817,7 +10669,11 @@ static int i40e_setup_tc_cls_flower(struct i40e_netdev_priv *np,
 	case FLOW_CLS_DESTROY:
 		return i40e_delete_clsflower(vsi, cls_flower);
 	case FLOW_CLS_STATS:
+#ifdef HAVE_TC_FLOW_RULE_INFRASTRUCTURE
+		return i40e_stats_clsflower(vsi, cls_flower);
+#else
 		return -EOPNOTSUPP;
+#endif /* HAVE_TC_FLOW_RULE_INFRASTRUCTURE */
 	default:
 		return -EOPNOTSUPP;
 	}
@@ -10052,11 +10908,15 @@ static void i40e_fdir_filter_exit(struct i40e_pf *pf)
 	struct i40e_flex_pit *pit_entry, *tmp;
 	struct hlist_node *node2;
 
+	mutex_lock(&pf->fdir_mutex);
 	hlist_for_each_entry_safe(filter, node2,
 				  &pf->fdir_filter_list, fdir_node) {
-		hlist_del(&filter->fdir_node);
+		i40e_fdir_index_del(pf, filter);
 		kfree(filter);
 	}
+#ifdef HAVE_XARRAY_API
+	xa_destroy(&pf->fdir_filter_xa);
+#endif /* HAVE_XARRAY_API */
 
 	list_for_each_entry_safe(pit_entry, tmp, &pf->l3_flex_pit_list, list) {
 		list_del(&pit_entry->list);
@@ -10071,6 +10931,7 @@ static void i40e_fdir_filter_exit(struct i40e_pf *pf)
 	INIT_LIST_HEAD(&pf->l4_flex_pit_list);
 
 	pf->fdir_pf_active_filters = 0;
+	pf->fdir_vf_active_filters = 0;
 	i40e_reset_fdir_filter_cnt(pf);
 
 	/* Reprogram the default input set for TCP/IPv4 */
@@ -10116,6 +10977,7 @@ static void i40e_fdir_filter_exit(struct i40e_pf *pf)
 
 	i40e_write_fd_input_set(pf, I40E_FILTER_PCTYPE_FRAG_IPV6,
 				I40E_L3_SRC_MASK | I40E_L3_DST_MASK);
+	mutex_unlock(&pf->fdir_mutex);
 }
 
 /**
@@ -10131,9 +10993,12 @@ static void i40e_cloud_filter_exit(struct i40e_pf *pf)
 
 	hlist_for_each_entry_safe(cfilter, node,
 				  &pf->cloud_filter_list, cloud_node) {
-		hlist_del(&cfilter->cloud_node);
+		i40e_cloud_index_del(pf, cfilter);
 		kfree(cfilter);
 	}
+#ifdef HAVE_XARRAY_API
+	xa_destroy(&pf->cloud_filter_xa);
+#endif /* HAVE_XARRAY_API */
 	pf->num_cloud_filters = 0;
 
 	if ((pf->flags & I40E_FLAG_FD_SB_TO_CLOUD_FILTER) &&
@@ -10174,6 +11039,12 @@ int i40e_close(struct net_device *netdev)
  * The essential difference in resets is that the PF Reset
  * doesn't clear the packet buffers, doesn't reset the PE
  * firmware, and doesn't bother the other PFs on the chip.
+ *
+ * Entry points from outside the driver (ethtool, debugfs, SR-IOV
+ * configuration and the reset subtask) hold service_rwsem for writing, which
+ * nests inside RTNL, to keep the service subtasks out. It is not taken here
+ * because the rebuild itself, which already holds it, can end up here when a
+ * VSI fails to come back up.
  **/
 void i40e_do_reset(struct i40e_pf *pf, u32 reset_flags, bool lock_acquired)
 {
@@ -10267,6 +11138,19 @@ void i40e_do_reset(struct i40e_pf *pf, u32 reset_flags, bool lock_acquired)
 	}
 }
 
+/**
+ * i40e_adminq_task_stop - Wait for the AdminQ task ahead of a reset
+ * @pf: board private structure
+ *
+ * The AdminQ task takes RTNL for link and LLDP events, so this must be
+ * called before RTNL is taken by the reset entry points.
+ **/
+static void i40e_adminq_task_stop(struct i40e_pf *pf)
+{
+	if (pf->adminq_task.func)
+		cancel_work_sync(&pf->adminq_task);
+}
+
 /**
  * i40e_do_reset_safe - Protected reset path for userland calls.
  * @pf: board private structure
@@ -10275,8 +11159,11 @@ void i40e_do_reset(struct i40e_pf *pf, u32 reset_flags, bool lock_acquired)
  **/
 void i40e_do_reset_safe(struct i40e_pf *pf, u32 reset_flags)
 {
+	i40e_adminq_task_stop(pf);
 	rtnl_lock();
+	down_write(&pf->service_rwsem);
 	i40e_do_reset(pf, reset_flags, true);
+	up_write(&pf->service_rwsem);
 	rtnl_unlock();
 }
 
@@ -10494,7 +11381,9 @@ static void i40e_handle_lan_overflow_event(struct i40e_pf *pf,
 		i40e_vc_notify_vf_reset(vf);
 		/* Allow VF to process pending reset notification */
 		msleep(20);
+		down_write(&pf->vc_rwsem);
 		i40e_reset_vf(vf, false);
+		up_write(&pf->vc_rwsem);
 	}
 }
 
@@ -10584,7 +11473,6 @@ static void i40e_delete_invalid_filter(struct i40e_pf *pf,
 				       struct i40e_fdir_filter *filter)
 {
 	/* Update counters */
-	pf->fdir_pf_active_filters--;
 	pf->fd_inv = 0;
 
 	switch (filter->flow_type) {
@@ -10642,11 +11530,46 @@ static void i40e_delete_invalid_filter(struct i40e_pf *pf,
 #endif /* HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC */
 	}
 
-	/* Remove the filter from the list and free memory */
-	hlist_del(&filter->fdir_node);
+	/* Remove the filter from the indexes and free memory */
+	i40e_fdir_index_del(pf, filter);
 	kfree(filter);
 }
 
+/**
+ * i40e_fdir_free_loc - Find a free Flow Director location for tc or a VF
+ * @pf: Pointer to PF
+ * @loc: filled with the location
+ *
+ * tc drop rules and VF rules are placed from the top of the table downwards
+ * so that they stay out of the way of the low locations usually picked by
+ * ethtool users. The search resumes where the previous one stopped, which
+ * keeps bulk rule installs linear. Called with fdir_mutex held.
+ **/
+int i40e_fdir_free_loc(struct i40e_pf *pf, u32 *loc)
+{
+	u32 max = pf->hw.func_caps.fd_filters_best_effort +
+		  pf->hw.func_caps.fd_filters_guaranteed;
+	u32 i, n;
+
+	if (!max)
+		return -ENOSPC;
+
+	n = pf->fdir_tc_loc_hint;
+	if (n > max)
+		n = max;
+	for (i = 0; i < max; i++) {
+		n = (n ? n : max) - 1;
+		if (i40e_fdir_index_find(pf, n) || i40e_cloud_index_find(pf, n))
+			continue;
+
+		*loc = n;
+		pf->fdir_tc_loc_hint = n;
+		return 0;
+	}
+
+	return -ENOSPC;
+}
+
 /**
  * i40e_fdir_check_and_reenable - Function to reenabe FD ATR or SB if disabled
  * @pf: board private structure
@@ -10655,7 +11578,7 @@ void i40e_fdir_check_and_reenable(struct i40e_pf *pf)
 {
 	struct i40e_fdir_filter *filter;
 	u32 fcnt_prog, fcnt_avail;
-	struct hlist_node *node;
+	unsigned int fd_id;
 
 	if (test_bit(__I40E_FD_FLUSH_REQUESTED, pf->state))
 		return;
@@ -10676,28 +11599,50 @@ void i40e_fdir_check_and_reenable(struct i40e_pf *pf)
 	    (pf->fd_tcp4_filter_cnt == 0) && (pf->fd_tcp6_filter_cnt == 0))
 		i40e_reenable_fdir_atr(pf);
 
-	/* if hw had a problem adding a filter, delete it */
-	if (pf->fd_inv > 0) {
-		hlist_for_each_entry_safe(filter, node,
-					  &pf->fdir_filter_list, fdir_node)
-			if (filter->fd_id == pf->fd_inv)
-				i40e_delete_invalid_filter(pf, filter);
+	/* if hw had a problem adding filters, delete them */
+	for_each_set_bit(fd_id, pf->fd_inv_map, I40E_FDIR_MAX_FD_ID) {
+		clear_bit(fd_id, pf->fd_inv_map);
+		filter = i40e_fdir_index_find(pf, fd_id);
+		if (filter)
+			i40e_delete_invalid_filter(pf, filter);
+	}
+
+	/* fd_ids outside of the map are only tracked one at a time */
+	if (pf->fd_inv >= I40E_FDIR_MAX_FD_ID) {
+		filter = i40e_fdir_index_find(pf, pf->fd_inv);
+		if (filter)
+			i40e_delete_invalid_filter(pf, filter);
 	}
 }
 
 #define I40E_MIN_FD_FLUSH_INTERVAL 10
 #define I40E_MIN_FD_FLUSH_SB_ATR_UNSTABLE 30
+/* how long the HW may take to clear the FD table, and how often to look */
+#define I40E_FD_FLUSH_TIMEOUT_MS	250
+#define I40E_FD_FLUSH_POLL_MS		5
+/* sideband filters replayed per service task run, a few FD ring's worth */
+#define I40E_FD_REPLAY_BUDGET		128
 /**
- * i40e_fdir_flush_and_replay - Function to flush all FD filters and replay SB
+ * i40e_fdir_flush_poll_soon - Have the service task look at the flush again
  * @pf: board private structure
+ *
+ * The service timer normally fires once a second, which is far longer than
+ * the table clear takes, so pull it in while a flush is in flight.
  **/
-static void i40e_fdir_flush_and_replay(struct i40e_pf *pf)
+static void i40e_fdir_flush_poll_soon(struct i40e_pf *pf)
+{
+	mod_timer(&pf->service_timer,
+		  jiffies + msecs_to_jiffies(I40E_FD_FLUSH_POLL_MS));
+}
+
+/**
+ * i40e_fdir_flush_start - Start flushing all FD filters
+ * @pf: board private structure
+ **/
+static void i40e_fdir_flush_start(struct i40e_pf *pf)
 {
 	unsigned long min_flush_time;
-	int flush_wait_retry = 50;
-	bool disable_atr = false;
 	int fd_room;
-	int reg;
 
 	if (!time_after(jiffies, pf->fd_flush_timestamp +
 				 (I40E_MIN_FD_FLUSH_INTERVAL * HZ)))
@@ -10710,14 +11655,16 @@ static void i40e_fdir_flush_and_replay(struct i40e_pf *pf)
 			 (I40E_MIN_FD_FLUSH_SB_ATR_UNSTABLE * HZ);
 	fd_room = pf->fdir_pf_filter_count - pf->fdir_pf_active_filters;
 
+	pf->fd_flush_disable_atr = false;
 	if (!(time_after(jiffies, min_flush_time)) &&
 	    (fd_room < I40E_FDIR_BUFFER_HEAD_ROOM_FOR_ATR)) {
 		if (I40E_DEBUG_FD & pf->hw.debug_mask)
 			dev_info(&pf->pdev->dev, "ATR disabled, not enough FD filter space.\n");
-		disable_atr = true;
+		pf->fd_flush_disable_atr = true;
 	}
 
 	pf->fd_flush_timestamp = jiffies;
+	pf->fd_flush_start_ns = ktime_get_ns();
 	set_bit(__I40E_FD_ATR_AUTO_DISABLED, pf->state);
 	/* flush all filters */
 	wr32(&pf->hw, I40E_PFQF_CTL_1,
@@ -10725,24 +11672,98 @@ static void i40e_fdir_flush_and_replay(struct i40e_pf *pf)
 	i40e_flush(&pf->hw);
 	pf->fd_flush_cnt++;
 	pf->fd_add_err = 0;
-	do {
-		/* Check FD flush status every 5-6msec */
-		usleep_range(5000, 6000);
+	pf->fd_flush_state = I40E_FD_FLUSH_CLEARING;
+	i40e_fdir_flush_poll_soon(pf);
+}
+
+/**
+ * i40e_fdir_replay_chunk - Replay the next batch of sideband filters
+ * @pf: board private structure
+ *
+ * Filters are replayed in fd_id order, picking up at fd_replay_pos where the
+ * previous run stopped. Returns true once all of them have been handed to
+ * the HW.
+ **/
+static bool i40e_fdir_replay_chunk(struct i40e_pf *pf)
+{
+	struct i40e_vsi *vsi = i40e_pf_get_main_vsi(pf);
+	int budget = I40E_FD_REPLAY_BUDGET;
+	struct i40e_fdir_filter *filter;
+
+	if (!(pf->flags & I40E_FLAG_FD_SB_ENABLED)) {
+		pf->fd_replay_pos = NULL;
+		return true;
+	}
+
+	filter = pf->fd_replay_pos;
+	while (filter && budget--) {
+		__i40e_add_del_fdir(vsi, filter, true);
+		filter = i40e_fdir_index_after(pf, filter);
+	}
+	pf->fd_replay_pos = filter;
+	i40e_fdir_kick(pf);
+
+	return !filter;
+}
+
+/**
+ * i40e_fdir_flush_and_replay - Function to flush all FD filters and replay SB
+ * @pf: board private structure
+ *
+ * Advances the flush by one step per service task run so that the service
+ * task never sleeps waiting for the table clear. A replay chunk can still
+ * sleep briefly in i40e_program_fdir_filter() if the sideband ring fills
+ * up. Sideband filters are replayed first and ATR is only allowed to
+ * repopulate the table once they are all back.
+ **/
+static void i40e_fdir_flush_and_replay(struct i40e_pf *pf)
+{
+	u64 blackout_us, elapsed_ns;
+	int reg;
+
+	switch (pf->fd_flush_state) {
+	case I40E_FD_FLUSH_IDLE:
+		i40e_fdir_flush_start(pf);
+		break;
+	case I40E_FD_FLUSH_CLEARING:
 		reg = rd32(&pf->hw, I40E_PFQF_CTL_1);
-		if (!(reg & I40E_PFQF_CTL_1_CLEARFDTABLE_MASK))
+		elapsed_ns = ktime_get_ns() - pf->fd_flush_start_ns;
+		if (reg & I40E_PFQF_CTL_1_CLEARFDTABLE_MASK) {
+			if (elapsed_ns < I40E_FD_FLUSH_TIMEOUT_MS * NSEC_PER_MSEC) {
+				i40e_fdir_flush_poll_soon(pf);
+				break;
+			}
+			/* retry from scratch after I40E_MIN_FD_FLUSH_INTERVAL */
+			dev_warn(&pf->pdev->dev, "FD table did not flush, needs more time\n");
+			pf->fd_flush_timeout_cnt++;
+			pf->fd_flush_state = I40E_FD_FLUSH_IDLE;
+			break;
+		}
+		/* reset FDIR counters as we're replaying all existing filters */
+		i40e_reset_fdir_filter_cnt(pf);
+		pf->fd_replay_pos = i40e_fdir_index_next(pf, 0);
+		pf->fd_flush_state = I40E_FD_FLUSH_REPLAY;
+		fallthrough;
+	case I40E_FD_FLUSH_REPLAY:
+		if (!i40e_fdir_replay_chunk(pf)) {
+			i40e_service_event_schedule(pf);
 			break;
-	} while (flush_wait_retry--);
+		}
 
-	if (reg & I40E_PFQF_CTL_1_CLEARFDTABLE_MASK) {
-		dev_warn(&pf->pdev->dev, "FD table did not flush, needs more time\n");
-	} else {
-		/* replay sideband filters */
-		i40e_fdir_filter_restore(i40e_pf_get_main_vsi(pf));
-		if (!disable_atr && !pf->fd_tcp4_filter_cnt)
+		blackout_us = div_u64(ktime_get_ns() - pf->fd_flush_start_ns,
+				      NSEC_PER_USEC);
+		pf->fd_flush_blackout_us = blackout_us;
+		if (blackout_us > pf->fd_flush_blackout_max_us)
+			pf->fd_flush_blackout_max_us = blackout_us;
+
+		pf->fd_flush_state = I40E_FD_FLUSH_IDLE;
+		if (!pf->fd_flush_disable_atr && !pf->fd_tcp4_filter_cnt)
 			clear_bit(__I40E_FD_ATR_AUTO_DISABLED, pf->state);
 		clear_bit(__I40E_FD_FLUSH_REQUESTED, pf->state);
 		if (I40E_DEBUG_FD & pf->hw.debug_mask)
-			dev_info(&pf->pdev->dev, "FD Filter table flushed and FD-SB replayed.\n");
+			dev_info(&pf->pdev->dev, "FD Filter table flushed and FD-SB replayed in %llu usecs.\n",
+				 blackout_us);
+		break;
 	}
 }
 
@@ -10772,11 +11793,12 @@ static void i40e_fdir_reinit_subtask(struct i40e_pf *pf)
 	if (test_bit(__I40E_DOWN, pf->state))
 		return;
 
+	mutex_lock(&pf->fdir_mutex);
 	if (test_bit(__I40E_FD_FLUSH_REQUESTED, pf->state))
 		i40e_fdir_flush_and_replay(pf);
 
 	i40e_fdir_check_and_reenable(pf);
-
+	mutex_unlock(&pf->fdir_mutex);
 }
 
 /**
@@ -10840,10 +11862,12 @@ static void i40e_veb_link_event(struct i40e_veb *veb, bool link_up)
 }
 
 /**
- * i40e_link_event - Update netif_carrier status
+ * __i40e_link_event - Update netif_carrier status
  * @pf: board private structure
+ *
+ * Called with pf->link_mutex held.
  **/
-static void i40e_link_event(struct i40e_pf *pf)
+static void __i40e_link_event(struct i40e_pf *pf)
 {
 	struct i40e_vsi *vsi = i40e_pf_get_main_vsi(pf);
 	u8 new_link_speed, old_link_speed;
@@ -10929,14 +11953,26 @@ static void i40e_link_event(struct i40e_pf *pf)
 #endif /* CONFIG_DCB */
 }
 
+/**
+ * i40e_link_event - Update netif_carrier status
+ * @pf: board private structure
+ *
+ * The AdminQ task and the watchdog subtask run concurrently, link_mutex
+ * keeps their link state updates apart.
+ **/
+static void i40e_link_event(struct i40e_pf *pf)
+{
+	mutex_lock(&pf->link_mutex);
+	__i40e_link_event(pf);
+	mutex_unlock(&pf->link_mutex);
+}
+
 /**
  * i40e_watchdog_subtask - periodic checks not using event driven response
  * @pf: board private structure
  **/
 static void i40e_watchdog_subtask(struct i40e_pf *pf)
 {
-	int i;
-
 	/* if interface is down do nothing */
 	if (test_bit(__I40E_DOWN, pf->state) ||
 	    test_bit(__I40E_CONFIG_BUSY, pf->state))
@@ -10953,19 +11989,7 @@ static void i40e_watchdog_subtask(struct i40e_pf *pf)
 	    test_bit(__I40E_TEMP_LINK_POLLING, pf->state))
 		i40e_link_event(pf);
 
-	/* Update the stats for active netdevs so the network stack
-	 * can look at updated numbers whenever it cares to
-	 */
-	for (i = 0; i < pf->num_alloc_vsi; i++)
-		if (pf->vsi[i] && pf->vsi[i]->netdev)
-			i40e_update_stats(pf->vsi[i]);
-
-	if (pf->flags & I40E_FLAG_VEB_STATS_ENABLED) {
-		/* Update the stats for the active switching components */
-		for (i = 0; i < I40E_MAX_VEB; i++)
-			if (pf->veb[i])
-				i40e_update_veb_stats(pf->veb[i]);
-	}
+	/* HW stats are read on demand, see i40e_stats_subtask */
 #ifdef HAVE_PTP_1588_CLOCK
 
 	i40e_ptp_rx_hang(pf);
@@ -11000,8 +12024,11 @@ static void i40e_reset_subtask(struct i40e_pf *pf)
 			     | BIT(__I40E_RESET_INTR_RECEIVED))))
 		return;
 
+	i40e_adminq_task_stop(pf);
 	rtnl_lock();
 	i40e_trace(state_reset, pf, reset_flags);
+	/* keep the other subtasks out while the device is reset */
+	down_write(&pf->service_rwsem);
 
 	/* If there's a recovery already waiting, it takes
 	 * precedence before starting a new reset sequence.
@@ -11020,6 +12047,7 @@ static void i40e_reset_subtask(struct i40e_pf *pf)
 		i40e_do_reset(pf, reset_flags, true);
 	}
 
+	up_write(&pf->service_rwsem);
 	rtnl_unlock();
 }
 
@@ -11141,6 +12169,9 @@ static void i40e_clean_adminq_subtask(struct i40e_pf *pf)
 	if (test_bit(__I40E_RESET_FAILED, pf->state))
 		return;
 
+	/* run completions of asynchronous ASQ commands */
+	i40e_asq_reap(hw);
+
 	/* check for error indications */
 	val = rd32(&pf->hw, pf->hw.aq.arq.len);
 	i40e_trace(state_arq, pf, val);
@@ -11243,10 +12274,15 @@ static void i40e_clean_adminq_subtask(struct i40e_pf *pf)
 				 opcode);
 			break;
 		}
+		pf->arq_events++;
+		if (pending > pf->arq_pending_max)
+			pf->arq_pending_max = pending;
 	} while (i++ < pf->adminq_work_limit);
 
 	if (i < pf->adminq_work_limit)
 		clear_bit(__I40E_ADMINQ_EVENT_PENDING, pf->state);
+	else
+		pf->arq_budget_exhausted++;
 
 	/* re-enable Admin queue interrupt cause */
 	val = rd32(hw, I40E_PFINT_ICR0_ENA);
@@ -11257,6 +12293,37 @@ static void i40e_clean_adminq_subtask(struct i40e_pf *pf)
 	kfree(event.msg_buf);
 }
 
+/**
+ * i40e_adminq_task - Drain the AdminQ rings
+ * @work: pointer to work_struct containing our data
+ *
+ * Runs from the misc interrupt whenever the AdminQ cause fires, and at
+ * least once per service timer tick. At most adminq_work_limit events are
+ * handled per run, the task requeues itself when more are pending.
+ **/
+static void i40e_adminq_task(struct work_struct *work)
+{
+	struct i40e_pf *pf = container_of(work,
+					  struct i40e_pf,
+					  adminq_task);
+
+	/* the rings are torn down and rebuilt by a reset */
+	if (test_bit(__I40E_RESET_RECOVERY_PENDING, pf->state) ||
+	    test_bit(__I40E_SUSPENDED, pf->state))
+		return;
+
+	if (test_and_set_bit(__I40E_ADMINQ_SCHED, pf->state))
+		return;
+
+	i40e_clean_adminq_subtask(pf);
+
+	smp_mb__before_atomic();
+	clear_bit(__I40E_ADMINQ_SCHED, pf->state);
+
+	if (test_bit(__I40E_ADMINQ_EVENT_PENDING, pf->state))
+		i40e_adminq_event_schedule(pf);
+}
+
 /**
  * i40e_verify_eeprom - make sure eeprom is good to use
  * @pf: board private structure
@@ -11542,8 +12609,6 @@ static int i40e_get_capabilities(struct i40e_pf *pf,
 	return 0;
 }
 
-static int i40e_vsi_clear(struct i40e_vsi *vsi);
-
 /**
  * i40e_fdir_sb_setup - initialize the Flow Director resources for Sideband
  * @pf: board private structure
@@ -11603,6 +12668,11 @@ static void i40e_prep_for_reset(struct i40e_pf *pf)
 
 	if (test_and_set_bit(__I40E_RESET_RECOVERY_PENDING, pf->state))
 		return;
+
+	/* RESET_RECOVERY_PENDING keeps the AdminQ task from being queued
+	 * again. A running instance is not waited for here, it may be blocked
+	 * on RTNL held by our caller, see i40e_adminq_task_stop().
+	 */
 	if (i40e_check_asq_alive(&pf->hw))
 		i40e_vc_notify_reset(pf);
 
@@ -12028,7 +13098,9 @@ static void i40e_rebuild(struct i40e_pf *pf, bool reinit, bool lock_acquired)
 	}
 #endif /* HAVE_NDO_SET_VF_LINK_STATE */
 
+	down_write(&pf->vc_rwsem);
 	i40e_reset_all_vfs(pf, true);
+	up_write(&pf->vc_rwsem);
 
 	/* TODO: restart clients */
 	/* tell the firmware that we're starting */
@@ -12046,6 +13118,9 @@ clear_recovery:
 	i40e_trace(state_rebuild, pf, ret);
 	clear_bit(__I40E_RESET_RECOVERY_PENDING, pf->state);
 	clear_bit(__I40E_TIMEOUT_RECOVERY_PENDING, pf->state);
+
+	/* pick up ARQ events that were posted while the task was stopped */
+	i40e_adminq_event_schedule(pf);
 }
 
 /**
@@ -12264,7 +13339,9 @@ static void i40e_handle_mdd_event(struct i40e_pf *pf)
 			if (is_mdd_on_tx)
 				i40e_print_vf_tx_mdd_event(pf, vf);
 
+			down_write(&pf->vc_rwsem);
 			i40e_vc_reset_vf(vf, true);
+			up_write(&pf->vc_rwsem);
 		}
 	}
 
@@ -12343,6 +13420,7 @@ static void i40e_sync_udp_filters_subtask(struct i40e_pf *pf)
 
 			/* release RTNL while we wait on AQ command */
 			rtnl_unlock();
+			down_read(&pf->service_rwsem);
 
 			if (port)
 				ret = i40e_aq_add_udp_tunnel(hw, port,
@@ -12354,6 +13432,7 @@ static void i40e_sync_udp_filters_subtask(struct i40e_pf *pf)
 							     NULL);
 
 			/* reacquire RTNL so we can update filter_index */
+			up_read(&pf->service_rwsem);
 			rtnl_lock();
 
 			if (ret) {
@@ -12387,15 +13466,206 @@ static void i40e_sync_udp_filters_subtask(struct i40e_pf *pf)
 #endif /* HAVE_VXLAN_RX_OFFLOAD || HAVE_UDP_ENC_RX_OFFLOAD */
 
 /**
- * i40e_service_task - Run the driver's async subtasks
+ * i40e_client_service_subtask - Open, close or notify the client
+ * @pf: board private structure
+ **/
+static void i40e_client_service_subtask(struct i40e_pf *pf)
+{
+	if (test_and_clear_bit(__I40E_CLIENT_RESET, pf->state)) {
+		/* Client subtask will reopen next time through. */
+		i40e_notify_client_of_netdev_close(pf, true);
+	} else {
+		i40e_client_subtask(pf);
+		if (test_and_clear_bit(__I40E_CLIENT_L2_CHANGE, pf->state))
+			i40e_notify_client_of_l2_param_changes(pf);
+	}
+}
+
+/**
+ * i40e_vflr_subtask - Handle VF resets signalled by VFLR
+ * @pf: board private structure
+ **/
+static void i40e_vflr_subtask(struct i40e_pf *pf)
+{
+	i40e_vc_process_vflr_event(pf);
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(struct i40e_pf *pf);
+	unsigned long interval;
+	bool high_prio;
+} i40e_subtask_info[I40E_SUBTASK_MAX] = {
+	[I40E_SUBTASK_RESET] = { "reset", i40e_reset_subtask, 0, true },
+	[I40E_SUBTASK_MDD] = { "mdd", i40e_handle_mdd_event, 0, true },
+	[I40E_SUBTASK_VFLR] = { "vflr", i40e_vflr_subtask, 0, true },
+	[I40E_SUBTASK_SYNC_FILTERS] = { "sync_filters",
+					i40e_sync_filters_subtask, 0, false },
+	[I40E_SUBTASK_HUNG_DETECT] = { "hung_detect",
+				       i40e_detect_recover_hung, HZ / 4,
+				       false },
+	/* rate limited by service_timer_period on its own */
+	[I40E_SUBTASK_WATCHDOG] = { "watchdog", i40e_watchdog_subtask, 0,
+				    false },
+	[I40E_SUBTASK_FDIR_REINIT] = { "fdir_reinit",
+				       i40e_fdir_reinit_subtask, 0, false },
+	[I40E_SUBTASK_CLIENT] = { "client", i40e_client_service_subtask, 0,
+				  false },
+#if defined(HAVE_VXLAN_RX_OFFLOAD) || defined(HAVE_UDP_ENC_RX_OFFLOAD)
+#if defined(HAVE_UDP_ENC_TUNNEL) || defined(HAVE_UDP_ENC_RX_OFFLOAD)
+#ifndef HAVE_UDP_TUNNEL_NIC_INFO
+	[I40E_SUBTASK_UDP_SYNC] = { "udp_sync", i40e_sync_udp_filters_subtask,
+				    0, false },
+#endif /* HAVE_UDP_TUNNEL_NIC_INFO */
+#endif
+#endif /* HAVE_VXLAN_RX_OFFLOAD || HAVE_UDP_ENC_RX_OFFLOAD */
+	[I40E_SUBTASK_STATS] = { "stats", i40e_stats_subtask, 0, false },
+};
+
+/**
+ * i40e_subtask_schedule - Queue one service subtask
+ * @pf: board private structure
+ * @id: subtask to queue
+ *
+ * Subtasks with an interval are not queued again until it has passed
+ * since they last ran. Nothing is queued once the PF is suspended or
+ * being removed, ndo_get_stats64 can still get here until the netdevs
+ * are unregistered.
+ **/
+static void i40e_subtask_schedule(struct i40e_pf *pf, enum i40e_subtask_id id)
+{
+	struct i40e_subtask *st = &pf->subtask[id];
+
+	if (!st->fn)
+		return;
+
+	if (test_bit(__I40E_SUSPENDED, pf->state) ||
+	    test_bit(__I40E_IN_REMOVE, pf->state))
+		return;
+
+	if (st->interval && st->runs &&
+	    time_before(jiffies, st->last_run + st->interval)) {
+		st->throttled++;
+		return;
+	}
+
+	queue_work(st->high_prio ? i40e_svc_wq : i40e_wq, &st->work);
+}
+
+/**
+ * i40e_subtask_task - Run one service subtask
+ * @work: pointer to work_struct containing our data
+ **/
+static void i40e_subtask_task(struct work_struct *work)
+{
+	struct i40e_subtask *st = container_of(work, struct i40e_subtask,
+					       work);
+	enum i40e_subtask_id id = st - st->pf->subtask;
+	struct i40e_pf *pf = st->pf;
+	u64 start, ns;
+
+	/* don't bother with service tasks if a reset is in progress */
+	if (test_bit(__I40E_RESET_RECOVERY_PENDING, pf->state) ||
+	    test_bit(__I40E_SUSPENDED, pf->state))
+		return;
+
+	start = ktime_get_ns();
+	st->last_run = jiffies;
+	/* service_rwsem nests inside RTNL, the subtasks that take RTNL
+	 * take service_rwsem themselves
+	 */
+	if (id == I40E_SUBTASK_RESET || id == I40E_SUBTASK_UDP_SYNC) {
+		st->fn(pf);
+	} else {
+		down_read(&pf->service_rwsem);
+		st->fn(pf);
+		up_read(&pf->service_rwsem);
+	}
+	ns = ktime_get_ns() - start;
+
+	st->runs++;
+	st->total_ns += ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+
+	/* come back right away while the event is still pending */
+	if ((id == I40E_SUBTASK_MDD &&
+	     test_bit(__I40E_MDD_EVENT_PENDING, pf->state)) ||
+	    (id == I40E_SUBTASK_VFLR &&
+	     test_bit(__I40E_VFLR_EVENT_PENDING, pf->state))) {
+		if (!test_bit(__I40E_DOWN, pf->state))
+			i40e_subtask_schedule(pf, id);
+	}
+}
+
+/**
+ * i40e_subtask_init - Set up the service subtask work items
+ * @pf: board private structure
+ **/
+static void i40e_subtask_init(struct i40e_pf *pf)
+{
+	int i;
+
+	init_rwsem(&pf->service_rwsem);
+	for (i = 0; i < I40E_SUBTASK_MAX; i++) {
+		struct i40e_subtask *st = &pf->subtask[i];
+
+		st->pf = pf;
+		st->fn = i40e_subtask_info[i].fn;
+		st->name = i40e_subtask_info[i].name ? : "none";
+		st->interval = i40e_subtask_info[i].interval;
+		st->high_prio = i40e_subtask_info[i].high_prio;
+		INIT_WORK(&st->work, i40e_subtask_task);
+	}
+}
+
+/**
+ * i40e_subtask_cancel - Wait for the service subtasks to finish
+ * @pf: board private structure
+ *
+ * Only call this after the service task itself has been stopped.
+ **/
+static void i40e_subtask_cancel(struct i40e_pf *pf)
+{
+	int i;
+
+	for (i = 0; i < I40E_SUBTASK_MAX; i++)
+		if (pf->subtask[i].work.func)
+			cancel_work_sync(&pf->subtask[i].work);
+}
+
+/**
+ * i40e_subtask_stats_clear - Reset the service subtask accounting
+ * @pf: board private structure
+ **/
+void i40e_subtask_stats_clear(struct i40e_pf *pf)
+{
+	int i;
+
+	for (i = 0; i < I40E_SUBTASK_MAX; i++) {
+		struct i40e_subtask *st = &pf->subtask[i];
+
+		st->runs = 0;
+		st->throttled = 0;
+		st->total_ns = 0;
+		st->max_ns = 0;
+	}
+}
+
+/**
+ * i40e_service_task - Queue the driver's async subtasks
  * @work: pointer to work_struct containing our data
+ *
+ * Every subtask runs as its own work item, so a slow one does not hold up
+ * the others. Reset, MDD and VFLR handling go to a high priority unbound
+ * workqueue.
  **/
 static void i40e_service_task(struct work_struct *work)
 {
 	struct i40e_pf *pf = container_of(work,
 					  struct i40e_pf,
 					  service_task);
-	unsigned long start_time = jiffies;
+	int i;
 
 	/* don't bother with service tasks if a reset is in progress */
 	if (test_bit(__I40E_RESET_RECOVERY_PENDING, pf->state) ||
@@ -12407,50 +13677,18 @@ static void i40e_service_task(struct work_struct *work)
 		return;
 
 	if (!test_bit(__I40E_RECOVERY_MODE, pf->state)) {
-		i40e_detect_recover_hung(pf);
-		i40e_sync_filters_subtask(pf);
-		i40e_reset_subtask(pf);
-		i40e_handle_mdd_event(pf);
-		i40e_vc_process_vflr_event(pf);
-		i40e_watchdog_subtask(pf);
-		i40e_fdir_reinit_subtask(pf);
-		if (test_and_clear_bit(__I40E_CLIENT_RESET, pf->state)) {
-			/* Client subtask will reopen next time through. */
-			i40e_notify_client_of_netdev_close(
-						pf, true);
-		} else {
-			i40e_client_subtask(pf);
-			if (test_and_clear_bit(__I40E_CLIENT_L2_CHANGE,
-					       pf->state))
-
-				i40e_notify_client_of_l2_param_changes(pf);
-		}
-#if defined(HAVE_VXLAN_RX_OFFLOAD) || defined(HAVE_UDP_ENC_RX_OFFLOAD)
-#if defined(HAVE_UDP_ENC_TUNNEL) || defined(HAVE_UDP_ENC_RX_OFFLOAD)
-#ifndef HAVE_UDP_TUNNEL_NIC_INFO
-		i40e_sync_udp_filters_subtask(pf);
-#endif /* HAVE_UDP_TUNNEL_NIC_INFO */
-#endif
-#endif /* HAVE_VXLAN_RX_OFFLOAD || HAVE_UDP_ENC_RX_OFFLOAD */
+		for (i = 0; i < I40E_SUBTASK_MAX; i++)
+			i40e_subtask_schedule(pf, i);
 	} else {
-		i40e_reset_subtask(pf);
+		i40e_subtask_schedule(pf, I40E_SUBTASK_RESET);
 	}
 
-	i40e_clean_adminq_subtask(pf);
+	/* poll the AdminQ in case an interrupt was missed */
+	i40e_adminq_event_schedule(pf);
 
 	/* flush memory to make sure state is correct before next watchdog */
 	smp_mb__before_atomic();
 	clear_bit(__I40E_SERVICE_SCHED, pf->state);
-
-	/* If the tasks have taken longer than one timer cycle or there
-	 * is more work to be done, reschedule the service task now
-	 * rather than wait for the timer to tick again.
-	 */
-	if (time_after(jiffies, (start_time + pf->service_timer_period)) ||
-	    test_bit(__I40E_ADMINQ_EVENT_PENDING, pf->state)		 ||
-	    test_bit(__I40E_MDD_EVENT_PENDING, pf->state)		 ||
-	    test_bit(__I40E_VFLR_EVENT_PENDING, pf->state))
-		i40e_service_event_schedule(pf);
 }
 
 /**
@@ -12630,18 +13868,24 @@ int i40e_vsi_mem_alloc(struct i40e_pf *pf, enum i40e_vsi_type type)
 	vsi->flags = 0;
 	vsi->idx = vsi_idx;
 	vsi->int_rate_limit = 0;
+	vsi->bw_burst = I40E_MAX_BW_INACTIVE_ACCUM;
 	vsi->rss_table_size = (vsi->type == I40E_VSI_MAIN) ?
 				pf->rss_table_size : 64;
 	vsi->netdev_registered = false;
 	vsi->work_limit = I40E_DEFAULT_IRQ_WORK;
-	hash_init(vsi->mac_filter_hash);
 	vsi->irqs_ready = false;
 
+	ret = i40e_filter_hash_init(vsi);
+	if (ret)
+		goto err_filter_hash;
+
 #ifdef HAVE_AF_XDP_ZC_SUPPORT
 	if (type == I40E_VSI_MAIN) {
 		vsi->af_xdp_zc_qps = bitmap_zalloc(pf->num_lan_qps, GFP_KERNEL);
-		if (!vsi->af_xdp_zc_qps)
+		if (!vsi->af_xdp_zc_qps) {
+			ret = -ENOMEM;
 			goto err_rings;
+		}
 	}
 #endif /* HAVE_AF_XDP_ZC_SUPPORT */
 
@@ -12669,6 +13913,8 @@ err_rings:
 #ifdef HAVE_AF_XDP_ZC_SUPPORT
 	bitmap_free(vsi->af_xdp_zc_qps);
 #endif /* HAVE_AF_XDP_ZC_SUPPORT */
+	i40e_filter_hash_destroy(vsi);
+err_filter_hash:
 	pf->next_vsi = i - 1;
 	kfree(vsi);
 unlock_pf:
@@ -12701,7 +13947,7 @@ static void i40e_vsi_free_arrays(struct i40e_vsi *vsi, bool free_qvectors)
  * i40e_vsi_clear - Deallocate the VSI provided
  * @vsi: the VSI being un-configured
  **/
-static int i40e_vsi_clear(struct i40e_vsi *vsi)
+int i40e_vsi_clear(struct i40e_vsi *vsi)
 {
 	struct i40e_pf *pf;
 
@@ -12729,7 +13975,7 @@ static int i40e_vsi_clear(struct i40e_vsi *vsi)
 	}
 
 	/* updates the PF for this cleared vsi */
-	i40e_put_lump(pf->qp_pile, vsi->base_queue, vsi->idx);
+	i40e_vsi_put_qp_lump(vsi);
 	i40e_put_lump(pf->irq_pile, vsi->base_vector, vsi->idx);
 
 #ifdef HAVE_AF_XDP_ZC_SUPPORT
@@ -12744,6 +13990,7 @@ static int i40e_vsi_clear(struct i40e_vsi *vsi)
 
 unlock_vsi:
 	mutex_unlock(&pf->switch_mutex);
+	i40e_filter_hash_destroy(vsi);
 free_vsi:
 	kfree(vsi);
 
@@ -12787,7 +14034,7 @@ static int i40e_alloc_rings(struct i40e_vsi *vsi)
 			goto err_out;
 
 		ring->queue_index = i;
-		ring->reg_idx = vsi->base_queue + i;
+		ring->reg_idx = i40e_vsi_pf_q(vsi, i);
 		ring->ring_active = false;
 		ring->vsi = vsi;
 		ring->netdev = vsi->netdev;
@@ -12806,8 +14053,9 @@ static int i40e_alloc_rings(struct i40e_vsi *vsi)
 		if (!i40e_enabled_xdp_vsi(vsi))
 			goto setup_rx;
 
+		/* XDP only runs on the main VSI, which is never scattered */
 		ring->queue_index = vsi->alloc_queue_pairs + i;
-		ring->reg_idx = vsi->base_queue + ring->queue_index;
+		ring->reg_idx = i40e_vsi_pf_q(vsi, ring->queue_index);
 		ring->ring_active = false;
 		ring->vsi = vsi;
 		ring->netdev = NULL;
@@ -12823,7 +14071,7 @@ static int i40e_alloc_rings(struct i40e_vsi *vsi)
 
 setup_rx:
 		ring->queue_index = i;
-		ring->reg_idx = vsi->base_queue + i;
+		ring->reg_idx = i40e_vsi_pf_q(vsi, i);
 		ring->ring_active = false;
 		ring->vsi = vsi;
 		ring->netdev = vsi->netdev;
@@ -13107,6 +14355,10 @@ static int i40e_vsi_alloc_q_vector(struct i40e_vsi *vsi, int v_idx)
 	q_vector->v_idx = v_idx;
 #ifdef HAVE_IRQ_AFFINITY_NOTIFY
 	cpumask_copy(&q_vector->affinity_mask, cpu_possible_mask);
+#ifdef HAVE_NAPI_THREADED
+	INIT_DELAYED_WORK(&q_vector->affinity_work,
+			  i40e_napi_thread_affinity_task);
+#endif /* HAVE_NAPI_THREADED */
 #endif
 	if (vsi->netdev)
 		netif_napi_add(vsi->netdev, &q_vector->napi,
@@ -13464,21 +14716,35 @@ static int i40e_get_rss_reg(struct i40e_vsi *vsi, u8 *seed,
 {
 	struct i40e_pf *pf = vsi->back;
 	struct i40e_hw *hw = &pf->hw;
+	u16 vf_id = vsi->vf_id;
 	u16 i;
 
 	if (seed) {
 		u32 *seed_dw = (u32 *)seed;
 
-		for (i = 0; i <= I40E_PFQF_HKEY_MAX_INDEX; i++)
-			seed_dw[i] = i40e_read_rx_ctl(hw, I40E_PFQF_HKEY(i));
+		if (vsi->type == I40E_VSI_SRIOV) {
+			for (i = 0; i <= I40E_VFQF_HKEY1_MAX_INDEX; i++)
+				seed_dw[i] = rd32(hw, I40E_VFQF_HKEY1(i, vf_id));
+		} else {
+			for (i = 0; i <= I40E_PFQF_HKEY_MAX_INDEX; i++)
+				seed_dw[i] = i40e_read_rx_ctl(hw,
+							      I40E_PFQF_HKEY(i));
+		}
 	}
 	if (lut) {
 		u32 *lut_dw = (u32 *)lut;
 
-		if (lut_size != I40E_HLUT_ARRAY_SIZE)
-			return -EINVAL;
-		for (i = 0; i <= I40E_PFQF_HLUT_MAX_INDEX; i++)
-			lut_dw[i] = rd32(hw, I40E_PFQF_HLUT(i));
+		if (vsi->type == I40E_VSI_SRIOV) {
+			if (lut_size != I40E_VF_HLUT_ARRAY_SIZE)
+				return -EINVAL;
+			for (i = 0; i <= I40E_VFQF_HLUT_MAX_INDEX; i++)
+				lut_dw[i] = rd32(hw, I40E_VFQF_HLUT1(i, vf_id));
+		} else {
+			if (lut_size != I40E_HLUT_ARRAY_SIZE)
+				return -EINVAL;
+			for (i = 0; i <= I40E_PFQF_HLUT_MAX_INDEX; i++)
+				lut_dw[i] = rd32(hw, I40E_PFQF_HLUT(i));
+		}
 	}
 
 	return 0;
@@ -14205,6 +15471,28 @@ static int i40e_set_features(struct net_device *netdev,
 	struct i40e_pf *pf = vsi->back;
 	bool need_reset;
 
+	/* refuse before anything is changed, so that pf->flags and the HW
+	 * stay in line with netdev->features
+	 */
+#ifdef NETIF_F_HW_TC
+	if (!(features & NETIF_F_HW_TC) &&
+	    (netdev->features & NETIF_F_HW_TC) &&
+	    (pf->num_cloud_filters || i40e_fdir_has_tc_rules(pf))) {
+		dev_err(&pf->pdev->dev,
+			"Offloaded tc filters active, can't turn hw_tc_offload off");
+		return -EINVAL;
+	}
+
+#endif
+	/* tc owns its drop rules, they must not vanish behind its back */
+	if (!(features & NETIF_F_NTUPLE) &&
+	    (pf->flags & I40E_FLAG_FD_SB_ENABLED) &&
+	    i40e_fdir_has_tc_rules(pf)) {
+		dev_err(&pf->pdev->dev,
+			"Offloaded tc flower drop rules active, can't turn ntuple off\n");
+		return -EBUSY;
+	}
+
 	if (features & NETIF_F_RXHASH && !(netdev->features & NETIF_F_RXHASH))
 		i40e_pf_config_rss(pf);
 	else if (!(features & NETIF_F_RXHASH) &&
@@ -14221,13 +15509,6 @@ static int i40e_set_features(struct net_device *netdev,
 		i40e_vlan_stripping_disable(vsi);
 
 #ifdef NETIF_F_HW_TC
-	if (!(features & NETIF_F_HW_TC) &&
-	    (netdev->features & NETIF_F_HW_TC) && pf->num_cloud_filters) {
-		dev_err(&pf->pdev->dev,
-			"Offloaded tc filters active, can't turn hw_tc_offload off");
-		return -EINVAL;
-	}
-
 	if ((features & NETIF_F_HW_TC) &&
 	    !(netdev->features & NETIF_F_HW_TC))
 		pf->flags |= I40E_FLAG_CLS_FLOWER;
@@ -15788,6 +17069,41 @@ err:
 	return ret;
 }
 
+/**
+ * i40e_aq_add_vsi_wait - Send an add VSI command without holding the ASQ
+ * @pf: board private structure
+ * @ctxt: the VSI context to add
+ *
+ * The command is posted asynchronously and the caller sleeps until it
+ * completes, so VF rebuild work items adding their VSIs at the same time
+ * have their commands in flight together rather than one after the other
+ * behind the ASQ lock.
+ **/
+static i40e_status i40e_aq_add_vsi_wait(struct i40e_pf *pf,
+					struct i40e_vsi_context *ctxt)
+{
+	struct i40e_asq_cmd_details cmd_details = {};
+	struct i40e_asq_cmd_done done = {};
+	struct i40e_hw *hw = &pf->hw;
+	i40e_status ret;
+
+	done.buff = &ctxt->info;
+	done.buff_size = sizeof(ctxt->info);
+	cmd_details.async = true;
+	cmd_details.done = &done;
+	ret = i40e_aq_add_vsi(hw, ctxt, &cmd_details);
+	if (ret)
+		/* not posted, e.g. the ASQ is full; fall back to waiting */
+		return i40e_aq_add_vsi(hw, ctxt, NULL);
+
+	ret = i40e_asq_wait_done(hw, &done, false);
+	hw->aq.asq_last_status = done.aq_rc;
+	if (!ret)
+		i40e_aq_add_vsi_resp(ctxt, &done.desc);
+
+	return ret;
+}
+
 /**
  * i40e_add_vsi - Add a VSI to the switch
  * @vsi: the VSI being configured
@@ -15989,7 +17305,7 @@ static int i40e_add_vsi(struct i40e_vsi *vsi)
 	}
 
 	if (vsi->type != I40E_VSI_MAIN) {
-		ret = i40e_aq_add_vsi(hw, &ctxt, NULL);
+		ret = i40e_aq_add_vsi_wait(pf, &ctxt);
 		if (ret) {
 			dev_info(&vsi->back->pdev->dev,
 				 "add vsi failed, err %s aq_err %s\n",
@@ -16023,12 +17339,14 @@ static int i40e_add_vsi(struct i40e_vsi *vsi)
 	}
 
 	spin_lock_bh(&vsi->mac_filter_hash_lock);
-	vsi->active_filters = 0;
 	/* If macvlan filters already exist, force them to get loaded */
 	hash_for_each_safe(vsi->mac_filter_hash, bkt, h, f, hlist) {
 		f->state = I40E_FILTER_NEW;
+		i40e_filter_mark_dirty(vsi, f);
 		f_count++;
 	}
+	vsi->active_filters = 0;
+	vsi->failed_filters = 0;
 	spin_unlock_bh(&vsi->mac_filter_hash_lock);
 	clear_bit(__I40E_VSI_OVERFLOW_PROMISC, vsi->state);
 
@@ -16230,7 +17548,7 @@ static struct i40e_vsi *i40e_vsi_reinit_setup(struct i40e_vsi *vsi)
 
 	pf = vsi->back;
 
-	i40e_put_lump(pf->qp_pile, vsi->base_queue, vsi->idx);
+	i40e_vsi_put_qp_lump(vsi);
 	i40e_vsi_clear_rings(vsi);
 
 	i40e_vsi_free_arrays(vsi, false);
@@ -16242,7 +17560,7 @@ static struct i40e_vsi *i40e_vsi_reinit_setup(struct i40e_vsi *vsi)
 	alloc_queue_pairs = vsi->alloc_queue_pairs *
 			    (i40e_enabled_xdp_vsi(vsi) ? 2 : 1);
 
-	ret = i40e_get_lump(pf, pf->qp_pile, alloc_queue_pairs, vsi->idx);
+	ret = i40e_vsi_get_qp_lump(vsi, alloc_queue_pairs);
 	if (ret < 0) {
 		dev_info(&pf->pdev->dev,
 			 "failed to get tracking for %d queues for VSI %d err %d\n",
@@ -16306,20 +17624,23 @@ static int i40e_netif_set_realnum_tx_rx_queues(struct i40e_vsi *vsi) {
 }
 
 /**
- * i40e_vsi_setup - Set up a VSI by a given type
+ * i40e_vsi_reserve - Reserve the sw resources of a VSI by a given type
  * @pf: board private structure
  * @type: VSI type
  * @uplink_seid: the switch element to link to
  * @param1: usage depends upon VSI type. For VF types, indicates VF id
  *
- * This allocates the sw VSI structure and its queue resources, then add a VSI
- * to the identified VEB.
+ * This allocates the sw VSI structure and its queue resources and finds, or
+ * creates, the VEB it goes under. The VSI is not known to the HW until
+ * i40e_vsi_activate() is called for it. For VF VSIs the activation only
+ * touches the VSI itself, so the reservations can be serialized and the
+ * activations run concurrently.
  *
- * Returns pointer to the successfully allocated and configure VSI sw struct on
- * success, otherwise returns NULL on failure.
+ * Returns pointer to the reserved VSI sw struct on success, otherwise
+ * returns NULL on failure.
  **/
-struct i40e_vsi *i40e_vsi_setup(struct i40e_pf *pf, u8 type,
-				u16 uplink_seid, u32 param1)
+struct i40e_vsi *i40e_vsi_reserve(struct i40e_pf *pf, u8 type,
+				  u16 uplink_seid, u32 param1)
 {
 	struct i40e_vsi *vsi = NULL;
 	struct i40e_veb *veb = NULL;
@@ -16412,8 +17733,7 @@ struct i40e_vsi *i40e_vsi_setup(struct i40e_pf *pf, u8 type,
 	else if (type == I40E_VSI_SRIOV)
 		vsi->vf_id = param1;
 	/* assign it some queues */
-	ret = i40e_get_lump(pf, pf->qp_pile, vsi->alloc_queue_pairs,
-				vsi->idx);
+	ret = i40e_vsi_get_qp_lump(vsi, vsi->alloc_queue_pairs);
 	if (ret < 0) {
 		dev_info(&pf->pdev->dev,
 			 "failed to get tracking for %d queues for VSI %d err=%d\n",
@@ -16421,12 +17741,34 @@ struct i40e_vsi *i40e_vsi_setup(struct i40e_pf *pf, u8 type,
 		goto err_vsi;
 	}
 	vsi->base_queue = ret;
+	vsi->uplink_seid = uplink_seid;
+
+	return vsi;
+
+err_vsi:
+	i40e_vsi_clear(vsi);
+err_alloc:
+	return NULL;
+}
+
+/**
+ * i40e_vsi_activate - Add a reserved VSI to the HW
+ * @vsi: VSI returned by i40e_vsi_reserve()
+ *
+ * On failure everything but the reservation is undone, the caller is
+ * expected to give that back with i40e_vsi_clear().
+ *
+ * Returns 0 on success, negative on failure
+ **/
+int i40e_vsi_activate(struct i40e_vsi *vsi)
+{
+	struct i40e_pf *pf = vsi->back;
+	int ret;
 
 	/* get a VSI from the hardware */
-	vsi->uplink_seid = uplink_seid;
 	ret = i40e_add_vsi(vsi);
 	if (ret)
-		goto err_vsi;
+		return ret;
 
 	switch (vsi->type) {
 	/* setup the netdev if needed */
@@ -16475,9 +17817,9 @@ struct i40e_vsi *i40e_vsi_setup(struct i40e_pf *pf, u8 type,
 
 	if ((pf->hw_features & I40E_HW_RSS_AQ_CAPABLE) &&
 	    (vsi->type == I40E_VSI_VMDQ2)) {
-		ret = i40e_vsi_config_rss(vsi);
+		i40e_vsi_config_rss(vsi);
 	}
-	return vsi;
+	return 0;
 
 err_rings:
 	i40e_vsi_free_q_vectors(vsi);
@@ -16490,10 +17832,37 @@ err_msix:
 	}
 err_netdev:
 	i40e_aq_delete_element(&pf->hw, vsi->seid, NULL);
-err_vsi:
-	i40e_vsi_clear(vsi);
-err_alloc:
-	return NULL;
+	return ret;
+}
+
+/**
+ * i40e_vsi_setup - Set up a VSI by a given type
+ * @pf: board private structure
+ * @type: VSI type
+ * @uplink_seid: the switch element to link to
+ * @param1: usage depends upon VSI type. For VF types, indicates VF id
+ *
+ * This allocates the sw VSI structure and its queue resources, then add a VSI
+ * to the identified VEB.
+ *
+ * Returns pointer to the successfully allocated and configure VSI sw struct on
+ * success, otherwise returns NULL on failure.
+ **/
+struct i40e_vsi *i40e_vsi_setup(struct i40e_pf *pf, u8 type,
+				u16 uplink_seid, u32 param1)
+{
+	struct i40e_vsi *vsi;
+
+	vsi = i40e_vsi_reserve(pf, type, uplink_seid, param1);
+	if (!vsi)
+		return NULL;
+
+	if (i40e_vsi_activate(vsi)) {
+		i40e_vsi_clear(vsi);
+		return NULL;
+	}
+
+	return vsi;
 }
 
 /**
@@ -17499,6 +18868,9 @@ static int i40e_init_recovery_mode(struct i40e_pf *pf, struct i40e_hw *hw)
 
 	INIT_WORK(&pf->service_task, i40e_service_task);
 	clear_bit(__I40E_SERVICE_SCHED, pf->state);
+	INIT_WORK(&pf->adminq_task, i40e_adminq_task);
+	clear_bit(__I40E_ADMINQ_SCHED, pf->state);
+	i40e_subtask_init(pf);
 
 	err = i40e_init_interrupt_scheme(pf);
 	if (err)
@@ -17742,6 +19114,15 @@ static int i40e_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 	INIT_LIST_HEAD(&pf->l3_flex_pit_list);
 	INIT_LIST_HEAD(&pf->l4_flex_pit_list);
 	INIT_LIST_HEAD(&pf->ddp_old_prof);
+	i40e_sb_filter_index_init(pf);
+	mutex_init(&pf->stats_mutex);
+	mutex_init(&pf->link_mutex);
+	seqlock_init(&pf->vf_stats_lock);
+	pf->stats_fresh_usecs = I40E_STATS_FRESH_USECS_DEFAULT;
+	init_rwsem(&pf->vc_rwsem);
+	mutex_init(&pf->vf_res_mutex);
+	spin_lock_init(&pf->vfr_all_stats.lock);
+	spin_lock_init(&pf->vfr_one_stats.lock);
 
 	/* set up the spinlocks for the AQ, do this only once in probe
 	 * and destroy them only once in remove
@@ -17749,6 +19130,10 @@ static int i40e_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 	i40e_init_spinlock_d(&hw->aq.asq_spinlock);
 	i40e_init_spinlock_d(&hw->aq.arq_spinlock);
 
+	/* per-opcode AQ accounting is best effort, run without it on failure */
+	hw->aq.op_stats = kcalloc(I40E_AQ_STATS_OPCODES,
+				  sizeof(*hw->aq.op_stats), GFP_KERNEL);
+
 	if (debug != -1)
 		pf->msg_enable = pf->hw.debug_mask = debug;
 
@@ -17850,6 +19235,7 @@ static int i40e_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 		dev_info(&pdev->dev, "sw_init failed: %d\n", err);
 		goto err_sw_init;
 	}
+	i40e_fdir_cnt_layout(pf);
 
 	if (test_bit(__I40E_RECOVERY_MODE, pf->state))
 		return i40e_init_recovery_mode(pf, hw);
@@ -17926,6 +19312,9 @@ static int i40e_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 
 	INIT_WORK(&pf->service_task, i40e_service_task);
 	clear_bit(__I40E_SERVICE_SCHED, pf->state);
+	INIT_WORK(&pf->adminq_task, i40e_adminq_task);
+	clear_bit(__I40E_ADMINQ_SCHED, pf->state);
+	i40e_subtask_init(pf);
 
 	/* NVM bit on means WoL not supported for the port */
 	i40e_read_nvm_word(hw, I40E_SR_NVM_WAKE_ON_LAN, &wol_nvm_bits);
@@ -18300,6 +19689,7 @@ err_init_lan_hmc:
 err_sw_init:
 err_adminq_setup:
 err_pf_reset:
+	kfree(hw->aq.op_stats);
 	iounmap(hw->hw_addr);
 err_ioremap:
 	kfree(pf);
@@ -18367,6 +19757,9 @@ static void i40e_remove(struct pci_dev *pdev)
 		del_timer_sync(&pf->service_timer);
 	if (pf->service_task.func)
 		cancel_work_sync(&pf->service_task);
+	i40e_subtask_cancel(pf);
+	if (pf->adminq_task.func)
+		cancel_work_sync(&pf->adminq_task);
 	/* Client close must be called explicitly here because the timer
 	 * has been stopped.
 	 */
@@ -18436,6 +19829,11 @@ static void i40e_remove(struct pci_dev *pdev)
 	}
 
 unmap:
+	/* the netdevs are gone, catch a stats request that raced the
+	 * __I40E_SUSPENDED check in i40e_subtask_schedule()
+	 */
+	i40e_subtask_cancel(pf);
+
 	/* Free MSI/legacy interrupt 0 when in recovery mode.
 	 * This is normally done in i40e_vsi_free_irq on
 	 * VSI close but since recovery mode doesn't allow to up
@@ -18466,8 +19864,13 @@ debug_mode_clear:
 	/* destroy the locks only once, here */
 	i40e_destroy_spinlock_d(&hw->aq.arq_spinlock);
 	i40e_destroy_spinlock_d(&hw->aq.asq_spinlock);
+	kfree(hw->aq.op_stats);
+	hw->aq.op_stats = NULL;
 	mutex_destroy(&pf->tc_mutex);
 	mutex_destroy(&pf->switch_mutex);
+	mutex_destroy(&pf->stats_mutex);
+	mutex_destroy(&pf->link_mutex);
+	mutex_destroy(&pf->fdir_mutex);
 
 	for (i = 0; i < I40E_MAX_VEB; i++) {
 		kfree(pf->veb[i]);
@@ -18718,6 +20121,8 @@ static void i40e_shutdown(struct pci_dev *pdev)
 
 	del_timer_sync(&pf->service_timer);
 	cancel_work_sync(&pf->service_task);
+	i40e_subtask_cancel(pf);
+	cancel_work_sync(&pf->adminq_task);
 	i40e_cloud_filter_exit(pf);
 	i40e_fdir_teardown(pf);
 
@@ -18793,6 +20198,8 @@ static int i40e_suspend(struct device *dev)
 	/* Ensure service task will not be running */
 	del_timer_sync(&pf->service_timer);
 	cancel_work_sync(&pf->service_task);
+	i40e_subtask_cancel(pf);
+	cancel_work_sync(&pf->adminq_task);
 
 	/* Client close must be called explicitly here because the timer
 	 * has been stopped.
@@ -19024,6 +20431,30 @@ static int __init i40e_init_module(void)
 		pr_err("%s: Failed to create workqueue\n", i40e_driver_name);
 		return -ENOMEM;
 	}
+
+	/* AdminQ events are latency sensitive (link changes, VF mailbox) and
+	 * get a high priority workqueue of their own.
+	 */
+	i40e_aq_wq = alloc_workqueue("%s_aq", WQ_HIGHPRI | WQ_MEM_RECLAIM, 0,
+				     i40e_driver_name);
+	if (!i40e_aq_wq) {
+		pr_err("%s: Failed to create AdminQ workqueue\n",
+		       i40e_driver_name);
+		destroy_workqueue(i40e_wq);
+		return -ENOMEM;
+	}
+
+	/* reset, MDD and VFLR handling, see i40e_service_task */
+	i40e_svc_wq = alloc_workqueue("%s_svc",
+				      WQ_UNBOUND | WQ_HIGHPRI | WQ_MEM_RECLAIM,
+				      0, i40e_driver_name);
+	if (!i40e_svc_wq) {
+		pr_err("%s: Failed to create service workqueue\n",
+		       i40e_driver_name);
+		destroy_workqueue(i40e_aq_wq);
+		destroy_workqueue(i40e_wq);
+		return -ENOMEM;
+	}
 #ifdef HAVE_RHEL7_PCI_DRIVER_RH
 	/* The size member must be initialized in the driver via a call to
 	 * set_pci_driver_rh_size before pci_register_driver is called
@@ -19046,6 +20477,8 @@ static void __exit i40e_exit_module(void)
 {
 	pci_unregister_driver(&i40e_driver);
 	destroy_workqueue(i40e_wq);
+	destroy_workqueue(i40e_aq_wq);
+	destroy_workqueue(i40e_svc_wq);
 	ida_destroy(&i40e_client_ida);
 	i40e_dbg_exit();
 #ifdef HAVE_KFREE_RCU_BARRIER
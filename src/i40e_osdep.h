@@ -72,6 +72,19 @@ do {								\
 			(h)->bus.func, ##__VA_ARGS__);		\
 } while (0)
 
+#define i40e_time_ns()	ktime_get_ns()
+
+/* AdminQ tracepoints live in the driver, so that shared code does not need
+ * the trace headers
+ */
+struct i40e_hw;
+struct i40e_aq_desc;
+void i40e_aq_trace_submit_d(struct i40e_hw *hw, struct i40e_aq_desc *desc);
+void i40e_aq_trace_done_d(struct i40e_hw *hw, struct i40e_aq_desc *desc,
+			  u64 lat_ns);
+#define i40e_aq_trace_submit(h, d)	i40e_aq_trace_submit_d(h, d)
+#define i40e_aq_trace_done(h, d, l)	i40e_aq_trace_done_d(h, d, l)
+
 /* these things are all directly replaced with sed during the kernel build */
 #define INLINE inline
 
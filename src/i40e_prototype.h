@@ -50,6 +50,12 @@ i40e_asq_send_command_v2(struct i40e_hw *hw,
 			 u16  buff_size,
 			 struct i40e_asq_cmd_details *cmd_details,
 			 enum i40e_admin_queue_err *aq_status);
+u16 i40e_asq_reap(struct i40e_hw *hw);
+u32 i40e_aq_stats_snapshot(struct i40e_hw *hw, struct i40e_aq_op_stats *stats,
+			   bool clear);
+enum i40e_status_code
+i40e_asq_wait_done(struct i40e_hw *hw, struct i40e_asq_cmd_done *done,
+		   bool is_atomic_context);
 
 /* debug function for adminq */
 void i40e_debug_aq(struct i40e_hw *hw, enum i40e_debug_mask mask,
@@ -138,6 +144,8 @@ i40e_status i40e_aq_send_driver_version(struct i40e_hw *hw,
 i40e_status i40e_aq_add_vsi(struct i40e_hw *hw,
 				struct i40e_vsi_context *vsi_ctx,
 				struct i40e_asq_cmd_details *cmd_details);
+void i40e_aq_add_vsi_resp(struct i40e_vsi_context *vsi_ctx,
+			  struct i40e_aq_desc *desc);
 i40e_status i40e_aq_set_vsi_broadcast(struct i40e_hw *hw,
 				u16 vsi_id, bool set_filter,
 				struct i40e_asq_cmd_details *cmd_details);
@@ -508,6 +516,7 @@ u32 i40e_read_rx_ctl(struct i40e_hw *hw, u32 reg_addr);
 i40e_status i40e_aq_rx_ctl_write_register(struct i40e_hw *hw,
 				u32 reg_addr, u32 reg_val,
 				struct i40e_asq_cmd_details *cmd_details);
+bool i40e_rx_ctl_use_register(struct i40e_hw *hw);
 void i40e_write_rx_ctl(struct i40e_hw *hw, u32 reg_addr, u32 reg_val);
 enum i40e_status_code
 i40e_aq_set_phy_register_ext(struct i40e_hw *hw,
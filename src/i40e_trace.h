@@ -389,6 +389,47 @@ DEFINE_EVENT(
 		 struct i40e_nvm_access *cmd, int ret_val, int err),
 	TP_ARGS(hw, cmd, ret_val, err));
 
+DECLARE_EVENT_CLASS(
+	i40e_aq_template,
+	TP_PROTO(struct i40e_hw *hw, struct i40e_aq_desc *desc, u64 lat_ns),
+	TP_ARGS(hw, desc, lat_ns),
+	TP_STRUCT__entry(
+		__field(u64, bus)
+		__field(u64, lat_ns)
+		__field(u16, opcode)
+		__field(u16, flags)
+		__field(u16, datalen)
+		__string(rc, i40e_aq_str(hw, (enum i40e_admin_queue_err)
+					 (LE16_TO_CPU(desc->retval) & 0xff))))
+	,
+	TP_fast_assign(
+		__entry->bus = (((u64)hw->bus.bus_id) << 32) |
+			(((u64)hw->bus.device) << 16) | hw->bus.func;
+		__entry->lat_ns = lat_ns;
+		__entry->opcode = LE16_TO_CPU(desc->opcode);
+		__entry->flags = LE16_TO_CPU(desc->flags);
+		__entry->datalen = LE16_TO_CPU(desc->datalen);
+		_kc__assign_str(rc, i40e_aq_str(hw, (enum i40e_admin_queue_err)
+					(LE16_TO_CPU(desc->retval) & 0xff)));)
+	,
+	TP_printk(
+		"aq: bus %02x:%02x.%1x opcode=0x%04x flags=0x%04x datalen=%u rc=%s lat_ns=%llu",
+		(unsigned int)(__entry->bus >> 32),
+		0xffff & (unsigned int)(__entry->bus >> 16),
+		0xffff & (unsigned int)__entry->bus,
+		__entry->opcode, __entry->flags, __entry->datalen,
+		__get_str(rc), __entry->lat_ns));
+
+DEFINE_EVENT(
+	i40e_aq_template, i40e_aq_submit,
+	TP_PROTO(struct i40e_hw *hw, struct i40e_aq_desc *desc, u64 lat_ns),
+	TP_ARGS(hw, desc, lat_ns));
+
+DEFINE_EVENT(
+	i40e_aq_template, i40e_aq_complete,
+	TP_PROTO(struct i40e_hw *hw, struct i40e_aq_desc *desc, u64 lat_ns),
+	TP_ARGS(hw, desc, lat_ns));
+
 #endif /* _I40E_TRACE_H_ */
 /* This must be outside ifdef _I40E_TRACE_H */
 
@@ -75,13 +75,38 @@ static void i40e_fdir(struct i40e_ring *tx_ring,
 	fdir_desc->fd_id = cpu_to_le32(fdata->fd_id);
 }
 
-#define I40E_FD_CLEAN_DELAY 10
 /**
- * i40e_program_fdir_filter - Program a Flow Director filter
+ * i40e_fdir_kick - Hand all posted Flow Director descriptors to the HW
+ * @pf: The PF pointer
+ *
+ * i40e_program_fdir_filter() only posts descriptors, this bumps the tail of
+ * the sideband ring once for everything posted since the last kick.
+ **/
+void i40e_fdir_kick(struct i40e_pf *pf)
+{
+	struct i40e_ring *tx_ring;
+	struct i40e_vsi *vsi;
+
+	vsi = i40e_find_vsi_by_type(pf, I40E_VSI_FDIR);
+	if (!vsi)
+		return;
+
+	tx_ring = vsi->tx_rings[0];
+	writel(tx_ring->next_to_use, tx_ring->tail);
+}
+
+#define I40E_FD_CLEAN_DELAY 100
+/**
+ * i40e_program_fdir_filter - Post a Flow Director filter program request
  * @fdir_data: Packet data that will be filter parameters
  * @raw_packet: the pre-allocated packet buffer for FDir
  * @pf: The PF pointer
  * @add: True for add/update, False for remove
+ *
+ * The descriptors are only handed to the HW by i40e_fdir_kick(), or when
+ * the ring fills up, so that many requests can be posted back to back.
+ * Completion is not waited for, failures are reported per fd_id through
+ * i40e_fd_handle_status().
  **/
 static int i40e_program_fdir_filter(struct i40e_fdir_filter *fdir_data,
 				    u8 *raw_packet, struct i40e_pf *pf,
@@ -104,11 +129,17 @@ static int i40e_program_fdir_filter(struct i40e_fdir_filter *fdir_data,
 	tx_ring = vsi->tx_rings[0];
 	dev = tx_ring->dev;
 
-	/* we need two descriptors to add/del a filter and we can wait */
-	for (i = I40E_FD_CLEAN_DELAY; I40E_DESC_UNUSED(tx_ring) < 2; i--) {
-		if (!i)
-			return -EAGAIN;
-		msleep_interruptible(1);
+	/* we need two descriptors to add/del a filter, if the ring is full
+	 * let the HW drain what was posted so far and wait for the cleanup
+	 */
+	if (I40E_DESC_UNUSED(tx_ring) < 2) {
+		writel(tx_ring->next_to_use, tx_ring->tail);
+		for (i = I40E_FD_CLEAN_DELAY;
+		     I40E_DESC_UNUSED(tx_ring) < 2; i--) {
+			if (!i)
+				return -EAGAIN;
+			usleep_range(100, 200);
+		}
 	}
 
 	dma = dma_map_single(dev, raw_packet,
@@ -152,7 +183,6 @@ static int i40e_program_fdir_filter(struct i40e_fdir_filter *fdir_data,
 	/* Mark the data descriptor to be watched */
 	first->next_to_watch = tx_desc;
 
-	writel(tx_ring->next_to_use, tx_ring->tail);
 	return 0;
 
 dma_fail:
@@ -573,14 +603,16 @@ err:
 }
 
 /**
- * i40e_add_del_fdir - Build raw packets to add/del fdir filter
+ * __i40e_add_del_fdir - Build and post raw packets to add/del fdir filter
  * @vsi: pointer to the targeted VSI
  * @input: filter to add or delete
  * @add: true adds a filter, false removes it
  *
+ * Posts the program requests without handing them to the HW, callers
+ * programming many filters call i40e_fdir_kick() once when done.
  **/
-int i40e_add_del_fdir(struct i40e_vsi *vsi,
-		      struct i40e_fdir_filter *input, bool add)
+int __i40e_add_del_fdir(struct i40e_vsi *vsi,
+			struct i40e_fdir_filter *input, bool add)
 {
 	enum ip_ver { ipv6 = 0, ipv4 = 1 };
 	struct i40e_pf *pf = vsi->back;
@@ -664,6 +696,25 @@ int i40e_add_del_fdir(struct i40e_vsi *vsi,
 	return ret;
 }
 
+/**
+ * i40e_add_del_fdir - Build raw packets to add/del fdir filter
+ * @vsi: pointer to the targeted VSI
+ * @input: filter to add or delete
+ * @add: true adds a filter, false removes it
+ *
+ **/
+int i40e_add_del_fdir(struct i40e_vsi *vsi,
+		      struct i40e_fdir_filter *input, bool add)
+{
+	int ret;
+
+	ret = __i40e_add_del_fdir(vsi, input, add);
+	/* some of the packets may have been posted even on failure */
+	i40e_fdir_kick(vsi->back);
+
+	return ret;
+}
+
 #ifdef HAVE_MEM_TYPE_XSK_BUFF_POOL
 /**
  * i40e_fd_handle_status - check the Programming Status for FD
@@ -721,6 +772,14 @@ void i40e_fd_handle_status(struct i40e_ring *rx_ring,
 			dev_warn(&pdev->dev, "ntuple filter loc = %d, could not be added\n",
 				 pf->fd_inv);
 
+		/* Requests are pipelined, so remember every failed fd_id for
+		 * the service task rather than only the last one.
+		 */
+		if (pf->fd_inv && pf->fd_inv < I40E_FDIR_MAX_FD_ID) {
+			set_bit(pf->fd_inv, pf->fd_inv_map);
+			i40e_service_event_schedule(pf);
+		}
+
 		/* Check if the programming error is for ATR.
 		 * If so, auto disable ATR and set a state for
 		 * flush in progress. Next time we come here if flush is in
@@ -1200,19 +1259,19 @@ static inline unsigned int i40e_itr_divisor(struct i40e_q_vector *q_vector)
 
 	switch (q_vector->vsi->back->hw.phy.link_info.link_speed) {
 	case I40E_LINK_SPEED_40GB:
-		divisor = I40E_ITR_ADAPTIVE_MIN_INC * 1024;
+		divisor = I40E_ITR_DIVISOR_40G;
 		break;
 	case I40E_LINK_SPEED_25GB:
 	case I40E_LINK_SPEED_20GB:
-		divisor = I40E_ITR_ADAPTIVE_MIN_INC * 512;
+		divisor = I40E_ITR_DIVISOR_25G;
 		break;
 	default:
 	case I40E_LINK_SPEED_10GB:
-		divisor = I40E_ITR_ADAPTIVE_MIN_INC * 256;
+		divisor = I40E_ITR_DIVISOR_10G;
 		break;
 	case I40E_LINK_SPEED_1GB:
 	case I40E_LINK_SPEED_100MB:
-		divisor = I40E_ITR_ADAPTIVE_MIN_INC * 32;
+		divisor = I40E_ITR_DIVISOR_1G;
 		break;
 	}
 
@@ -1224,19 +1283,18 @@ static inline unsigned int i40e_itr_divisor(struct i40e_q_vector *q_vector)
  * @q_vector: structure containing interrupt and ring information
  * @rc: structure containing ring performance data
  *
- * Stores a new ITR value based on packets and byte
- * counts during the last interrupt.  The advantage of per interrupt
- * computation is faster updates and more accurate ITR for the current
- * traffic pattern.  Constants in this function were computed
- * based on theoretical maximum wire speed and thresholds were set based
- * on testing data as well as attempting to minimize response time
- * while increasing bulk throughput.
+ * Feeds the packet and byte counts gathered since the last interrupt to
+ * i40e_itr_compute and stores the resulting target ITR. The algorithm itself
+ * lives in i40e_itr.h so that it can be replayed against recorded traces
+ * outside of the kernel.
  **/
 static void i40e_update_itr(struct i40e_q_vector *q_vector,
 			    struct i40e_ring_container *rc)
 {
-	unsigned int avg_wire_size, packets, bytes, itr;
+	bool is_rx = i40e_container_is_rx(q_vector, rc);
+	struct i40e_ring_container *peer;
 	unsigned long next_update = jiffies;
+	unsigned int itr;
 
 	/* If we don't have any rings just leave ourselves set for maximum
 	 * possible latency so we take ourselves out of the equation.
@@ -1244,20 +1302,15 @@ static void i40e_update_itr(struct i40e_q_vector *q_vector,
 	if (!rc->ring || !ITR_IS_DYNAMIC(rc->ring->itr_setting))
 		return;
 
-	/* For Rx we want to push the delay up and default to low latency.
-	 * for Tx we want to pull the delay down and default to high latency.
-	 */
-	itr = i40e_container_is_rx(q_vector, rc) ?
-	      I40E_ITR_ADAPTIVE_MIN_USECS | I40E_ITR_ADAPTIVE_LATENCY :
-	      I40E_ITR_ADAPTIVE_MAX_USECS | I40E_ITR_ADAPTIVE_LATENCY;
-
 	/* If we didn't update within up to 1 - 2 jiffies we can assume
 	 * that either packets are coming in so slow there hasn't been
 	 * any work, or that there is so much work that NAPI is dealing
 	 * with interrupt moderation and we don't need to do anything.
 	 */
-	if (time_after(next_update, rc->next_update))
+	if (time_after(next_update, rc->next_update)) {
+		itr = i40e_itr_default(is_rx);
 		goto clear_counts;
+	}
 
 	/* If itr_countdown is set it means we programmed an ITR within
 	 * the last 4 interrupt cycles. This has a side effect of us
@@ -1270,149 +1323,12 @@ static void i40e_update_itr(struct i40e_q_vector *q_vector,
 		goto clear_counts;
 	}
 
-	packets = rc->total_packets;
-	bytes = rc->total_bytes;
-
-	if (i40e_container_is_rx(q_vector, rc)) {
-		/* If Rx there are 1 to 4 packets and bytes are less than
-		 * 9000 assume insufficient data to use bulk rate limiting
-		 * approach unless Tx is already in bulk rate limiting. We
-		 * are likely latency driven.
-		 */
-		if (packets && packets < 4 && bytes < 9000 &&
-		    (q_vector->tx.target_itr & I40E_ITR_ADAPTIVE_LATENCY)) {
-			itr = I40E_ITR_ADAPTIVE_LATENCY;
-			goto adjust_by_size;
-		}
-	} else if (packets < 4) {
-		/* If we have Tx and Rx ITR maxed and Tx ITR is running in
-		 * bulk mode and we are receiving 4 or fewer packets just
-		 * reset the ITR_ADAPTIVE_LATENCY bit for latency mode so
-		 * that the Rx can relax.
-		 */
-		if (rc->target_itr == I40E_ITR_ADAPTIVE_MAX_USECS &&
-		    (q_vector->rx.target_itr & I40E_ITR_MASK) ==
-		     I40E_ITR_ADAPTIVE_MAX_USECS)
-			goto clear_counts;
-	} else if (packets > 32) {
-		/* If we have processed over 32 packets in a single interrupt
-		 * for Tx assume we need to switch over to "bulk" mode.
-		 */
-		rc->target_itr &= ~I40E_ITR_ADAPTIVE_LATENCY;
-	}
-
-	/* We have no packets to actually measure against. This means
-	 * either one of the other queues on this vector is active or
-	 * we are a Tx queue doing TSO with too high of an interrupt rate.
-	 *
-	 * Between 4 and 56 we can assume that our current interrupt delay
-	 * is only slightly too low. As such we should increase it by a small
-	 * fixed amount.
-	 */
-	if (packets < 56) {
-		itr = rc->target_itr + I40E_ITR_ADAPTIVE_MIN_INC;
-		if ((itr & I40E_ITR_MASK) > I40E_ITR_ADAPTIVE_MAX_USECS) {
-			itr &= I40E_ITR_ADAPTIVE_LATENCY;
-			itr += I40E_ITR_ADAPTIVE_MAX_USECS;
-		}
-		goto clear_counts;
-	}
-
-	if (packets <= 256) {
-		itr = min(q_vector->tx.current_itr, q_vector->rx.current_itr);
-		itr &= I40E_ITR_MASK;
-
-		/* Between 56 and 112 is our "goldilocks" zone where we are
-		 * working out "just right". Just report that our current
-		 * ITR is good for us.
-		 */
-		if (packets <= 112)
-			goto clear_counts;
-
-		/* If packet count is 128 or greater we are likely looking
-		 * at a slight overrun of the delay we want. Try halving
-		 * our delay to see if that will cut the number of packets
-		 * in half per interrupt.
-		 */
-		itr /= 2;
-		itr &= I40E_ITR_MASK;
-		if (itr < I40E_ITR_ADAPTIVE_MIN_USECS)
-			itr = I40E_ITR_ADAPTIVE_MIN_USECS;
-
-		goto clear_counts;
-	}
-
-	/* The paths below assume we are dealing with a bulk ITR since
-	 * number of packets is greater than 256. We are just going to have
-	 * to compute a value and try to bring the count under control,
-	 * though for smaller packet sizes there isn't much we can do as
-	 * NAPI polling will likely be kicking in sooner rather than later.
-	 */
-	itr = I40E_ITR_ADAPTIVE_BULK;
-
-adjust_by_size:
-	/* If packet counts are 256 or greater we can assume we have a gross
-	 * overestimation of what the rate should be. Instead of trying to fine
-	 * tune it just use the formula below to try and dial in an exact value
-	 * give the current packet size of the frame.
-	 */
-	avg_wire_size = bytes / packets;
-
-	/* The following is a crude approximation of:
-	 *  wmem_default / (size + overhead) = desired_pkts_per_int
-	 *  rate / bits_per_byte / (size + ethernet overhead) = pkt_rate
-	 *  (desired_pkt_rate / pkt_rate) * usecs_per_sec = ITR value
-	 *
-	 * Assuming wmem_default is 212992 and overhead is 640 bytes per
-	 * packet, (256 skb, 64 headroom, 320 shared info), we can reduce the
-	 * formula down to
-	 *
-	 *  (170 * (size + 24)) / (size + 640) = ITR
-	 *
-	 * We first do some math on the packet size and then finally bitshift
-	 * by 8 after rounding up. We also have to account for PCIe link speed
-	 * difference as ITR scales based on this.
-	 */
-	if (avg_wire_size <= 60) {
-		/* Start at 250k ints/sec */
-		avg_wire_size = 4096;
-	} else if (avg_wire_size <= 380) {
-		/* 250K ints/sec to 60K ints/sec */
-		avg_wire_size *= 40;
-		avg_wire_size += 1696;
-	} else if (avg_wire_size <= 1084) {
-		/* 60K ints/sec to 36K ints/sec */
-		avg_wire_size *= 15;
-		avg_wire_size += 11452;
-	} else if (avg_wire_size <= 1980) {
-		/* 36K ints/sec to 30K ints/sec */
-		avg_wire_size *= 5;
-		avg_wire_size += 22420;
-	} else {
-		/* plateau at a limit of 30K ints/sec */
-		avg_wire_size = 32256;
-	}
-
-	/* If we are in low latency mode halve our delay which doubles the
-	 * rate to somewhere between 100K to 16K ints/sec
-	 */
-	if (itr & I40E_ITR_ADAPTIVE_LATENCY)
-		avg_wire_size /= 2;
-
-	/* Resultant value is 256 times larger than it needs to be. This
-	 * gives us room to adjust the value as needed to either increase
-	 * or decrease the value based on link speeds of 10G, 2.5G, 1G, etc.
-	 *
-	 * Use addition as we have already recorded the new latency flag
-	 * for the ITR value.
-	 */
-	itr += DIV_ROUND_UP(avg_wire_size, i40e_itr_divisor(q_vector)) *
-	       I40E_ITR_ADAPTIVE_MIN_INC;
-
-	if ((itr & I40E_ITR_MASK) > I40E_ITR_ADAPTIVE_MAX_USECS) {
-		itr &= I40E_ITR_ADAPTIVE_LATENCY;
-		itr += I40E_ITR_ADAPTIVE_MAX_USECS;
-	}
+	peer = is_rx ? &q_vector->tx : &q_vector->rx;
+	itr = i40e_itr_compute(is_rx, rc->target_itr, peer->target_itr,
+			       min(q_vector->tx.current_itr,
+				   q_vector->rx.current_itr),
+			       rc->total_packets, rc->total_bytes,
+			       i40e_itr_divisor(q_vector));
 
 clear_counts:
 	/* write back value */
@@ -3148,14 +3064,52 @@ static inline u32 i40e_buildreg_itr(const int type, u16 itr)
 /* a small macro to shorten up some long lines */
 #define INTREG I40E_PFINT_DYN_CTLN
 
-/* The act of updating the ITR will cause it to immediately trigger. In order
- * to prevent this from throwing off adaptive update statistics we defer the
- * update so that it can only happen so often. So after either Tx or Rx are
- * updated we make the adaptive scheme wait until either the ITR completely
- * expires via the next_update expiration or we have been through at least
- * 3 interrupts.
- */
-#define ITR_COUNTDOWN_START 3
+/**
+ * i40e_update_intrl - adapt the interrupt rate limit of a vector to its load
+ * @vsi: the VSI we care about
+ * @q_vector: q_vector whose rate limit is being updated
+ *
+ * Called when NAPI completes. If the vector kept exhausting its budget the
+ * softirq is saturating the CPU, so raise the INTRL credit interval by one
+ * step to batch more work per interrupt. Once the vector has been handling
+ * every interrupt in a single poll for a while, step back down towards the
+ * rx-usecs-high value configured by the user. Only the offending vector is
+ * throttled, so one noisy queue cannot hog the core it shares with others.
+ **/
+static void i40e_update_intrl(struct i40e_vsi *vsi,
+			      struct i40e_q_vector *q_vector)
+{
+	u16 intrl = q_vector->intrl;
+
+	if (!(vsi->back->flags & I40E_FLAG_ADAPTIVE_INTRL))
+		return;
+
+	if (q_vector->intrl_busy_polls >= I40E_INTRL_ADAPT_BUSY_POLLS) {
+		q_vector->intrl_idle_irqs = 0;
+		intrl = min_t(u16, intrl + I40E_INTRL_ADAPT_STEP,
+			      INTRL_REG_TO_USEC(I40E_MAX_INTRL));
+	} else if (!q_vector->intrl_busy_polls &&
+		   ++q_vector->intrl_idle_irqs >= I40E_INTRL_ADAPT_IDLE_IRQS) {
+		q_vector->intrl_idle_irqs = 0;
+		if (intrl > vsi->int_rate_limit + I40E_INTRL_ADAPT_STEP)
+			intrl -= I40E_INTRL_ADAPT_STEP;
+		else
+			intrl = vsi->int_rate_limit;
+	}
+	q_vector->intrl_busy_polls = 0;
+
+	if (intrl == q_vector->intrl)
+		return;
+
+	if (intrl > q_vector->intrl)
+		q_vector->intrl_raised++;
+	else
+		q_vector->intrl_lowered++;
+	q_vector->intrl = intrl;
+
+	wr32(&vsi->back->hw, I40E_PFINT_RATEN(q_vector->reg_idx),
+	     i40e_intrl_usec_to_reg(intrl));
+}
 
 /**
  * i40e_update_enable_itr - Update itr and re-enable MSIX interrupt
@@ -3178,48 +3132,48 @@ static inline void i40e_update_enable_itr(struct i40e_vsi *vsi,
 	/* These will do nothing if dynamic updates are not enabled */
 	i40e_update_itr(q_vector, &q_vector->tx);
 	i40e_update_itr(q_vector, &q_vector->rx);
+	i40e_update_intrl(vsi, q_vector);
 
-	/* This block of logic allows us to get away with only updating
-	 * one ITR value with each interrupt. The idea is to perform a
-	 * pseudo-lazy update with the following criteria.
-	 *
-	 * 1. Rx is given higher priority than Tx if both are in same state
-	 * 2. If we must reduce an ITR that is given highest priority.
-	 * 3. We then give priority to increasing ITR based on amount.
-	 */
-	if (q_vector->rx.target_itr < q_vector->rx.current_itr) {
-		/* Rx ITR needs to be reduced, this is highest priority */
+	switch (i40e_itr_select(q_vector->rx.target_itr,
+				q_vector->rx.current_itr,
+				q_vector->tx.target_itr,
+				q_vector->tx.current_itr)) {
+	case I40E_ITR_UPDATE_RX:
 		intval = i40e_buildreg_itr(I40E_RX_ITR,
 					   q_vector->rx.target_itr);
 		q_vector->rx.current_itr = q_vector->rx.target_itr;
 		q_vector->itr_countdown = ITR_COUNTDOWN_START;
-	} else if ((q_vector->tx.target_itr < q_vector->tx.current_itr) ||
-		   ((q_vector->rx.target_itr - q_vector->rx.current_itr) <
-		    (q_vector->tx.target_itr - q_vector->tx.current_itr))) {
-		/* Tx ITR needs to be reduced, this is second priority
-		 * Tx ITR needs to be increased more than Rx, fourth priority
-		 */
+		break;
+	case I40E_ITR_UPDATE_TX:
 		intval = i40e_buildreg_itr(I40E_TX_ITR,
 					   q_vector->tx.target_itr);
 		q_vector->tx.current_itr = q_vector->tx.target_itr;
 		q_vector->itr_countdown = ITR_COUNTDOWN_START;
-	} else if (q_vector->rx.current_itr != q_vector->rx.target_itr) {
-		/* Rx ITR needs to be increased, third priority */
-		intval = i40e_buildreg_itr(I40E_RX_ITR,
-					   q_vector->rx.target_itr);
-		q_vector->rx.current_itr = q_vector->rx.target_itr;
-		q_vector->itr_countdown = ITR_COUNTDOWN_START;
-	} else {
-		/* No ITR update, lowest priority */
+		break;
+	default:
 		intval = i40e_buildreg_itr(I40E_ITR_NONE, 0);
 		if (q_vector->itr_countdown)
 			q_vector->itr_countdown--;
+		break;
 	}
 
 	if (!test_bit(__I40E_VSI_DOWN, vsi->state))
 		wr32(hw, INTREG(q_vector->reg_idx), intval);
 }
 
+/**
+ * i40e_napi_is_threaded - check if NAPI is polled from a dedicated kthread
+ * @napi: napi struct to check
+ **/
+static inline bool i40e_napi_is_threaded(struct napi_struct *napi)
+{
+#ifdef HAVE_NAPI_THREADED
+	return test_bit(NAPI_STATE_THREADED, &napi->state);
+#else
+	return false;
+#endif /* HAVE_NAPI_THREADED */
+}
+
 /**
  * i40e_napi_poll - NAPI polling Rx/Tx cleanup routine
  * @napi: napi struct with our devices info in it
@@ -3315,8 +3269,14 @@ int i40e_napi_poll(struct napi_struct *napi, int budget)
 		 * cpu.  We check to make sure affinity is correct before we
 		 * continue to poll, otherwise we must stop polling so the
 		 * interrupt can move to the correct cpu.
+		 *
+		 * In threaded mode polling runs from a kthread that is
+		 * scheduled independently of the interrupt, so bouncing back
+		 * to the interrupt would not move it; leave its placement to
+		 * the scheduler and the napi-thread-affinity private flag.
 		 */
-		if (!cpumask_test_cpu(cpu_id, &q_vector->affinity_mask)) {
+		if (!i40e_napi_is_threaded(napi) &&
+		    !cpumask_test_cpu(cpu_id, &q_vector->affinity_mask)) {
 			/* Tell napi that we are done polling */
 			napi_complete_done(napi, work_done);
 
@@ -3327,6 +3287,9 @@ int i40e_napi_poll(struct napi_struct *napi, int budget)
 			return budget - 1;
 		}
 #endif /* HAVE_IRQ_AFFINITY_NOTIFY */
+		q_vector->intrl_budget_exhausted++;
+		if (q_vector->intrl_busy_polls < U16_MAX)
+			q_vector->intrl_busy_polls++;
 tx_only:
 		if (arm_wb) {
 			q_vector->tx.ring[0].tx_stats.tx_force_wb++;
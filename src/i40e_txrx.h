@@ -4,6 +4,8 @@
 #ifndef _I40E_TXRX_H_
 #define _I40E_TXRX_H_
 
+#include "i40e_itr.h"
+
 /* Interrupt Throttling and Rate Limiting Goodies */
 #define I40E_DEFAULT_IRQ_WORK      256
 
@@ -14,13 +16,7 @@
  * avoid an excessive amount of translation.
  */
 #define I40E_ITR_DYNAMIC	0x8000	/* use top bit as a flag */
-#define I40E_ITR_MASK		0x1FFE	/* mask for ITR register value */
 #define I40E_MIN_ITR		     2	/* reg uses 2 usec resolution */
-#define I40E_ITR_100K		    10  /* all values below must be even */
-#define I40E_ITR_50K		    20
-#define I40E_ITR_20K		    50
-#define I40E_ITR_18K		    60
-#define I40E_ITR_8K		   122
 #define I40E_MAX_ITR		  8160	/* maximum value as per datasheet */
 #define ITR_TO_REG(setting) ((setting) & ~I40E_ITR_DYNAMIC)
 #define ITR_REG_ALIGN(setting) __ALIGN_MASK(setting, ~I40E_ITR_MASK)
@@ -54,6 +50,15 @@ static inline u16 i40e_intrl_usec_to_reg(int intrl)
 #define I40E_INTRL_62K             16      /* 62500 ints/sec */
 #define I40E_INTRL_83K             12      /* 83333 ints/sec */
 
+/* Adaptive interrupt rate limiting, see i40e_update_intrl(). A vector raises
+ * its INTRL by one register step after this many consecutive NAPI polls used
+ * the whole budget, and lowers it again towards rx-usecs-high after this many
+ * interrupts in a row were fully handled by a single poll.
+ */
+#define I40E_INTRL_ADAPT_BUSY_POLLS	8
+#define I40E_INTRL_ADAPT_IDLE_IRQS	64
+#define I40E_INTRL_ADAPT_STEP		4	/* usecs, register resolution */
+
 #define I40E_QUEUE_END_OF_LIST 0x7FF
 
 /* this enum matches hardware bits and is meant to be used by DYN_CTLN
@@ -502,13 +507,6 @@ static inline void clear_ring_build_skb_enabled(struct i40e_ring *ring)
 	ring->flags &= ~I40E_RXR_FLAGS_BUILD_SKB_ENABLED;
 }
 
-#define I40E_ITR_ADAPTIVE_MIN_INC       0x0002
-#define I40E_ITR_ADAPTIVE_MIN_USECS     0x0002
-#define I40E_ITR_ADAPTIVE_MAX_USECS     0x007e
-#define I40E_ITR_ADAPTIVE_LATENCY       0x8000
-#define I40E_ITR_ADAPTIVE_BULK          0x0000
-#define ITR_IS_BULK(x) (!((x) & I40E_ITR_ADAPTIVE_LATENCY))
-
 static inline bool ring_is_xdp(struct i40e_ring *ring)
 {
 	return !!(ring->flags & I40E_TXR_FLAGS_XDP);
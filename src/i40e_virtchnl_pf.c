@@ -229,7 +229,8 @@ void i40e_vc_notify_vf_reset(struct i40e_vf *vf)
  * @vf: pointer to the VF info
  * @notify_vf: notify vf about reset or not
  *
- * Reset VF handler.
+ * Reset VF handler. The caller holds pf->vc_rwsem for writing, the VF
+ * message handlers run under it and the reset replaces the VF's VSI.
  **/
 void i40e_vc_reset_vf(struct i40e_vf *vf, bool notify_vf)
 {
@@ -490,32 +491,42 @@ irq_list_done:
 
 #define I40E_MAX_TX_QLEN 0x1FE0
 
+/**
+ * struct i40e_vf_qp_ctx - HMC contexts built for one VF queue pair
+ * @tx_ctx: Tx queue context
+ * @rx_ctx: Rx queue context
+ * @pf_queue_id: absolute PF queue the pair is backed by
+ **/
+struct i40e_vf_qp_ctx {
+	struct i40e_hmc_obj_txq tx_ctx;
+	struct i40e_hmc_obj_rxq rx_ctx;
+	u16 pf_queue_id;
+};
+
 /**
  * i40e_config_vsi_tx_queue
  * @vf: pointer to the VF info
  * @vsi_id: id of VSI as provided by the FW
  * @vsi_queue_id: vsi relative queue index
  * @info: config. info
+ * @tx_ctx: context to fill in
  *
- * configure tx queue
+ * validate the tx queue config and build its HMC context, nothing is
+ * written to the hardware here, see i40e_write_vf_qp_ctx
  **/
 static int i40e_config_vsi_tx_queue(struct i40e_vf *vf, u16 vsi_id,
 				    u16 vsi_queue_id,
-				    struct virtchnl_txq_info *info)
+				    struct virtchnl_txq_info *info,
+				    struct i40e_hmc_obj_txq *tx_ctx)
 {
 	struct i40e_pf *pf = vf->pf;
-	struct i40e_hw *hw = &pf->hw;
-	struct i40e_hmc_obj_txq tx_ctx;
 	struct i40e_vsi *vsi;
-	u16 pf_queue_id;
 	int ret = 0, i;
-	u32 qtx_ctl;
 
 	if (!i40e_vc_isvalid_vsi_id(vf, info->vsi_id)) {
 		ret = -ENOENT;
 		goto error_context;
 	}
-	pf_queue_id = i40e_vc_get_pf_queue_id(vf, vsi_id, vsi_queue_id);
 	vsi = i40e_find_vsi_from_id(pf, vsi_id);
 	if (!vsi) {
 		ret = -ENOENT;
@@ -523,20 +534,20 @@ static int i40e_config_vsi_tx_queue(struct i40e_vf *vf, u16 vsi_id,
 	}
 
 	/* clear the context structure first */
-	memset(&tx_ctx, 0, sizeof(struct i40e_hmc_obj_txq));
+	memset(tx_ctx, 0, sizeof(struct i40e_hmc_obj_txq));
 
 	/* only set the required fields */
-	tx_ctx.base = info->dma_ring_addr / 128;
+	tx_ctx->base = info->dma_ring_addr / 128;
 
 	/* ring_len has to be multiple of 8 */
 	if (info->ring_len & 7 || info->ring_len > I40E_MAX_TX_QLEN) {
 		ret = -EINVAL;
 		goto error_context;
 	}
-	tx_ctx.qlen = info->ring_len;
+	tx_ctx->qlen = info->ring_len;
 
 	if (vsi->tc_config.enabled_tc == 1) {
-		tx_ctx.rdylist = le16_to_cpu(vsi->info.qs_handle[0]);
+		tx_ctx->rdylist = le16_to_cpu(vsi->info.qs_handle[0]);
 	} else {
 		for (i = 0; i < I40E_MAX_TRAFFIC_CLASS; i++) {
 			/* If queue is assigned to this TC */
@@ -553,44 +564,14 @@ static int i40e_config_vsi_tx_queue(struct i40e_vf *vf, u16 vsi_id,
 		if (i >= I40E_MAX_TRAFFIC_CLASS ||
 		    le16_to_cpu(vsi->info.qs_handle[i]) ==
 		    I40E_AQ_VSI_QS_HANDLE_INVALID)
-			tx_ctx.rdylist = le16_to_cpu(vsi->info.qs_handle[0]);
+			tx_ctx->rdylist = le16_to_cpu(vsi->info.qs_handle[0]);
 		else
-			tx_ctx.rdylist = le16_to_cpu(vsi->info.qs_handle[i]);
-	}
-
-	tx_ctx.rdylist_act = 0;
-	tx_ctx.head_wb_ena = info->headwb_enabled;
-	tx_ctx.head_wb_addr = info->dma_headwb_addr;
-
-	/* clear the context in the HMC */
-	ret = i40e_clear_lan_tx_queue_context(hw, pf_queue_id);
-	if (ret) {
-		dev_err(&pf->pdev->dev,
-			"Failed to clear VF LAN Tx queue context %d, error: %d\n",
-			pf_queue_id, ret);
-		ret = -ENOENT;
-		goto error_context;
-	}
-
-	/* set the context in the HMC */
-	ret = i40e_set_lan_tx_queue_context(hw, pf_queue_id, &tx_ctx);
-	if (ret) {
-		dev_err(&pf->pdev->dev,
-			"Failed to set VF LAN Tx queue context %d error: %d\n",
-			pf_queue_id, ret);
-		ret = -ENOENT;
-		goto error_context;
+			tx_ctx->rdylist = le16_to_cpu(vsi->info.qs_handle[i]);
 	}
 
-	/* associate this queue with the PCI VF function */
-	qtx_ctl = I40E_QTX_CTL_VF_QUEUE;
-	qtx_ctl |= ((hw->pf_id << I40E_QTX_CTL_PF_INDX_SHIFT)
-		    & I40E_QTX_CTL_PF_INDX_MASK);
-	qtx_ctl |= (((vf->vf_id + hw->func_caps.vf_base_id)
-		     << I40E_QTX_CTL_VFVM_INDX_SHIFT)
-		    & I40E_QTX_CTL_VFVM_INDX_MASK);
-	wr32(hw, I40E_QTX_CTL(pf_queue_id), qtx_ctl);
-	i40e_flush(hw);
+	tx_ctx->rdylist_act = 0;
+	tx_ctx->head_wb_ena = info->headwb_enabled;
+	tx_ctx->head_wb_addr = info->dma_headwb_addr;
 
 error_context:
 	return ret;
@@ -604,49 +585,46 @@ error_context:
  * @vsi_id: id of VSI  as provided by the FW
  * @vsi_queue_id: vsi relative queue index
  * @info: config. info
+ * @rx_ctx: context to fill in
  *
- * configure rx queue
+ * validate the rx queue config and build its HMC context, nothing is
+ * written to the hardware here, see i40e_write_vf_qp_ctx
  **/
 static int i40e_config_vsi_rx_queue(struct i40e_vf *vf, u16 vsi_id,
 				    u16 vsi_queue_id,
-				    struct virtchnl_rxq_info *info)
+				    struct virtchnl_rxq_info *info,
+				    struct i40e_hmc_obj_rxq *rx_ctx)
 {
-	struct i40e_pf *pf = vf->pf;
-	struct i40e_hw *hw = &pf->hw;
-	struct i40e_hmc_obj_rxq rx_ctx;
-	struct i40e_vsi *vsi = pf->vsi[vf->lan_vsi_idx];
-	u16 pf_queue_id;
+	struct i40e_vsi *vsi = vf->pf->vsi[vf->lan_vsi_idx];
 	int ret = 0;
 
-	pf_queue_id = i40e_vc_get_pf_queue_id(vf, vsi_id, vsi_queue_id);
-
 	/* clear the context structure first */
-	memset(&rx_ctx, 0, sizeof(struct i40e_hmc_obj_rxq));
+	memset(rx_ctx, 0, sizeof(struct i40e_hmc_obj_rxq));
 
 	/* only set the required fields */
-	rx_ctx.base = info->dma_ring_addr / 128;
+	rx_ctx->base = info->dma_ring_addr / 128;
 
 	/* ring_len has to be multiple of 32 */
 	if (info->ring_len & 31 || info->ring_len > I40E_MAX_RX_QLEN) {
 		ret = -EINVAL;
 		goto error_param;
 	}
-	rx_ctx.qlen = info->ring_len;
+	rx_ctx->qlen = info->ring_len;
 
 	if (info->splithdr_enabled) {
-		rx_ctx.hsplit_0 = I40E_RX_SPLIT_L2      |
-				  I40E_RX_SPLIT_IP      |
-				  I40E_RX_SPLIT_TCP_UDP |
-				  I40E_RX_SPLIT_SCTP;
+		rx_ctx->hsplit_0 = I40E_RX_SPLIT_L2      |
+				   I40E_RX_SPLIT_IP      |
+				   I40E_RX_SPLIT_TCP_UDP |
+				   I40E_RX_SPLIT_SCTP;
 		/* header length validation */
 		if (info->hdr_size > ((2 * 1024) - 64)) {
 			ret = -EINVAL;
 			goto error_param;
 		}
-		rx_ctx.hbuff = info->hdr_size >> I40E_RXQ_CTX_HBUFF_SHIFT;
+		rx_ctx->hbuff = info->hdr_size >> I40E_RXQ_CTX_HBUFF_SHIFT;
 
 		/* set splitalways mode 10b */
-		rx_ctx.dtype = I40E_RX_DTYPE_HEADER_SPLIT;
+		rx_ctx->dtype = I40E_RX_DTYPE_HEADER_SPLIT;
 	}
 
 	/* databuffer length validation */
@@ -654,27 +632,48 @@ static int i40e_config_vsi_rx_queue(struct i40e_vf *vf, u16 vsi_id,
 		ret = -EINVAL;
 		goto error_param;
 	}
-	rx_ctx.dbuff = info->databuffer_size >> I40E_RXQ_CTX_DBUFF_SHIFT;
+	rx_ctx->dbuff = info->databuffer_size >> I40E_RXQ_CTX_DBUFF_SHIFT;
 
 	/* max pkt. length validation */
 	if (info->max_pkt_size >= (16 * 1024) || info->max_pkt_size < 64) {
 		ret = -EINVAL;
 		goto error_param;
 	}
-	rx_ctx.rxmax = info->max_pkt_size;
+	rx_ctx->rxmax = info->max_pkt_size;
 
 	/* if port/outer VLAN is configured increase the max packet size */
 	if (i40e_is_vid(&vsi->info))
-		rx_ctx.rxmax += VLAN_HLEN;
+		rx_ctx->rxmax += VLAN_HLEN;
 
 	/* enable 32bytes desc always */
-	rx_ctx.dsize = 1;
+	rx_ctx->dsize = 1;
 
 	/* default values */
-	rx_ctx.lrxqthresh = 1;
-	rx_ctx.crcstrip = 1;
-	rx_ctx.prefena = 1;
-	rx_ctx.l2tsel = 1;
+	rx_ctx->lrxqthresh = 1;
+	rx_ctx->crcstrip = 1;
+	rx_ctx->prefena = 1;
+	rx_ctx->l2tsel = 1;
+
+error_param:
+	return ret;
+}
+
+/**
+ * i40e_write_vf_qp_ctx
+ * @vf: pointer to the VF info
+ * @qp: contexts built by i40e_config_vsi_rx_queue/i40e_config_vsi_tx_queue
+ *
+ * Write the Rx and Tx HMC contexts of one queue pair and associate the Tx
+ * queue with the VF. The register writes are not flushed, the caller
+ * flushes once after all the pairs of the message are written.
+ **/
+static int i40e_write_vf_qp_ctx(struct i40e_vf *vf, struct i40e_vf_qp_ctx *qp)
+{
+	struct i40e_pf *pf = vf->pf;
+	struct i40e_hw *hw = &pf->hw;
+	u16 pf_queue_id = qp->pf_queue_id;
+	u32 qtx_ctl;
+	int ret;
 
 	/* clear the context in the HMC */
 	ret = i40e_clear_lan_rx_queue_context(hw, pf_queue_id);
@@ -682,22 +681,44 @@ static int i40e_config_vsi_rx_queue(struct i40e_vf *vf, u16 vsi_id,
 		dev_err(&pf->pdev->dev,
 			"Failed to clear VF LAN Rx queue context %d, error: %d\n",
 			pf_queue_id, ret);
-		ret = -ENOENT;
-		goto error_param;
+		return -ENOENT;
 	}
 
 	/* set the context in the HMC */
-	ret = i40e_set_lan_rx_queue_context(hw, pf_queue_id, &rx_ctx);
+	ret = i40e_set_lan_rx_queue_context(hw, pf_queue_id, &qp->rx_ctx);
 	if (ret) {
 		dev_err(&pf->pdev->dev,
 			"Failed to set VF LAN Rx queue context %d error: %d\n",
 			pf_queue_id, ret);
-		ret = -ENOENT;
-		goto error_param;
+		return -ENOENT;
 	}
 
-error_param:
-	return ret;
+	ret = i40e_clear_lan_tx_queue_context(hw, pf_queue_id);
+	if (ret) {
+		dev_err(&pf->pdev->dev,
+			"Failed to clear VF LAN Tx queue context %d, error: %d\n",
+			pf_queue_id, ret);
+		return -ENOENT;
+	}
+
+	ret = i40e_set_lan_tx_queue_context(hw, pf_queue_id, &qp->tx_ctx);
+	if (ret) {
+		dev_err(&pf->pdev->dev,
+			"Failed to set VF LAN Tx queue context %d error: %d\n",
+			pf_queue_id, ret);
+		return -ENOENT;
+	}
+
+	/* associate this queue with the PCI VF function */
+	qtx_ctl = I40E_QTX_CTL_VF_QUEUE;
+	qtx_ctl |= ((hw->pf_id << I40E_QTX_CTL_PF_INDX_SHIFT)
+		    & I40E_QTX_CTL_PF_INDX_MASK);
+	qtx_ctl |= (((vf->vf_id + hw->func_caps.vf_base_id)
+		     << I40E_QTX_CTL_VFVM_INDX_SHIFT)
+		    & I40E_QTX_CTL_VFVM_INDX_MASK);
+	wr32(hw, I40E_QTX_CTL(pf_queue_id), qtx_ctl);
+
+	return 0;
 }
 
 /**
@@ -1205,12 +1226,23 @@ static int i40e_restore_vfd_config(struct i40e_vf *vf, struct i40e_vsi *vsi)
 	u8 sec_flag;
 	u16 vid;
 
-	/* Restore all VF-d configuration on reset */
+	/* Restore all VF-d configuration on reset, the trunk goes in under
+	 * one hold of the filter lock and one filter sync
+	 */
+	spin_lock_bh(&vsi->mac_filter_hash_lock);
 	for_each_set_bit(vid, vf->trunk_vlans, VLAN_N_VID) {
-		ret = i40e_vsi_add_vlan(vsi, vid);
+		/* VID 0 is received untagged, see i40e_vsi_add_vlan */
+		if (!vid)
+			continue;
+		ret = i40e_add_vlan_all_mac(vsi, vid);
 		if (ret)
-			goto err_out;
+			break;
 	}
+	spin_unlock_bh(&vsi->mac_filter_hash_lock);
+	if (ret)
+		goto err_out;
+	if (!bitmap_empty(vf->trunk_vlans, VLAN_N_VID))
+		i40e_service_event_schedule(pf);
 
 	cnt = bitmap_weight(vf->mirror_vlans, VLAN_N_VID);
 	if (cnt) {
@@ -1349,7 +1381,31 @@ error_unlock:
 	return ret;
 }
 
-static bool i40e_find_vmmac_on_list(struct i40e_vf *vf, const u8 *macaddr);
+static struct i40e_vm_mac *i40e_find_vmmac_on_list(struct i40e_vf *vf,
+						   const u8 *macaddr);
+
+/**
+ * i40e_is_first_mac_filter
+ * @vsi: pointer to the vsi structure
+ * @f: MAC filter to check
+ *
+ * A MAC is on the VSI once per VLAN, all of them in the same bucket. Returns
+ * true if @f is the first filter of its MAC so each MAC is handled once.
+ **/
+static bool i40e_is_first_mac_filter(struct i40e_vsi *vsi,
+				     struct i40e_mac_filter *f)
+{
+	struct i40e_mac_filter *tmp;
+
+	hash_for_each_possible(vsi->mac_filter_hash, tmp, hlist,
+			       i40e_addr_to_hkey(f->macaddr)) {
+		if (tmp == f)
+			return true;
+		if (ether_addr_equal(tmp->macaddr, f->macaddr))
+			return false;
+	}
+	return true;
+}
 
 /**
  * i40e_retain_mac_list
@@ -1357,37 +1413,43 @@ static bool i40e_find_vmmac_on_list(struct i40e_vf *vf, const u8 *macaddr);
  * @vf_id: VF identifier
  * @vsi_idx: vsi idx
  *
- * This function do backup of vf mac_list without broadcast and default
- * lan address before vsi release
+ * This function do backup of vf mac_list without broadcast, default
+ * lan address and addresses added by the VM before vsi release
  **/
 static int i40e_retain_mac_list(struct i40e_pf *pf, int vf_id, u16 vsi_idx)
 {
-	struct vfd_macaddr *tmp, *pos;
+	struct i40e_vf *vf = &pf->vf[vf_id];
+	struct i40e_vsi *vsi = pf->vsi[vsi_idx];
 	struct list_head *mac_list;
-	u8 broadcast[ETH_ALEN];
-	struct i40e_vsi *vsi;
-	struct i40e_vf *vf;
-	int ret;
+	struct i40e_mac_filter *f;
+	struct vfd_macaddr *elem;
+	int ret = 0, bkt;
 
-	vf = &pf->vf[vf_id];
-	vsi = pf->vsi[vsi_idx];
 	mac_list = &pf->mac_list[vf_id];
-	eth_broadcast_addr(broadcast);
 	INIT_LIST_HEAD(mac_list);
 
-	ret = i40e_copy_mac_list_sync(vsi, mac_list);
-	if (ret)
-		goto err_copy;
-
-	list_for_each_entry_safe(tmp, pos, mac_list, list) {
-		if (ether_addr_equal(tmp->mac, broadcast) ||
-		    ether_addr_equal(tmp->mac, vf->default_lan_addr.addr) ||
-		    i40e_find_vmmac_on_list(vf, tmp->mac)) {
-			list_del(&tmp->list);
-			kfree(tmp);
+	/* filter while copying, every lookup is hashed so this stays linear
+	 * in the number of filters on the VSI
+	 */
+	spin_lock_bh(&vsi->mac_filter_hash_lock);
+	hash_for_each(vsi->mac_filter_hash, bkt, f, hlist) {
+		if (is_broadcast_ether_addr(f->macaddr) ||
+		    ether_addr_equal(f->macaddr, vf->default_lan_addr.addr) ||
+		    i40e_find_vmmac_on_list(vf, f->macaddr) ||
+		    !i40e_is_first_mac_filter(vsi, f))
+			continue;
+
+		elem = kzalloc(sizeof(*elem), GFP_ATOMIC);
+		if (!elem) {
+			ret = -ENOMEM;
+			break;
 		}
+		INIT_LIST_HEAD(&elem->list);
+		ether_addr_copy(elem->mac, f->macaddr);
+		list_add_tail(&elem->list, mac_list);
 	}
-err_copy:
+	spin_unlock_bh(&vsi->mac_filter_hash_lock);
+
 	return ret;
 }
 
@@ -1509,27 +1571,94 @@ static int i40e_set_source_pruning(struct i40e_vf *vf)
  * @vf: pointer to the VF info
  * @idx: VSI index, applies only for ADq mode, zero otherwise
  *
- * alloc VF vsi context & resources
+ * reserve VF vsi context, called with vf_res_mutex held; the VSI is added
+ * to the HW later by i40e_config_vsi_res()
  **/
 static int i40e_alloc_vsi_res(struct i40e_vf *vf, u8 idx)
 {
-	struct i40e_mac_filter *f = NULL;
 	struct i40e_vsi *main_vsi, *vsi;
 	struct i40e_pf *pf = vf->pf;
-	u64 max_tx_rate = 0;
-	int ret = 0;
 
 	main_vsi = i40e_pf_get_main_vsi(pf);
-	vsi = i40e_vsi_setup(pf, I40E_VSI_SRIOV, main_vsi->seid, vf->vf_id);
+	vsi = i40e_vsi_reserve(pf, I40E_VSI_SRIOV, main_vsi->seid, vf->vf_id);
 
 	if (!vsi) {
+		dev_err(&pf->pdev->dev,
+			"reserve vsi failed for VF %d\n", vf->vf_id);
+		return -ENOENT;
+	}
+
+	if (!idx)
+		vf->lan_vsi_idx = vsi->idx;
+
+	/* storing VSI index for ADq, the id comes with the HW VSI */
+	if (vf->adq_enabled)
+		vf->ch[idx].vsi_idx = vsi->idx;
+
+	return 0;
+}
+
+/**
+ * i40e_clear_vsi_res
+ * @vf: pointer to the VF info
+ * @idx: VSI index, applies only for ADq mode, zero otherwise
+ *
+ * give back a VF vsi reserved by i40e_alloc_vsi_res() that never made it to
+ * the HW, called with vf_res_mutex held
+ **/
+static void i40e_clear_vsi_res(struct i40e_vf *vf, u8 idx)
+{
+	u16 vsi_idx = idx ? vf->ch[idx].vsi_idx : vf->lan_vsi_idx;
+	struct i40e_pf *pf = vf->pf;
+
+	if (!vsi_idx)
+		return;
+
+	i40e_vsi_clear(pf->vsi[vsi_idx]);
+	if (!idx)
+		vf->lan_vsi_idx = 0;
+	if (vf->adq_enabled)
+		vf->ch[idx].vsi_idx = 0;
+}
+
+/**
+ * i40e_config_vsi_res
+ * @vf: pointer to the VF info
+ * @idx: VSI index, applies only for ADq mode, zero otherwise
+ *
+ * add a VF vsi reserved by i40e_alloc_vsi_res() to the HW and program its
+ * filters, rate limit and VF-d settings; only touches this VSI, so VFs do it
+ * concurrently
+ **/
+static int i40e_config_vsi_res(struct i40e_vf *vf, u8 idx)
+{
+	struct i40e_mac_filter *f = NULL;
+	struct i40e_pf *pf = vf->pf;
+	u64 max_tx_rate = 0;
+	struct i40e_vsi *vsi;
+	int ret = 0;
+
+	vsi = pf->vsi[idx ? vf->ch[idx].vsi_idx : vf->lan_vsi_idx];
+
+	ret = i40e_vsi_activate(vsi);
+	if (ret) {
 		dev_err(&pf->pdev->dev,
 			"add vsi failed for VF %d, aq_err %d\n",
 			vf->vf_id, pf->hw.aq.asq_last_status);
-		ret = -ENOENT;
-		goto error_alloc_vsi_res;
+		/* only the reservation is left, there is nothing to release */
+		mutex_lock(&pf->vf_res_mutex);
+		i40e_clear_vsi_res(vf, idx);
+		mutex_unlock(&pf->vf_res_mutex);
+		return -ENOENT;
 	}
 
+	if (!idx)
+		vf->lan_vsi_id = vsi->id;
+
+	/* storing VSI id for ADq and don't apply the mac filter */
+	if (vf->adq_enabled)
+		vf->ch[idx].vsi_id = vsi->id;
+
 	if (!idx) {
 		u64 hena = i40e_pf_get_default_rss_hena(pf);
 		bool trunk_conf = false;
@@ -1540,8 +1669,6 @@ static int i40e_alloc_vsi_res(struct i40e_vf *vf, u8 idx)
 			if (vid != (vf->port_vlan_id & I40E_VLAN_MASK))
 				trunk_conf = true;
 		}
-		vf->lan_vsi_idx = vsi->idx;
-		vf->lan_vsi_id = vsi->id;
 		/* If the port VLAN has been configured and then the
 		 * VF driver was removed then the VSI port VLAN
 		 * configuration was destroyed.  Check if there is
@@ -1580,12 +1707,6 @@ static int i40e_alloc_vsi_res(struct i40e_vf *vf, u8 idx)
 			dev_err(&pf->pdev->dev, "Unable to program ucast filters\n");
 	}
 
-	/* storing VSI index and id for ADq and don't apply the mac filter */
-	if (vf->adq_enabled) {
-		vf->ch[idx].vsi_idx = vsi->idx;
-		vf->ch[idx].vsi_id = vsi->id;
-	}
-
 	/* Set VF bandwidth if specified */
 	if (vf->tx_rate) {
 		max_tx_rate = vf->tx_rate;
@@ -1593,10 +1714,12 @@ static int i40e_alloc_vsi_res(struct i40e_vf *vf, u8 idx)
 		max_tx_rate = vf->ch[idx].max_tx_rate;
 	}
 
+	vsi->bw_burst = vf->tx_burst;
 	if (max_tx_rate) {
 		max_tx_rate = div_u64(max_tx_rate, I40E_BW_CREDIT_DIVISOR);
 		ret = i40e_aq_config_vsi_bw_limit(&pf->hw, vsi->seid,
-						  max_tx_rate, 0, NULL);
+						  max_tx_rate, vsi->bw_burst,
+						  NULL);
 		if (ret)
 			dev_err(&pf->pdev->dev, "Unable to set tx rate, VF %d, error code %d.\n",
 				vf->vf_id, ret);
@@ -1613,10 +1736,47 @@ static int i40e_alloc_vsi_res(struct i40e_vf *vf, u8 idx)
 	if (!idx)
 		ret = i40e_set_source_pruning(vf);
 
-error_alloc_vsi_res:
 	return ret;
 }
 
+/* VSILAN_QTABLE registers programmed per VSI, two queues each */
+#define I40E_VF_QTABLE_REGS	7
+
+/**
+ * i40e_write_vsi_qtable - Program the VSILAN_QTABLE registers of a VSI
+ * @hw: pointer to the hw struct
+ * @vsi_id: VSI the table belongs to
+ * @regs: one value per register
+ *
+ * The writes go through the firmware, all of them are posted before
+ * waiting for the first one. Those that fail are done again through
+ * i40e_write_rx_ctl(), which retries and falls back to the register.
+ **/
+static void i40e_write_vsi_qtable(struct i40e_hw *hw, u16 vsi_id,
+				  const u32 *regs)
+{
+	struct i40e_asq_cmd_done done[I40E_VF_QTABLE_REGS] = {};
+	struct i40e_asq_cmd_details cmd_details = {};
+	bool posted[I40E_VF_QTABLE_REGS] = {};
+	int j;
+
+	cmd_details.async = true;
+	for (j = 0; j < I40E_VF_QTABLE_REGS; j++) {
+		if (i40e_rx_ctl_use_register(hw))
+			break;
+		cmd_details.done = &done[j];
+		posted[j] = !i40e_aq_rx_ctl_write_register(hw,
+					I40E_VSILAN_QTABLE(j, vsi_id),
+					regs[j], &cmd_details);
+	}
+
+	for (j = 0; j < I40E_VF_QTABLE_REGS; j++) {
+		if (posted[j] && !i40e_asq_wait_done(hw, &done[j], false))
+			continue;
+		i40e_write_rx_ctl(hw, I40E_VSILAN_QTABLE(j, vsi_id), regs[j]);
+	}
+}
+
 /**
  * i40e_map_pf_queues_to_vsi
  * @vf: pointer to the VF info
@@ -1626,9 +1786,10 @@ error_alloc_vsi_res:
  **/
 static void i40e_map_pf_queues_to_vsi(struct i40e_vf *vf)
 {
+	u32 reg, regs[I40E_VF_QTABLE_REGS];
 	struct i40e_pf *pf = vf->pf;
 	struct i40e_hw *hw = &pf->hw;
-	u32 reg, num_tc = 1; /* VF has at least one traffic class */
+	u32 num_tc = 1; /* VF has at least one traffic class */
 	u16 vsi_id, qps;
 	int i, j;
 
@@ -1644,7 +1805,7 @@ static void i40e_map_pf_queues_to_vsi(struct i40e_vf *vf)
 			vsi_id = vf->lan_vsi_id;
 		}
 
-		for (j = 0; j < 7; j++) {
+		for (j = 0; j < I40E_VF_QTABLE_REGS; j++) {
 			if (j * 2 >= qps) {
 				/* end of list */
 				reg = 0x07FF07FF;
@@ -1657,10 +1818,9 @@ static void i40e_map_pf_queues_to_vsi(struct i40e_vf *vf)
 							      (j * 2) + 1);
 				reg |= qid << 16;
 			}
-			i40e_write_rx_ctl(hw,
-					  I40E_VSILAN_QTABLE(j, vsi_id),
-					  reg);
+			regs[j] = reg;
 		}
+		i40e_write_vsi_qtable(hw, vsi_id, regs);
 	}
 }
 
@@ -1741,7 +1901,8 @@ static void i40e_enable_vf_mappings(struct i40e_vf *vf)
  * i40e_disable_vf_mappings
  * @vf: pointer to the VF info
  *
- * disable VF mappings
+ * disable VF mappings, the caller flushes the writes once it is done with
+ * all the VFs it tears down
  **/
 static void i40e_disable_vf_mappings(struct i40e_vf *vf)
 {
@@ -1754,7 +1915,26 @@ static void i40e_disable_vf_mappings(struct i40e_vf *vf)
 	for (i = 0; i < I40E_MAX_VSI_QP; i++)
 		wr32(hw, I40E_VPLAN_QTABLE(i, vf->vf_id),
 		     I40E_QUEUE_END_OF_LIST);
-	i40e_flush(hw);
+}
+
+/**
+ * i40e_find_vmvlan_on_list
+ * @vf: pointer to the VF info
+ * @vlan: VLAN tag to look up
+ *
+ * Search VLAN tag in the VLAN hash for VM
+ **/
+static struct i40e_vm_vlan *i40e_find_vmvlan_on_list(struct i40e_vf *vf,
+						     s16 vlan)
+{
+	struct i40e_vm_vlan *entry;
+
+	hash_for_each_possible(vf->vm_vlan_hash, entry, hlist,
+			       i40e_vlan_to_hkey(vlan)) {
+		if (entry->vlan == vlan)
+			return entry;
+	}
+	return NULL;
 }
 
 /**
@@ -1763,7 +1943,8 @@ static void i40e_disable_vf_mappings(struct i40e_vf *vf)
  * @vfl:  pointer to the VF VLAN tag filters list
  * @vlan_idx: vlan_id index in VLAN tag filters list
  *
- * add VLAN tag into the VLAN list for VM
+ * add VLAN tag into the VLAN hash for VM, a VLAN already there is kept
+ * once so the VLAN count matches the filters on the VSI
  **/
 static i40e_status
 i40e_add_vmvlan_to_list(struct i40e_vf *vf,
@@ -1772,15 +1953,19 @@ i40e_add_vmvlan_to_list(struct i40e_vf *vf,
 {
 	struct i40e_vm_vlan *vlan_elem;
 
+	if (i40e_find_vmvlan_on_list(vf, vfl->vlan_id[vlan_idx]))
+		return I40E_SUCCESS;
+
 	vlan_elem = (struct i40e_vm_vlan *)kzalloc(sizeof(*vlan_elem),
 						   GFP_KERNEL);
 	if (!vlan_elem)
 		return I40E_ERR_NO_MEMORY;
 	vlan_elem->vlan = vfl->vlan_id[vlan_idx];
 	vlan_elem->vsi_id = vfl->vsi_id;
-	INIT_LIST_HEAD(&vlan_elem->list);
+	INIT_HLIST_NODE(&vlan_elem->hlist);
 	vf->num_vlan++;
-	list_add(&vlan_elem->list, &vf->vm_vlan_list);
+	hash_add(vf->vm_vlan_hash, &vlan_elem->hlist,
+		 i40e_vlan_to_hkey(vlan_elem->vlan));
 	return I40E_SUCCESS;
 }
 
@@ -1790,23 +1975,21 @@ i40e_add_vmvlan_to_list(struct i40e_vf *vf,
  * @vf: pointer to the VF info
  * @vlan: VLAN tag to be removed from the list
  *
- * delete VLAN tag from the VLAN list for VM
+ * delete VLAN tag from the VLAN hash for VM
  **/
 static void i40e_del_vmvlan_from_list(struct i40e_vsi *vsi,
 				      struct i40e_vf *vf, u16 vlan)
 {
-	struct i40e_vm_vlan *entry, *tmp;
+	struct i40e_vm_vlan *entry;
 
-	list_for_each_entry_safe(entry, tmp,
-				 &vf->vm_vlan_list, list) {
-		if (vlan == entry->vlan) {
-			i40e_vsi_kill_vlan(vsi, vlan);
-			vf->num_vlan--;
-			list_del(&entry->list);
-			kfree(entry);
-			break;
-		}
-	}
+	entry = i40e_find_vmvlan_on_list(vf, vlan);
+	if (!entry)
+		return;
+
+	i40e_vsi_kill_vlan(vsi, vlan);
+	vf->num_vlan--;
+	hash_del(&entry->hlist);
+	kfree(entry);
 }
 
 /**
@@ -1814,44 +1997,69 @@ static void i40e_del_vmvlan_from_list(struct i40e_vsi *vsi,
  * @vsi: pointer to the VSI structure
  * @vf: pointer to the VF info
  *
- * remove whole list of VLAN tags for VM
+ * remove all VLAN tags for VM
  **/
 static void i40e_free_vmvlan_list(struct i40e_vsi *vsi, struct i40e_vf *vf)
 {
-	struct i40e_vm_vlan *entry, *tmp;
+	struct i40e_vm_vlan *entry;
+	struct hlist_node *tmp;
+	int bkt;
 
-	if (list_empty(&vf->vm_vlan_list))
+	if (hash_empty(vf->vm_vlan_hash))
 		return;
 
-	list_for_each_entry_safe(entry, tmp,
-				 &vf->vm_vlan_list, list) {
+	hash_for_each_safe(vf->vm_vlan_hash, bkt, tmp, entry, hlist) {
 		if (vsi)
 			i40e_vsi_kill_vlan(vsi, entry->vlan);
-		list_del(&entry->list);
+		hash_del(&entry->hlist);
 		kfree(entry);
 	}
 	vf->num_vlan = 0;
 }
 
+/**
+ * i40e_find_vmmac_on_list
+ * @vf: pointer to the VF info
+ * @macaddr: pointer to the MAC address
+ *
+ * Search MAC address in the MAC hash for VM
+ **/
+static struct i40e_vm_mac *i40e_find_vmmac_on_list(struct i40e_vf *vf,
+						   const u8 *macaddr)
+{
+	struct i40e_vm_mac *entry;
+
+	hash_for_each_possible(vf->vm_mac_hash, entry, hlist,
+			       i40e_addr_to_hkey(macaddr)) {
+		if (ether_addr_equal(macaddr, entry->macaddr))
+			return entry;
+	}
+	return NULL;
+}
+
 /**
  * i40e_add_vmmac_to_list
  * @vf: pointer to the VF info
  * @macaddr: pointer to the MAC address
  *
- * add MAC address into the MAC list for VM
+ * add MAC address into the MAC hash for VM
  **/
 static i40e_status i40e_add_vmmac_to_list(struct i40e_vf *vf,
 					  const u8 *macaddr)
 {
 	struct i40e_vm_mac *mac_elem;
 
+	if (i40e_find_vmmac_on_list(vf, macaddr))
+		return I40E_SUCCESS;
+
 	mac_elem = (struct i40e_vm_mac *)kzalloc(sizeof(*mac_elem), GFP_ATOMIC);
 
 	if (!mac_elem)
 		return I40E_ERR_NO_MEMORY;
 	ether_addr_copy(mac_elem->macaddr, macaddr);
-	INIT_LIST_HEAD(&mac_elem->list);
-	list_add(&mac_elem->list, &vf->vm_mac_list);
+	INIT_HLIST_NODE(&mac_elem->hlist);
+	hash_add(vf->vm_mac_hash, &mac_elem->hlist,
+		 i40e_addr_to_hkey(macaddr));
 	return I40E_SUCCESS;
 }
 
@@ -1860,56 +2068,37 @@ static i40e_status i40e_add_vmmac_to_list(struct i40e_vf *vf,
  * @vf: pointer to the VF info
  * @macaddr: pointer to the MAC address
  *
- * delete MAC address from the MAC list for VM
+ * delete MAC address from the MAC hash for VM
  **/
 static void i40e_del_vmmac_from_list(struct i40e_vf *vf, const u8 *macaddr)
 {
-	struct i40e_vm_mac *entry, *tmp;
+	struct i40e_vm_mac *entry;
 
-	list_for_each_entry_safe(entry, tmp, &vf->vm_mac_list, list) {
-		if (ether_addr_equal(macaddr, entry->macaddr)) {
-			list_del(&entry->list);
-			kfree(entry);
-			break;
-		}
-	}
-}
-
-#ifdef HAVE_NDO_SET_VF_LINK_STATE
-/**
- * i40e_find_vmmac_on_list
- * @vf: pointer to the VF info
- * @macaddr: pointer to the MAC address
- *
- * Search MAC address on MAC list
- **/
-static bool i40e_find_vmmac_on_list(struct i40e_vf *vf, const u8 *macaddr)
-{
-	struct i40e_vm_mac *entry, *tmp;
+	entry = i40e_find_vmmac_on_list(vf, macaddr);
+	if (!entry)
+		return;
 
-	list_for_each_entry_safe(entry, tmp, &vf->vm_mac_list, list) {
-		if (ether_addr_equal(macaddr, entry->macaddr))
-			return true;
-	}
-	return false;
+	hash_del(&entry->hlist);
+	kfree(entry);
 }
-#endif /* HAVE_NDO_SET_VF_LINK_STATE */
 
 /**
  * i40e_free_vmmac_list
  * @vf: pointer to the VF info
  *
- * remove whole list of MAC addresses for VM
+ * remove all MAC addresses for VM
  **/
 static void i40e_free_vmmac_list(struct i40e_vf *vf)
 {
-	struct i40e_vm_mac *entry, *tmp;
+	struct i40e_vm_mac *entry;
+	struct hlist_node *tmp;
+	int bkt;
 
-	if (list_empty(&vf->vm_mac_list))
+	if (hash_empty(vf->vm_mac_hash))
 		return;
 
-	list_for_each_entry_safe(entry, tmp, &vf->vm_mac_list, list) {
-		list_del(&entry->list);
+	hash_for_each_safe(vf->vm_mac_hash, bkt, tmp, entry, hlist) {
+		hash_del(&entry->hlist);
 		kfree(entry);
 	}
 }
@@ -1940,6 +2129,25 @@ static void i40e_free_vf_res(struct i40e_vf *vf)
 	}
 #endif /* HAVE_NDO_SET_VF_LINK_STATE */
 
+	/* rules steering to the VF's queues must not outlive them */
+	if (vf->num_fdir_filters && pf->vsi[pf->lan_vsi]) {
+		mutex_lock(&pf->fdir_mutex);
+		i40e_del_fdir_vf_all(pf->vsi[pf->lan_vsi], vf->vf_id);
+		mutex_unlock(&pf->fdir_mutex);
+	}
+
+	/* the next VSI counts from zero, make the next reader sweep again */
+	mutex_lock(&pf->stats_mutex);
+	write_seqlock_bh(&pf->vf_stats_lock);
+	memset(&vf->stats_snap, 0, sizeof(vf->stats_snap));
+	write_sequnlock_bh(&pf->vf_stats_lock);
+	pf->vf_stats_updated = 0;
+	mutex_unlock(&pf->stats_mutex);
+
+	/* a new VF driver starts over from the default hash */
+	vf->rss_hfunc = VIRTCHNL_RSS_ALG_TOEPLITZ_ASYMMETRIC;
+	vf->rss_key_set = false;
+
 	/* It's possible the VF had requeuested more queues than the default so
 	 * do the accounting here when we're about to free them.
 	 */
@@ -1962,7 +2170,7 @@ static void i40e_free_vf_res(struct i40e_vf *vf)
 			 * release it again and only clear their values in
 			 * structure variables
 			 */
-			if (j)
+			if (j && vf->ch[j].vsi_idx)
 				i40e_vsi_release(pf->vsi[vf->ch[j].vsi_idx]);
 			vf->ch[j].vsi_idx = 0;
 			vf->ch[j].vsi_id = 0;
@@ -1980,8 +2188,8 @@ static void i40e_free_vf_res(struct i40e_vf *vf)
 						      (vf->vf_id))
 						     + (i - 1));
 		wr32(hw, reg_idx, I40E_VFINT_DYN_CTLN_CLEARPBA_MASK);
-		i40e_flush(hw);
 	}
+	i40e_flush(hw);
 
 	/* clear the irq settings */
 	for (i = 0; i < msix_vf; i++) {
@@ -1995,8 +2203,8 @@ static void i40e_free_vf_res(struct i40e_vf *vf)
 		reg = (I40E_VPINT_LNKLSTN_FIRSTQ_TYPE_MASK |
 		       I40E_VPINT_LNKLSTN_FIRSTQ_INDX_MASK);
 		wr32(hw, reg_idx, reg);
-		i40e_flush(hw);
 	}
+	i40e_flush(hw);
 	i40e_free_vmvlan_list(NULL, vf);
 	i40e_free_vmmac_list(vf);
 
@@ -2010,7 +2218,8 @@ static void i40e_free_vf_res(struct i40e_vf *vf)
  * i40e_alloc_vf_res
  * @vf: pointer to the VF info
  *
- * allocate VF resources
+ * allocate VF resources, called with vf_res_mutex held as the VSIs come out
+ * of the queue pile, VSI array and VEB shared by all VFs
  **/
 static int i40e_alloc_vf_res(struct i40e_vf *vf)
 {
@@ -2068,11 +2277,6 @@ static int i40e_alloc_vf_res(struct i40e_vf *vf)
 	 */
 	vf->num_queue_pairs = total_queue_pairs;
 
-	/* set default queue type for the VF */
-	vf->queue_type = VFD_QUEUE_TYPE_RSS;
-	/* VF is now completely initialized */
-	set_bit(I40E_VF_STATE_INIT, &vf->vf_states);
-
 error_alloc:
 	if (ret)
 		i40e_free_vf_res(vf);
@@ -2080,6 +2284,41 @@ error_alloc:
 	return ret;
 }
 
+/**
+ * i40e_config_vf_res
+ * @vf: pointer to the VF info
+ *
+ * configure the VSIs allocated by i40e_alloc_vf_res(), called without
+ * vf_res_mutex so that VFs being rebuilt together program their VSIs
+ * concurrently
+ **/
+static int i40e_config_vf_res(struct i40e_vf *vf)
+{
+	struct i40e_pf *pf = vf->pf;
+	int ret, idx = 0;
+
+	do {
+		ret = i40e_config_vsi_res(vf, idx);
+	} while (!ret && vf->adq_enabled && ++idx < vf->num_tc);
+
+	if (ret) {
+		mutex_lock(&pf->vf_res_mutex);
+		/* the ADq VSIs after the failed one were never added either */
+		while (vf->adq_enabled && ++idx < vf->num_tc)
+			i40e_clear_vsi_res(vf, idx);
+		i40e_free_vf_res(vf);
+		mutex_unlock(&pf->vf_res_mutex);
+		return ret;
+	}
+
+	/* set default queue type for the VF */
+	vf->queue_type = VFD_QUEUE_TYPE_RSS;
+	/* VF is now completely initialized */
+	set_bit(I40E_VF_STATE_INIT, &vf->vf_states);
+
+	return 0;
+}
+
 #define VF_DEVICE_STATUS 0xAA
 #define VF_TRANS_PENDING_MASK 0x20
 /**
@@ -2188,6 +2427,29 @@ static int i40e_sync_vfr_reset(struct i40e_hw *hw, int vf_id)
 	return -EAGAIN;
 }
 
+/**
+ * i40e_vc_msg_flush - drop the virtchnl messages a VF still has queued
+ * @vf: pointer to the VF info
+ *
+ * Messages sent before a reset of the VF refer to a configuration that is
+ * about to be torn down, so they are discarded just like the ones a PF
+ * reset loses from the ARQ.
+ **/
+static void i40e_vc_msg_flush(struct i40e_vf *vf)
+{
+	struct i40e_vc_msg *m, *tmp;
+	LIST_HEAD(msgs);
+
+	spin_lock(&vf->vc_msg_lock);
+	list_splice_init(&vf->vc_msg_list, &msgs);
+	vf->vc_msg_dropped += vf->vc_msg_depth;
+	vf->vc_msg_depth = 0;
+	spin_unlock(&vf->vc_msg_lock);
+
+	list_for_each_entry_safe(m, tmp, &msgs, list)
+		kfree(m);
+}
+
 /**
  * i40e_trigger_vf_reset
  * @vf: pointer to the VF structure
@@ -2208,6 +2470,8 @@ static void i40e_trigger_vf_reset(struct i40e_vf *vf, bool flr)
 	/* warn the VF */
 	vf_active = test_and_clear_bit(I40E_VF_STATE_ACTIVE, &vf->vf_states);
 
+	i40e_vc_msg_flush(vf);
+
 	/* Disable VF's configuration API during reset. The flag is re-enabled
 	 * in i40e_alloc_vf_res(), when it's safe again to access VF's VSI.
 	 * It's normally disabled in i40e_free_vf_res(), but it's safer
@@ -2262,10 +2526,16 @@ static void i40e_cleanup_reset_vf(struct i40e_vf *vf)
 	struct i40e_pf *pf = vf->pf;
 	struct i40e_hw *hw = &pf->hw;
 	u32 reg;
+	int ret;
 
 	/* disable promisc modes in case they were enabled */
 	i40e_config_vf_promiscuous_mode(vf, vf->lan_vsi_id, false, false);
 
+	/* Only one VF at a time goes through VSI teardown and setup, the rest
+	 * of the rebuild runs concurrently with the other VFs.
+	 */
+	mutex_lock(&pf->vf_res_mutex);
+
 	/* free VF resources to begin resetting the VSI state */
 	i40e_free_vf_res(vf);
 
@@ -2284,7 +2554,11 @@ static void i40e_cleanup_reset_vf(struct i40e_vf *vf)
 	wr32(hw, I40E_VPGEN_VFRTRIG(vf->vf_id), reg);
 
 	/* reallocate VF resources to finish resetting the VSI state */
-	if (!i40e_alloc_vf_res(vf)) {
+	ret = i40e_alloc_vf_res(vf);
+	mutex_unlock(&pf->vf_res_mutex);
+	if (!ret)
+		ret = i40e_config_vf_res(vf);
+	if (!ret) {
 		int abs_vf_id = vf->vf_id + (int)hw->func_caps.vf_base_id;
 		i40e_enable_vf_mappings(vf);
 		set_bit(I40E_VF_STATE_ACTIVE, &vf->vf_states);
@@ -2307,18 +2581,81 @@ static void i40e_cleanup_reset_vf(struct i40e_vf *vf)
 	wr32(hw, I40E_VFGEN_RSTAT1(vf->vf_id), VIRTCHNL_VFR_VFACTIVE);
 }
 
+/**
+ * i40e_vfr_phase - close a timed phase of a VF reset
+ * @ns: per phase times of the reset
+ * @phase: phase that just ended
+ * @start: start of the phase, updated to now for the next one
+ **/
+static void i40e_vfr_phase(u64 *ns, enum i40e_vfr_phase phase, u64 *start)
+{
+	u64 now = ktime_get_ns();
+
+	ns[phase] += now - *start;
+	*start = now;
+}
+
+/**
+ * i40e_vfr_stats_add - account the phase times of a VF reset
+ * @stats: reset statistics to update
+ * @ns: per phase times of the reset
+ * @vfs: number of VFs rebuilt
+ **/
+static void i40e_vfr_stats_add(struct i40e_vfr_stats *stats, const u64 *ns,
+			       int vfs)
+{
+	int i;
+
+	spin_lock(&stats->lock);
+	stats->count++;
+	stats->vfs += vfs;
+	for (i = 0; i < I40E_VFR_PHASE_MAX; i++) {
+		stats->last_ns[i] = ns[i];
+		stats->total_ns[i] += ns[i];
+		if (ns[i] > stats->max_ns[i])
+			stats->max_ns[i] = ns[i];
+	}
+	spin_unlock(&stats->lock);
+}
+
+/**
+ * i40e_vfr_stats_clear - reset the VF reset timing statistics
+ * @pf: pointer to the PF structure
+ **/
+void i40e_vfr_stats_clear(struct i40e_pf *pf)
+{
+	struct i40e_vfr_stats *stats[] = {
+		&pf->vfr_all_stats, &pf->vfr_one_stats,
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(stats); i++) {
+		spin_lock(&stats[i]->lock);
+		stats[i]->count = 0;
+		stats[i]->vfs = 0;
+		memset(stats[i]->last_ns, 0, sizeof(stats[i]->last_ns));
+		memset(stats[i]->total_ns, 0, sizeof(stats[i]->total_ns));
+		memset(stats[i]->max_ns, 0, sizeof(stats[i]->max_ns));
+		spin_unlock(&stats[i]->lock);
+	}
+}
+
 /**
  * i40e_reset_vf
  * @vf: pointer to the VF structure
  * @flr: VFLR was issued or not
  *
+ * The caller holds pf->vc_rwsem for writing.
+ *
  * Returns true if the VF is reset, false otherwise.
  **/
 bool i40e_reset_vf(struct i40e_vf *vf, bool flr)
 {
+	u64 ns[I40E_VFR_PHASE_MAX] = { 0 };
 	struct i40e_pf *pf = vf->pf;
 	struct i40e_hw *hw = &pf->hw;
 	bool rsd = false;
+	u64 t;
 	u32 reg;
 	int i;
 
@@ -2333,24 +2670,27 @@ bool i40e_reset_vf(struct i40e_vf *vf, bool flr)
 	if (test_and_set_bit(I40E_VF_STATE_RESETTING, &vf->vf_states))
 		return false;
 
+	t = ktime_get_ns();
 	i40e_trigger_vf_reset(vf, flr);
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_TRIGGER, &t);
 
-	/* poll VPGEN_VFRSTAT reg to make sure
-	 * that reset is complete
+	/* VF reset requires driver to first reset the VF and then
+	 * poll the status register to make sure that the reset
+	 * completed successfully. Due to internal HW FIFO flushes,
+	 * we must wait 10ms before the register will be valid.
 	 */
-	for (i = 0; i < 10; i++) {
-		/* VF reset requires driver to first reset the VF and then
-		 * poll the status register to make sure that the reset
-		 * completed successfully. Due to internal HW FIFO flushes,
-		 * we must wait 10ms before the register will be valid.
-		 */
-		usleep_range(10000, 20000);
+	usleep_range(I40E_VFR_SETTLE_USECS, 2 * I40E_VFR_SETTLE_USECS);
+	for (i = 0; ; i++) {
 		reg = rd32(hw, I40E_VPGEN_VFRSTAT(vf->vf_id));
 		if (reg & I40E_VPGEN_VFRSTAT_VFRD_MASK) {
 			rsd = true;
 			break;
 		}
+		if (i == I40E_VFR_POLL_COUNT)
+			break;
+		usleep_range(I40E_VFR_POLL_USECS, 2 * I40E_VFR_POLL_USECS);
 	}
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_HW_WAIT, &t);
 
 	if (flr)
 		usleep_range(10000, 20000);
@@ -2359,39 +2699,59 @@ bool i40e_reset_vf(struct i40e_vf *vf, bool flr)
 		dev_err(&pf->pdev->dev, "VF reset check timeout on VF %d\n",
 			vf->vf_id);
 	usleep_range(10000, 20000);
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_SETTLE, &t);
 
 	/* On initial reset, we don't have any queues to disable */
 	if (vf->lan_vsi_idx != 0)
 		i40e_vsi_stop_rings(pf->vsi[vf->lan_vsi_idx]);
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_RINGS, &t);
 
 	i40e_cleanup_reset_vf(vf);
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_REBUILD, &t);
 
 	i40e_flush(hw);
 	usleep_range(20000, 40000);
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_SETTLE, &t);
 	vf->reset_timestamp = ktime_get_ns();
 	clear_bit(I40E_VF_STATE_RESETTING, &vf->vf_states);
+	i40e_vfr_stats_add(&pf->vfr_one_stats, ns, 1);
 
 	return true;
 }
 
+/**
+ * i40e_vf_rebuild_task
+ * @work: pointer to reset_work in the VF structure
+ *
+ * Finish the reset of one VF on behalf of i40e_reset_all_vfs()
+ **/
+static void i40e_vf_rebuild_task(struct work_struct *work)
+{
+	struct i40e_vf *vf = container_of(work, struct i40e_vf, reset_work);
+
+	i40e_cleanup_reset_vf(vf);
+}
+
 /**
  * i40e_reset_all_vfs
  * @pf: pointer to the PF structure
  * @flr: VFLR was issued or not
  *
  * Reset all allocated VFs in one go. First, tell the hardware to reset each
- * VF, then do all the waiting in one chunk, and finally finish restoring each
- * VF after the wait. This is useful during PF routines which need to reset
- * all VFs, as otherwise it must perform these resets in a serialized fashion.
+ * VF, then do all the waiting in one chunk, and finally restore all the VFs
+ * in parallel. This is useful during PF routines which need to reset all
+ * VFs, as otherwise it must perform these resets in a serialized fashion.
  *
  * Returns true if any VFs were reset, and false otherwise.
  **/
 bool i40e_reset_all_vfs(struct i40e_pf *pf, bool flr)
 {
+	u64 ns[I40E_VFR_PHASE_MAX] = { 0 };
 	struct i40e_hw *hw = &pf->hw;
 	struct i40e_vf *vf;
-	int i;
+	int i, vfs = 0;
 	u32 reg;
+	u64 t;
 
 	/* If we don't have any VFs, then there is nothing to reset */
 	if (!pf->num_alloc_vfs)
@@ -2401,22 +2761,24 @@ bool i40e_reset_all_vfs(struct i40e_pf *pf, bool flr)
 	if (test_and_set_bit(__I40E_VF_DISABLE, pf->state))
 		return false;
 
+	t = ktime_get_ns();
 	/* Begin reset on all VFs at once */
 	for (vf = &pf->vf[0]; vf < &pf->vf[pf->num_alloc_vfs]; ++vf) {
 		/* If VF is being reset no need to trigger reset again */
 		if (!test_bit(I40E_VF_STATE_RESETTING, &vf->vf_states))
 			i40e_trigger_vf_reset(vf, flr);
 	}
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_TRIGGER, &t);
 
 	/* HW requires some time to make sure it can flush the FIFO for a VF
-	 * when it resets it. Poll the VPGEN_VFRSTAT register for each VF in
-	 * sequence to make sure that it has completed. We'll keep track of
+	 * when it resets it. Once that is over poll the VPGEN_VFRSTAT
+	 * register of each VF in sequence at a finer interval, so that the
+	 * rebuild starts as soon as the last VF is done. We'll keep track of
 	 * the VFs using a simple iterator that increments once that VF has
 	 * finished resetting.
 	 */
-	for (i = 0, vf = &pf->vf[0]; i < 10 && vf < &pf->vf[pf->num_alloc_vfs]; ++i) {
-		usleep_range(10000, 20000);
-
+	usleep_range(I40E_VFR_SETTLE_USECS, 2 * I40E_VFR_SETTLE_USECS);
+	for (i = 0, vf = &pf->vf[0]; ; i++) {
 		/* Check each VF in sequence, beginning with the VF to fail
 		 * the previous check.
 		 */
@@ -2432,7 +2794,13 @@ bool i40e_reset_all_vfs(struct i40e_pf *pf, bool flr)
 			 */
 			++vf;
 		}
+
+		if (vf == &pf->vf[pf->num_alloc_vfs] ||
+		    i == I40E_VFR_POLL_COUNT)
+			break;
+		usleep_range(I40E_VFR_POLL_USECS, 2 * I40E_VFR_POLL_USECS);
 	}
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_HW_WAIT, &t);
 
 	if (flr)
 		usleep_range(10000, 20000);
@@ -2444,6 +2812,7 @@ bool i40e_reset_all_vfs(struct i40e_pf *pf, bool flr)
 		dev_err(&pf->pdev->dev, "VF reset check timeout on VF %d\n",
 			vf->vf_id);
 	usleep_range(10000, 20000);
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_SETTLE, &t);
 
 	/* Begin disabling all the rings associated with VFs, but do not wait
 	 * between each VF.
@@ -2478,24 +2847,32 @@ bool i40e_reset_all_vfs(struct i40e_pf *pf, bool flr)
 	/* Hw may need up to 50ms to finish disabling the RX queues. We
 	 * minimize the wait by delaying only once for all VFs.
 	 */
-	mdelay(50);
+	msleep(50);
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_RINGS, &t);
 
-	/* Finish the reset on each VF */
+	/* Finish the reset on each VF, all of them at once */
 	for (vf = &pf->vf[0]; vf < &pf->vf[pf->num_alloc_vfs]; ++vf) {
 		/* If VF is reset in another thread just continue */
 		if (test_bit(I40E_VF_STATE_RESETTING, &vf->vf_states))
 			continue;
 
-		i40e_cleanup_reset_vf(vf);
+		queue_work(pf->vc_wq, &vf->reset_work);
+		vfs++;
 	}
+	for (vf = &pf->vf[0]; vf < &pf->vf[pf->num_alloc_vfs]; ++vf)
+		flush_work(&vf->reset_work);
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_REBUILD, &t);
 
 	i40e_flush(hw);
 	usleep_range(20000, 40000);
+	i40e_vfr_phase(ns, I40E_VFR_PHASE_SETTLE, &t);
 	clear_bit(__I40E_VF_DISABLE, pf->state);
+	i40e_vfr_stats_add(&pf->vfr_all_stats, ns, vfs);
 
 	return true;
 }
 
+static void i40e_vc_msg_task(struct work_struct *work);
 #ifdef HAVE_NDO_SET_VF_LINK_STATE
 static int i40e_set_pf_egress_mirror(struct pci_dev *pdev, const int mirror);
 static int i40e_set_pf_ingress_mirror(struct pci_dev *pdev, const int mirror);
@@ -2523,9 +2900,24 @@ void i40e_free_vfs(struct i40e_pf *pf)
 
 	set_bit(__I40E_VFS_RELEASING, pf->state);
 
+	/* Nothing gets queued for the VFs once VFS_RELEASING is set, wait for
+	 * an ARQ run that may have missed it and for the VF message workers.
+	 */
+	flush_work(&pf->adminq_task);
+	for (i = 0; i < pf->num_alloc_vfs; i++) {
+		cancel_work_sync(&pf->vf[i].vc_msg_work);
+		i40e_vc_msg_flush(&pf->vf[i]);
+	}
+
 	while (test_and_set_bit(__I40E_VF_DISABLE, pf->state))
 		usleep_range(1000, 2000);
 
+	/* no VF reset can queue rebuild work past this point */
+	if (pf->vc_wq) {
+		destroy_workqueue(pf->vc_wq);
+		pf->vc_wq = NULL;
+	}
+
 	i40e_notify_client_of_vf_enable(pf, 0);
 
 #ifdef HAVE_NDO_SET_VF_LINK_STATE
@@ -2575,6 +2967,9 @@ void i40e_free_vfs(struct i40e_pf *pf)
 	else
 		dev_warn(&pf->pdev->dev, "VFs are assigned - not disabling SR-IOV\n");
 
+	/* keep out the PF-initiated VF resets, the VSIs go away below */
+	down_write(&pf->vc_rwsem);
+
 	/* Amortize wait time by stopping all VFs at the same time */
 	for (i = 0; i < pf->num_alloc_vfs; i++) {
 		if (test_bit(I40E_VF_STATE_INIT, &pf->vf[i].vf_states))
@@ -2599,6 +2994,8 @@ void i40e_free_vfs(struct i40e_pf *pf)
 		/* disable qp mappings */
 		i40e_disable_vf_mappings(&pf->vf[i]);
 	}
+	i40e_flush(hw);
+	up_write(&pf->vc_rwsem);
 #ifdef HAVE_NDO_SET_VF_LINK_STATE
 	if (pf->vfd_obj) {
 		destroy_vfd_sysfs(pf->pdev, pf->vfd_obj);
@@ -2656,6 +3053,14 @@ int i40e_alloc_vfs(struct i40e_pf *pf, u16 num_alloc_vfs)
 		goto err_alloc;
 	}
 	pf->vf = vfs;
+	/* room for every VF's message worker and reset rebuild at once */
+	pf->vc_wq = alloc_workqueue("%s_vc_%s", WQ_UNBOUND | WQ_MEM_RECLAIM,
+				    2 * num_alloc_vfs, i40e_driver_name,
+				    pci_name(pf->pdev));
+	if (!pf->vc_wq) {
+		ret = -ENOMEM;
+		goto err_alloc;
+	}
 #ifdef HAVE_NDO_SET_VF_LINK_STATE
 	/* set vfd ops */
 	vfd_ops = &i40e_vfd_ops;
@@ -2683,17 +3088,25 @@ int i40e_alloc_vfs(struct i40e_pf *pf, u16 num_alloc_vfs)
 		vfs[i].allow_bcast = true;
 		/* assign default vlan_stripping value */
 		vfs[i].vlan_stripping = true;
+		/* assign default Tx rate limit burst */
+		vfs[i].tx_burst = I40E_MAX_BW_INACTIVE_ACCUM;
 		/* assign default capabilities */
 		set_bit(I40E_VIRTCHNL_VF_CAP_L2, &vfs[i].vf_caps);
 		set_bit(I40E_VF_STATE_PRE_ENABLE, &vfs[i].vf_states);
-		INIT_LIST_HEAD(&vfs[i].vm_vlan_list);
-		INIT_LIST_HEAD(&vfs[i].vm_mac_list);
+		hash_init(vfs[i].vm_vlan_hash);
+		hash_init(vfs[i].vm_mac_hash);
+		INIT_LIST_HEAD(&vfs[i].vc_msg_list);
+		spin_lock_init(&vfs[i].vc_msg_lock);
+		INIT_WORK(&vfs[i].vc_msg_work, i40e_vc_msg_task);
+		INIT_WORK(&vfs[i].reset_work, i40e_vf_rebuild_task);
 		/* assign source pruning default value */
 		vfs[i].source_pruning = true;
 	}
+	down_write(&pf->vc_rwsem);
 	pf->num_alloc_vfs = num_alloc_vfs;
 	/* VF resources get allocated during reset */
 	i40e_reset_all_vfs(pf, false);
+	up_write(&pf->vc_rwsem);
 
 	i40e_notify_client_of_vf_enable(pf, num_alloc_vfs);
 err_alloc:
@@ -2922,7 +3335,23 @@ static void i40e_del_qch(struct i40e_vf *vf)
 		}
 	}
 }
-#endif /* __TC_MQPRIO_MODE_MAX */
+#endif /* __TC_MQPRIO_MODE_MAX */
+
+/**
+ * i40e_vc_fdir_allowed - Check if a VF may program Flow Director rules
+ * @vf: pointer to the VF info
+ *
+ * The sideband table is shared by the whole port and cannot match on the
+ * VF's MAC address, so a rule steering to or dropping from the VF also sees
+ * traffic addressed to others. Only trusted VFs get to install them.
+ **/
+static bool i40e_vc_fdir_allowed(struct i40e_vf *vf)
+{
+	struct i40e_pf *pf = vf->pf;
+
+	return (pf->flags & I40E_FLAG_FD_SB_ENABLED) &&
+	       test_bit(I40E_VIRTCHNL_VF_CAP_PRIVILEGE, &vf->vf_caps);
+}
 
 /**
  * i40e_vc_get_vf_resources_msg
@@ -3032,6 +3461,13 @@ static int i40e_vc_get_vf_resources_msg(struct i40e_vf *vf, u8 *msg)
 	if (vf->driver_caps & VIRTCHNL_VF_OFFLOAD_USO)
 		vfres->vf_cap_flags |= VIRTCHNL_VF_OFFLOAD_USO;
 
+	if (vf->driver_caps & VIRTCHNL_VF_OFFLOAD_ADV_RSS_PF)
+		vfres->vf_cap_flags |= VIRTCHNL_VF_OFFLOAD_ADV_RSS_PF;
+
+	if ((vf->driver_caps & VIRTCHNL_VF_OFFLOAD_FDIR_PF) &&
+	    i40e_vc_fdir_allowed(vf))
+		vfres->vf_cap_flags |= VIRTCHNL_VF_OFFLOAD_FDIR_PF;
+
 	vfres->num_vsis = num_vsis;
 	vfres->num_queue_pairs = vf->num_queue_pairs;
 	vfres->max_vectors = pf->hw.func_caps.num_msix_vectors_vf;
@@ -3313,6 +3749,7 @@ static int i40e_vc_config_queues_msg(struct i40e_vf *vf, u8 *msg)
 	struct virtchnl_queue_pair_info *qpi;
 	i40e_status aq_ret = I40E_SUCCESS;
 	u16 vsi_id, vsi_queue_id = 0;
+	struct i40e_vf_qp_ctx *qp_ctx;
 	struct i40e_pf *pf = vf->pf;
 	struct i40e_vsi *vsi;
 	int i, j = 0, idx = 0;
@@ -3342,8 +3779,18 @@ static int i40e_vc_config_queues_msg(struct i40e_vf *vf, u8 *msg)
 		}
 	}
 
+	qp_ctx = kcalloc(qci->num_queue_pairs, sizeof(*qp_ctx), GFP_KERNEL);
+	if (!qp_ctx) {
+		aq_ret = I40E_ERR_NO_MEMORY;
+		goto error_param;
+	}
+
 	vsi_id = qci->vsi_id;
 
+	/* Validate every pair and build all the contexts before touching the
+	 * HMC, so a bad pair late in the message leaves no queue half
+	 * programmed and the writes below go out back to back.
+	 */
 	for (i = 0; i < qci->num_queue_pairs; i++) {
 		qpi = &qci->qpair[i];
 
@@ -3351,7 +3798,7 @@ static int i40e_vc_config_queues_msg(struct i40e_vf *vf, u8 *msg)
 			if (!i40e_vc_isvalid_queue_id(vf, vsi_id,
 						      qpi->txq.queue_id)) {
 				aq_ret = I40E_ERR_PARAM;
-				goto error_param;
+				goto error_free;
 			}
 
 			vsi_queue_id = qpi->txq.queue_id;
@@ -3360,25 +3807,27 @@ static int i40e_vc_config_queues_msg(struct i40e_vf *vf, u8 *msg)
 			    qpi->rxq.vsi_id != qci->vsi_id ||
 			    qpi->rxq.queue_id != vsi_queue_id) {
 				aq_ret = I40E_ERR_PARAM;
-				goto error_param;
+				goto error_free;
 			}
 		}
 
 		if (vf->adq_enabled) {
 			if (idx >= ARRAY_SIZE(vf->ch) || idx >= vf->num_tc) {
 				aq_ret = I40E_ERR_NO_AVAILABLE_VSI;
-				goto error_param;
+				goto error_free;
 			}
 			vsi_id = vf->ch[idx].vsi_id;
 		}
 
 		if (i40e_config_vsi_rx_queue(vf, vsi_id, vsi_queue_id,
-					     &qpi->rxq) ||
+					     &qpi->rxq, &qp_ctx[i].rx_ctx) ||
 		    i40e_config_vsi_tx_queue(vf, vsi_id, vsi_queue_id,
-					     &qpi->txq)) {
+					     &qpi->txq, &qp_ctx[i].tx_ctx)) {
 			aq_ret = I40E_ERR_PARAM;
-			goto error_param;
+			goto error_free;
 		}
+		qp_ctx[i].pf_queue_id = i40e_vc_get_pf_queue_id(vf, vsi_id,
+								vsi_queue_id);
 
 		/* For ADq there can be up to 4 VSIs with max 4 queues each.
 		 * VF does not know about these additional VSIs and all
@@ -3388,7 +3837,7 @@ static int i40e_vc_config_queues_msg(struct i40e_vf *vf, u8 *msg)
 		if (vf->adq_enabled) {
 			if (idx >= ARRAY_SIZE(vf->ch) || idx >= vf->num_tc) {
 				aq_ret = I40E_ERR_NO_AVAILABLE_VSI;
-				goto error_param;
+				goto error_free;
 			}
 			if (j == (vf->ch[idx].num_qps - 1)) {
 				idx++;
@@ -3401,6 +3850,16 @@ static int i40e_vc_config_queues_msg(struct i40e_vf *vf, u8 *msg)
 		}
 	}
 
+	for (i = 0; i < qci->num_queue_pairs; i++) {
+		if (i40e_write_vf_qp_ctx(vf, &qp_ctx[i])) {
+			aq_ret = I40E_ERR_PARAM;
+			break;
+		}
+	}
+	i40e_flush(&pf->hw);
+	if (aq_ret)
+		goto error_free;
+
 	/* set vsi num_queue_pairs in use to num configured by VF */
 	if (!vf->adq_enabled) {
 		pf->vsi[vf->lan_vsi_idx]->num_queue_pairs =
@@ -3412,11 +3871,13 @@ static int i40e_vc_config_queues_msg(struct i40e_vf *vf, u8 *msg)
 
 			if (i40e_update_adq_vsi_queues(vsi, i)) {
 				aq_ret = I40E_ERR_CONFIG;
-				goto error_param;
+				goto error_free;
 			}
 		}
 	}
 
+error_free:
+	kfree(qp_ctx);
 error_param:
 	/* send the response to the VF */
 	return i40e_vc_send_resp_to_vf(vf, VIRTCHNL_OP_CONFIG_VSI_QUEUES,
@@ -3510,29 +3971,109 @@ error_param:
 }
 
 /**
- * i40e_ctrl_vf_tx_rings
+ * i40e_ctrl_vf_rings_no_wait
  * @vsi: the SRIOV VSI being configured
- * @q_map: bit map of the queues to be enabled
- * @enable: start or stop the queue
+ * @rx_map: bit map of the Rx queues to be changed
+ * @tx_map: bit map of the Tx queues to be changed
+ * @enable: start or stop the queues
+ *
+ * Request the new state for every queue in the maps without waiting for
+ * the hardware to get there. Rx queues go first on enable and Tx queues
+ * go first on disable. The caller waits for all of them together with
+ * i40e_wait_vf_rings, so the settle time is paid once per message instead
+ * of once per queue.
  **/
-static int i40e_ctrl_vf_tx_rings(struct i40e_vsi *vsi, unsigned long q_map,
-				 bool enable)
+static void i40e_ctrl_vf_rings_no_wait(struct i40e_vsi *vsi,
+				       unsigned long rx_map,
+				       unsigned long tx_map, bool enable)
 {
 	struct i40e_pf *pf = vsi->back;
-	int ret = 0;
 	u16 q_id;
 
-	if (test_bit(__I40E_PORT_SUSPENDED, pf->state) && enable)
-		return ret;
+	if (!enable)
+		for_each_set_bit(q_id, &tx_map, I40E_MAX_VF_QUEUES)
+			i40e_control_tx_q(pf, i40e_vsi_pf_q(vsi, q_id), false);
 
-	for_each_set_bit(q_id, &q_map, I40E_MAX_VF_QUEUES) {
-		ret = i40e_control_wait_tx_q(vsi->seid, pf,
-					     vsi->base_queue + q_id,
-					     false /*is xdp*/, enable);
-		if (ret)
-			break;
+	for_each_set_bit(q_id, &rx_map, I40E_MAX_VF_QUEUES)
+		i40e_control_rx_q(pf, i40e_vsi_pf_q(vsi, q_id), enable);
+
+	if (enable)
+		for_each_set_bit(q_id, &tx_map, I40E_MAX_VF_QUEUES)
+			i40e_control_tx_q(pf, i40e_vsi_pf_q(vsi, q_id), true);
+}
+
+/**
+ * i40e_wait_vf_rings
+ * @vsi: the SRIOV VSI being configured
+ * @rx_map: bit map of the Rx queues to wait for
+ * @tx_map: bit map of the Tx queues to wait for
+ * @enable: state the queues were asked to reach
+ *
+ * Returns 0 once every queue in the maps reached the requested state,
+ * -ETIMEDOUT as soon as one of them did not
+ **/
+static int i40e_wait_vf_rings(struct i40e_vsi *vsi, unsigned long rx_map,
+			      unsigned long tx_map, bool enable)
+{
+	struct i40e_pf *pf = vsi->back;
+	int pf_q, ret;
+	u16 q_id;
+
+	for_each_set_bit(q_id, &tx_map, I40E_MAX_VF_QUEUES) {
+		pf_q = i40e_vsi_pf_q(vsi, q_id);
+		ret = i40e_pf_txq_wait(pf, pf_q, enable);
+		if (ret) {
+			dev_info(&pf->pdev->dev,
+				 "VSI seid %d Tx ring %d %sable timeout\n",
+				 vsi->seid, pf_q, (enable ? "en" : "dis"));
+			return ret;
+		}
 	}
-	return ret;
+
+	for_each_set_bit(q_id, &rx_map, I40E_MAX_VF_QUEUES) {
+		pf_q = i40e_vsi_pf_q(vsi, q_id);
+		ret = i40e_pf_rxq_wait(pf, pf_q, enable);
+		if (ret) {
+			dev_info(&pf->pdev->dev,
+				 "VSI seid %d Rx ring %d %sable timeout\n",
+				 vsi->seid, pf_q, (enable ? "en" : "dis"));
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * i40e_ctrl_vf_rings
+ * @vsi: the SRIOV VSI being configured
+ * @rx_map: bit map of the Rx queues to be changed
+ * @tx_map: bit map of the Tx queues to be changed
+ * @enable: start or stop the queues
+ **/
+static int i40e_ctrl_vf_rings(struct i40e_vsi *vsi, unsigned long rx_map,
+			      unsigned long tx_map, bool enable)
+{
+	struct i40e_pf *pf = vsi->back;
+
+	if (test_bit(__I40E_PORT_SUSPENDED, pf->state) && enable)
+		return 0;
+
+	i40e_ctrl_vf_rings_no_wait(vsi, rx_map, tx_map, enable);
+
+	return i40e_wait_vf_rings(vsi, rx_map, tx_map, enable);
+}
+
+/**
+ * i40e_ctrl_vf_tx_rings
+ * @vsi: the SRIOV VSI being configured
+ * @q_map: bit map of the queues to be enabled
+ * @enable: start or stop the queue
+ **/
+static int i40e_ctrl_vf_tx_rings(struct i40e_vsi *vsi, unsigned long q_map,
+				 bool enable)
+{
+	return i40e_ctrl_vf_rings(vsi, 0, q_map, enable);
 }
 
 /**
@@ -3544,20 +4085,7 @@ static int i40e_ctrl_vf_tx_rings(struct i40e_vsi *vsi, unsigned long q_map,
 static int i40e_ctrl_vf_rx_rings(struct i40e_vsi *vsi, unsigned long q_map,
 				 bool enable)
 {
-	struct i40e_pf *pf = vsi->back;
-	int ret = 0;
-	u16 q_id;
-
-	if (test_bit(__I40E_PORT_SUSPENDED, pf->state) && enable)
-		return ret;
-
-	for_each_set_bit(q_id, &q_map, I40E_MAX_VF_QUEUES) {
-		ret = i40e_control_wait_rx_q(pf, vsi->base_queue + q_id,
-					     enable);
-		if (ret)
-			break;
-	}
-	return ret;
+	return i40e_ctrl_vf_rings(vsi, q_map, 0, enable);
 }
 
 /**
@@ -3613,32 +4141,30 @@ static int i40e_vc_enable_queues_msg(struct i40e_vf *vf, u8 *msg)
 		goto error_param;
 	}
 
-	/* Use the queue bit map sent by the VF */
-	if (i40e_ctrl_vf_rx_rings(pf->vsi[vf->lan_vsi_idx], vqs->rx_queues,
-				  true)) {
-		aq_ret = I40E_ERR_TIMEOUT;
+	if (test_bit(__I40E_PORT_SUSPENDED, pf->state))
 		goto error_param;
-	}
-	if (i40e_ctrl_vf_tx_rings(pf->vsi[vf->lan_vsi_idx], vqs->tx_queues,
-				  true)) {
+
+	/* Use the queue bit map sent by the VF. Kick every ring first, on the
+	 * LAN VSI and on the additional ADq VSIs, then wait for all of them.
+	 */
+	i40e_ctrl_vf_rings_no_wait(pf->vsi[vf->lan_vsi_idx], vqs->rx_queues,
+				   vqs->tx_queues, true);
+	/* zero belongs to LAN VSI */
+	for (i = 1; vf->adq_enabled && i < vf->num_tc; i++)
+		i40e_ctrl_vf_rings_no_wait(pf->vsi[vf->ch[i].vsi_idx],
+					   vqs->rx_queues, vqs->tx_queues,
+					   true);
+
+	if (i40e_wait_vf_rings(pf->vsi[vf->lan_vsi_idx], vqs->rx_queues,
+			       vqs->tx_queues, true)) {
 		aq_ret = I40E_ERR_TIMEOUT;
 		goto error_param;
 	}
-
-	/* need to start the rings for additional ADq VSI's as well */
-	if (vf->adq_enabled) {
-		/* zero belongs to LAN VSI */
-		for (i = 1; i < vf->num_tc; i++) {
-			if (i40e_ctrl_vf_rx_rings(pf->vsi[vf->ch[i].vsi_idx],
-						  vqs->rx_queues, true)) {
-				aq_ret = I40E_ERR_TIMEOUT;
-				goto error_param;
-			}
-			if (i40e_ctrl_vf_tx_rings(pf->vsi[vf->ch[i].vsi_idx],
-						  vqs->tx_queues, true)) {
-				aq_ret = I40E_ERR_TIMEOUT;
-				goto error_param;
-			}
+	for (i = 1; vf->adq_enabled && i < vf->num_tc; i++) {
+		if (i40e_wait_vf_rings(pf->vsi[vf->ch[i].vsi_idx],
+				       vqs->rx_queues, vqs->tx_queues, true)) {
+			aq_ret = I40E_ERR_TIMEOUT;
+			goto error_param;
 		}
 	}
 
@@ -3679,13 +4205,8 @@ static int i40e_vc_disable_queues_msg(struct i40e_vf *vf, u8 *msg)
 	}
 
 	/* Use the queue bit map sent by the VF */
-	if (i40e_ctrl_vf_tx_rings(pf->vsi[vf->lan_vsi_idx], vqs->tx_queues,
-				  false)) {
-		aq_ret = I40E_ERR_TIMEOUT;
-		goto error_param;
-	}
-	if (i40e_ctrl_vf_rx_rings(pf->vsi[vf->lan_vsi_idx], vqs->rx_queues,
-				  false)) {
+	if (i40e_ctrl_vf_rings(pf->vsi[vf->lan_vsi_idx], vqs->rx_queues,
+			       vqs->tx_queues, false)) {
 		aq_ret = I40E_ERR_TIMEOUT;
 		goto error_param;
 	}
@@ -3695,64 +4216,11 @@ error_param:
 				       aq_ret);
 }
 
-/**
- * i40e_check_enough_queue - find enough queue
- * @vf: pointer to the VF info
- * @needed: the number of items needed
- *
- * Returns the base item index of the queue, or negative for error
- **/
-static int i40e_check_enough_queue(struct i40e_vf *vf, u16 needed)
-{
-	struct i40e_pf *pf = vf->pf;
-	struct i40e_vsi *vsi = pf->vsi[vf->lan_vsi_idx];
-	u16 i, cur_queues, more, pool_size;
-	struct i40e_lump_tracking *pile;
-
-	cur_queues = vsi->alloc_queue_pairs;
-
-	/* if current allocated queues is enough for need */
-	if (cur_queues >= needed)
-		return vsi->base_queue;
-
-	pile = pf->qp_pile;
-	if (cur_queues > 0) {
-		/*
-		 * if queues of allocated not zero, just check if
-		 * there is enough queues behind the allocated queues
-		 * for more.
-		 */
-		more = needed - cur_queues;
-		for (i = vsi->base_queue + cur_queues;
-			i < pile->num_entries; i++) {
-			if (pile->list[i] & I40E_PILE_VALID_BIT)
-				break;
-
-			if (more-- == 1)
-				/* there is enough */
-				return vsi->base_queue;
-		}
-	}
-
-	pool_size = 0;
-	for (i = 0; i < pile->num_entries; i++) {
-		if (pile->list[i] & I40E_PILE_VALID_BIT) {
-			pool_size = 0;
-			continue;
-		}
-		if (needed <= ++pool_size)
-			/* there is enough */
-			return i;
-	}
-
-	return -ENOMEM;
-}
-
 static int i40e_set_vf_num_queues(struct i40e_vf *vf, int num_queues)
 {
 	int cur_pairs = vf->num_queue_pairs;
 	struct i40e_pf *pf = vf->pf;
-	int max_size;
+	int free_qps;
 
 	if (num_queues > I40E_MAX_VF_QUEUES) {
 		dev_err(&pf->pdev->dev, "Unable to configure %d VF queues, the maximum is %d\n",
@@ -3764,22 +4232,22 @@ static int i40e_set_vf_num_queues(struct i40e_vf *vf, int num_queues)
 			 num_queues - cur_pairs,
 			 pf->queues_left);
 		return -EINVAL;
-	} else if (i40e_check_enough_queue(vf, num_queues) < 0) {
-		dev_warn(&pf->pdev->dev, "VF requested %d more queues, but there is not enough for it.\n",
-			 num_queues - cur_pairs);
-		return -EINVAL;
 	}
 
-	max_size = i40e_max_lump_qp(pf);
-	if (max_size < 0) {
+	/* The VF VSI queue map is non-contiguous, so the new queues do not
+	 * have to come from one lump, the VF's own queues are given back
+	 * on the reset before the new set is assigned.
+	 */
+	free_qps = i40e_free_lump_qp(pf);
+	if (free_qps < 0) {
 		dev_err(&pf->pdev->dev, "Unable to configure %d VF queues, pile=<null>\n",
 			num_queues);
 		return -EINVAL;
 	}
 
-	if (num_queues > max_size) {
+	if (num_queues > free_qps + cur_pairs) {
 		dev_err(&pf->pdev->dev, "Unable to configure %d VF queues, only %d available\n",
-			num_queues, max_size);
+			num_queues, free_qps + cur_pairs);
 		return -EINVAL;
 	}
 
@@ -3804,12 +4272,69 @@ static int i40e_vc_request_queues_msg(struct i40e_vf *vf, u8 *msg)
 	struct virtchnl_vf_res_request *vfres =
 		(struct virtchnl_vf_res_request *)msg;
 	u16 req_pairs = vfres->num_queue_pairs;
+	struct i40e_pf *pf = vf->pf;
+	int avail;
 
 	if (!i40e_sync_vf_state(vf, I40E_VF_STATE_ACTIVE))
 		return -EINVAL;
 
-	return i40e_set_vf_num_queues(vf, req_pairs);
+	if (!i40e_set_vf_num_queues(vf, req_pairs))
+		return 0;
+
+	/* tell the VF how many it can have so it can ask again */
+	avail = i40e_free_lump_qp(pf);
+	avail = min_t(int, vf->num_queue_pairs + min(avail, pf->queues_left),
+		      I40E_MAX_VF_QUEUES);
+	vfres->num_queue_pairs = max(avail, 0);
+
+	return i40e_vc_send_msg_to_vf(vf, VIRTCHNL_OP_REQUEST_QUEUES, 0,
+				      (u8 *)vfres, sizeof(*vfres));
+}
+
+/**
+ * __i40e_vf_stats_snapshot
+ * @vf: pointer to the VF info
+ * @stats: filled with the stats of the VF
+ *
+ * Refreshes the snapshot of all VFs if it is older than the stats freshness
+ * window and copies out the values of this VF. The caller holds
+ * pf->vc_rwsem.
+ **/
+static void __i40e_vf_stats_snapshot(struct i40e_vf *vf,
+				     struct i40e_eth_stats *stats)
+{
+	struct i40e_pf *pf = vf->pf;
+	unsigned int seq;
+
+	i40e_update_vf_stats(pf);
+	do {
+		seq = read_seqbegin(&pf->vf_stats_lock);
+		*stats = vf->stats_snap;
+	} while (read_seqretry(&pf->vf_stats_lock, seq));
+}
+
+/**
+ * i40e_vf_stats_snapshot
+ * @pf: pointer to the PF structure
+ * @vf_id: VF identifier, already validated by the caller
+ * @stats: filled with the stats of the VF
+ *
+ * Same as __i40e_vf_stats_snapshot() for callers outside the VC message
+ * task. Returns -EINVAL if the VFs went away in the meantime.
+ **/
+static int i40e_vf_stats_snapshot(struct i40e_pf *pf, int vf_id,
+				  struct i40e_eth_stats *stats)
+{
+	int ret = 0;
+
+	down_read(&pf->vc_rwsem);
+	if (vf_id < pf->num_alloc_vfs)
+		__i40e_vf_stats_snapshot(&pf->vf[vf_id], stats);
+	else
+		ret = -EINVAL;
+	up_read(&pf->vc_rwsem);
 
+	return ret;
 }
 
 /**
@@ -3845,8 +4370,7 @@ static int i40e_vc_get_stats_msg(struct i40e_vf *vf, u8 *msg)
 		aq_ret = I40E_ERR_PARAM;
 		goto error_param;
 	}
-	i40e_update_eth_stats(vsi);
-	stats = vsi->eth_stats;
+	__i40e_vf_stats_snapshot(vf, &stats);
 
 error_param:
 	/* send the response back to the VF */
@@ -4460,6 +4984,52 @@ error_param:
 	return i40e_vc_send_resp_to_vf(vf, VIRTCHNL_OP_DEL_VLAN, aq_ret);
 }
 
+/* 16 bit pattern repeated across the whole key for the symmetric hash */
+#define I40E_VC_RSS_SYM_KEY_PATTERN	0x6d5a
+
+/**
+ * i40e_vc_apply_rss_key - Program the VF's RSS key for its hash function
+ * @vf: pointer to the VF info
+ *
+ * Only the key is per VF, the hash function is shared by the whole device.
+ * A Toeplitz key that repeats every 16 bits hashes a flow and its reverse
+ * alike, since swapping addresses or ports moves them by a multiple of 16
+ * bits in the hash input. The symmetric hash always uses the well known
+ * 0x6d5a pattern, since the first 16 bits of an arbitrary key can spread
+ * flows badly. The key the VF asked for is kept for the asymmetric hash.
+ **/
+static int i40e_vc_apply_rss_key(struct i40e_vf *vf)
+{
+	u8 key[sizeof(vf->rss_key)] __aligned(4);
+	struct i40e_pf *pf = vf->pf;
+	struct i40e_vsi *vsi;
+	unsigned int i;
+	int ret;
+
+	vsi = pf->vsi[vf->lan_vsi_idx];
+	if (!vsi)
+		return I40E_ERR_PARAM;
+
+	if (!vf->rss_key_set) {
+		ret = i40e_get_rss(vsi, key, NULL, 0);
+		if (ret)
+			return ret;
+		memcpy(vf->rss_key, key, sizeof(key));
+		vf->rss_key_set = true;
+	}
+
+	if (vf->rss_hfunc == VIRTCHNL_RSS_ALG_TOEPLITZ_SYMMETRIC) {
+		for (i = 0; i < sizeof(key); i += 2) {
+			key[i] = I40E_VC_RSS_SYM_KEY_PATTERN >> 8;
+			key[i + 1] = I40E_VC_RSS_SYM_KEY_PATTERN & 0xff;
+		}
+	} else {
+		memcpy(key, vf->rss_key, sizeof(key));
+	}
+
+	return i40e_config_rss(vsi, key, NULL, 0);
+}
+
 /**
  * i40e_vc_config_rss_key
  * @vf: pointer to the VF info
@@ -4472,8 +5042,6 @@ static int i40e_vc_config_rss_key(struct i40e_vf *vf, u8 *msg)
 	struct virtchnl_rss_key *vrk =
 		(struct virtchnl_rss_key *)msg;
 	i40e_status aq_ret = I40E_SUCCESS;
-	struct i40e_pf *pf = vf->pf;
-	struct i40e_vsi *vsi = NULL;
 
 	if (!i40e_sync_vf_state(vf, I40E_VF_STATE_ACTIVE) ||
 	    !i40e_vc_isvalid_vsi_id(vf, vrk->vsi_id) ||
@@ -4482,8 +5050,9 @@ static int i40e_vc_config_rss_key(struct i40e_vf *vf, u8 *msg)
 		goto err;
 	}
 
-	vsi = pf->vsi[vf->lan_vsi_idx];
-	aq_ret = i40e_config_rss(vsi, vrk->key, NULL, 0);
+	memcpy(vf->rss_key, vrk->key, sizeof(vf->rss_key));
+	vf->rss_key_set = true;
+	aq_ret = i40e_vc_apply_rss_key(vf);
 err:
 	/* send the response to the VF */
 	return i40e_vc_send_resp_to_vf(vf, VIRTCHNL_OP_CONFIG_RSS_KEY,
@@ -4579,17 +5148,232 @@ static int i40e_vc_set_rss_hena(struct i40e_vf *vf, u8 *msg)
 	struct i40e_pf *pf = vf->pf;
 	struct i40e_hw *hw = &pf->hw;
 
-	if (!i40e_sync_vf_state(vf, I40E_VF_STATE_ACTIVE)) {
+	if (!i40e_sync_vf_state(vf, I40E_VF_STATE_ACTIVE)) {
+		aq_ret = I40E_ERR_PARAM;
+		goto err;
+	}
+	i40e_write_rx_ctl(hw, I40E_VFQF_HENA1(0, vf->vf_id), (u32)vrh->hena);
+	i40e_write_rx_ctl(hw, I40E_VFQF_HENA1(1, vf->vf_id),
+			  (u32)(vrh->hena >> 32));
+
+	/* send the response to the VF */
+err:
+	return i40e_vc_send_resp_to_vf(vf, VIRTCHNL_OP_SET_RSS_HENA, aq_ret);
+}
+
+#define I40E_VC_HDR_FIELD(field)	BIT((field) & PROTO_HDR_FIELD_MASK)
+#define I40E_VC_IPV4_ADDR_FIELDS \
+	(I40E_VC_HDR_FIELD(VIRTCHNL_PROTO_HDR_IPV4_SRC) | \
+	 I40E_VC_HDR_FIELD(VIRTCHNL_PROTO_HDR_IPV4_DST))
+#define I40E_VC_IPV4_FIELDS (I40E_VC_IPV4_ADDR_FIELDS | \
+	I40E_VC_HDR_FIELD(VIRTCHNL_PROTO_HDR_IPV4_PROT))
+#define I40E_VC_IPV6_ADDR_FIELDS \
+	(I40E_VC_HDR_FIELD(VIRTCHNL_PROTO_HDR_IPV6_SRC) | \
+	 I40E_VC_HDR_FIELD(VIRTCHNL_PROTO_HDR_IPV6_DST))
+#define I40E_VC_IPV6_FIELDS (I40E_VC_IPV6_ADDR_FIELDS | \
+	I40E_VC_HDR_FIELD(VIRTCHNL_PROTO_HDR_IPV6_PROT))
+/* the source and destination ports are the first two fields of the TCP,
+ * UDP and SCTP headers alike, field 0 is the source port and 1 the
+ * destination port for all three
+ */
+#define I40E_VC_L4_PORT_FIELDS	(BIT(0) | BIT(1))
+
+/**
+ * i40e_vc_config_rss_hfunc
+ * @vf: pointer to the VF info
+ * @msg: pointer to the msg buffer
+ *
+ * Select the VF's RSS hash function. Only the Toeplitz hash can be chosen
+ * per VF, the XOR hash applies to the whole device.
+ **/
+static int i40e_vc_config_rss_hfunc(struct i40e_vf *vf, u8 *msg)
+{
+	struct virtchnl_rss_hfunc *vrh = (struct virtchnl_rss_hfunc *)msg;
+	i40e_status aq_ret = I40E_SUCCESS;
+
+	if (!i40e_sync_vf_state(vf, I40E_VF_STATE_ACTIVE) ||
+	    !i40e_vc_isvalid_vsi_id(vf, vrh->vsi_id) ||
+	    !(vf->driver_caps & VIRTCHNL_VF_OFFLOAD_RSS_PF)) {
+		aq_ret = I40E_ERR_PARAM;
+		goto err;
+	}
+
+	switch (vrh->rss_algorithm) {
+	case VIRTCHNL_RSS_ALG_TOEPLITZ_ASYMMETRIC:
+	case VIRTCHNL_RSS_ALG_TOEPLITZ_SYMMETRIC:
+		break;
+	default:
+		aq_ret = I40E_ERR_NOT_IMPLEMENTED;
+		goto err;
+	}
+
+	if (vf->rss_hfunc != vrh->rss_algorithm) {
+		vf->rss_hfunc = vrh->rss_algorithm;
+		aq_ret = i40e_vc_apply_rss_key(vf);
+	}
+err:
+	return i40e_vc_send_resp_to_vf(vf, VIRTCHNL_OP_CONFIG_RSS_HFUNC,
+				       aq_ret);
+}
+
+/**
+ * i40e_vc_rss_cfg_hena - Hash enable bits selected by a virtchnl RSS config
+ * @vf: pointer to the VF info
+ * @rss_cfg: the configuration sent by the VF
+ * @hena: filled with the packet classifier types to hash
+ *
+ * The header fields fed to the hash are set per packet classifier type for
+ * the whole device, each VF only chooses which types are hashed. A config is
+ * accepted when it asks for the fields the device hashes: both addresses,
+ * plus both ports when an L4 header is given. Tunnel inner headers are not
+ * hashed, the outer UDP header of VXLAN and GTP-U packets is.
+ **/
+static int i40e_vc_rss_cfg_hena(struct i40e_vf *vf,
+				struct virtchnl_rss_cfg *rss_cfg, u64 *hena)
+{
+	struct virtchnl_proto_hdrs *hdrs = &rss_cfg->proto_hdrs;
+	struct virtchnl_proto_hdr *hdr;
+	int l3 = 0, l4 = 0;
+	u32 fields, i;
+
+	if (hdrs->tunnel_level || !hdrs->count ||
+	    hdrs->count > VIRTCHNL_MAX_NUM_PROTO_HDRS)
+		return -EOPNOTSUPP;
+
+	for (i = 0; i < hdrs->count; i++) {
+		hdr = &hdrs->proto_hdr[i];
+
+		switch (hdr->type) {
+		case VIRTCHNL_PROTO_HDR_ETH:
+			if (i || hdr->field_selector)
+				return -EOPNOTSUPP;
+			break;
+		case VIRTCHNL_PROTO_HDR_IPV4:
+			fields = hdr->field_selector & ~I40E_VC_HDR_FIELD
+					(VIRTCHNL_PROTO_HDR_IPV4_PROT);
+			if (l3 || fields != I40E_VC_IPV4_ADDR_FIELDS)
+				return -EOPNOTSUPP;
+			l3 = ETH_P_IP;
+			break;
+		case VIRTCHNL_PROTO_HDR_IPV6:
+			fields = hdr->field_selector & ~I40E_VC_HDR_FIELD
+					(VIRTCHNL_PROTO_HDR_IPV6_PROT);
+			if (l3 || fields != I40E_VC_IPV6_ADDR_FIELDS)
+				return -EOPNOTSUPP;
+			l3 = ETH_P_IPV6;
+			break;
+		case VIRTCHNL_PROTO_HDR_TCP:
+		case VIRTCHNL_PROTO_HDR_UDP:
+		case VIRTCHNL_PROTO_HDR_SCTP:
+			if (!l3 || l4 ||
+			    hdr->field_selector != I40E_VC_L4_PORT_FIELDS)
+				return -EOPNOTSUPP;
+			l4 = hdr->type;
+			break;
+		default:
+			return -EOPNOTSUPP;
+		}
+	}
+
+	switch (l4) {
+	case VIRTCHNL_PROTO_HDR_TCP:
+		*hena = l3 == ETH_P_IP ?
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_IPV4_TCP) |
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_IPV4_TCP_SYN_NO_ACK) :
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_IPV6_TCP) |
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_IPV6_TCP_SYN_NO_ACK);
+		break;
+	case VIRTCHNL_PROTO_HDR_UDP:
+		*hena = l3 == ETH_P_IP ?
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_IPV4_UDP) |
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_UNICAST_IPV4_UDP) |
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_MULTICAST_IPV4_UDP) :
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_IPV6_UDP) |
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_UNICAST_IPV6_UDP) |
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_MULTICAST_IPV6_UDP);
+		break;
+	case VIRTCHNL_PROTO_HDR_SCTP:
+		*hena = l3 == ETH_P_IP ?
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_IPV4_SCTP) :
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_IPV6_SCTP);
+		break;
+	default:
+		if (!l3)
+			return -EOPNOTSUPP;
+		*hena = l3 == ETH_P_IP ?
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_IPV4_OTHER) |
+			BIT_ULL(I40E_FILTER_PCTYPE_FRAG_IPV4) :
+			BIT_ULL(I40E_FILTER_PCTYPE_NONF_IPV6_OTHER) |
+			BIT_ULL(I40E_FILTER_PCTYPE_FRAG_IPV6);
+		break;
+	}
+
+	/* the split TCP and UDP types only exist on some parts */
+	*hena &= i40e_pf_get_default_rss_hena(vf->pf);
+	return 0;
+}
+
+/**
+ * i40e_vc_rss_cfg_msg
+ * @vf: pointer to the VF info
+ * @msg: pointer to the msg buffer
+ * @add: true for VIRTCHNL_OP_ADD_RSS_CFG, false for VIRTCHNL_OP_DEL_RSS_CFG
+ *
+ * Enable or disable hashing of the packet types matched by the config in
+ * the VF's hash enable registers. Asking for the symmetric Toeplitz hash
+ * switches the VF's key to a symmetric one, for all of its packet types.
+ **/
+static int i40e_vc_rss_cfg_msg(struct i40e_vf *vf, u8 *msg, bool add)
+{
+	struct virtchnl_rss_cfg *rss_cfg = (struct virtchnl_rss_cfg *)msg;
+	u32 v_opcode = add ? VIRTCHNL_OP_ADD_RSS_CFG : VIRTCHNL_OP_DEL_RSS_CFG;
+	i40e_status aq_ret = I40E_SUCCESS;
+	struct i40e_pf *pf = vf->pf;
+	struct i40e_hw *hw = &pf->hw;
+	u64 hena, cfg_hena;
+
+	if (!i40e_sync_vf_state(vf, I40E_VF_STATE_ACTIVE) ||
+	    !(vf->driver_caps & VIRTCHNL_VF_OFFLOAD_ADV_RSS_PF) ||
+	    pf->vf_base_mode_only) {
 		aq_ret = I40E_ERR_PARAM;
 		goto err;
 	}
-	i40e_write_rx_ctl(hw, I40E_VFQF_HENA1(0, vf->vf_id), (u32)vrh->hena);
+
+	switch (rss_cfg->rss_algorithm) {
+	case VIRTCHNL_RSS_ALG_TOEPLITZ_ASYMMETRIC:
+	case VIRTCHNL_RSS_ALG_TOEPLITZ_SYMMETRIC:
+		break;
+	default:
+		aq_ret = I40E_ERR_NOT_IMPLEMENTED;
+		goto err;
+	}
+
+	if (i40e_vc_rss_cfg_hena(vf, rss_cfg, &cfg_hena)) {
+		dev_info(&pf->pdev->dev,
+			 "VF %d: RSS config selects fields this device can't hash per VF\n",
+			 vf->vf_id);
+		aq_ret = I40E_ERR_NOT_IMPLEMENTED;
+		goto err;
+	}
+
+	hena = (u64)i40e_read_rx_ctl(hw, I40E_VFQF_HENA1(0, vf->vf_id)) |
+	       ((u64)i40e_read_rx_ctl(hw, I40E_VFQF_HENA1(1, vf->vf_id)) << 32);
+	if (add)
+		hena |= cfg_hena;
+	else
+		hena &= ~cfg_hena;
+	i40e_write_rx_ctl(hw, I40E_VFQF_HENA1(0, vf->vf_id), (u32)hena);
 	i40e_write_rx_ctl(hw, I40E_VFQF_HENA1(1, vf->vf_id),
-			  (u32)(vrh->hena >> 32));
+			  (u32)(hena >> 32));
 
-	/* send the response to the VF */
+	if (add &&
+	    rss_cfg->rss_algorithm == VIRTCHNL_RSS_ALG_TOEPLITZ_SYMMETRIC &&
+	    vf->rss_hfunc != VIRTCHNL_RSS_ALG_TOEPLITZ_SYMMETRIC) {
+		vf->rss_hfunc = VIRTCHNL_RSS_ALG_TOEPLITZ_SYMMETRIC;
+		aq_ret = i40e_vc_apply_rss_key(vf);
+	}
 err:
-	return i40e_vc_send_resp_to_vf(vf, VIRTCHNL_OP_SET_RSS_HENA, aq_ret);
+	return i40e_vc_send_resp_to_vf(vf, v_opcode, aq_ret);
 }
 
 /**
@@ -5326,6 +6110,374 @@ err:
 
 #endif /* __TC_MQPRIO_MODE_MAX */
 
+/**
+ * i40e_vc_fdir_quota - Number of Flow Director rules a VF may own
+ * @pf: pointer to the PF info
+ *
+ * The sideband space guaranteed to the PF is shared evenly between the PF
+ * and its VFs, so that no VF can starve the PF or the other VFs. Rules the
+ * PF itself has added beyond its share shrink what is left for the VFs.
+ **/
+static u32 i40e_vc_fdir_quota(struct i40e_pf *pf)
+{
+	u32 pf_rules = pf->fdir_pf_active_filters - pf->fdir_vf_active_filters;
+	u32 reserved = pf->fdir_pf_filter_count / (pf->num_alloc_vfs + 1);
+
+	reserved = max(reserved, pf_rules);
+	if (!pf->num_alloc_vfs || reserved >= pf->fdir_pf_filter_count)
+		return 0;
+
+	return (pf->fdir_pf_filter_count - reserved) / pf->num_alloc_vfs;
+}
+
+/**
+ * i40e_vc_fdir_parse_l4 - Fill the ports of a flow spec from a virtchnl header
+ * @hdr: TCP, UDP or SCTP header sent by the VF
+ * @l3: ETH_P_IP or ETH_P_IPV6, the network header preceding @hdr
+ * @fsp: flow spec to fill
+ **/
+static int i40e_vc_fdir_parse_l4(struct virtchnl_proto_hdr *hdr, int l3,
+				 struct ethtool_rx_flow_spec *fsp)
+{
+	struct udphdr *l4h = (struct udphdr *)hdr->buffer;
+	__be16 *psrc, *pdst, *m_psrc, *m_pdst;
+
+	if (hdr->field_selector & ~I40E_VC_L4_PORT_FIELDS)
+		return -EINVAL;
+
+#ifdef HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC
+	if (l3 == ETH_P_IPV6) {
+		psrc = &fsp->h_u.tcp_ip6_spec.psrc;
+		pdst = &fsp->h_u.tcp_ip6_spec.pdst;
+		m_psrc = &fsp->m_u.tcp_ip6_spec.psrc;
+		m_pdst = &fsp->m_u.tcp_ip6_spec.pdst;
+	} else
+#endif /* HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC */
+	{
+		psrc = &fsp->h_u.tcp_ip4_spec.psrc;
+		pdst = &fsp->h_u.tcp_ip4_spec.pdst;
+		m_psrc = &fsp->m_u.tcp_ip4_spec.psrc;
+		m_pdst = &fsp->m_u.tcp_ip4_spec.pdst;
+	}
+
+	if (hdr->field_selector & BIT(0)) {
+		*psrc = l4h->source;
+		*m_psrc = htons(0xFFFF);
+	}
+	if (hdr->field_selector & BIT(1)) {
+		*pdst = l4h->dest;
+		*m_pdst = htons(0xFFFF);
+	}
+
+	return 0;
+}
+
+/**
+ * i40e_vc_fdir_parse_rule - Translate a virtchnl FDIR rule into a flow spec
+ * @vf: pointer to the VF info
+ * @rule: the rule as sent by the VF
+ * @fsp: flow spec to fill, the location is left to the caller
+ *
+ * Only what the sideband table matches without flexible payload is accepted:
+ * an optional Ethernet header without addresses, then IPv4 or IPv6 addresses
+ * and optionally TCP, UDP or SCTP ports. An ethertype can only be matched if
+ * it is the one implied by the IP header, the table has no field for it. The
+ * rule must carry exactly one action, drop or steer to one of the VF's own
+ * queues.
+ **/
+static int i40e_vc_fdir_parse_rule(struct i40e_vf *vf,
+				   struct virtchnl_fdir_rule *rule,
+				   struct ethtool_rx_flow_spec *fsp)
+{
+	struct virtchnl_proto_hdrs *hdrs = &rule->proto_hdrs;
+	struct virtchnl_filter_action *act;
+	struct virtchnl_proto_hdr *hdr;
+#ifdef HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC
+	struct ipv6hdr *ip6h;
+#endif /* HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC */
+	struct iphdr *iph;
+	int l3 = 0, l4 = 0;
+	__be16 etype = 0;
+	u32 i;
+
+	if (hdrs->tunnel_level || !hdrs->count ||
+	    hdrs->count > VIRTCHNL_MAX_NUM_PROTO_HDRS)
+		return -EINVAL;
+
+	for (i = 0; i < hdrs->count; i++) {
+		hdr = &hdrs->proto_hdr[i];
+
+		switch (hdr->type) {
+		case VIRTCHNL_PROTO_HDR_ETH:
+			if (i || hdr->field_selector &
+			    ~I40E_VC_HDR_FIELD(VIRTCHNL_PROTO_HDR_ETH_ETHERTYPE))
+				return -EINVAL;
+			if (VIRTCHNL_TEST_PROTO_HDR_FIELD(hdr,
+							  VIRTCHNL_PROTO_HDR_ETH_ETHERTYPE)) {
+				etype = ((struct ethhdr *)hdr->buffer)->h_proto;
+				if (!etype)
+					return -EINVAL;
+			}
+			break;
+		case VIRTCHNL_PROTO_HDR_IPV4:
+			if (l3 || hdr->field_selector & ~I40E_VC_IPV4_FIELDS)
+				return -EINVAL;
+			iph = (struct iphdr *)hdr->buffer;
+			l3 = ETH_P_IP;
+			if (VIRTCHNL_TEST_PROTO_HDR_FIELD(hdr,
+							  VIRTCHNL_PROTO_HDR_IPV4_SRC)) {
+				fsp->h_u.tcp_ip4_spec.ip4src = iph->saddr;
+				fsp->m_u.tcp_ip4_spec.ip4src = htonl(0xFFFFFFFF);
+			}
+			if (VIRTCHNL_TEST_PROTO_HDR_FIELD(hdr,
+							  VIRTCHNL_PROTO_HDR_IPV4_DST)) {
+				fsp->h_u.tcp_ip4_spec.ip4dst = iph->daddr;
+				fsp->m_u.tcp_ip4_spec.ip4dst = htonl(0xFFFFFFFF);
+			}
+			/* the protocol can only be matched through an L4 header */
+			if (VIRTCHNL_TEST_PROTO_HDR_FIELD(hdr,
+							  VIRTCHNL_PROTO_HDR_IPV4_PROT) &&
+			    (i + 1 >= hdrs->count ||
+			     hdrs->proto_hdr[i + 1].type == VIRTCHNL_PROTO_HDR_NONE))
+				return -EINVAL;
+			break;
+#ifdef HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC
+		case VIRTCHNL_PROTO_HDR_IPV6:
+			if (l3 || hdr->field_selector & ~I40E_VC_IPV6_FIELDS)
+				return -EINVAL;
+			ip6h = (struct ipv6hdr *)hdr->buffer;
+			l3 = ETH_P_IPV6;
+			if (VIRTCHNL_TEST_PROTO_HDR_FIELD(hdr,
+							  VIRTCHNL_PROTO_HDR_IPV6_SRC)) {
+				memcpy(fsp->h_u.tcp_ip6_spec.ip6src,
+				       &ip6h->saddr, sizeof(ip6h->saddr));
+				memset(fsp->m_u.tcp_ip6_spec.ip6src, 0xFF,
+				       sizeof(fsp->m_u.tcp_ip6_spec.ip6src));
+			}
+			if (VIRTCHNL_TEST_PROTO_HDR_FIELD(hdr,
+							  VIRTCHNL_PROTO_HDR_IPV6_DST)) {
+				memcpy(fsp->h_u.tcp_ip6_spec.ip6dst,
+				       &ip6h->daddr, sizeof(ip6h->daddr));
+				memset(fsp->m_u.tcp_ip6_spec.ip6dst, 0xFF,
+				       sizeof(fsp->m_u.tcp_ip6_spec.ip6dst));
+			}
+			if (VIRTCHNL_TEST_PROTO_HDR_FIELD(hdr,
+							  VIRTCHNL_PROTO_HDR_IPV6_PROT) &&
+			    (i + 1 >= hdrs->count ||
+			     hdrs->proto_hdr[i + 1].type == VIRTCHNL_PROTO_HDR_NONE))
+				return -EINVAL;
+			break;
+#endif /* HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC */
+		case VIRTCHNL_PROTO_HDR_TCP:
+		case VIRTCHNL_PROTO_HDR_UDP:
+		case VIRTCHNL_PROTO_HDR_SCTP:
+			if (!l3 || l4 || i40e_vc_fdir_parse_l4(hdr, l3, fsp))
+				return -EINVAL;
+			l4 = hdr->type;
+			break;
+		case VIRTCHNL_PROTO_HDR_NONE:
+			/* trailing padding headers are ignored */
+			if (!l3)
+				return -EINVAL;
+			i = hdrs->count;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	/* nothing in the flow spec matches the ethertype, only accept the
+	 * one that the flow type matches anyway
+	 */
+	if (etype && ntohs(etype) != l3)
+		return -EINVAL;
+
+	switch (l3) {
+	case ETH_P_IP:
+		switch (l4) {
+		case VIRTCHNL_PROTO_HDR_TCP:
+			fsp->flow_type = TCP_V4_FLOW;
+			break;
+		case VIRTCHNL_PROTO_HDR_UDP:
+			fsp->flow_type = UDP_V4_FLOW;
+			break;
+		case VIRTCHNL_PROTO_HDR_SCTP:
+			fsp->flow_type = SCTP_V4_FLOW;
+			break;
+		default:
+			fsp->flow_type = IP_USER_FLOW;
+			fsp->h_u.usr_ip4_spec.ip_ver = ETH_RX_NFC_IP4;
+			break;
+		}
+		break;
+#ifdef HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC
+	case ETH_P_IPV6:
+		switch (l4) {
+		case VIRTCHNL_PROTO_HDR_TCP:
+			fsp->flow_type = TCP_V6_FLOW;
+			break;
+		case VIRTCHNL_PROTO_HDR_UDP:
+			fsp->flow_type = UDP_V6_FLOW;
+			break;
+		case VIRTCHNL_PROTO_HDR_SCTP:
+			fsp->flow_type = SCTP_V6_FLOW;
+			break;
+		default:
+			fsp->flow_type = IPV6_USER_FLOW;
+			break;
+		}
+		break;
+#endif /* HAVE_ETHTOOL_FLOW_UNION_IP6_SPEC */
+	default:
+		return -EINVAL;
+	}
+
+	if (rule->action_set.count != 1)
+		return -EINVAL;
+
+	act = &rule->action_set.actions[0];
+	switch (act->type) {
+	case VIRTCHNL_ACTION_DROP:
+		fsp->ring_cookie = RX_CLS_FLOW_DISC;
+		break;
+	case VIRTCHNL_ACTION_QUEUE:
+		/* ADq owns the queue to traffic class mapping */
+		if (vf->adq_enabled ||
+		    act->act_conf.queue.index >= vf->num_queue_pairs)
+			return -EINVAL;
+		/* VFs are one-indexed in the ring cookie */
+		fsp->ring_cookie = act->act_conf.queue.index |
+				   ((u64)(vf->vf_id + 1) <<
+				    ETHTOOL_RX_FLOW_SPEC_RING_VF_OFF);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * i40e_vc_add_fdir_filter_msg
+ * @vf: pointer to the VF info
+ * @msg: pointer to the msg buffer
+ *
+ * Validates and, unless validate_only is set, programs a Flow Director
+ * sideband rule on behalf of the VF. The rule's location in the PF table is
+ * handed back to the VF as its flow_id.
+ **/
+static int i40e_vc_add_fdir_filter_msg(struct i40e_vf *vf, u8 *msg)
+{
+	struct virtchnl_fdir_add *fltr = (struct virtchnl_fdir_add *)msg;
+	struct ethtool_rx_flow_spec fsp = {};
+	i40e_status aq_ret = I40E_SUCCESS;
+	struct i40e_pf *pf = vf->pf;
+	struct i40e_vsi *vsi;
+	int ret;
+
+	if (!i40e_sync_vf_state(vf, I40E_VF_STATE_ACTIVE) ||
+	    !i40e_vc_isvalid_vsi_id(vf, fltr->vsi_id)) {
+		aq_ret = I40E_ERR_PARAM;
+		goto err;
+	}
+
+	if (!i40e_vc_fdir_allowed(vf)) {
+		dev_info(&pf->pdev->dev,
+			 "VF %d: Flow Director needs a trusted VF and ntuple on the PF\n",
+			 vf->vf_id);
+		aq_ret = I40E_ERR_PARAM;
+		goto err;
+	}
+
+	fltr->flow_id = 0;
+	if (i40e_vc_fdir_parse_rule(vf, &fltr->rule_cfg, &fsp)) {
+		fltr->status = VIRTCHNL_FDIR_FAILURE_RULE_INVALID;
+		goto err;
+	}
+
+	if (vf->num_fdir_filters >= i40e_vc_fdir_quota(pf)) {
+		fltr->status = VIRTCHNL_FDIR_FAILURE_RULE_NORESOURCE;
+		goto err;
+	}
+
+	if (fltr->validate_only) {
+		fltr->status = VIRTCHNL_FDIR_SUCCESS;
+		goto err;
+	}
+
+	vsi = pf->vsi[pf->lan_vsi];
+	mutex_lock(&pf->fdir_mutex);
+	ret = i40e_fdir_free_loc(pf, &fsp.location);
+	if (!ret)
+		ret = i40e_add_fdir_vf(vsi, &fsp, vf->vf_id);
+	mutex_unlock(&pf->fdir_mutex);
+
+	switch (ret) {
+	case 0:
+		fltr->flow_id = fsp.location;
+		fltr->status = VIRTCHNL_FDIR_SUCCESS;
+		break;
+	case -EEXIST:
+		fltr->status = VIRTCHNL_FDIR_FAILURE_RULE_EXIST;
+		break;
+	case -EOPNOTSUPP:
+		/* input set differs from the rules already in the table */
+		fltr->status = VIRTCHNL_FDIR_FAILURE_RULE_CONFLICT;
+		break;
+	case -ENOSPC:
+		fltr->status = VIRTCHNL_FDIR_FAILURE_RULE_NORESOURCE;
+		break;
+	case -EBUSY:
+		fltr->status = VIRTCHNL_FDIR_FAILURE_RULE_TIMEOUT;
+		break;
+	default:
+		fltr->status = VIRTCHNL_FDIR_FAILURE_RULE_INVALID;
+		break;
+	}
+
+err:
+	return i40e_vc_send_msg_to_vf(vf, VIRTCHNL_OP_ADD_FDIR_FILTER, aq_ret,
+				      (u8 *)fltr, sizeof(*fltr));
+}
+
+/**
+ * i40e_vc_del_fdir_filter_msg
+ * @vf: pointer to the VF info
+ * @msg: pointer to the msg buffer
+ *
+ * Removes a Flow Director rule the VF added before, by its flow_id.
+ **/
+static int i40e_vc_del_fdir_filter_msg(struct i40e_vf *vf, u8 *msg)
+{
+	struct virtchnl_fdir_del *fltr = (struct virtchnl_fdir_del *)msg;
+	i40e_status aq_ret = I40E_SUCCESS;
+	struct i40e_fdir_filter *rule;
+	struct i40e_pf *pf = vf->pf;
+	int ret;
+
+	if (!i40e_sync_vf_state(vf, I40E_VF_STATE_ACTIVE) ||
+	    !i40e_vc_isvalid_vsi_id(vf, fltr->vsi_id)) {
+		aq_ret = I40E_ERR_PARAM;
+		goto err;
+	}
+
+	mutex_lock(&pf->fdir_mutex);
+	rule = i40e_fdir_index_find(pf, fltr->flow_id);
+	if (!rule || !rule->vf_owned || rule->vf_id != vf->vf_id) {
+		fltr->status = VIRTCHNL_FDIR_FAILURE_RULE_NONEXIST;
+	} else {
+		ret = i40e_del_fdir_owned(pf->vsi[pf->lan_vsi], rule);
+		fltr->status = ret == -EBUSY ?
+			       VIRTCHNL_FDIR_FAILURE_RULE_TIMEOUT :
+			       VIRTCHNL_FDIR_SUCCESS;
+	}
+	mutex_unlock(&pf->fdir_mutex);
+
+err:
+	return i40e_vc_send_msg_to_vf(vf, VIRTCHNL_OP_DEL_FDIR_FILTER, aq_ret,
+				      (u8 *)fltr, sizeof(*fltr));
+}
+
 /**
  * i40e_vc_set_dvm_caps - set VLAN capabilities when the device is in DVM
  * @vf: VF that capabilities are being set for
@@ -5761,34 +6913,22 @@ error_param:
 }
 
 /**
- * i40e_vc_process_vf_msg
- * @pf: pointer to the PF structure
- * @vf_id: source VF id
+ * i40e_vc_handle_vf_msg
+ * @vf: pointer to the VF info
  * @v_opcode: operation code
- * @v_retval: unused return value code
  * @msg: pointer to the msg buffer
  * @msglen: msg length
  *
- * called from the common aeq/arq handler to
- * process request from VF
+ * called from the VF's message worker to
+ * validate and process request from VF
  **/
-int i40e_vc_process_vf_msg(struct i40e_pf *pf, s16 vf_id, u32 v_opcode,
-			   u32 __always_unused v_retval, u8 *msg, u16 msglen)
+static int i40e_vc_handle_vf_msg(struct i40e_vf *vf, u32 v_opcode, u8 *msg,
+				 u16 msglen)
 {
-	struct i40e_hw *hw = &pf->hw;
-	int local_vf_id = vf_id - (s16)hw->func_caps.vf_base_id;
-	struct i40e_vf *vf;
+	struct i40e_pf *pf = vf->pf;
+	int local_vf_id = vf->vf_id;
 	int ret;
 
-	pf->vf_aq_requests++;
-	if (local_vf_id < 0 || local_vf_id >= pf->num_alloc_vfs)
-		return -EINVAL;
-	vf = &(pf->vf[local_vf_id]);
-
-	/* Check if VF is disabled. */
-	if (test_bit(I40E_VF_STATE_DISABLED, &vf->vf_states))
-		return I40E_ERR_PARAM;
-
 	/* perform basic checks on the msg */
 	ret = virtchnl_vc_validate_vf_msg(&vf->vf_ver, v_opcode, msg, msglen);
 
@@ -5859,6 +6999,15 @@ int i40e_vc_process_vf_msg(struct i40e_pf *pf, s16 vf_id, u32 v_opcode,
 	case VIRTCHNL_OP_SET_RSS_HENA:
 		ret = i40e_vc_set_rss_hena(vf, msg);
 		break;
+	case VIRTCHNL_OP_CONFIG_RSS_HFUNC:
+		ret = i40e_vc_config_rss_hfunc(vf, msg);
+		break;
+	case VIRTCHNL_OP_ADD_RSS_CFG:
+		ret = i40e_vc_rss_cfg_msg(vf, msg, true);
+		break;
+	case VIRTCHNL_OP_DEL_RSS_CFG:
+		ret = i40e_vc_rss_cfg_msg(vf, msg, false);
+		break;
 	case VIRTCHNL_OP_ENABLE_VLAN_STRIPPING:
 		ret = i40e_vc_enable_vlan_stripping(vf, msg);
 		break;
@@ -5882,6 +7031,12 @@ int i40e_vc_process_vf_msg(struct i40e_pf *pf, s16 vf_id, u32 v_opcode,
 		ret = i40e_vc_del_cloud_filter(vf, msg);
 		break;
 #endif /* __TC_MQPRIO_MODE_MAX */
+	case VIRTCHNL_OP_ADD_FDIR_FILTER:
+		ret = i40e_vc_add_fdir_filter_msg(vf, msg);
+		break;
+	case VIRTCHNL_OP_DEL_FDIR_FILTER:
+		ret = i40e_vc_del_fdir_filter_msg(vf, msg);
+		break;
 	case VIRTCHNL_OP_GET_OFFLOAD_VLAN_V2_CAPS:
 		ret = i40e_vc_get_offload_vlan_v2(vf);
 		break;
@@ -5916,7 +7071,177 @@ int i40e_vc_process_vf_msg(struct i40e_pf *pf, s16 vf_id, u32 v_opcode,
 		break;
 	}
 
-	return ret;
+	return ret;
+}
+
+/**
+ * i40e_vc_msg_vsi_local - check if a VF message only touches the VF's VSI
+ * @v_opcode: operation code
+ *
+ * Filter, promiscuous, RSS, VLAN offload and statistics requests only
+ * program the VSI owned by the VF, so they are handled concurrently with
+ * those of other VFs. Flow Director requests share the PF's sideband table
+ * but serialize on fdir_mutex. Everything else, queue and vector setup
+ * included, may touch resources shared across VFs and runs alone.
+ **/
+static bool i40e_vc_msg_vsi_local(u32 v_opcode)
+{
+	switch (v_opcode) {
+	case VIRTCHNL_OP_ADD_ETH_ADDR:
+	case VIRTCHNL_OP_DEL_ETH_ADDR:
+	case VIRTCHNL_OP_ADD_VLAN:
+	case VIRTCHNL_OP_DEL_VLAN:
+	case VIRTCHNL_OP_ADD_VLAN_V2:
+	case VIRTCHNL_OP_DEL_VLAN_V2:
+	case VIRTCHNL_OP_CONFIG_PROMISCUOUS_MODE:
+	case VIRTCHNL_OP_GET_STATS:
+	case VIRTCHNL_OP_CONFIG_RSS_KEY:
+	case VIRTCHNL_OP_CONFIG_RSS_LUT:
+	case VIRTCHNL_OP_GET_RSS_HENA_CAPS:
+	case VIRTCHNL_OP_SET_RSS_HENA:
+	case VIRTCHNL_OP_CONFIG_RSS_HFUNC:
+	case VIRTCHNL_OP_ADD_RSS_CFG:
+	case VIRTCHNL_OP_DEL_RSS_CFG:
+	case VIRTCHNL_OP_ENABLE_VLAN_STRIPPING:
+	case VIRTCHNL_OP_DISABLE_VLAN_STRIPPING:
+	case VIRTCHNL_OP_ENABLE_VLAN_STRIPPING_V2:
+	case VIRTCHNL_OP_DISABLE_VLAN_STRIPPING_V2:
+	case VIRTCHNL_OP_ENABLE_VLAN_INSERTION_V2:
+	case VIRTCHNL_OP_DISABLE_VLAN_INSERTION_V2:
+	case VIRTCHNL_OP_ADD_FDIR_FILTER:
+	case VIRTCHNL_OP_DEL_FDIR_FILTER:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * i40e_vc_msg_task - handle the virtchnl messages queued by one VF
+ * @work: pointer to vc_msg_work in the VF structure
+ *
+ * Handles at most I40E_VC_MSG_BUDGET messages in arrival order and then
+ * requeues itself behind the other VFs' workers, so that a VF flooding the
+ * mailbox cannot delay the others by more than one budget.
+ **/
+static void i40e_vc_msg_task(struct work_struct *work)
+{
+	struct i40e_vf *vf = container_of(work, struct i40e_vf, vc_msg_work);
+	int budget = I40E_VC_MSG_BUDGET;
+	struct i40e_pf *pf = vf->pf;
+	struct i40e_vc_msg *m;
+	bool vsi_local;
+	u64 ns;
+
+	/* keep PF resets out while the VF's VSI is being configured */
+	down_read(&pf->service_rwsem);
+	while (budget) {
+		spin_lock(&vf->vc_msg_lock);
+		m = list_first_entry_or_null(&vf->vc_msg_list,
+					     struct i40e_vc_msg, list);
+		if (m) {
+			list_del(&m->list);
+			vf->vc_msg_depth--;
+			if (test_bit(I40E_VF_STATE_DISABLED, &vf->vf_states)) {
+				vf->vc_msg_dropped++;
+				spin_unlock(&vf->vc_msg_lock);
+				kfree(m);
+				continue;
+			}
+		}
+		spin_unlock(&vf->vc_msg_lock);
+		if (!m)
+			break;
+
+		vsi_local = i40e_vc_msg_vsi_local(m->opcode);
+		if (vsi_local)
+			down_read(&pf->vc_rwsem);
+		else
+			down_write(&pf->vc_rwsem);
+		i40e_vc_handle_vf_msg(vf, m->opcode, m->msg, m->msglen);
+		if (vsi_local)
+			up_read(&pf->vc_rwsem);
+		else
+			up_write(&pf->vc_rwsem);
+
+		ns = ktime_get_ns() - m->rx_ns;
+		vf->vc_msg_count++;
+		vf->vc_msg_lat_sum_ns += ns;
+		if (ns > vf->vc_msg_lat_max_ns)
+			vf->vc_msg_lat_max_ns = ns;
+		kfree(m);
+		budget--;
+	}
+	up_read(&pf->service_rwsem);
+
+	/* budget used up, let the other VFs have a turn */
+	if (!budget)
+		queue_work(pf->vc_wq, &vf->vc_msg_work);
+}
+
+/**
+ * i40e_vc_process_vf_msg
+ * @pf: pointer to the PF structure
+ * @vf_id: source VF id
+ * @v_opcode: operation code
+ * @v_retval: unused return value code
+ * @msg: pointer to the msg buffer
+ * @msglen: msg length
+ *
+ * called from the common aeq/arq handler to queue
+ * request from VF for the VF's message worker
+ **/
+int i40e_vc_process_vf_msg(struct i40e_pf *pf, s16 vf_id, u32 v_opcode,
+			   u32 __always_unused v_retval, u8 *msg, u16 msglen)
+{
+	struct i40e_hw *hw = &pf->hw;
+	int local_vf_id = vf_id - (s16)hw->func_caps.vf_base_id;
+	struct i40e_vc_msg *m;
+	struct i40e_vf *vf;
+
+	pf->vf_aq_requests++;
+	if (local_vf_id < 0 || local_vf_id >= pf->num_alloc_vfs)
+		return -EINVAL;
+	vf = &(pf->vf[local_vf_id]);
+
+	/* Check if VF is disabled. */
+	if (test_bit(I40E_VF_STATE_DISABLED, &vf->vf_states))
+		return I40E_ERR_PARAM;
+
+	/* the workers are going away with the VFs */
+	if (test_bit(__I40E_VFS_RELEASING, pf->state))
+		return -EBUSY;
+
+	/* the ARQ buffer is reused for the next event, keep a copy */
+	m = kmalloc(sizeof(*m) + msglen, GFP_KERNEL);
+	if (!m) {
+		i40e_vc_send_resp_to_vf(vf, v_opcode, I40E_ERR_NO_MEMORY);
+		return -ENOMEM;
+	}
+	m->rx_ns = ktime_get_ns();
+	m->opcode = v_opcode;
+	m->msglen = msglen;
+	if (msglen)
+		memcpy(m->msg, msg, msglen);
+
+	spin_lock(&vf->vc_msg_lock);
+	if (vf->vc_msg_depth >= I40E_VC_MSG_QLEN_MAX) {
+		vf->vc_msg_dropped++;
+		spin_unlock(&vf->vc_msg_lock);
+		kfree(m);
+		/* fail the request now instead of leaving the VF to time out */
+		i40e_vc_send_resp_to_vf(vf, v_opcode,
+					I40E_ERR_ADMIN_QUEUE_FULL);
+		return -EBUSY;
+	}
+	list_add_tail(&m->list, &vf->vc_msg_list);
+	if (++vf->vc_msg_depth > vf->vc_msg_depth_max)
+		vf->vc_msg_depth_max = vf->vc_msg_depth;
+	spin_unlock(&vf->vc_msg_lock);
+
+	queue_work(pf->vc_wq, &vf->vc_msg_work);
+
+	return 0;
 }
 
 /**
@@ -5947,6 +7272,8 @@ int i40e_vc_process_vflr_event(struct i40e_pf *pf)
 	i40e_flush(hw);
 
 	clear_bit(__I40E_VFLR_EVENT_PENDING, pf->state);
+	/* keep the VF message workers out while VFs are reset */
+	down_write(&pf->vc_rwsem);
 	for (vf_id = 0; vf_id < pf->num_alloc_vfs; vf_id++) {
 		reg_idx = (hw->func_caps.vf_base_id + vf_id) / 32;
 		bit_idx = (hw->func_caps.vf_base_id + vf_id) % 32;
@@ -5957,6 +7284,7 @@ int i40e_vc_process_vflr_event(struct i40e_pf *pf)
 			/* i40e_reset_vf will clear the bit in GLGEN_VFLRSTAT */
 			i40e_reset_vf(vf, true);
 	}
+	up_write(&pf->vc_rwsem);
 
 	return 0;
 }
@@ -6008,11 +7336,12 @@ static int i40e_set_vf_mac(struct i40e_vf *vf, struct i40e_vsi *vsi,
 			break;
 		msleep(20);
 	}
+	down_write(&pf->vc_rwsem);
 	if (!test_bit(I40E_VF_STATE_INIT, &vf->vf_states)) {
 		dev_err(&pf->pdev->dev, "VF %d still in reset. Try again.\n",
 			vf->vf_id);
 		ret = -EAGAIN;
-		goto error_param;
+		goto error_unlock;
 	}
 	vsi = pf->vsi[vf->lan_vsi_idx];
 
@@ -6039,7 +7368,7 @@ static int i40e_set_vf_mac(struct i40e_vf *vf, struct i40e_vsi *vsi,
 	if (i40e_sync_vsi_filters(vsi)) {
 		dev_err(&pf->pdev->dev, "Unable to program ucast filters\n");
 		ret = -EIO;
-		goto error_param;
+		goto error_unlock;
 	}
 
 	ether_addr_copy(vf->default_lan_addr.addr, mac);
@@ -6060,6 +7389,8 @@ static int i40e_set_vf_mac(struct i40e_vf *vf, struct i40e_vsi *vsi,
 	 */
 	i40e_vc_reset_vf(vf, true);
 	dev_info(&pf->pdev->dev, "Bring down and up the VF interface to make this change effective.\n");
+error_unlock:
+	up_write(&pf->vc_rwsem);
 error_param:
 	clear_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state);
 	return ret;
@@ -6125,6 +7456,8 @@ int i40e_ndo_set_vf_port_vlan(struct net_device *netdev,
 		return -EAGAIN;
 	}
 
+	down_write(&pf->vc_rwsem);
+
 	/* validate the request */
 	ret = i40e_validate_vf(pf, vf_id);
 	if (ret)
@@ -6308,10 +7641,114 @@ int i40e_ndo_set_vf_port_vlan(struct net_device *netdev,
 	i40e_service_event_schedule(vsi->back);
 
 error_pvid:
+	up_write(&pf->vc_rwsem);
 	clear_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state);
 	return ret;
 }
 
+/**
+ * i40e_vf_check_min_tx_rate
+ * @vf: pointer to the VF info
+ * @vsi: the VF LAN VSI
+ * @min_tx_rate: minimum Tx rate in Mbps, 0 to drop it
+ * @max_tx_rate: the maximum Tx rate the VF will have, 0 for none
+ * @share: on success, the ETS share in percent of the link
+ *
+ * Returns 0 if @min_tx_rate can be programmed, negative otherwise
+ **/
+static int i40e_vf_check_min_tx_rate(struct i40e_vf *vf, struct i40e_vsi *vsi,
+				     unsigned int min_tx_rate,
+				     unsigned int max_tx_rate, int *share)
+{
+	struct i40e_pf *pf = vf->pf;
+	int speed, i, total = 0;
+
+	*share = 0;
+	if (vf->tc_bw_share_req) {
+		dev_err(&pf->pdev->dev,
+			"VF %d has per TC shares, cannot set a minimum Tx rate\n",
+			vf->vf_id);
+		return -EPERM;
+	}
+
+	if (min_tx_rate) {
+		speed = i40e_get_link_speed(vsi);
+		if (speed < 0 || min_tx_rate > speed) {
+			dev_err(&pf->pdev->dev,
+				"Invalid min tx rate %u specified for VF %d\n",
+				min_tx_rate, vf->vf_id);
+			return -EINVAL;
+		}
+		if (max_tx_rate && min_tx_rate > max_tx_rate) {
+			dev_err(&pf->pdev->dev,
+				"Min tx rate %u for VF %d is above its max tx rate %u\n",
+				min_tx_rate, vf->vf_id, max_tx_rate);
+			return -EINVAL;
+		}
+		/* round up so the share covers the whole minimum */
+		*share = DIV_ROUND_UP(min_tx_rate * 100, speed);
+	}
+
+	for (i = 0; i < pf->num_alloc_vfs; i++)
+		if (i != vf->vf_id && pf->vf[i].bw_share_applied)
+			total += pf->vf[i].bw_share;
+	if (total + *share > 100) {
+		dev_err(&pf->pdev->dev,
+			"Min tx rate %u for VF %d needs a %d%% share of the link, %d%% is already given to other VFs\n",
+			min_tx_rate, vf->vf_id, *share, total);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * i40e_vf_set_min_tx_rate
+ * @vf: pointer to the VF info
+ * @vsi: the VF LAN VSI
+ * @min_tx_rate: minimum Tx rate in Mbps, 0 to drop it
+ *
+ * The minimum is programmed as a weighted ETS share of the VF VSI among its
+ * siblings under the VEB, in percent of the link the same way the VF-d
+ * bw_share is. It only weighs the VF against the others when the link is
+ * congested, it is not a hard guarantee. The shares of all VFs are kept at
+ * or below 100%.
+ *
+ * Returns 0 on success, negative on failure
+ **/
+static int i40e_vf_set_min_tx_rate(struct i40e_vf *vf, struct i40e_vsi *vsi,
+				   unsigned int min_tx_rate)
+{
+	struct i40e_aqc_configure_vsi_tc_bw_data bw_data = {0};
+	struct i40e_pf *pf = vf->pf;
+	int i, share, err;
+	i40e_status ret;
+
+	err = i40e_vf_check_min_tx_rate(vf, vsi, min_tx_rate, vf->tx_rate,
+					&share);
+	if (err)
+		return err;
+
+	/* without a guarantee the VSI goes back to the default single credit */
+	bw_data.tc_valid_bits = 1;
+	bw_data.tc_bw_credits[0] = share ? share : 1;
+	ret = i40e_aq_config_vsi_tc_bw(&pf->hw, vsi->seid, &bw_data, NULL);
+	if (ret) {
+		dev_info(&pf->pdev->dev,
+			 "AQ command Config VSI BW allocation per TC failed = %d\n",
+			 pf->hw.aq.asq_last_status);
+		return -EIO;
+	}
+
+	for (i = 0; i < I40E_MAX_TRAFFIC_CLASS; i++)
+		vsi->info.qs_handle[i] = bw_data.qs_handles[i];
+
+	vf->min_tx_rate = min_tx_rate;
+	vf->bw_share = share;
+	vf->bw_share_applied = !!share;
+	return 0;
+}
+
 /**
  * i40e_ndo_set_vf_bw
  * @netdev: network interface device structure
@@ -6330,9 +7767,10 @@ int i40e_ndo_set_vf_bw(struct net_device *netdev, int vf_id, int max_tx_rate)
 {
 	struct i40e_netdev_priv *np = netdev_priv(netdev);
 	struct i40e_pf *pf = np->vsi->back;
+	unsigned int min_rate;
 	struct i40e_vsi *vsi;
 	struct i40e_vf *vf;
-	int ret = 0;
+	int ret = 0, share;
 
 	if (test_and_set_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state)) {
 		dev_warn(&pf->pdev->dev, "Unable to configure VFs, other operation is pending.\n");
@@ -6353,11 +7791,31 @@ int i40e_ndo_set_vf_bw(struct net_device *netdev, int vf_id, int max_tx_rate)
 		goto error;
 	}
 
+#ifdef HAVE_NDO_SET_VF_MIN_MAX_TX_RATE
+	min_rate = min_tx_rate;
+#else
+	min_rate = vf->min_tx_rate;
+#endif
+	/* check both rates before programming either of them */
+	if (min_rate != vf->min_tx_rate) {
+		ret = i40e_vf_check_min_tx_rate(vf, vsi, min_rate, max_tx_rate,
+						&share);
+	} else if (max_tx_rate && min_rate > max_tx_rate) {
+		dev_err(&pf->pdev->dev,
+			"Max tx rate %d for VF %d is below its min tx rate %u\n",
+			max_tx_rate, vf_id, min_rate);
+		ret = -EINVAL;
+	}
+	if (ret)
+		goto error;
+
 	ret = i40e_set_bw_limit(vsi, vsi->seid, max_tx_rate);
 	if (ret)
 		goto error;
 
 	vf->tx_rate = max_tx_rate;
+	if (min_rate != vf->min_tx_rate)
+		ret = i40e_vf_set_min_tx_rate(vf, vsi, min_rate);
 error:
 	clear_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state);
 	return ret;
@@ -6417,7 +7875,7 @@ int i40e_ndo_get_vf_config(struct net_device *netdev,
 
 #ifdef HAVE_NDO_SET_VF_MIN_MAX_TX_RATE
 	ivi->max_tx_rate = vf->tx_rate;
-	ivi->min_tx_rate = 0;
+	ivi->min_tx_rate = vf->min_tx_rate;
 #else
 	ivi->tx_rate = vf->tx_rate;
 #endif
@@ -6480,6 +7938,8 @@ int i40e_ndo_set_vf_link_state(struct net_device *netdev, int vf_id, int link)
 		return -EAGAIN;
 	}
 
+	down_write(&pf->vc_rwsem);
+
 	/* validate the request */
 	if (vf_id >= pf->num_alloc_vfs) {
 		dev_err(&pf->pdev->dev, "Invalid VF Identifier %d\n", vf_id);
@@ -6539,6 +7999,7 @@ int i40e_ndo_set_vf_link_state(struct net_device *netdev, int vf_id, int link)
 			       I40E_SUCCESS, (u8 *)&pfe, sizeof(pfe), NULL);
 
 error_out:
+	up_write(&pf->vc_rwsem);
 	clear_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state);
 	return ret;
 }
@@ -6630,6 +8091,8 @@ int i40e_ndo_set_vf_trust(struct net_device *netdev, int vf_id, bool setting)
 		return -EAGAIN;
 	}
 
+	down_write(&pf->vc_rwsem);
+
 	/* validate the request */
 	if (vf_id >= pf->num_alloc_vfs) {
 		dev_err(&pf->pdev->dev, "Invalid VF Identifier %d\n", vf_id);
@@ -6668,6 +8131,7 @@ int i40e_ndo_set_vf_trust(struct net_device *netdev, int vf_id, bool setting)
 #endif /* __TC_MQPRIO_MODE_MAX */
 
 out:
+	up_write(&pf->vc_rwsem);
 	clear_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state);
 	return ret;
 }
@@ -6685,7 +8149,7 @@ int i40e_get_vf_stats(struct net_device *netdev, int vf_id,
 {
 	struct i40e_netdev_priv *np = netdev_priv(netdev);
 	struct i40e_pf *pf = np->vsi->back;
-	struct i40e_eth_stats *stats;
+	struct i40e_eth_stats stats;
 	struct i40e_vsi *vsi;
 	struct i40e_vf *vf;
 
@@ -6704,22 +8168,22 @@ int i40e_get_vf_stats(struct net_device *netdev, int vf_id,
 	if (!vsi)
 		return -EINVAL;
 
-	i40e_update_eth_stats(vsi);
-	stats = &vsi->eth_stats;
+	if (i40e_vf_stats_snapshot(pf, vf_id, &stats))
+		return -EINVAL;
 
 	memset(vf_stats, 0, sizeof(*vf_stats));
 
-	vf_stats->rx_packets = stats->rx_unicast + stats->rx_broadcast +
-		stats->rx_multicast;
-	vf_stats->tx_packets = stats->tx_unicast + stats->tx_broadcast +
-		stats->tx_multicast;
-	vf_stats->rx_bytes   = stats->rx_bytes;
-	vf_stats->tx_bytes   = stats->tx_bytes;
-	vf_stats->broadcast  = stats->rx_broadcast;
-	vf_stats->multicast  = stats->rx_multicast;
+	vf_stats->rx_packets = stats.rx_unicast + stats.rx_broadcast +
+		stats.rx_multicast;
+	vf_stats->tx_packets = stats.tx_unicast + stats.tx_broadcast +
+		stats.tx_multicast;
+	vf_stats->rx_bytes   = stats.rx_bytes;
+	vf_stats->tx_bytes   = stats.tx_bytes;
+	vf_stats->broadcast  = stats.rx_broadcast;
+	vf_stats->multicast  = stats.rx_multicast;
 #ifdef HAVE_VF_STATS_DROPPED
-	vf_stats->rx_dropped = stats->rx_discards;
-	vf_stats->tx_dropped = stats->tx_discards;
+	vf_stats->rx_dropped = stats.rx_discards;
+	vf_stats->tx_dropped = stats.tx_discards;
 #endif
 
 	return 0;
@@ -6851,7 +8315,9 @@ int i40e_enable_vf_queues(struct i40e_vsi *vsi, bool enable)
 
 	if (enable) {
 		i40e_vc_notify_vf_reset(vf);
+		down_write(&pf->vc_rwsem);
 		i40e_reset_vf(vf, false);
+		up_write(&pf->vc_rwsem);
 		ret = i40e_set_link_state(pf->pdev, vf_id, VF_LINKSTATE_AUTO);
 	}
 err_out:
@@ -7085,6 +8551,8 @@ static int i40e_set_trunk(struct pci_dev *pdev, int vf_id,
 		return -EAGAIN;
 	}
 
+	down_write(&pf->vc_rwsem);
+
 	/* validate the request */
 	ret = i40e_validate_vf(pf, vf_id);
 	if (ret)
@@ -7146,6 +8614,7 @@ static int i40e_set_trunk(struct pci_dev *pdev, int vf_id,
 	if (vid && i40e_is_double_vlan(&pf->hw))
 		i40e_vc_reset_vf(vf, true);
 out:
+	up_write(&pf->vc_rwsem);
 	clear_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state);
 	return ret;
 }
@@ -7582,6 +9051,8 @@ static int i40e_store_vf_bw_share(struct pci_dev *pdev, int vf_id, u8 bw_share)
 		return -EPERM;
 
 	vf->bw_share = bw_share;
+	/* an explicit share replaces the one derived from min_tx_rate */
+	vf->min_tx_rate = 0;
 
 	/* this tracking bool is set to true when 'apply' attribute is used */
 	vf->bw_share_applied = false;
@@ -7682,6 +9153,7 @@ static int i40e_set_vf_enable(struct pci_dev *pdev, int vf_id,
 		goto err_out;
 	vf = &pf->vf[vf_id];
 
+	down_write(&pf->vc_rwsem);
 	/* allow the VF to get enabled */
 	if (enable) {
 		vf->is_disabled_from_host = false;
@@ -7695,7 +9167,7 @@ static int i40e_set_vf_enable(struct pci_dev *pdev, int vf_id,
 		/* force link down to prevent tx hangs */
 		ret = i40e_set_link_state(pdev, vf_id, VF_LINKSTATE_OFF);
 		if (ret)
-			goto err_out;
+			goto err_unlock;
 		vf->is_disabled_from_host = true;
 
 		/* Try to stop both Tx&Rx rings even if one of the calls fails
@@ -7709,6 +9181,8 @@ static int i40e_set_vf_enable(struct pci_dev *pdev, int vf_id,
 		ret = tmp ? tmp : ret;
 	}
 
+err_unlock:
+	up_write(&pf->vc_rwsem);
 err_out:
 	return ret;
 }
@@ -7743,18 +9217,17 @@ static int i40e_get_rx_bytes(struct pci_dev *pdev, int vf_id,
 			     u64 *rx_bytes)
 {
 	struct i40e_pf *pf = pci_get_drvdata(pdev);
-	struct i40e_vsi *vsi;
-	struct i40e_vf *vf;
+	struct i40e_eth_stats stats;
 	int ret;
 
 	/* validate the request */
 	ret = i40e_validate_vf(pf, vf_id);
 	if (ret)
 		goto err_out;
-	vf = &pf->vf[vf_id];
-	vsi = pf->vsi[vf->lan_vsi_idx];
-	i40e_update_eth_stats(vsi);
-	*rx_bytes = vsi->eth_stats.rx_bytes;
+	ret = i40e_vf_stats_snapshot(pf, vf_id, &stats);
+	if (ret)
+		goto err_out;
+	*rx_bytes = stats.rx_bytes;
 err_out:
 	return ret;
 }
@@ -7773,18 +9246,17 @@ static int i40e_get_rx_dropped(struct pci_dev *pdev, int vf_id,
 			       u64 *rx_dropped)
 {
 	struct i40e_pf *pf = pci_get_drvdata(pdev);
-	struct i40e_vsi *vsi;
-	struct i40e_vf *vf;
+	struct i40e_eth_stats stats;
 	int ret;
 
 	/* validate the request */
 	ret = i40e_validate_vf(pf, vf_id);
 	if (ret)
 		goto err_out;
-	vf = &pf->vf[vf_id];
-	vsi = pf->vsi[vf->lan_vsi_idx];
-	i40e_update_eth_stats(vsi);
-	*rx_dropped = vsi->eth_stats.rx_discards;
+	ret = i40e_vf_stats_snapshot(pf, vf_id, &stats);
+	if (ret)
+		goto err_out;
+	*rx_dropped = stats.rx_discards;
 err_out:
 	return ret;
 }
@@ -7803,19 +9275,18 @@ static int i40e_get_rx_packets(struct pci_dev *pdev, int vf_id,
 			       u64 *rx_packets)
 {
 	struct i40e_pf *pf = pci_get_drvdata(pdev);
-	struct i40e_vsi *vsi;
-	struct i40e_vf *vf;
+	struct i40e_eth_stats stats;
 	int ret;
 
 	/* validate the request */
 	ret = i40e_validate_vf(pf, vf_id);
 	if (ret)
 		goto err_out;
-	vf = &pf->vf[vf_id];
-	vsi = pf->vsi[vf->lan_vsi_idx];
-	i40e_update_eth_stats(vsi);
-	*rx_packets = vsi->eth_stats.rx_unicast + vsi->eth_stats.rx_multicast +
-		      vsi->eth_stats.rx_broadcast;
+	ret = i40e_vf_stats_snapshot(pf, vf_id, &stats);
+	if (ret)
+		goto err_out;
+	*rx_packets = stats.rx_unicast + stats.rx_multicast +
+		      stats.rx_broadcast;
 err_out:
 	return ret;
 }
@@ -7834,18 +9305,17 @@ static int i40e_get_tx_bytes(struct pci_dev *pdev, int vf_id,
 			     u64 *tx_bytes)
 {
 	struct i40e_pf *pf = pci_get_drvdata(pdev);
-	struct i40e_vsi *vsi;
-	struct i40e_vf *vf;
+	struct i40e_eth_stats stats;
 	int ret;
 
 	/* validate the request */
 	ret = i40e_validate_vf(pf, vf_id);
 	if (ret)
 		goto err_out;
-	vf = &pf->vf[vf_id];
-	vsi = pf->vsi[vf->lan_vsi_idx];
-	i40e_update_eth_stats(vsi);
-	*tx_bytes = vsi->eth_stats.tx_bytes;
+	ret = i40e_vf_stats_snapshot(pf, vf_id, &stats);
+	if (ret)
+		goto err_out;
+	*tx_bytes = stats.tx_bytes;
 err_out:
 	return ret;
 }
@@ -7864,18 +9334,17 @@ static int i40e_get_tx_dropped(struct pci_dev *pdev, int vf_id,
 			       u64 *tx_dropped)
 {
 	struct i40e_pf *pf = pci_get_drvdata(pdev);
-	struct i40e_vsi *vsi;
-	struct i40e_vf *vf;
+	struct i40e_eth_stats stats;
 	int ret;
 
 	/* validate the request */
 	ret = i40e_validate_vf(pf, vf_id);
 	if (ret)
 		goto err_out;
-	vf = &pf->vf[vf_id];
-	vsi = pf->vsi[vf->lan_vsi_idx];
-	i40e_update_eth_stats(vsi);
-	*tx_dropped = vsi->eth_stats.tx_discards;
+	ret = i40e_vf_stats_snapshot(pf, vf_id, &stats);
+	if (ret)
+		goto err_out;
+	*tx_dropped = stats.tx_discards;
 err_out:
 	return ret;
 }
@@ -7894,19 +9363,18 @@ static int i40e_get_tx_packets(struct pci_dev *pdev, int vf_id,
 			       u64 *tx_packets)
 {
 	struct i40e_pf *pf = pci_get_drvdata(pdev);
-	struct i40e_vsi *vsi;
-	struct i40e_vf *vf;
+	struct i40e_eth_stats stats;
 	int ret;
 
 	/* validate the request */
 	ret = i40e_validate_vf(pf, vf_id);
 	if (ret)
 		goto err_out;
-	vf = &pf->vf[vf_id];
-	vsi = pf->vsi[vf->lan_vsi_idx];
-	i40e_update_eth_stats(vsi);
-	*tx_packets = vsi->eth_stats.tx_unicast + vsi->eth_stats.tx_multicast +
-		      vsi->eth_stats.tx_broadcast;
+	ret = i40e_vf_stats_snapshot(pf, vf_id, &stats);
+	if (ret)
+		goto err_out;
+	*tx_packets = stats.tx_unicast + stats.tx_multicast +
+		      stats.tx_broadcast;
 err_out:
 	return ret;
 }
@@ -7925,18 +9393,17 @@ static int i40e_get_tx_errors(struct pci_dev *pdev, int vf_id,
 			      u64 *tx_errors)
 {
 	struct i40e_pf *pf = pci_get_drvdata(pdev);
-	struct i40e_vsi *vsi;
-	struct i40e_vf *vf;
+	struct i40e_eth_stats stats;
 	int ret;
 
 	/* validate the request */
 	ret = i40e_validate_vf(pf, vf_id);
 	if (ret)
 		goto err_out;
-	vf = &pf->vf[vf_id];
-	vsi = pf->vsi[vf->lan_vsi_idx];
-	i40e_update_eth_stats(vsi);
-	*tx_errors = vsi->eth_stats.tx_errors;
+	ret = i40e_vf_stats_snapshot(pf, vf_id, &stats);
+	if (ret)
+		goto err_out;
+	*tx_errors = stats.tx_errors;
 err_out:
 	return ret;
 }
@@ -8816,8 +10283,11 @@ static int i40e_set_pf_tpid(struct pci_dev *pdev, u16 tp_id)
 	/* in case PF is configured to double VLAN mode, then VFs need to be
 	 * reset in order to renegotiate TPID for VFs
 	 */
-	if (i40e_is_double_vlan(&pf->hw))
+	if (i40e_is_double_vlan(&pf->hw)) {
+		down_write(&pf->vc_rwsem);
 		i40e_reset_all_vfs(pf, false);
+		up_write(&pf->vc_rwsem);
+	}
 
 	return ret;
 }
@@ -8858,7 +10328,11 @@ static int i40e_set_num_queues(struct pci_dev *pdev, int vf_id, int num_queues)
 		return -EAGAIN;
 	}
 
-	return i40e_set_vf_num_queues(vf, num_queues);
+	down_write(&pf->vc_rwsem);
+	ret = i40e_set_vf_num_queues(vf, num_queues);
+	up_write(&pf->vc_rwsem);
+
+	return ret;
 }
 
 /**
@@ -8946,6 +10420,14 @@ static int i40e_set_max_tx_rate(struct pci_dev *pdev, int vf_id,
 		goto error;
 	}
 
+	if (*max_tx_rate && *max_tx_rate < vf->min_tx_rate) {
+		dev_err(&pf->pdev->dev,
+			"Max tx rate %u for VF %d is below its min tx rate %u\n",
+			*max_tx_rate, vf_id, vf->min_tx_rate);
+		ret = -EINVAL;
+		goto error;
+	}
+
 	ret = i40e_set_bw_limit(vsi, vsi->seid, *max_tx_rate);
 	if (ret)
 		goto error;
@@ -8956,6 +10438,168 @@ error:
 	return ret;
 }
 
+/**
+ * i40e_get_min_tx_rate
+ * @kobj: the sriov/<vf_id> kobject of a VF
+ * @attr: struct kobj_attribute
+ * @buff: buffer for data
+ *
+ * This function shows the minimum transmit bandwidth, in Mbps, of the
+ * specified VF, value 0 means none is set.
+ *
+ * Returns the length written on success, negative on failure
+ **/
+static int i40e_get_min_tx_rate(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buff)
+{
+	struct pci_dev *pdev;
+	struct i40e_pf *pf;
+	int vf_id, ret;
+
+	ret = __get_pdev_and_vfid(kobj, &pdev, &vf_id);
+	if (ret)
+		return ret;
+
+	pf = pci_get_drvdata(pdev);
+	ret = i40e_validate_vf(pf, vf_id);
+	if (ret)
+		return ret;
+
+	return scnprintf(buff, PAGE_SIZE, "%u\n", pf->vf[vf_id].min_tx_rate);
+}
+
+/**
+ * i40e_set_min_tx_rate
+ * @kobj: the sriov/<vf_id> kobject of a VF
+ * @attr: struct kobj_attribute
+ * @buff: buffer with input data
+ * @count: size of buff
+ *
+ * This function sets the minimum transmit bandwidth, in Mbps, of the
+ * specified VF, value 0 drops it.
+ *
+ * Returns count on success, negative on failure
+ **/
+static int i40e_set_min_tx_rate(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buff, size_t count)
+{
+	unsigned int min_tx_rate;
+	struct pci_dev *pdev;
+	struct i40e_vsi *vsi;
+	struct i40e_vf *vf;
+	struct i40e_pf *pf;
+	int vf_id, ret;
+
+	ret = __get_pdev_and_vfid(kobj, &pdev, &vf_id);
+	if (ret)
+		return ret;
+
+	ret = kstrtouint(buff, 10, &min_tx_rate);
+	if (ret)
+		return ret;
+
+	pf = pci_get_drvdata(pdev);
+	if (test_and_set_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state)) {
+		dev_warn(&pf->pdev->dev,
+			 "Unable to configure VFs, other operation is pending.\n");
+		return -EAGAIN;
+	}
+
+	/* validate the request */
+	ret = i40e_validate_vf(pf, vf_id);
+	if (ret)
+		goto error;
+
+	vf = &pf->vf[vf_id];
+	vsi = pf->vsi[vf->lan_vsi_idx];
+	if (!test_bit(I40E_VF_STATE_INIT, &vf->vf_states)) {
+		dev_err(&pf->pdev->dev, "VF %d still in reset. Try again.\n",
+			vf_id);
+		ret = -EAGAIN;
+		goto error;
+	}
+
+	ret = i40e_vf_set_min_tx_rate(vf, vsi, min_tx_rate);
+error:
+	clear_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state);
+	return ret ? ret : count;
+}
+
+/**
+ * i40e_get_max_tx_burst
+ * @pdev: PCI device information struct
+ * @vf_id: VF identifier
+ * @burst: on success, log2 of the credits the max_tx_rate limit may burst
+ *
+ * Returns 0 on success, negative on failure
+ **/
+static int i40e_get_max_tx_burst(struct pci_dev *pdev, int vf_id, u8 *burst)
+{
+	struct i40e_pf *pf = pci_get_drvdata(pdev);
+	int ret;
+
+	ret = i40e_validate_vf(pf, vf_id);
+	if (ret)
+		return ret;
+
+	*burst = pf->vf[vf_id].tx_burst;
+	return 0;
+}
+
+/**
+ * i40e_set_max_tx_burst
+ * @pdev: PCI device information struct
+ * @vf_id: VF identifier
+ * @burst: log2 of the 50 Mbps credits the max_tx_rate limit may burst
+ *
+ * A VF idle under its max_tx_rate limit saves up to 2^burst credits and may
+ * then send above the limit until they are spent. 0 keeps the VF closest
+ * to the limit at all times.
+ *
+ * Returns 0 on success, negative on failure
+ **/
+static int i40e_set_max_tx_burst(struct pci_dev *pdev, int vf_id,
+				 const u8 burst)
+{
+	struct i40e_pf *pf = pci_get_drvdata(pdev);
+	struct i40e_vsi *vsi;
+	struct i40e_vf *vf;
+	int ret;
+
+	if (burst > I40E_MAX_BW_INACTIVE_ACCUM) {
+		dev_err(&pdev->dev, "Invalid max tx burst %u, value must be between 0 and %d\n",
+			burst, I40E_MAX_BW_INACTIVE_ACCUM);
+		return -EINVAL;
+	}
+
+	if (test_and_set_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state)) {
+		dev_warn(&pf->pdev->dev,
+			 "Unable to configure VFs, other operation is pending.\n");
+		return -EAGAIN;
+	}
+
+	/* validate the request */
+	ret = i40e_validate_vf(pf, vf_id);
+	if (ret)
+		goto error;
+
+	vf = &pf->vf[vf_id];
+	vf->tx_burst = burst;
+
+	/* a VF in reset picks the burst up when its VSI is set up again */
+	vsi = pf->vsi[vf->lan_vsi_idx];
+	if (!test_bit(I40E_VF_STATE_INIT, &vf->vf_states) || !vsi)
+		goto error;
+
+	vsi->bw_burst = burst;
+	if (vf->tx_rate)
+		ret = i40e_set_bw_limit(vsi, vsi->seid, vf->tx_rate);
+error:
+	clear_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state);
+	return ret;
+}
+
 /**
  * i40e_get_trust_state
  * @pdev: PCI device information struct
@@ -9003,6 +10647,8 @@ static int i40e_set_trust_state(struct pci_dev *pdev, int vf_id, bool enable)
 		return -EAGAIN;
 	}
 
+	down_write(&pf->vc_rwsem);
+
 	if (pf->flags & I40E_FLAG_MFP_ENABLED) {
 		dev_err(&pf->pdev->dev, "Trusted VF not supported in MFP mode.\n");
 		ret = -EINVAL;
@@ -9043,6 +10689,7 @@ static int i40e_set_trust_state(struct pci_dev *pdev, int vf_id, bool enable)
 #endif /* __TC_MQPRIO_MODE_MAX */
 
 out:
+	up_write(&pf->vc_rwsem);
 	clear_bit(__I40E_VIRTCHNL_OP_PENDING, pf->state);
 	return ret;
 }
@@ -9576,6 +11223,10 @@ const struct vfd_ops i40e_vfd_ops = {
 	.set_num_queues		= i40e_set_num_queues,
 	.get_max_tx_rate	= i40e_get_max_tx_rate,
 	.set_max_tx_rate	= i40e_set_max_tx_rate,
+	.get_min_tx_rate	= i40e_get_min_tx_rate,
+	.set_min_tx_rate	= i40e_set_min_tx_rate,
+	.get_max_tx_burst	= i40e_get_max_tx_burst,
+	.set_max_tx_burst	= i40e_set_max_tx_burst,
 	.get_trust_state	= i40e_get_trust_state,
 	.set_trust_state	= i40e_set_trust_state,
 	.get_queue_type		= i40e_get_queue_type,
@@ -22,6 +22,16 @@
 #define I40E_VFR_WAIT_COUNT		100
 #define I40E_VF_RESET_TIME_MIN		30000000	// time in nsec
 
+/* VPGEN_VFRSTAT is not valid until the HW has flushed the VF's FIFOs, after
+ * that it is polled at a finer interval until the VF reports reset done
+ */
+#define I40E_VFR_SETTLE_USECS		10000
+#define I40E_VFR_POLL_USECS		1000
+#define I40E_VFR_POLL_COUNT		90
+
+#define I40E_VC_MSG_QLEN_MAX		256	/* messages queued per VF */
+#define I40E_VC_MSG_BUDGET		8	/* messages handled per worker run */
+
 /* Various queue ctrls */
 enum i40e_queue_ctrl {
 	I40E_QUEUE_CTRL_UNKNOWN = 0,
@@ -45,6 +55,25 @@ enum i40e_vf_states {
 	I40E_VF_STATE_RESOURCES_LOADED,
 };
 
+/* VF reset phases timed for debugfs "dump vf_reset" */
+enum i40e_vfr_phase {
+	I40E_VFR_PHASE_TRIGGER = 0,	/* trigger the reset, quiesce PCI */
+	I40E_VFR_PHASE_HW_WAIT,		/* wait for VPGEN_VFRSTAT.VFRD */
+	I40E_VFR_PHASE_SETTLE,		/* fixed HW settle delays */
+	I40E_VFR_PHASE_RINGS,		/* stop the VF rings */
+	I40E_VFR_PHASE_REBUILD,		/* VSI teardown and setup */
+	I40E_VFR_PHASE_MAX,
+};
+
+struct i40e_vfr_stats {
+	spinlock_t lock;
+	u64 count;		/* resets timed */
+	u64 vfs;		/* VFs rebuilt by them */
+	u64 last_ns[I40E_VFR_PHASE_MAX];
+	u64 total_ns[I40E_VFR_PHASE_MAX];
+	u64 max_ns[I40E_VFR_PHASE_MAX];
+};
+
 /* VF capabilities */
 enum i40e_vf_capabilities {
 	I40E_VIRTCHNL_VF_CAP_PRIVILEGE = 0,
@@ -64,16 +93,16 @@ struct i40evf_channel {
 	u64 max_tx_rate; /* bandwidth rate allocation for VSIs */
 };
 
-/* used for VLAN list 'vm_vlan_list' by VM for trusted and untrusted VF */
+/* used for VLAN hash 'vm_vlan_hash' by VM for trusted and untrusted VF */
 struct i40e_vm_vlan {
-	struct list_head list;
+	struct hlist_node hlist;
 	s16 vlan;
 	u16 vsi_id;
 };
 
-/* used for MAC list 'vm_mac_list' to recognize MACs added by VM */
+/* used for MAC hash 'vm_mac_hash' to recognize MACs added by VM */
 struct i40e_vm_mac {
-	struct list_head list;
+	struct hlist_node hlist;
 	u8 macaddr[ETH_ALEN];
 };
 
@@ -90,6 +119,15 @@ struct i40e_time_mac {
 	u8 addr[ETH_ALEN];
 };
 
+/* virtchnl message copied off the ARQ, waiting for the VF's worker */
+struct i40e_vc_msg {
+	struct list_head list;
+	u64 rx_ns;		/* when the message was taken off the ARQ */
+	u32 opcode;
+	u16 msglen;
+	u8 msg[];
+};
+
 struct i40e_mdd_vf_events {
 	u64 count;	/* total count of Rx|Tx events */
 	/* count number of the last printed event */
@@ -134,6 +172,8 @@ struct i40e_vf {
 	unsigned long vf_caps;	/* vf's adv. capabilities */
 	unsigned long vf_states;	/* vf's runtime states */
 	unsigned int tx_rate;	/* Tx bandwidth limit in Mbps */
+	unsigned int min_tx_rate;	/* guaranteed Tx bandwidth in Mbps */
+	u8 tx_burst;		/* log2 of the credits tx_rate may burst */
 #ifdef HAVE_NDO_SET_VF_LINK_STATE
 	bool link_forced;
 	bool link_up;		/* only valid if VF link is forced */
@@ -162,18 +202,44 @@ struct i40e_vf {
 	u8 queue_type;
 	bool allow_bcast;
 	bool is_disabled_from_host; /* bool for PF ctrl of VF enable/disable */
-	/* VLAN list created by VM for trusted and untrusted VF */
-	struct list_head vm_vlan_list;
-	/* MAC list created by VM */
-	struct list_head vm_mac_list;
+	/* VLANs created by VM for trusted and untrusted VF, keyed by VLAN */
+	DECLARE_HASHTABLE(vm_vlan_hash, 6);
+	/* MACs created by VM, keyed by i40e_addr_to_hkey() */
+	DECLARE_HASHTABLE(vm_mac_hash, 6);
 	/* ADq related variables */
 	bool adq_enabled; /* flag to enable adq */
 	u8 num_tc;
 	struct i40evf_channel ch[I40E_MAX_VF_VSI];
 	struct hlist_head cloud_filter_list;
 	u16 num_cloud_filters;
+	u16 num_fdir_filters;	/* sideband rules added through virtchnl */
+	/* VSI stats as of pf->vf_stats_updated, under pf->vf_stats_lock */
+	struct i40e_eth_stats stats_snap;
+	/* hash function and last RSS key asked for by the VF, the key
+	 * is only programmed while the hash is asymmetric
+	 */
+	u8 rss_hfunc;		/* enum virtchnl_rss_algorithm */
+	bool rss_key_set;
+	u8 rss_key[(I40E_VFQF_HKEY1_MAX_INDEX + 1) * 4];
 	struct i40e_vf_tc_info tc_info;
 	struct virtchnl_vlan_caps vlan_v2_caps;
+
+	/* virtchnl messages waiting for vc_msg_work, list and depth are
+	 * protected by vc_msg_lock, the other counters are only updated by
+	 * the worker
+	 */
+	struct list_head vc_msg_list;
+	spinlock_t vc_msg_lock;
+	struct work_struct vc_msg_work;
+	u32 vc_msg_depth;
+	u32 vc_msg_depth_max;
+	u64 vc_msg_dropped;
+	u64 vc_msg_count;
+	u64 vc_msg_lat_sum_ns;	/* ARQ to handler done, over vc_msg_count */
+	u64 vc_msg_lat_max_ns;
+
+	/* rebuilds the VF in parallel with the others in i40e_reset_all_vfs */
+	struct work_struct reset_work;
 };
 
 void i40e_free_vfs(struct i40e_pf *pf);
@@ -187,6 +253,7 @@ int i40e_vc_process_vflr_event(struct i40e_pf *pf);
 void i40e_vc_reset_vf(struct i40e_vf *vf, bool notify_vf);
 bool i40e_reset_vf(struct i40e_vf *vf, bool flr);
 bool i40e_reset_all_vfs(struct i40e_pf *pf, bool flr);
+void i40e_vfr_stats_clear(struct i40e_pf *pf);
 void i40e_vc_notify_vf_reset(struct i40e_vf *vf);
 
 /* VF configuration related iplink handlers */
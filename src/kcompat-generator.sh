@@ -182,6 +182,8 @@ function gen-flow-dissector() {
 	tmh='include/net/tc_act/tc_mirred.h'
 	gen HAVE_FLOW_DISSECTOR_KEY_PPPOE if enum flow_dissector_key_id matches FLOW_DISSECTOR_KEY_PPPOE in "$fdh" "$fkh"
 	gen HAVE_FLOW_BLOCK_API if fun flow_block_cb_priv in "$foh"
+	gen HAVE_FLOW_STATS_UPDATE_DROPS if fun flow_stats_update matches 'u64 drops' in "$foh"
+	gen HAVE_FLOW_STATS_UPDATE_HW_STATS if fun flow_stats_update matches 'used_hw_stats' in "$foh"
 	# following HAVE ... CVLAN flag is mistakenly named after an enum key,
 	# but guards code around function call that was introduced later
 	gen HAVE_FLOW_DISSECTOR_KEY_CVLAN if fun flow_rule_match_cvlan in "$foh"
@@ -260,6 +262,7 @@ function gen-mm() {
 
 function gen-netdevice() {
 	ndh='include/linux/netdevice.h'
+	gen HAVE_NAPI_THREADED if fun dev_set_threaded in "$ndh"
 	gen HAVE_NDO_BRIDGE_SETLINK_EXTACK if method ndo_bridge_setlink of net_device_ops matches 'struct netlink_ext_ack \\*extack' in "$ndh"
 	gen HAVE_NDO_ETH_IOCTL if fun ndo_eth_ioctl in "$ndh"
 	gen HAVE_NDO_EXTENDED_SET_TX_MAXRATE if method ndo_set_tx_maxrate of net_device_ops_extended in "$ndh"
@@ -276,6 +279,8 @@ function gen-netdevice() {
 	gen HAVE_NETDEV_FCOE_MTU if struct net_device matches fcoe_mtu in "$ndh"
 	gen HAVE_NETDEV_IRQ_AFFINITY_AND_ARFS if struct net_device matches irq_affinity_auto in "$ndh"
 	gen HAVE_NETDEV_MIN_MAX_MTU if struct net_device matches min_mtu in "$ndh"
+	gen HAVE_NETIF_NAPI_SET_IRQ if fun netif_napi_set_irq in "$ndh"
+	gen HAVE_NETIF_QUEUE_SET_NAPI if fun netif_queue_set_napi in "$ndh"
 	gen HAVE_NETIF_SET_TSO_MAX if fun netif_set_tso_max_size in "$ndh"
 	gen HAVE_RHEL7_NETDEV_OPS_EXT_NDO_SETUP_TC if method ndo_setup_tc_rh of net_device_ops_extended in "$ndh"
 	gen HAVE_SET_NETDEV_DEVLINK_PORT if macro SET_NETDEV_DEVLINK_PORT in "$ndh"
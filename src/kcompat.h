@@ -1106,6 +1106,8 @@ __x < __y ? __x : __y;							\
 #include "kcompat_vfd.h"
 struct vfd_objects *create_vfd_sysfs(struct pci_dev *pdev, int num_alloc_vfs);
 void destroy_vfd_sysfs(struct pci_dev *pdev, struct vfd_objects *vfd_obj);
+int __get_pdev_and_vfid(struct kobject *kobj, struct pci_dev **pdev,
+			int *vf_id);
 
 /* Older versions of GCC will trigger -Wformat-nonliteral warnings for const
  * char * strings. Unfortunately, the implementation of do_trace_printk does
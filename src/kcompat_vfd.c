@@ -33,8 +33,8 @@ static int __get_pf_pdev(struct kobject *kobj, struct pci_dev **pdev)
  * @pdev:	PCI device information struct
  * @vf_id:	VF id of the VF under consideration
  */
-static int __get_pdev_and_vfid(struct kobject *kobj, struct pci_dev **pdev,
-			       int *vf_id)
+int __get_pdev_and_vfid(struct kobject *kobj, struct pci_dev **pdev,
+			int *vf_id)
 {
 	struct device *dev;
 
@@ -1552,6 +1552,68 @@ static ssize_t vfd_max_tx_rate_store(struct kobject *kobj,
 	return ret ? ret : count;
 }
 
+/**
+ * vfd_max_tx_burst_show - handler for max_tx_burst show function
+ * @kobj:	kobject being called
+ * @attr:	struct kobj_attribute
+ * @buff:	buffer for data
+ **/
+static ssize_t vfd_max_tx_burst_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buff)
+{
+	struct pci_dev *pdev;
+	int vf_id, ret;
+	u8 burst;
+
+	if (!vfd_ops->get_max_tx_burst)
+		return -EOPNOTSUPP;
+
+	ret = __get_pdev_and_vfid(kobj, &pdev, &vf_id);
+	if (ret)
+		return ret;
+
+	ret = vfd_ops->get_max_tx_burst(pdev, vf_id, &burst);
+	if (ret < 0)
+		return ret;
+
+	ret = scnprintf(buff, PAGE_SIZE, "%u\n", burst);
+	return ret;
+}
+
+/**
+ * vfd_max_tx_burst_store - handler for max_tx_burst store function
+ * @kobj:	kobject being called
+ * @attr:	struct kobj_attribute
+ * @buff:	buffer with input data
+ * @count:	size of buff
+ **/
+static ssize_t vfd_max_tx_burst_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buff, size_t count)
+{
+	struct pci_dev *pdev;
+	int vf_id, ret;
+	u8 burst;
+
+	if (!vfd_ops->set_max_tx_burst)
+		return -EOPNOTSUPP;
+
+	ret = __get_pdev_and_vfid(kobj, &pdev, &vf_id);
+	if (ret)
+		return ret;
+
+	ret = kstrtou8(buff, 10, &burst);
+	if (ret) {
+		dev_err(&pdev->dev,
+			"Invalid argument, not a decimal number: %s", buff);
+		return ret;
+	}
+
+	ret = vfd_ops->set_max_tx_burst(pdev, vf_id, burst);
+
+	return ret ? ret : count;
+}
+
 /**
  * vfd_min_tx_rate_show - handler for min_tx_rate show function
  * @kobj:	kobject being called
@@ -2834,6 +2896,9 @@ static struct kobj_attribute link_state_attribute =
 	__ATTR(link_state, 0644, vfd_link_state_show, vfd_link_state_store);
 static struct kobj_attribute max_tx_rate_attribute =
 	__ATTR(max_tx_rate, 0644, vfd_max_tx_rate_show, vfd_max_tx_rate_store);
+static struct kobj_attribute max_tx_burst_attribute =
+	__ATTR(max_tx_burst, 0644, vfd_max_tx_burst_show,
+	       vfd_max_tx_burst_store);
 static struct kobj_attribute min_tx_rate_attribute =
 	__ATTR(min_tx_rate, 0644, vfd_min_tx_rate_show, vfd_min_tx_rate_store);
 static struct kobj_attribute trust_attribute =
@@ -2864,6 +2929,7 @@ static struct attribute *s_attrs[] = {
 	&vlan_strip_attribute.attr,
 	&link_state_attribute.attr,
 	&max_tx_rate_attribute.attr,
+	&max_tx_burst_attribute.attr,
 	&min_tx_rate_attribute.attr,
 	&trust_attribute.attr,
 	&reset_stats_attribute.attr,
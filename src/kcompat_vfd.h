@@ -125,6 +125,9 @@ struct vfd_ops {
 			       unsigned int *max_tx_rate);
 	int (*set_max_tx_rate)(struct pci_dev *pdev, int vf_id,
 			       unsigned int *max_tx_rate);
+	int (*get_max_tx_burst)(struct pci_dev *pdev, int vf_id, u8 *burst);
+	int (*set_max_tx_burst)(struct pci_dev *pdev, int vf_id,
+				const u8 burst);
 	int (*get_min_tx_rate)(struct kobject *,
 			       struct kobj_attribute *, char *);
 	int (*set_min_tx_rate)(struct kobject *, struct kobj_attribute *,